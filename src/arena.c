@@ -0,0 +1,239 @@
+/*
+ * arena.c
+ * -------
+ * Size-class slab allocator backing the text of a LineBuffer. See arena.h
+ * for an overview. Small blocks are carved from a bump region at the end
+ * of the newest slab; when a slab runs out its remainder is split into
+ * free blocks of smaller classes so no space is stranded. Large blocks are
+ * kept on a doubly linked list so they can be released individually or
+ * all together with the slabs.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct ArenaSlab {
+    struct ArenaSlab *next;
+};
+
+struct ArenaBig {
+    struct ArenaBig *prev;
+    struct ArenaBig *next;
+};
+
+#define SLAB_HEADER ALIGN_UP(sizeof(struct ArenaSlab))
+#define BIG_HEADER ALIGN_UP(sizeof(struct ArenaBig))
+
+/* Index of the smallest class holding SIZE bytes. */
+static int size_class(size_t size) {
+    int c = 0;
+    size_t cls = ARENA_MIN_CLASS;
+    while (cls < size) {
+        cls <<= 1;
+        c++;
+    }
+    return c;
+}
+
+static size_t class_size(int c) {
+    return (size_t)ARENA_MIN_CLASS << c;
+}
+
+/* Hand out the rest of the current slab as free blocks. */
+static void arena_retire_bump(Arena *a) {
+    for (int c = ARENA_CLASSES - 1; c >= 0; --c) {
+        while ((size_t)(a->bump_end - a->bump) >= class_size(c)) {
+            *(void **)a->bump = a->free_list[c];
+            a->free_list[c] = a->bump;
+            a->bump += class_size(c);
+        }
+    }
+    a->bump = a->bump_end = NULL;
+}
+
+static int arena_new_slab(Arena *a) {
+    struct ArenaSlab *slab = malloc(SLAB_HEADER + a->slab_size);
+    if (!slab)
+        return -1;
+    if (a->bump)
+        arena_retire_bump(a);
+    slab->next = a->slabs;
+    a->slabs = slab;
+    a->reserved += SLAB_HEADER + a->slab_size;
+    a->bump = (char *)slab + SLAB_HEADER;
+    a->bump_end = a->bump + a->slab_size;
+    if (a->slab_size < ARENA_SLAB_MAX)
+        a->slab_size *= 2;
+    return 0;
+}
+
+/** Initialise A as an empty arena. No memory is allocated until needed. */
+void arena_init(Arena *a) {
+    a->slabs = NULL;
+    a->slab_size = ARENA_SLAB_MIN;
+    a->bump = a->bump_end = NULL;
+    for (int c = 0; c < ARENA_CLASSES; ++c)
+        a->free_list[c] = NULL;
+    a->big = NULL;
+    a->reserved = 0;
+    a->granted = 0;
+}
+
+/**
+ * Return every block of A to the system in one pass over its slabs and
+ * large blocks. A is left empty and may be reused.
+ */
+void arena_release(Arena *a) {
+    while (a->slabs) {
+        struct ArenaSlab *next = a->slabs->next;
+        free(a->slabs);
+        a->slabs = next;
+    }
+    while (a->big) {
+        struct ArenaBig *next = a->big->next;
+        free(a->big);
+        a->big = next;
+    }
+    arena_init(a);
+}
+
+/**
+ * Allocate at least SIZE bytes from A. The number of usable bytes, which
+ * must later be passed to arena_free(), is stored in *GRANTED. The block
+ * is not zeroed. Returns NULL on allocation failure.
+ */
+void *arena_alloc(Arena *a, size_t size, size_t *granted) {
+    if (size > ARENA_MAX_CLASS) {
+        struct ArenaBig *big = malloc(BIG_HEADER + size);
+        if (!big)
+            return NULL;
+        big->prev = NULL;
+        big->next = a->big;
+        if (a->big)
+            a->big->prev = big;
+        a->big = big;
+        a->reserved += BIG_HEADER + size;
+        a->granted += size;
+        *granted = size;
+        return (char *)big + BIG_HEADER;
+    }
+
+    int c = size_class(size);
+    size_t cls = class_size(c);
+    void *block = a->free_list[c];
+    if (block) {
+        a->free_list[c] = *(void **)block;
+    } else {
+        if ((size_t)(a->bump_end - a->bump) < cls && arena_new_slab(a) < 0)
+            return NULL;
+        block = a->bump;
+        a->bump += cls;
+    }
+    a->granted += cls;
+    *granted = cls;
+    return block;
+}
+
+/**
+ * Release PTR, a block of SIZE granted bytes, back to A. Small blocks are
+ * kept for reuse; large ones are returned to the system. A SIZE of zero
+ * marks memory the arena does not own and is ignored.
+ */
+void arena_free(Arena *a, void *ptr, size_t size) {
+    if (!ptr || size == 0)
+        return;
+    if (size > ARENA_MAX_CLASS) {
+        struct ArenaBig *big = (struct ArenaBig *)((char *)ptr - BIG_HEADER);
+        if (big->prev)
+            big->prev->next = big->next;
+        else
+            a->big = big->next;
+        if (big->next)
+            big->next->prev = big->prev;
+        free(big);
+        a->reserved -= BIG_HEADER + size;
+        a->granted -= size;
+        return;
+    }
+    a->granted -= size;
+    int c = size_class(size);
+    *(void **)ptr = a->free_list[c];
+    a->free_list[c] = ptr;
+}
+
+/**
+ * Move PTR (OLD_SIZE granted bytes) into a block of at least SIZE bytes,
+ * preserving its contents. Behaves like arena_alloc() when PTR is NULL.
+ * On failure NULL is returned and PTR is left untouched.
+ */
+void *arena_resize(Arena *a, void *ptr, size_t old_size, size_t size,
+                   size_t *granted) {
+    if (!ptr)
+        return arena_alloc(a, size, granted);
+    if (size <= old_size) {
+        *granted = old_size;
+        return ptr;
+    }
+    if (old_size > ARENA_MAX_CLASS) {
+        struct ArenaBig *big = (struct ArenaBig *)((char *)ptr - BIG_HEADER);
+        struct ArenaBig *tmp = realloc(big, BIG_HEADER + size);
+        if (!tmp)
+            return NULL;
+        if (tmp->prev)
+            tmp->prev->next = tmp;
+        else
+            a->big = tmp;
+        if (tmp->next)
+            tmp->next->prev = tmp;
+        a->reserved += size - old_size;
+        a->granted += size - old_size;
+        *granted = size;
+        return (char *)tmp + BIG_HEADER;
+    }
+    void *block = arena_alloc(a, size, granted);
+    if (!block)
+        return NULL;
+    memcpy(block, ptr, old_size);
+    arena_free(a, ptr, old_size);
+    return block;
+}
+
+/**
+ * Move every slab, large block and free block of FROM into A, so blocks
+ * granted by either arena can be freed through A and are released with
+ * it. FROM is left empty.
+ */
+void arena_adopt(Arena *a, Arena *from) {
+    if (from->bump)
+        arena_retire_bump(from);
+    for (int c = 0; c < ARENA_CLASSES; ++c) {
+        while (from->free_list[c]) {
+            void *block = from->free_list[c];
+            from->free_list[c] = *(void **)block;
+            *(void **)block = a->free_list[c];
+            a->free_list[c] = block;
+        }
+    }
+    while (from->slabs) {
+        struct ArenaSlab *slab = from->slabs;
+        from->slabs = slab->next;
+        slab->next = a->slabs;
+        a->slabs = slab;
+    }
+    while (from->big) {
+        struct ArenaBig *big = from->big;
+        from->big = big->next;
+        big->prev = NULL;
+        big->next = a->big;
+        if (a->big)
+            a->big->prev = big;
+        a->big = big;
+    }
+    a->reserved += from->reserved;
+    a->granted += from->granted;
+    arena_init(from);
+}
@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Arena
+ * -----
+ * A per-buffer allocator for line text. Requests up to ARENA_MAX_CLASS bytes
+ * are rounded up to a power-of-two size class and carved from large slabs;
+ * freed blocks go onto a free list for their class and are reused by the
+ * next allocation of that class, so editing churns no system allocator
+ * calls and long sessions do not fragment the heap. Larger blocks are
+ * allocated individually but still tracked by the arena. Everything is
+ * returned to the system at once by arena_release(), without visiting the
+ * individual blocks.
+ *
+ * Blocks carry no header: callers pass the size they were granted back to
+ * arena_free() and arena_resize(). The arena counts the bytes it holds
+ * from the system and the bytes it has granted, so the difference, held
+ * in free lists and the unused tail of the newest slab, is known without
+ * visiting any block.
+ */
+
+#define ARENA_MIN_CLASS 16
+#define ARENA_MAX_CLASS 4096
+#define ARENA_CLASSES 9          /* 16, 32, ... 4096 */
+#define ARENA_SLAB_MIN 8192       /* first slab; later ones double */
+#define ARENA_SLAB_MAX 262144
+
+struct ArenaSlab;
+struct ArenaBig;
+
+typedef struct Arena {
+    struct ArenaSlab *slabs;           /* every slab, newest first */
+    size_t slab_size;                  /* size of the next slab */
+    char *bump;                        /* unused tail of the newest slab */
+    char *bump_end;
+    void *free_list[ARENA_CLASSES];    /* released blocks per class */
+    struct ArenaBig *big;              /* blocks above ARENA_MAX_CLASS */
+    size_t reserved;                   /* bytes allocated from the system */
+    size_t granted;                    /* bytes handed out and not freed */
+} Arena;
+
+void arena_init(Arena *a);
+void arena_release(Arena *a);
+void *arena_alloc(Arena *a, size_t size, size_t *granted);
+void *arena_resize(Arena *a, void *ptr, size_t old_size, size_t size,
+                   size_t *granted);
+void arena_free(Arena *a, void *ptr, size_t size);
+void arena_adopt(Arena *a, Arena *from);
+
+#endif /* ARENA_H */
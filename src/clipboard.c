@@ -16,6 +16,7 @@
 #include "clipboard.h"
 #include "files.h"
 #include "syntax.h"
+#include "line_pool.h"
 #include "undo.h"
 
 /* Global clipboard buffer shared by all files */
@@ -95,7 +96,7 @@ void copy_selection(FileState *fs) {
                 global_clipboard[clip_len] = '\0';
             }
             const char *src = lb_get(&fs->buffer, y - 1 + fs->start_line);
-            size_t to_copy = strlen(src);
+            size_t to_copy = lb_length(&fs->buffer, y - 1 + fs->start_line);
             if (to_copy > CLIPBOARD_SIZE - 1 - clip_len) {
                 to_copy = CLIPBOARD_SIZE - 1 - clip_len;
             }
@@ -116,6 +117,8 @@ void copy_selection(FileState *fs) {
  * Modifies the file buffer, moves the cursor and marks the file modified.
  */
 void paste_clipboard(FileState *fs, int *cursor_x, int *cursor_y) {
+    if (reject_edit(fs))
+        return;
     char tmp[CLIPBOARD_SIZE];
     strncpy(tmp, global_clipboard, sizeof(tmp) - 1);
     tmp[sizeof(tmp) - 1] = '\0';
@@ -124,44 +127,40 @@ void paste_clipboard(FileState *fs, int *cursor_x, int *cursor_y) {
     bool first = true;
     while (line) {
         size_t len = strlen(line);
-        int line_idx = *cursor_y - 1 + fs->start_line;
-        char *dest = fs->buffer.lines[line_idx];
-        size_t dest_len = strlen(dest);
+        long line_idx = *cursor_y - 1 + fs->start_line;
+        size_t dest_len = lb_length(&fs->buffer, line_idx);
         char *old_text = NULL;
         
         if (first) {
-            old_text = strdup(dest);
-            if (!old_text)
-                allocation_failed("strdup failed");
-        }
-
-        if (ensure_col_capacity(fs, (int)(dest_len + len + 1)) < 0) {
-            if (old_text)
-                free(old_text);
-            allocation_failed("ensure_col_capacity failed");
+            old_text = lb_share(&fs->buffer, line_idx);
+            if (!old_text) {
+                allocation_failed("lb_share failed");
+                return;
+            }
         }
-        dest = fs->buffer.lines[line_idx];
 
         if (*cursor_x > (int)dest_len + 1)
             *cursor_x = dest_len + 1;
         size_t idx = (size_t)(*cursor_x - 1);
-        memmove(&dest[idx + len], &dest[idx], dest_len - idx + 1);
-        memcpy(&dest[idx], line, len);
+        if (lb_insert_text(&fs->buffer, line_idx, idx, line, len) < 0) {
+            pool_release(old_text);
+            allocation_failed("lb_insert_text failed");
+            return;
+        }
         *cursor_x += len;
 
-        char *new_text = strdup(dest);
+        char *new_text = lb_share(&fs->buffer, line_idx);
         if (!new_text) {
-            if (old_text)
-                free(old_text);
-            allocation_failed("strdup failed");
+            pool_release(old_text);
+            allocation_failed("lb_share failed");
+            return;
         }
 
         if (first) {
-            push(&fs->undo_stack, (Change){ line_idx, old_text, new_text });
+            record_change(fs, (Change){ line_idx, old_text, new_text, 0, false });
         } else {
-            push(&fs->undo_stack, (Change){ line_idx, NULL, new_text });
-            if (old_text)
-                free(old_text); /* only free if allocated */
+            record_change(fs, (Change){ line_idx, NULL, new_text, 0, false });
+            pool_release(old_text); /* only set for the first line */
         }
 
         line = strtok(NULL, "\n");
@@ -170,18 +169,10 @@ void paste_clipboard(FileState *fs, int *cursor_x, int *cursor_y) {
             (*cursor_y)++;
             fs->cursor_x = *cursor_x = 1;
             fs->cursor_y = *cursor_y;
-            if (ensure_line_capacity(fs, fs->buffer.count + 1) < 0) {
-                show_message("Unable to allocate line");
-                break;
-            }
             if (lb_insert(&fs->buffer, *cursor_y - 1 + fs->start_line, "") < 0) {
                 show_message("Unable to insert line");
                 break;
             }
-            char *p = realloc(fs->buffer.lines[*cursor_y - 1 + fs->start_line], fs->line_capacity);
-            if (!p)
-                allocation_failed("realloc failed");
-            fs->buffer.lines[*cursor_y - 1 + fs->start_line] = p;
         }
         first = false;
     }
@@ -215,8 +206,10 @@ void handle_selection_mode(FileState *fs, int ch, int *cursor_x, int *cursor_y)
         fs->sel_end_x = *cursor_x;
     }
     if (ch == KEY_RIGHT) {
-        /* Do not allow the cursor to move past the buffer width */
-        if (*cursor_x < fs->line_capacity - 1) (*cursor_x)++;
+        /* Do not allow the cursor to move past the end of the line */
+        long idx = *cursor_y - 1 + fs->start_line;
+        if (idx < fs->buffer.count &&
+            *cursor_x <= (int)lb_length(&fs->buffer, idx)) (*cursor_x)++;
         fs->sel_end_x = *cursor_x;
     }
     if (ch == 10) {
@@ -246,7 +239,7 @@ void copy_selection_keyboard(FileState *fs) {
  * of the removed region and disables selection_mode.
  */
 void cut_selection(FileState *fs) {
-    if (!fs->selection_mode)
+    if (!fs->selection_mode || reject_edit(fs))
         return;
 
     int start_y = fs->sel_start_y;
@@ -269,39 +262,67 @@ void cut_selection(FileState *fs) {
         ensure_line_loaded(fs, y - 1 + fs->start_line);
     copy_selection(fs);
 
-    char *first = fs->buffer.lines[start_y - 1 + fs->start_line];
-    char *last = fs->buffer.lines[end_y - 1 + fs->start_line];
-    char *old_first = strdup(first);
-    if (!old_first)
-        allocation_failed("strdup failed");
+    long first_idx = start_y - 1 + fs->start_line;
+    const char *first = lb_get(&fs->buffer, first_idx);
+    const char *last = lb_get(&fs->buffer, end_y - 1 + fs->start_line);
+    char *old_first = lb_share(&fs->buffer, first_idx);
+    if (!old_first) {
+        allocation_failed("lb_share failed");
+        return;
+    }
 
     if (start_y == end_y) {
-        memmove(&first[start_x - 1], &first[end_x], strlen(first) - end_x + 1);
-        char *new_first = strdup(first);
+        if (lb_delete_text(&fs->buffer, first_idx, start_x - 1,
+                           end_x - start_x + 1) < 0) {
+            pool_release(old_first);
+            allocation_failed("lb_delete_text failed");
+            return;
+        }
+        char *new_first = lb_share(&fs->buffer, first_idx);
         if (!new_first) {
-            free(old_first);
-            allocation_failed("strdup failed");
+            pool_release(old_first);
+            allocation_failed("lb_share failed");
+            return;
         }
-        push(&fs->undo_stack,
-             (Change){ start_y - 1 + fs->start_line, old_first, new_first });
+        record_change(fs, (Change){ first_idx, old_first, new_first, 0, false });
     } else {
-        first[start_x - 1] = '\0';
-        strncat(first, &last[end_x], fs->line_capacity - strlen(first) - 1);
-        char *new_first = strdup(first);
+        size_t first_len = lb_length(&fs->buffer, first_idx);
+        size_t last_len = lb_length(&fs->buffer, end_y - 1 + fs->start_line);
+        size_t keep = (size_t)(start_x - 1) < first_len ? (size_t)(start_x - 1)
+                                                       : first_len;
+        const char *tail = (size_t)end_x < last_len ? &last[end_x] : "";
+        size_t tail_len = (size_t)end_x < last_len ? last_len - end_x : 0;
+        char *joined = malloc(keep + tail_len + 1);
+        if (!joined) {
+            pool_release(old_first);
+            allocation_failed("malloc failed");
+            return;
+        }
+        memcpy(joined, first, keep);
+        memcpy(joined + keep, tail, tail_len + 1);
+        char *new_first = pool_intern(joined, keep + tail_len);
+        free(joined);
         if (!new_first) {
-            free(old_first);
-            allocation_failed("strdup failed");
+            pool_release(old_first);
+            allocation_failed("pool_intern failed");
+            return;
+        }
+        record_change(fs, (Change){ first_idx, old_first, new_first, 0, false });
+        if (lb_set_shared(&fs->buffer, first_idx, new_first,
+                          keep + tail_len) < 0) {
+            allocation_failed("lb_set_shared failed");
+            return;
         }
-        push(&fs->undo_stack,
-             (Change){ start_y - 1 + fs->start_line, old_first, new_first });
 
         int remove_count = end_y - start_y;
-        int del_idx = start_y - 1 + fs->start_line + 1;
+        long del_idx = start_y - 1 + fs->start_line + 1;
         for (int i = 0; i < remove_count; ++i) {
-            char *old_line = strdup(fs->buffer.lines[del_idx]);
-            if (!old_line)
-                allocation_failed("strdup failed");
-            push(&fs->undo_stack, (Change){ del_idx, old_line, NULL });
+            char *old_line = lb_share(&fs->buffer, del_idx);
+            if (!old_line) {
+                allocation_failed("lb_share failed");
+                return;
+            }
+            record_change(fs, (Change){ del_idx, old_line, NULL, 0, false });
             lb_delete(&fs->buffer, del_idx);
         }
     }
@@ -78,6 +78,24 @@ static void get_macros_path(char *buf, size_t size) {
     snprintf(buf, size, "%s/.ventomacros", homedir);
 }
 
+// Build the path of the directory holding swap files of hibernated buffers
+// in BUF.  $VENTO_SWAP is honoured when present and falls back to
+// ~/.ventoswap next to the configuration file.
+void get_swap_dir(char *buf, size_t size) {
+    const char *sp = getenv("VENTO_SWAP");
+    if (sp && *sp) {
+        strncpy(buf, sp, size - 1);
+        buf[size - 1] = '\0';
+        return;
+    }
+
+    struct passwd *pw = getpwuid(getuid());
+    const char *homedir = pw ? pw->pw_dir : getenv("HOME");
+    if (!homedir || homedir[0] == '\0')
+        homedir = ".";
+    snprintf(buf, size, "%s/.ventoswap", homedir);
+}
+
 // Trim leading and trailing whitespace from STR in place.
 static void trim(char *str) {
     char *start = str;
@@ -255,7 +273,15 @@ void config_save(const AppConfig *cfg) {
         "tab_width",
         "macros_file",
         "macro_record_key",
-        "macro_play_key"
+        "macro_play_key",
+        "piece_table",
+        "compress_files",
+        "share_lines",
+        "read_only_mb",
+        "handle_pool",
+        "memory_budget_mb",
+        "hibernate_minutes",
+        "save_fsync"
     };
 
     char path[PATH_MAX];
@@ -281,6 +307,14 @@ void config_save(const AppConfig *cfg) {
     fprintf(f, "%s=%s\n", keys[15], cfg->macros_file);
     fprintf(f, "%s=%d\n", keys[16], cfg->macro_record_key);
     fprintf(f, "%s=%d\n", keys[17], cfg->macro_play_key);
+    fprintf(f, "%s=%s\n", keys[18], cfg->piece_table ? "true" : "false");
+    fprintf(f, "%s=%s\n", keys[19], cfg->compress_files ? "true" : "false");
+    fprintf(f, "%s=%s\n", keys[20], cfg->share_lines ? "true" : "false");
+    fprintf(f, "%s=%d\n", keys[21], cfg->read_only_mb);
+    fprintf(f, "%s=%d\n", keys[22], cfg->handle_pool);
+    fprintf(f, "%s=%d\n", keys[23], cfg->memory_budget_mb);
+    fprintf(f, "%s=%d\n", keys[24], cfg->hibernate_minutes);
+    fprintf(f, "%s=%s\n", keys[25], cfg->save_fsync ? "true" : "false");
     fclose(f);
 }
 
@@ -405,6 +439,30 @@ void config_load(AppConfig *cfg) {
             tmp.macro_record_key = atoi(value);
         } else if (strcmp(key, "macro_play_key") == 0) {
             tmp.macro_play_key = atoi(value);
+        } else if (strcmp(key, "piece_table") == 0) {
+            tmp.piece_table = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "compress_files") == 0) {
+            tmp.compress_files = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "share_lines") == 0) {
+            tmp.share_lines = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "read_only_mb") == 0) {
+            tmp.read_only_mb = atoi(value);
+            if (tmp.read_only_mb < 0)
+                tmp.read_only_mb = 0;
+        } else if (strcmp(key, "handle_pool") == 0) {
+            tmp.handle_pool = atoi(value);
+            if (tmp.handle_pool < 0)
+                tmp.handle_pool = 0;
+        } else if (strcmp(key, "memory_budget_mb") == 0) {
+            tmp.memory_budget_mb = atoi(value);
+            if (tmp.memory_budget_mb < 0)
+                tmp.memory_budget_mb = 0;
+        } else if (strcmp(key, "hibernate_minutes") == 0) {
+            tmp.hibernate_minutes = atoi(value);
+            if (tmp.hibernate_minutes < 0)
+                tmp.hibernate_minutes = 0;
+        } else if (strcmp(key, "save_fsync") == 0) {
+            tmp.save_fsync = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
         } else {
             // Unknown key, ignore
             continue;
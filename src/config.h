@@ -4,6 +4,7 @@
 #define VERSION "0.1.3"
 
 #include "path_utils.h"
+#include <stddef.h>
 
 /* Directory containing installed color themes. Can be overridden at compile
  * time by defining THEME_DIR. Defaults to "themes" which resolves to the
@@ -35,6 +36,14 @@ typedef struct {
     char macros_file[PATH_MAX];
     int macro_record_key;
     int macro_play_key;
+    int piece_table;
+    int compress_files;
+    int share_lines;
+    int read_only_mb;
+    int handle_pool;
+    int memory_budget_mb;
+    int hibernate_minutes;
+    int save_fsync;
 } AppConfig;
 
 extern AppConfig app_config;
@@ -46,5 +55,6 @@ void config_save(const AppConfig *cfg);
 void read_config_file(AppConfig *cfg);
 void macros_load(AppConfig *cfg);
 void macros_save(const AppConfig *cfg);
+void get_swap_dir(char *buf, size_t size);
 
 #endif // CONFIG_H
@@ -86,6 +86,14 @@ void clamp_scroll_x(FileState *fs) {
         fs->scroll_x = 0;
 }
 
+/*
+ * Screen column of the cursor inside the text window, accounting for the
+ * line number gutter and horizontal scrolling.
+ */
+int cursor_screen_x(FileState *fs) {
+    return fs->cursor_x - fs->scroll_x + get_line_number_offset(fs);
+}
+
 void on_sigwinch(int sig) {
     (void)sig;
     resize_pending = 1;
@@ -94,7 +102,7 @@ void on_sigwinch(int sig) {
 __attribute__((weak)) int get_line_number_offset(FileState *fs) {
     if (!show_line_numbers || !fs)
         return 0;
-    int lines = fs->buffer.count > 0 ? fs->buffer.count : 1;
+    long lines = fs->buffer.count > 0 ? fs->buffer.count : 1;
     int width = 1;
     while (lines >= 10) { width++; lines /= 10; }
     return width + 1;
@@ -126,6 +134,7 @@ int key_next_file = KEY_F(6);  // Key code for switching to the next file
 int key_prev_file = KEY_F(7);  // Key code for switching to the previous file
 int key_replace = 18;  // Key code for replacing text (CTRL-R)
 int key_goto_line = 7;  // Key code for go to line (CTRL-G)
+int key_follow = KEY_F(8);  // Key code for toggling follow mode
 int key_menu_open = KEY_F(10);  // Key code for opening the menu (F10)
 
 static void handle_key_up_wrapper(struct FileState *fs, int *cx, int *cy) {
@@ -269,7 +278,7 @@ static void handle_replace_wrapper(struct FileState *fs, int *cx, int *cy) {
 }
 
 static void handle_goto_line_wrapper(struct FileState *fs, int *cx, int *cy) {
-    int line;
+    long line;
     if (show_goto_dialog(input_ctx, &line)) {
         go_to_line(input_ctx, fs, line);
         *cx = fs->cursor_x;
@@ -364,8 +373,15 @@ static void handle_prev_file_wrapper(struct FileState *fs, int *cx, int *cy) {
     prev_file(input_ctx);
 }
 
+static void handle_follow_wrapper(struct FileState *fs, int *cx, int *cy) {
+    (void)cx;
+    (void)cy;
+    toggle_follow(input_ctx, fs);
+}
+
 static void handle_clear_buffer_wrapper(struct FileState *fs, int *cx, int *cy) {
-    (void)fs;
+    if (reject_edit(fs))
+        return;
     clear_text_buffer();
     *cx = 1;
     *cy = 1;
@@ -449,6 +465,7 @@ void initialize_key_mappings(void) {
     key_mappings[key_mapping_count++] = (KeyMapping){key_undo, handle_undo_wrapper};
     key_mappings[key_mapping_count++] = (KeyMapping){key_next_file, handle_next_file_wrapper};
     key_mappings[key_mapping_count++] = (KeyMapping){key_prev_file, handle_prev_file_wrapper};
+    key_mappings[key_mapping_count++] = (KeyMapping){key_follow, handle_follow_wrapper};
     key_mappings[key_mapping_count++] = (KeyMapping){key_macro_record, handle_macro_record_wrapper};
     key_mappings[key_mapping_count++] = (KeyMapping){key_macro_play, handle_macro_play_wrapper};
     key_mappings[key_mapping_count++] = (KeyMapping){KEY_CTRL_T, NULL}; /* placeholder for menu key, handled elsewhere */
@@ -483,7 +500,7 @@ void run_editor(EditorContext *ctx) {
     MEVENT event; // Mouse event structure
 
     wmove(ctx->text_win, ctx->active_file->cursor_y,
-          ctx->active_file->cursor_x + get_line_number_offset(ctx->active_file));
+          cursor_screen_x(ctx->active_file));
 
     drawBar();
     update_status_bar(ctx, ctx->active_file);
@@ -506,6 +523,10 @@ void run_editor(EditorContext *ctx) {
         }
 
         if (rc == ERR) {
+            update_followed_files(ctx);
+            update_saves(ctx);
+            check_memory_budget(ctx);
+            hibernate_idle_files(ctx);
             continue; // No input available
         }
 
@@ -567,7 +588,7 @@ void run_editor(EditorContext *ctx) {
         /* Refresh status bar and screen after processing the event */
         update_status_bar(ctx, ctx->active_file);
         wmove(ctx->text_win, ctx->active_file->cursor_y,
-              ctx->active_file->cursor_x + get_line_number_offset(ctx->active_file));  // Restore cursor position
+              cursor_screen_x(ctx->active_file));  // Restore cursor position
         wnoutrefresh(ctx->text_win);
         doupdate();
     }
@@ -585,21 +606,11 @@ void initialize_buffer() {
     if (!active_file)
         return;
 
-    /* Allocate memory for each line in the text buffer */
-    for (int i = 0; i < active_file->buffer.capacity; ++i) {
-        if (active_file->buffer.lines[i] != NULL) {
-            free(active_file->buffer.lines[i]);
-            active_file->buffer.lines[i] = NULL;
-        }
-        active_file->buffer.lines[i] =
-            (char *)calloc(active_file->line_capacity, sizeof(char));
-        if (active_file->buffer.lines[i] == NULL) {
-            allocation_failed("calloc failed in initialize_buffer");
-        }
+    /* Drop every line and start over with a single empty one */
+    if (lb_reset(&active_file->buffer) < 0) {
+        allocation_failed("lb_reset failed in initialize_buffer");
+        return;
     }
-
-    /* Set the initial line count and start line */
-    active_file->buffer.count = 1;
     active_file->start_line = 0;
 }
 
@@ -621,7 +632,7 @@ void draw_text_buffer(FileState *fs, WINDOW *win) {
     int offset = 0;
     WINDOW *content = win;
     if (show_line_numbers) {
-        int lines = fs->buffer.count > 0 ? fs->buffer.count : 1;
+        long lines = fs->buffer.count > 0 ? fs->buffer.count : 1;
         num_width = 1;
         while (lines >= 10) { num_width++; lines /= 10; }
         offset = num_width + 1; /* numbers plus space */
@@ -631,6 +642,9 @@ void draw_text_buffer(FileState *fs, WINDOW *win) {
 
     // Ensure enough lines are loaded for display
     ensure_line_loaded(fs, fs->start_line + max_lines);
+    // Have the screens around this one read from disk in the background
+    lb_read_ahead(&fs->buffer, fs->start_line - max_lines,
+                  fs->start_line + 2 * max_lines);
 
     int visible_width = COLS - 2 - offset;
     if (visible_width < 1)
@@ -638,20 +652,31 @@ void draw_text_buffer(FileState *fs, WINDOW *win) {
 
     // Iterate over each line to be displayed on the window
     for (int i = 0; i < max_lines && i + fs->start_line < fs->buffer.count; ++i) {
-        int line_idx = i + fs->start_line;
+        long line_idx = i + fs->start_line;
         if (show_line_numbers) {
-            mvwprintw(win, i + 1, 1, "%*d ", num_width, line_idx + 1);
+            mvwprintw(win, i + 1, 1, "%*ld ", num_width, line_idx + 1);
         }
-        const char *line = fs->buffer.lines[line_idx];
-        const char *start = line + fs->scroll_x;
+        const char *line = lb_get(&fs->buffer, line_idx);
+        size_t line_len = line ? lb_length(&fs->buffer, line_idx) : 0;
+        /* Only the visible slice of a long line is ever examined */
+        size_t skip = (size_t)fs->scroll_x < line_len ? (size_t)fs->scroll_x
+                                                      : line_len;
+        size_t shown = line_len - skip;
         int use_w = visible_width;
+        if (shown > (size_t)use_w)
+            shown = use_w;
         char *temp = malloc(use_w + 1);
         if (!temp) {
             allocation_failed("malloc failed");
             return;
         }
-        strncpy(temp, start, use_w);
-        temp[use_w] = '\0';
+        if (shown > 0)
+            memcpy(temp, line + skip, shown);
+        temp[shown] = '\0';
+        /* NUL bytes are drawn as '@' so later columns stay in place */
+        for (char *nul = memchr(temp, '\0', shown); nul;
+             nul = memchr(nul, '\0', shown - (nul - temp)))
+            *nul = '@';
         // Apply syntax highlighting to the current line of text
         apply_syntax_highlighting(fs, content, temp, i + 1);
         free(temp);
@@ -660,6 +685,10 @@ void draw_text_buffer(FileState *fs, WINDOW *win) {
         if (fs->match_start_y == line_idx && fs->match_start_x >= 0) {
             int start_x = fs->match_start_x - fs->scroll_x + offset;
             int len = fs->match_end_x - fs->match_start_x + 1;
+            if (start_x < offset) {
+                len -= offset - start_x;
+                start_x = offset;
+            }
             if (start_x < COLS - 2 && len > 0) {
                 if (start_x + len > COLS - 2)
                     len = COLS - 2 - start_x;
@@ -674,9 +703,11 @@ void draw_text_buffer(FileState *fs, WINDOW *win) {
     int scrollbar_start = 0;
     int scrollbar_end = 0;
 
-    if (fs->buffer.count > 0) {
-        scrollbar_start = (fs->start_line * scrollbar_height) / fs->buffer.count;
-        scrollbar_end = ((fs->start_line + max_lines) * scrollbar_height) / fs->buffer.count;
+    // Lines of a file still being loaded are counted by its line index
+    long total_lines = total_line_count(fs);
+    if (total_lines > 0) {
+        scrollbar_start = (int)((long long)fs->start_line * scrollbar_height / total_lines);
+        scrollbar_end = (int)((long long)(fs->start_line + max_lines) * scrollbar_height / total_lines);
     }
 
     // Draw scrollbar
@@ -739,8 +770,7 @@ void redraw() {
     werase(text_win); // Clear the text window
     box(text_win, 0, 0); // Redraw the border of the text window
     draw_text_buffer(active_file, text_win); // Redraw the text buffer
-    wmove(text_win, active_file->cursor_y,
-          active_file->cursor_x + get_line_number_offset(active_file)); // Move the cursor to its previous position
+    wmove(text_win, active_file->cursor_y, cursor_screen_x(active_file)); // Move the cursor to its previous position
     wnoutrefresh(text_win); // Queue refresh for the text window
 }
 
@@ -765,7 +795,7 @@ void perform_resize(void) {
     if (new_capacity < 1)
         new_capacity = 1;
 
-    /* Resize all open file windows and buffers */
+    /* Resize all open file windows; line storage is left untouched */
     for (int i = 0; i < file_manager.count; ++i) {
         FileState *fs = file_manager.files[i];
         if (!fs || !fs->text_win) {
@@ -774,8 +804,8 @@ void perform_resize(void) {
         wresize(fs->text_win, LINES - 2, COLS);
         mvwin(fs->text_win, 1, 0);
 
-        if (ensure_col_capacity(fs, new_capacity) < 0)
-            allocation_failed("ensure_col_capacity failed");
+        if (new_capacity > fs->line_capacity)
+            fs->line_capacity = new_capacity;
         clamp_scroll_x(fs);
     }
 
@@ -798,8 +828,7 @@ void perform_resize(void) {
         active_file->cursor_y = 1;
 
     update_status_bar(input_ctx, active_file);
-    wmove(text_win, active_file->cursor_y,
-          active_file->cursor_x + get_line_number_offset(active_file));
+    wmove(text_win, active_file->cursor_y, cursor_screen_x(active_file));
     wnoutrefresh(text_win);
 
     /* Redraw the menu bar after all windows have been updated */
@@ -817,16 +846,16 @@ void perform_resize(void) {
  * @return None
  */
 void clear_text_buffer() {
-    if (!active_file)
+    if (!active_file || reject_edit(active_file))
         return;
 
-    // Set all elements of the text buffer to 0
-    for (int i = 0; i < active_file->buffer.capacity; ++i) {
-        memset(active_file->buffer.lines[i], 0, active_file->line_capacity);
+    // Empty the text buffer, leaving a single blank line
+    if (lb_reset(&active_file->buffer) < 0) {
+        allocation_failed("lb_reset failed");
+        return;
     }
 
-    // Reset line count and start line variables
-    active_file->buffer.count = 1;
+    // Reset start line
     if (active_file)
         active_file->start_line = 0;
 
@@ -3,6 +3,8 @@
 
 #include <ncurses.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <wchar.h>
 typedef struct EditorContext EditorContext;
@@ -17,14 +19,23 @@ typedef struct EditorContext EditorContext;
  * A `Change` stores the line index along with the previous and new contents of
  * that line.  When `old_text` is NULL the change represents an insertion and
  * when `new_text` is NULL it represents a deletion.  Both strings are
- * dynamically allocated and ownership is transferred to the stack when the
- * change is pushed.  They are freed when the entry is popped or when the entire
- * stack is destroyed.
+ * references into the line pool (pool_intern() or lb_share()) and are handed
+ * to the stack when the change is pushed.  They are released with
+ * pool_release() when the entry is discarded or the entire stack is destroyed.
+ *
+ * A change with `in_line` set stays within its line instead: `old_text` holds
+ * the bytes removed at column `col` and `new_text` the bytes inserted there,
+ * either being NULL when there are none.  Typing and deleting characters are
+ * recorded this way, so a keystroke costs its own bytes rather than copies of
+ * the line, and consecutive keystrokes within a word share one record (see
+ * push_edit()).
  */
 typedef struct Change {
-    int line;        /* Affected line index */
+    long line;       /* Affected line index */
     char *old_text;  /* Text before the change or NULL */
     char *new_text;  /* Text after the change or NULL */
+    size_t col;      /* Column of an in_line change */
+    bool in_line;    /* The texts are bytes at col, not whole lines */
 } Change;
 
 typedef struct Node {
@@ -33,8 +44,6 @@ typedef struct Node {
 } Node;
 
 
-#define DEFAULT_BUFFER_LINES 5000
-
 // Define custom key constants for CTRL-Left, CTRL-Right, CTRL-Page Up, CTRL-Page Down
 #define KEY_CTRL_LEFT       1000
 #define KEY_CTRL_RIGHT      1001
@@ -65,7 +74,10 @@ extern char search_text[256];
 extern volatile sig_atomic_t resize_pending;
 extern int exiting;
 extern EditorContext editor;
-extern int start_line;
+extern long start_line;
+extern int read_only_files;
+extern int follow_files;
+extern int recover_files;
 extern int key_macro_record;
 extern int key_macro_play;
 void handle_regular_mode(EditorContext *ctx, struct FileState *fs, wint_t ch);
@@ -79,11 +91,17 @@ void redraw(void);
 void delete_current_line(EditorContext *ctx, struct FileState *fs);
 void insert_new_line(EditorContext *ctx, struct FileState *fs);
 void update_status_bar(EditorContext *ctx, struct FileState *fs);
-void go_to_line(EditorContext *ctx, struct FileState *fs, int line) __attribute__((weak));
+void go_to_line(EditorContext *ctx, struct FileState *fs, long line) __attribute__((weak));
+void toggle_follow(EditorContext *ctx, struct FileState *fs);
+void update_followed_files(EditorContext *ctx);
+void update_saves(EditorContext *ctx);
+void check_memory_budget(EditorContext *ctx);
+void hibernate_idle_files(EditorContext *ctx);
 __attribute__((weak)) int get_line_number_offset(struct FileState *fs);
 void on_sigwinch(int sig);
 void perform_resize(void);
 void clamp_scroll_x(struct FileState *fs);
+int cursor_screen_x(struct FileState *fs);
 void cleanup_on_exit(struct FileManager *fm);
 void disable_ctrl_c_z(void);
 void apply_colors(void);
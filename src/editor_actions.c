@@ -2,14 +2,21 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include "editor.h"
+#include "config.h"
 #include "syntax.h"
 #include "files.h"
 #include "file_manager.h"
 #include "editor_state.h"
+#include "line_pool.h"
 #include "undo.h"
 #include "file_ops.h"
 #include "macro.h"
+#include "follow.h"
+#include "mem_budget.h"
+#include "hibernate.h"
+#include "save.h"
 
 /*
  * editor_actions.c
@@ -33,17 +40,16 @@
  * redrawn and comment highlighting is marked dirty.
  */
 void delete_current_line(EditorContext *ctx, FileState *fs) {
-    if (fs->buffer.count == 0) {
+    if (fs->buffer.count == 0 || reject_edit(fs)) {
         return;
     }
-    int line_to_delete = fs->cursor_y - 1 + fs->start_line;
-    const char *cur_line = lb_get(&fs->buffer, line_to_delete);
-    char *old_text = cur_line ? strdup(cur_line) : strdup("");
+    long line_to_delete = fs->cursor_y - 1 + fs->start_line;
+    char *old_text = lb_share(&fs->buffer, line_to_delete);
     if (!old_text) {
-        allocation_failed("strdup failed");
+        allocation_failed("lb_share failed");
         return;
     }
-    push(&fs->undo_stack, (Change){line_to_delete, old_text, NULL});
+    record_change(fs, (Change){line_to_delete, old_text, NULL, 0, false});
     lb_delete(&fs->buffer, line_to_delete);
     fs->modified = true;
     if (fs->cursor_y < LINES - 4 && fs->cursor_y <= fs->buffer.count) {
@@ -75,23 +81,21 @@ void delete_current_line(EditorContext *ctx, FileState *fs) {
  */
 void insert_new_line(EditorContext *ctx, FileState *fs) {
     (void)ctx;
-    int idx = fs->cursor_y + fs->start_line - 1;
-    if (lb_insert(&fs->buffer, idx, "") < 0)
+    if (reject_edit(fs))
+        return;
+    long idx = fs->cursor_y + fs->start_line - 1;
+    if (lb_insert(&fs->buffer, idx, "") < 0) {
         allocation_failed("lb_insert failed");
-    char *p = realloc(fs->buffer.lines[idx], fs->line_capacity);
-    if (!p)
-        allocation_failed("realloc failed");
-    fs->buffer.lines[idx] = p;
-    fs->buffer.lines[idx][0] = '\0';
-    Change change;
+        return;
+    }
+    Change change = {0};
     change.line = fs->cursor_y + fs->start_line - 1;
-    change.old_text = NULL;
-    change.new_text = strdup("");
+    change.new_text = pool_intern("", 0);
     if (!change.new_text) {
-        allocation_failed("strdup failed");
+        allocation_failed("pool_intern failed");
         return;
     }
-    push(&fs->undo_stack, change);
+    record_change(fs, change);
     fs->modified = true;
     mark_comment_state_dirty(fs);
     fs->cursor_x = 1;
@@ -119,7 +123,7 @@ void handle_undo_wrapper(FileState *fs, int *cx, int *cy) {
  * ctx - Editor context used for updating screen state.
  *
  * The cursor position of the current FileState is saved and its file handle
- * closed if it was lazily loaded.  `file_manager.active_index`, `active_file`
+ * parked if it was lazily loaded.  `file_manager.active_index`, `active_file`
  * and `text_win` are updated to reference the newly selected file.  The
  * function redraws the screen and updates the status bar before returning the
  * new cursor position.
@@ -135,11 +139,7 @@ CursorPos next_file(EditorContext *ctx) {
     if (cur) {
         cur->saved_cursor_x = cur->cursor_x;
         cur->saved_cursor_y = cur->cursor_y;
-        if (cur->fp && !cur->file_complete) {
-            cur->file_pos = ftell(cur->fp);
-            fclose(cur->fp);
-            cur->fp = NULL;
-        }
+        park_file(cur);
     }
     int prev_index = file_manager.active_index;
     int idx = prev_index;
@@ -161,11 +161,8 @@ CursorPos next_file(EditorContext *ctx) {
     int res = fm_switch(&file_manager, idx);
     if (res < 0) {
         file_manager.active_index = prev_index;
-        if (cur && !cur->fp && !cur->file_complete) {
-            cur->fp = fopen(cur->filename, "r");
-            if (cur->fp)
-                fseek(cur->fp, cur->file_pos, SEEK_SET);
-        }
+        if (cur)
+            resume_file(cur);
         active_file = cur;
         text_win = cur ? cur->text_win : NULL;
         if (active_file) {
@@ -200,7 +197,7 @@ CursorPos next_file(EditorContext *ctx) {
  * ctx - Editor context used for updating screen state.
  *
  * The current file's cursor position is saved and any lazily loaded file
- * handle closed.  `file_manager.active_index`, `active_file` and `text_win`
+ * handle parked.  `file_manager.active_index`, `active_file` and `text_win`
  * are updated to the newly selected file.  The display is redrawn and the
  * status bar refreshed before the new cursor position is returned.
  */
@@ -215,11 +212,7 @@ CursorPos prev_file(EditorContext *ctx) {
     if (cur) {
         cur->saved_cursor_x = cur->cursor_x;
         cur->saved_cursor_y = cur->cursor_y;
-        if (cur->fp && !cur->file_complete) {
-            cur->file_pos = ftell(cur->fp);
-            fclose(cur->fp);
-            cur->fp = NULL;
-        }
+        park_file(cur);
     }
     int prev_index = file_manager.active_index;
     int idx = prev_index;
@@ -243,11 +236,8 @@ CursorPos prev_file(EditorContext *ctx) {
     int res = fm_switch(&file_manager, idx);
     if (res < 0) {
         file_manager.active_index = prev_index;
-        if (cur && !cur->fp && !cur->file_complete) {
-            cur->fp = fopen(cur->filename, "r");
-            if (cur->fp)
-                fseek(cur->fp, cur->file_pos, SEEK_SET);
-        }
+        if (cur)
+            resume_file(cur);
         active_file = cur;
         text_win = cur ? cur->text_win : NULL;
         if (active_file) {
@@ -282,8 +272,8 @@ CursorPos prev_file(EditorContext *ctx) {
  * ctx - Editor context used to access the file manager.
  * fs  - Currently active FileState.
  *
- * The function prints the file name, modification flag and cursor position at
- * the top and bottom of the screen.  Macro recording/playing state is also
+ * The function prints the file name, modification, read-only and follow flags
+ * and cursor position at the top and bottom of the screen.  Macro recording/playing state is also
  * indicated.  It calls `wnoutrefresh` on `stdscr` so the status area is
  * redrawn during the next `doupdate` call.
  */
@@ -299,6 +289,10 @@ void update_status_bar(EditorContext *ctx, FileState *fs) {
     const char *fmt = (fs && fs->modified) ? "%s* [%d/%d]" : "%s [%d/%d]";
     size_t base_len = snprintf(NULL, 0, fmt, name, idx, total);
     size_t extra_len = 0;
+    if (fs && fs->read_only)
+        extra_len += strlen(" [RO]");
+    if (fs && fs->follow)
+        extra_len += strlen(" [FOLLOW]");
     if (macro_state.recording)
         extra_len += strlen(" [REC]");
     else if (macro_state.playing)
@@ -313,6 +307,10 @@ void update_status_bar(EditorContext *ctx, FileState *fs) {
     }
 
     snprintf(display, base_len + 1, fmt, name, idx, total);
+    if (fs && fs->read_only)
+        strcat(display, " [RO]");
+    if (fs && fs->follow)
+        strcat(display, " [FOLLOW]");
     if (macro_state.recording)
         strcat(display, " [REC]");
     else if (macro_state.playing)
@@ -328,8 +326,8 @@ void update_status_bar(EditorContext *ctx, FileState *fs) {
     free(display);
     move(LINES - 1, 0);
     clrtoeol();
-    int actual_line_number = fs ? (fs->cursor_y + fs->start_line) : 0;
-    mvprintw(LINES - 1, 0, "Lines: %d  Current Line: %d  Column: %d", fs ? fs->buffer.count : 0, actual_line_number, fs ? fs->cursor_x : 0);
+    long actual_line_number = fs ? (fs->cursor_y + fs->start_line) : 0;
+    mvprintw(LINES - 1, 0, "Lines: %ld  Current Line: %ld  Column: %d", fs ? total_line_count(fs) : 0, actual_line_number, fs ? fs->cursor_x : 0);
     int help_col = COLS - 15;
     if (help_col < 0) help_col = 0;
     mvprintw(LINES - 1, help_col, "CTRL-H - Help");
@@ -348,7 +346,7 @@ void update_status_bar(EditorContext *ctx, FileState *fs) {
  * the cursor location.  The text window is cleared, redrawn and positioned on
  * the new line.
  */
-void go_to_line(EditorContext *ctx, FileState *fs, int line) {
+void go_to_line(EditorContext *ctx, FileState *fs, long line) {
     if (fs->buffer.count == 0)
         return;
 
@@ -361,7 +359,7 @@ void go_to_line(EditorContext *ctx, FileState *fs, int line) {
 
     int lines_per_screen = LINES - 3;
     int middle_line = lines_per_screen / 2;
-    int idx = line - 1;
+    long idx = line - 1;
 
     if (fs->buffer.count <= lines_per_screen) {
         fs->start_line = 0;
@@ -379,7 +377,200 @@ void go_to_line(EditorContext *ctx, FileState *fs, int line) {
     werase(ctx->text_win);
     box(ctx->text_win, 0, 0);
     draw_text_buffer(fs, ctx->text_win);
-    wmove(ctx->text_win, fs->cursor_y,
-          fs->cursor_x + get_line_number_offset(fs));
+    wmove(ctx->text_win, fs->cursor_y, cursor_screen_x(fs));
+    wnoutrefresh(ctx->text_win);
+}
+
+/*
+ * Put the cursor on the last line of FS with that line at the bottom of
+ * the screen, the way follow mode shows a growing file.
+ */
+static void follow_to_end(FileState *fs) {
+    int rows = LINES - 4;
+    long count = fs->buffer.count > 0 ? fs->buffer.count : 1;
+    fs->start_line = count > rows ? count - rows : 0;
+    fs->cursor_y = count - fs->start_line;
+    fs->cursor_x = 1;
+    fs->scroll_x = 0;
+}
+
+/*
+ * Turn follow mode on or off for a file.
+ *
+ * ctx - Editor context providing the text window.
+ * fs  - FileState to follow.
+ *
+ * Following starts with the cursor on the last line so new text scrolls
+ * into view as it arrives.  Line insert and delete are enabled on the text
+ * window so ncurses can scroll the terminal rather than repaint each row.
+ */
+void toggle_follow(EditorContext *ctx, FileState *fs) {
+    const char *msg;
+    if (fs->follow) {
+        follow_stop(fs);
+        msg = "Stopped following file";
+    } else if (follow_start(fs) < 0) {
+        msg = "This file cannot be followed";
+    } else {
+        idlok(ctx->text_win, TRUE);
+        follow_to_end(fs);
+        msg = "Following file changes";
+    }
+    draw_text_buffer(fs, ctx->text_win);
+    wnoutrefresh(ctx->text_win);
+    update_status_bar(ctx, fs);
+    mvprintw(LINES - 2, 2, "%s", msg);
+    wnoutrefresh(stdscr);
+    wmove(ctx->text_win, fs->cursor_y, cursor_screen_x(fs));
     wnoutrefresh(ctx->text_win);
 }
+
+/*
+ * Take on text appended to every followed file.
+ *
+ * ctx - Editor context providing the text window.
+ *
+ * Called whenever the editor is idle.  The active file scrolls along only
+ * when its cursor is on the last line, and its window is redrawn only when
+ * the new text is on screen; otherwise just the line count changes.
+ */
+void update_followed_files(EditorContext *ctx) {
+    for (int i = 0; i < file_manager.count; ++i) {
+        FileState *fs = file_manager.files[i];
+        if (!fs || !fs->follow)
+            continue;
+        long before = fs->buffer.count;
+        bool at_end = fs->start_line + fs->cursor_y >= before;
+        int res = follow_update(fs);
+        if (res == 0 || fs != ctx->active_file)
+            continue;
+
+        if (at_end || fs->start_line + fs->cursor_y > fs->buffer.count)
+            follow_to_end(fs);
+        bool visible = at_end || before == 0 ||
+                       before - 1 < fs->start_line + LINES - 4 ||
+                       fs->buffer.count < before;
+        if (visible) {
+            draw_text_buffer(fs, ctx->text_win);
+            wnoutrefresh(ctx->text_win);
+        }
+        update_status_bar(ctx, fs);
+        if (res < 0) {
+            mvprintw(LINES - 2, 2, fs->follow ? "Could not read new text"
+                                              : "Stopped following: file replaced");
+            wnoutrefresh(stdscr);
+        }
+        wmove(ctx->text_win, fs->cursor_y, cursor_screen_x(fs));
+        wnoutrefresh(ctx->text_win);
+        doupdate();
+    }
+}
+
+/*
+ * Return true if the time in *DUE has come, and set it MS milliseconds
+ * ahead.  Lets work done while idle run at a fixed interval.
+ */
+static bool interval_due(struct timespec *due, long ms) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < due->tv_sec ||
+        (now.tv_sec == due->tv_sec && now.tv_nsec < due->tv_nsec))
+        return false;
+    due->tv_sec = now.tv_sec + ms / 1000;
+    due->tv_nsec = now.tv_nsec + (ms % 1000) * 1000000L;
+    if (due->tv_nsec >= 1000000000L) {
+        due->tv_sec++;
+        due->tv_nsec -= 1000000000L;
+    }
+    return true;
+}
+
+/*
+ * Report on files being saved in the background.
+ *
+ * ctx - Editor context providing the text window.
+ *
+ * Called whenever the editor is idle.  A save is reported as soon as it
+ * has finished; until then the share of the file written so far is shown
+ * every SV_PROGRESS_MS milliseconds.
+ */
+void update_saves(EditorContext *ctx) {
+    static struct timespec due;
+    bool show = interval_due(&due, SV_PROGRESS_MS);
+    for (int i = 0; i < file_manager.count; ++i) {
+        FileState *fs = file_manager.files[i];
+        if (!fs || !fs->save)
+            continue;
+        if (finish_save(fs, false)) {
+            if (ctx->active_file)
+                update_status_bar(ctx, ctx->active_file);
+        } else if (show) {
+            off_t written, total;
+            sv_done(fs->save, &written, &total);
+            mvprintw(LINES - 2, 2, "Saving %s: %d%%", fs->filename,
+                     total > 0 ? (int)(written * 100 / total) : 0);
+            clrtoeol();
+            wnoutrefresh(stdscr);
+        } else {
+            continue;
+        }
+        if (ctx->active_file) {
+            FileState *cur = ctx->active_file;
+            wmove(ctx->text_win, cur->cursor_y, cursor_screen_x(cur));
+            wnoutrefresh(ctx->text_win);
+        }
+        doupdate();
+    }
+}
+
+/*
+ * Keep the open files within the memory budget.
+ *
+ * ctx - Editor context providing the active file.
+ *
+ * Called whenever the editor is idle, but looks at the files at most every
+ * MB_CHECK_MS milliseconds.  The user is told when trimming the files was
+ * not enough to bring them within the budget, as edits are refused from
+ * then on.
+ */
+void check_memory_budget(EditorContext *ctx) {
+    static struct timespec due;
+    if (!interval_due(&due, MB_CHECK_MS))
+        return;
+    if (mb_check(&file_manager, ctx->active_file) > 0) {
+        mvprintw(LINES - 2, 2, "Memory budget of %d MiB exceeded; edits are "
+                               "refused", app_config.memory_budget_mb);
+        wnoutrefresh(stdscr);
+        doupdate();
+    }
+}
+
+/*
+ * Hibernate files that have not been shown for a while.
+ *
+ * ctx - Editor context providing the active file.
+ *
+ * Called whenever the editor is idle.  The active file is stamped as seen
+ * every time; every HB_CHECK_MS milliseconds the files not shown for
+ * app_config.hibernate_minutes are written to swap files (see hibernate.h)
+ * and restored when they are switched to again.
+ */
+void hibernate_idle_files(EditorContext *ctx) {
+    static struct timespec due;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (ctx->active_file)
+        ctx->active_file->active_at = now.tv_sec;
+    if (app_config.hibernate_minutes <= 0 || !interval_due(&due, HB_CHECK_MS))
+        return;
+    time_t idle = (time_t)app_config.hibernate_minutes * 60;
+    for (int i = 0; i < file_manager.count; ++i) {
+        FileState *fs = file_manager.files[i];
+        if (!fs || fs == ctx->active_file)
+            continue;
+        if (!fs->active_at)
+            fs->active_at = now.tv_sec;
+        if (now.tv_sec - fs->active_at >= idle && hb_can_sleep(fs))
+            hb_sleep(fs);
+    }
+}
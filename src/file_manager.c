@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include "file_manager.h"
 #include "editor_state.h"
+#include "hibernate.h"
 
 /*
  * Initialize a FileManager to an empty state.
@@ -72,19 +73,14 @@ int fm_add(FileManager *fm, FileState *fs) {
  * fm    - FileManager managing the list of files.
  * index - Index of the file to close.
  *
- * If the file was only partially loaded, its current position is stored and
- * the FILE pointer closed before freeing the FileState.  The entry is removed
+ * The FileState is freed, closing its FILE pointer whether it is open or
+ * parked if the file was only partially loaded.  The entry is removed
  * from the array, memory is freed and `active_index`, `count` and `capacity`
  * are updated accordingly.
  */
 void fm_close(FileManager *fm, int index) {
     if (!fm || index < 0 || index >= fm->count) return;
     FileState *fs = fm->files[index];
-    if (fs && fs->fp && !fs->file_complete) {
-        fs->file_pos = ftell(fs->fp);
-        fclose(fs->fp);
-        fs->fp = NULL;
-    }
     free_file_state(fs);
     for (int i = index; i < fm->count - 1; i++) {
         fm->files[i] = fm->files[i + 1];
@@ -112,11 +108,13 @@ void fm_close(FileManager *fm, int index) {
  * fm    - FileManager managing the list of files.
  * index - Index of the file to make active.
  *
- * Returns the new active index or -1 if the index is invalid.  Only the
- * active_index field is changed.
+ * Returns the new active index or -1 if the index is invalid or the file
+ * is hibernated and could not be restored.  A hibernated file is woken
+ * first; otherwise only the active_index field is changed.
  */
 int fm_switch(FileManager *fm, int index) {
     if (!fm || index < 0 || index >= fm->count) return -1;
+    if (hb_wake(fm->files[index]) < 0) return -1;
     fm->active_index = index;
     return fm->active_index;
 }
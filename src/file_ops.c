@@ -8,12 +8,20 @@
 #include "syntax.h"
 #include "file_ops.h"
 #include "files.h"
+#include "line_index.h"
+#include "mem_budget.h"
 #include "file_manager.h"
 #include "ui_common.h"
 #include "editor_state.h"
 #include "path_utils.h"
+#include "save.h"
+#include "journal.h"
+#include "config.h"
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /*
  * file_ops.c
@@ -26,6 +34,139 @@
  */
 
 #define INITIAL_LOAD_LINES 1024
+#define PAGED_LOAD_BYTES (64L << 20) /* larger files are paged, not mapped */
+#define PACKED_LOAD_BYTES (1L << 20) /* smallest file kept compressed */
+
+/*
+ * Tell the user how saving `fs` went.  RESULT is the return value of
+ * sv_finish(), with errno still set from it on failure.  A failed save
+ * marks the buffer modified again and waits for a key so the message is
+ * not lost to the next redraw.
+ */
+static void report_save(FileState *fs, int result) {
+    if (result == 0) {
+        mvprintw(LINES - 2, 2, "File saved as %s", fs->filename);
+        clrtoeol();
+        refresh();
+        return;
+    }
+    int err = errno;
+    fs->modified = true;
+    mvprintw(LINES - 2, 2, "Error saving file: %s", strerror(err));
+    clrtoeol();
+    refresh();
+    getch();
+}
+
+/*
+ * Refuse to start another save of `fs` while one is being written.
+ * Returns true, after telling the user, if a save is still running.
+ */
+static bool still_saving(FileState *fs) {
+    if (!fs->save)
+        return false;
+    mvprintw(LINES - 2, 2, "Still saving %s", fs->filename);
+    clrtoeol();
+    refresh();
+    return true;
+}
+
+/*
+ * Return how many bytes a save may copy: what is left of the memory
+ * budget, or no limit without one.
+ */
+static size_t save_headroom(void) {
+    if (app_config.memory_budget_mb <= 0)
+        return SIZE_MAX;
+    size_t budget = (size_t)app_config.memory_budget_mb << 20;
+    size_t used = mb_usage(&file_manager);
+    return used < budget ? budget - used : 0;
+}
+
+/*
+ * Start writing the buffer of `fs` to `fs->filename` in the background.
+ *
+ * Lines a mapped, paged or viewed file has not loaded yet, and the clean
+ * pages of a paged one, are copied from the file by the writer without
+ * being read into the buffer.  Only a stream has to be read to its end
+ * first, as its remaining lines can be reached no other way.  The other
+ * lines are copied for the writer as far as the memory budget allows;
+ * past that the file is written before this returns (see save.h).  The
+ * buffer counts as saved from here on, so edits made while the file is
+ * written mark it modified again; finish_save() reports the outcome.
+ */
+static void write_file(FileState *fs) {
+    if (file_streamed(fs)) {
+        resume_file(fs);
+        load_all_remaining_lines(fs);
+    }
+    fs->save = sv_start(&fs->buffer, fs->filename, app_config.save_fsync,
+                        save_headroom());
+    if (!fs->save) {
+        report_save(fs, -1);
+        return;
+    }
+    fs->modified = false;
+    jn_save_started(fs);
+    mvprintw(LINES - 2, 2, "Saving %s", fs->filename);
+    clrtoeol();
+    refresh();
+}
+
+/*
+ * Collect the background save of `fs`.
+ *
+ *  fs   - FileState that may be being saved.
+ *  wait - Wait for a running save instead of leaving it be.
+ *
+ * A finished save is reported with report_save() and, if it succeeded,
+ * brings the journal of unsaved changes up to date.  Returns true if no
+ * save of `fs` is running any more.
+ */
+bool finish_save(FileState *fs, bool wait) {
+    if (!fs->save)
+        return true;
+    if (!wait && !sv_done(fs->save, NULL, NULL))
+        return false;
+    int result = sv_finish(fs->save);
+    fs->save = NULL;
+    if (result == 0)
+        jn_saved(fs);
+    report_save(fs, result);
+    return true;
+}
+
+/*
+ * Replay the journal of unsaved changes left behind for `fs` (see
+ * journal.h) and tell the user how that went.  Failures wait for a key, as
+ * the changes stay in the journal until the problem is dealt with.
+ */
+static void recover_file(FileState *fs) {
+    long n = jn_recover(fs);
+    if (n < 0 && errno == ENOENT) {
+        mvprintw(LINES - 2, 2, "No unsaved changes to recover for %s",
+                 fs->filename);
+        clrtoeol();
+        refresh();
+        return;
+    }
+    if (n < 0) {
+        int err = errno;
+        mvprintw(LINES - 2, 2, "Cannot recover %s: %s", fs->filename,
+                 err == ESTALE ? "the file has changed since"
+                 : err == EINVAL ? "the journal is damaged"
+                                 : strerror(err));
+        clrtoeol();
+        refresh();
+        getch();
+        return;
+    }
+    draw_text_buffer(fs, text_win);
+    wrefresh(text_win);
+    mvprintw(LINES - 2, 2, "Recovered %ld changes to %s", n, fs->filename);
+    clrtoeol();
+    refresh();
+}
 
 /*
  * Save the current buffer to the file referenced by `fs`.
@@ -33,39 +174,23 @@
  *  ctx - Optional EditorContext.  Currently unused but passed for API symmetry.
  *  fs  - FileState describing the buffer to write.
  *
- * Before writing the buffer the function calls load_all_remaining_lines so that
- * a lazily loaded file is fully realized on disk.  On success the file is
- * truncated and rewritten line by line, `fs->modified` is cleared and a brief
- * status message is shown.  Errors simply display a message; the undo history
- * is unaffected and the caller must handle further recovery.  No redraw occurs
- * aside from the status bar updates.
+ * The file is written in the background by the save engine (see save.h),
+ * which never leaves it half written and copies the parts of a lazily
+ * loaded file that were never loaded across from the original.
+ * `fs->modified` is cleared as the save starts and the outcome is reported
+ * by finish_save() once the file is written; a failed save marks the
+ * buffer modified again.  The undo history is unaffected.  No redraw
+ * occurs aside from the status bar updates.  Read-only files are never
+ * saved, and a file is not saved again while it is still being written.
  */
 void save_file(EditorContext *ctx, FileState *fs) {
     (void)ctx;
+    if (reject_read_only(fs) || still_saving(fs))
+        return;
     if (strlen(fs->filename) == 0) {
         save_file_as(ctx, fs);
     } else {
-        load_all_remaining_lines(fs);
-        FILE *fp = fopen(fs->filename, "w");
-        if (fp) {
-            for (int i = 0; i < fs->buffer.count; ++i) {
-                const char *ln = lb_get(&fs->buffer, i);
-                if (!ln)
-                    ln = "";
-                fprintf(fp, "%s\n", ln);
-            }
-            fclose(fp);
-            fs->modified = false;
-            mvprintw(LINES - 2, 2, "File saved as %s", fs->filename);
-        } else {
-            int err = errno;
-            mvprintw(LINES - 2, 2, "Error saving file: %s", strerror(err));
-        }
-        clrtoeol();
-        refresh();
-        napms(1000);      /* display for one second */
-        mvprintw(LINES - 2, 2, "%*s", COLS - 4, "");
-        refresh();
+        write_file(fs);
         return;
     }
 }
@@ -77,41 +202,20 @@ void save_file(EditorContext *ctx, FileState *fs) {
  *  fs  - FileState whose buffer should be written.
  *
  * The chosen path is canonicalized and stored back into `fs->filename` before
- * writing.  Like save_file() this ensures any lazily loaded portions are read
- * first.  On success the modified flag is cleared and a short message is
- * displayed.  Failure simply reports an error.  No undo information changes and
- * only the status bar is redrawn.
+ * writing, which happens in the background like for save_file().  Any
+ * portions not loaded yet are copied across from the original file.  No
+ * undo information changes and only the status bar is redrawn.
  */
 void save_file_as(EditorContext *ctx, FileState *fs) {
     (void)ctx;
+    if (still_saving(fs))
+        return;
     char newpath[PATH_MAX];
     if (!show_save_file_dialog(ctx, newpath, sizeof(newpath)))
         return;    // user cancelled
     canonicalize_path(newpath, fs->filename, sizeof(fs->filename));
 
-    load_all_remaining_lines(fs);
-
-    FILE *fp = fopen(fs->filename, "w");
-    if (fp) {
-        for (int i = 0; i < fs->buffer.count; ++i) {
-            const char *ln = lb_get(&fs->buffer, i);
-            if (!ln)
-                ln = "";
-            fprintf(fp, "%s\n", ln);
-        }
-        fclose(fp);
-        fs->modified = false;
-        mvprintw(LINES - 2, 2, "File saved as %s", fs->filename);
-    } else {
-        int err = errno;
-        mvprintw(LINES - 2, 2, "Error saving file: %s", strerror(err));
-    }
-
-    clrtoeol();
-    refresh();
-    napms(1000);      /* display for one second */
-    mvprintw(LINES - 2, 2, "%*s", COLS - 4, "");
-    refresh();
+    write_file(fs);
     return;
 }
 
@@ -124,10 +228,22 @@ void save_file_as(EditorContext *ctx, FileState *fs) {
  *  filename   - Path to the file to open or NULL to prompt the user.
  *
  * Only the first INITIAL_LOAD_LINES lines are read immediately to keep large
- * files responsive.  The new FileState is inserted into the FileManager and the
+ * files responsive; for regular files a background LineIndex counts the rest
+ * so the status bar and scrollbar reflect the whole file.  Files of at least
+ * PAGED_LOAD_BYTES are opened with lb_page_file() so that only a window of
+ * pages is held in memory, however large they are.  With compress_files set,
+ * files of at least PACKED_LOAD_BYTES are read whole into compressed pages
+ * with lb_pack_file() instead of being mapped.  With share_lines set, lines
+ * split off a mapped or streamed file are interned in the line pool.  Files
+ * opened with -R, and files of at least read_only_mb MiB when that is set,
+ * are read-only: regular ones are viewed with lb_view_file(), which never
+ * copies their lines.  Unsaved changes a crash left in a journal (see
+ * journal.h) are replayed with --recover and reported otherwise.  The new
+ * FileState is inserted into the FileManager and the
  * previous active file is detached, closing its stream if it was only partially
  * loaded.  The associated ncurses window is drawn and refreshed.  On error a
- * message is displayed and the previous file remains active.
+ * message is displayed and the previous file remains active.  While the
+ * open files exceed the memory budget no further file is opened.
  *
  * Returns 0 on success or -1 on failure or user cancellation.  Undo history for
  * the new file starts empty.
@@ -156,18 +272,17 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
     for (int i = 0; i < file_manager.count; i++) {
         FileState *open_fs = file_manager.files[i];
         if (open_fs && strcmp(open_fs->filename, filename_canon) == 0) {
-            fm_switch(&file_manager, i);
+            if (fm_switch(&file_manager, i) < 0) {
+                sync_editor_context(ctx);
+                return -1;
+            }
             active_file = open_fs;
-            if (previous_active && previous_active != active_file &&
-                previous_active->fp && !previous_active->file_complete) {
+            if (previous_active && previous_active != active_file) {
                 /*
-                 * The previous file was only partially loaded. Store the current
-                 * position and close the handle so it can be re-opened lazily
-                 * later without keeping the descriptor open.
+                 * The previous file may only be partially loaded. Park its
+                 * stream so loading can resume without reopening the file.
                  */
-                previous_active->file_pos = ftell(previous_active->fp);
-                fclose(previous_active->fp);
-                previous_active->fp = NULL;
+                park_file(previous_active);
             }
             text_win = open_fs->text_win;
             if (ctx) {
@@ -182,10 +297,20 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
         }
     }
 
+    /* Another file would only take the editor further over its budget */
+    if (mb_over_budget()) {
+        mvprintw(LINES - 2, 2, "Memory budget of %d MiB exceeded; close a "
+                               "file first", app_config.memory_budget_mb);
+        refresh();
+        sync_editor_context(ctx);
+        return -1;
+    }
+
     /* Allocate a new file state */
-    FileState *fs = initialize_file_state(filename_canon, DEFAULT_BUFFER_LINES, COLS - 3);
+    FileState *fs = initialize_file_state(filename_canon, COLS - 3);
     if (!fs) {
         allocation_failed("initialize_file_state failed");
+        return -1;
     }
     active_file = fs;
 
@@ -193,24 +318,57 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
     canonicalize_path(filename_canon, fs->filename, sizeof(fs->filename));
 
 
-    fs->fp = fopen(filename_canon, "r");
+    int loaded;
+    struct stat st;
+    bool regular = stat(filename_canon, &st) == 0 && S_ISREG(st.st_mode);
+    bool read_only = read_only_files ||
+                     (regular && app_config.read_only_mb > 0 &&
+                      st.st_size >= (off_t)app_config.read_only_mb << 20);
     fs->file_pos = 0;
-    if (!fs->fp) {
-        int err = errno;
-        mvprintw(LINES - 2, 2, "Error loading file: %s", strerror(err));
-        refresh();
-        getch();
-        mvprintw(LINES - 2, 2, "                            ");
-        refresh();
-        free_file_state(fs);
-        active_file = previous_active;
-        text_win = previous_active ? previous_active->text_win : NULL;
-        sync_editor_context(ctx);
-        return -1;
+    if (read_only && regular &&
+        lb_view_file(&fs->buffer, filename_canon) == 0) {
+        /* Read-only files are shown straight from the mapping */
+        fs->fp = NULL;
+        fs->file_complete = false;
+        loaded = load_next_lines(fs, INITIAL_LOAD_LINES) < 0 ? -1 : 0;
+    } else if (app_config.piece_table) {
+        /* The piece table maps the whole file up front */
+        fs->fp = NULL;
+        fs->file_complete = true;
+        loaded = lb_init_piece_table(&fs->buffer, filename_canon);
+    } else if (regular && st.st_size >= PAGED_LOAD_BYTES &&
+               lb_page_file(&fs->buffer, filename_canon) == 0 &&
+               (fs->line_index = li_start(filename_canon)) != NULL) {
+        /* Huge files keep only the pages around the viewport in memory */
+        fs->fp = NULL;
+        loaded = load_next_lines(fs, INITIAL_LOAD_LINES) < 0 ? -1 : 0;
+    } else if (regular && app_config.compress_files &&
+               st.st_size >= PACKED_LOAD_BYTES) {
+        /* Compressed pages are expanded as the viewport reaches them */
+        fs->fp = NULL;
+        fs->file_complete = true;
+        loaded = lb_pack_file(&fs->buffer, filename_canon);
+    } else if (lb_map_file(&fs->buffer, filename_canon) == 0) {
+        /* Regular files are mapped and split into lines as they are needed */
+        fs->fp = NULL;
+        fs->buffer.share_lines = app_config.share_lines;
+        loaded = load_next_lines(fs, INITIAL_LOAD_LINES) < 0 ? -1 : 0;
+        if (loaded == 0 && !fs->file_complete)
+            fs->line_index = li_start(filename_canon);
+    } else {
+        /* Pipes and special files are read lazily through stdio */
+        fs->fp = fopen(filename_canon, "r");
+        loaded = fs->fp ? 0 : -1;
+        if (fs->fp) {
+            hp_stamp(fs->fp, &fs->stamp);
+            fs->file_complete = false;
+            lb_resize(&fs->buffer, 0);
+            fs->buffer.share_lines = app_config.share_lines;
+            if (load_next_lines(fs, INITIAL_LOAD_LINES) < 0)
+                loaded = -1;
+        }
     }
-    fs->file_complete = false;
-    fs->buffer.count = 0;
-    if (load_next_lines(fs, INITIAL_LOAD_LINES) < 0) {
+    if (loaded < 0) {
         int err = errno;
         mvprintw(LINES - 2, 2, "Error loading file: %s", strerror(err));
         refresh();
@@ -229,6 +387,7 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
     fs->last_scanned_line = 0;
     fs->last_comment_state = false;
     fs->modified = false;
+    fs->read_only = read_only;
 
     canonicalize_path(filename_canon, fs->filename, sizeof(fs->filename));
 
@@ -248,8 +407,7 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
     draw_text_buffer(fs, text_win);
     fs->cursor_x = fs->saved_cursor_x;
     fs->cursor_y = fs->saved_cursor_y;
-    wmove(text_win, fs->cursor_y,
-          fs->cursor_x + get_line_number_offset(fs));
+    wmove(text_win, fs->cursor_y, cursor_screen_x(fs));
     wrefresh(text_win);
 
     int idx = fm_add(&file_manager, fs);
@@ -278,15 +436,12 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
 
     fm_switch(&file_manager, idx);
     active_file = fm_current(&file_manager);
-    if (previous_active && previous_active != active_file &&
-        previous_active->fp && !previous_active->file_complete) {
+    if (previous_active && previous_active != active_file) {
         /*
-         * Record the offset of the partially loaded file and close its stream
-         * so that it may be reopened on demand without consuming resources.
+         * Park the stream of a partially loaded file so that loading may
+         * resume later without reopening and seeking it.
          */
-        previous_active->file_pos = ftell(previous_active->fp);
-        fclose(previous_active->fp);
-        previous_active->fp = NULL;
+        park_file(previous_active);
     }
 
     ctx->file_manager = file_manager;
@@ -295,10 +450,22 @@ int load_file(EditorContext *ctx, FileState *fs_unused, const char *filename) {
     sync_editor_context(ctx);
 
     update_status_bar(ctx, active_file);
-    extern int start_line;
+    extern long start_line;
     if (start_line > 0 && go_to_line)
         go_to_line(ctx, active_file, start_line);
     start_line = 0;    /* only apply once */
+    if (follow_files)
+        toggle_follow(ctx, active_file);
+    if (recover_files) {
+        recover_file(active_file);
+    } else if (jn_pending(active_file)) {
+        mvprintw(LINES - 2, 2, "Unsaved changes to %s were found; open it "
+                               "with --recover to restore them",
+                 active_file->filename);
+        clrtoeol();
+        refresh();
+        getch();
+    }
     sync_editor_context(ctx);
     return 0;
 }
@@ -319,7 +486,7 @@ void new_file(EditorContext *ctx, FileState *fs_unused) {
     FileState *previous_active = active_file;
     int previous_index = file_manager.active_index;
 
-    FileState *fs = initialize_file_state("", DEFAULT_BUFFER_LINES, COLS - 3);
+    FileState *fs = initialize_file_state("", COLS - 3);
     if (!fs) {
         allocation_failed("initialize_file_state failed");
     }
@@ -364,8 +531,7 @@ void new_file(EditorContext *ctx, FileState *fs_unused) {
     box(text_win, 0, 0);
     fs->cursor_x = fs->saved_cursor_x;
     fs->cursor_y = fs->saved_cursor_y;
-    wmove(text_win, fs->cursor_y,
-          fs->cursor_x + get_line_number_offset(fs));
+    wmove(text_win, fs->cursor_y, cursor_screen_x(fs));
     wrefresh(text_win);
 
     if (ctx)
@@ -373,6 +539,19 @@ void new_file(EditorContext *ctx, FileState *fs_unused) {
     update_status_bar(ctx, active_file);
 }
 
+/*
+ * Wake the file fm_close() left active, which may be hibernated, or failing
+ * that the first other open file that can be woken, and make it current.
+ * Returns false if no open file could be woken.
+ */
+static bool wake_active_file(void) {
+    int first = file_manager.active_index;
+    for (int i = 0; i < file_manager.count; ++i)
+        if (fm_switch(&file_manager, (first + i) % file_manager.count) >= 0)
+            return true;
+    return false;
+}
+
 /*
  * Close the file currently selected in the FileManager.
  *
@@ -381,9 +560,10 @@ void new_file(EditorContext *ctx, FileState *fs_unused) {
  *  cx, cy    - Optional pointers that receive the cursor position of the file
  *              that becomes active after the close.
  *
- * If the buffer is modified the user is prompted to save.  The FileManager
- * entry is removed and another file is activated or a fresh one created when no
- * files remain.  The caller's cursor pointers are updated accordingly and the
+ * If the buffer is modified the user is prompted to save, and the file stays
+ * open if that save fails or is cancelled.  The FileManager entry is removed
+ * and another file is woken and activated, or a fresh one created when no
+ * other file can be.  The caller's cursor pointers are updated accordingly and the
  * entire screen is redrawn.  Undo stacks are left intact for remaining files.
  */
 void close_current_file(EditorContext *ctx, FileState *fs_unused, int *cx, int *cy) {
@@ -402,18 +582,26 @@ void close_current_file(EditorContext *ctx, FileState *fs_unused, int *cx, int *
         current->saved_cursor_x = current->cursor_x;
         current->saved_cursor_y = current->cursor_y;
     }
+    if (current)
+        finish_save(current, true);
     if (current && current->modified) {
         int ch = show_message("File modified. Save before closing? (y/n)");
         if (ch == 'y' || ch == 'Y') {
             save_file(ctx, current);
+            finish_save(current, true);
+            if (current->modified)
+                return; /* the save failed or was cancelled */
         } else if (ch != 'n' && ch != 'N') {
             return; /* cancel on other keys */
         }
     }
     fm_close(&file_manager, file_manager.active_index);
+    /* The closed file's state is gone; nothing is shown until one is woken */
+    active_file = NULL;
+    text_win = NULL;
     sync_editor_context(ctx);
 
-    if (file_manager.count > 0) {
+    if (wake_active_file()) {
         active_file = fm_current(&file_manager);
         text_win = active_file->text_win;
     } else {
@@ -6,6 +6,7 @@ struct EditorContext;
 #include <stdbool.h>
 void save_file(struct EditorContext *ctx, struct FileState *fs);
 void save_file_as(struct EditorContext *ctx, struct FileState *fs);
+bool finish_save(struct FileState *fs, bool wait);
 int load_file(struct EditorContext *ctx, struct FileState *fs,
               const char *filename);
 void new_file(struct EditorContext *ctx, struct FileState *fs);
@@ -5,9 +5,13 @@
  *
  * FileState represents a single open document. It owns all strings in
  * its LineBuffer and releases them in free_file_state(). Large files are
- * read lazily: a FILE handle is opened on demand, additional lines are
- * loaded with load_next_lines(), and the handle is closed once the end is
- * reached.
+ * read lazily: regular files are mapped and split into lines as they are
+ * needed, while a background LineIndex counts the lines still ahead. Very
+ * large files are paged instead, holding only the pages in use, and files
+ * opened read-only are viewed straight from a mapping. Other files use a
+ * FILE handle, which is parked in the handle pool while another file is
+ * shown. Either way additional lines are loaded with load_next_lines(),
+ * and the file is closed once the end is reached.
  */
 #include <stdlib.h>
 #include <string.h>
@@ -17,10 +21,21 @@
 #include "config.h"
 #include "editor_state.h"
 #include "line_buffer.h"
+#include "line_index.h"
+#include "follow.h"
+#include "hibernate.h"
+#include "mem_budget.h"
+#include "journal.h"
+#include "rewrite.h"
+#include "save.h"
 #include "undo.h"
 #include "path_utils.h"
 #include <stddef.h>
 #include <errno.h>
+#include <time.h>
+
+#define INDEX_WAIT_MS 250 /* wait for the line index before showing it */
+
 /**
  * canonicalize_path - resolve PATH to an absolute form.
  * @path: input file path, may be NULL or empty.
@@ -49,18 +64,17 @@ void canonicalize_path(const char *path, char *out, size_t out_size) {
 /**
  * initialize_file_state - allocate and setup a new FileState.
  * @filename: path to load, may be NULL for an empty buffer.
- * @max_lines: initial line capacity.
- * @max_cols: initial column capacity for each line.
+ * @max_cols: number of text columns the window can show.
  *
- * Allocates all memory for the text buffer and creates an ncurses window.
- * The FileState takes ownership of the allocated lines which are freed
- * by free_file_state(). The file is not opened here; fp is set to NULL.
+ * Sets up an empty text buffer holding one blank line and creates an
+ * ncurses window. Line storage is only allocated once a line holds text;
+ * the FileState owns it and free_file_state() releases it. The file is not opened here; fp is set to NULL.
  *
  * Returns: a pointer to the new FileState or NULL on allocation failure.
  * Side effects: allocates memory and creates an ncurses window.
  */
 
-FileState *initialize_file_state(const char *filename, int max_lines, int max_cols) {
+FileState *initialize_file_state(const char *filename, int max_cols) {
     FileState *file_state = malloc(sizeof(FileState));
     if (!file_state) {
         return NULL;
@@ -70,24 +84,14 @@ FileState *initialize_file_state(const char *filename, int max_lines, int max_co
                      sizeof(file_state->filename));
 
     // Initialize text buffer
-    lb_init(&file_state->buffer, max_lines);
-    if (!file_state->buffer.lines) {
+    lb_init(&file_state->buffer);
+    // Start with a single empty line ready for editing
+    if (lb_insert(&file_state->buffer, 0, "") < 0) {
+        lb_free(&file_state->buffer);
         free(file_state);
         return NULL;
     }
-    for (int i = 0; i < max_lines; i++) {
-        file_state->buffer.lines[i] = calloc(max_cols, sizeof(char));
-        if (!file_state->buffer.lines[i]) {
-            for (int j = 0; j < i; j++)
-                free(file_state->buffer.lines[j]);
-            lb_free(&file_state->buffer);
-            free(file_state);
-            return NULL;
-        }
-    }
 
-    file_state->buffer.count = 1; // Start with a single empty line ready for editing
-    file_state->buffer.capacity = max_lines;
     file_state->line_capacity = max_cols;
     file_state->start_line = 0;
     file_state->scroll_x = 0;
@@ -109,42 +113,78 @@ FileState *initialize_file_state(const char *filename, int max_lines, int max_co
     file_state->nested_mode = 0;
     file_state->last_scanned_line = 0;
     file_state->last_comment_state = false;
-    file_state->text_win = newwin(LINES - 2, COLS, 1, 0); // Create a new window for the file
+    file_state->text_win = create_text_window(); // Create a new window for the file
     if (!file_state->text_win) {
         lb_free(&file_state->buffer);
         free(file_state);
         return NULL;
     }
-    keypad(file_state->text_win, TRUE);
-    meta(file_state->text_win, TRUE);
-    wtimeout(file_state->text_win, 10);
-    wbkgd(file_state->text_win, enable_color ? COLOR_PAIR(SYNTAX_BG) : A_NORMAL);
 
     file_state->fp = NULL;
+    file_state->line_index = NULL;
     file_state->file_pos = 0;
+    memset(&file_state->stamp, 0, sizeof(file_state->stamp));
     file_state->file_complete = true;
     file_state->modified = false;
+    file_state->read_only = false;
+    file_state->follow = NULL;
+    file_state->swap = NULL;
+    file_state->active_at = 0;
+    file_state->save = NULL;
+    file_state->journal = NULL;
+    file_state->rewrite = NULL;
 
     return file_state;
 }
+
+/**
+ * create_text_window - create the window a file is drawn in.
+ *
+ * The window covers the screen between the menu bar and the status line
+ * and reads keys with a short timeout so the editor can do idle work.
+ *
+ * Returns: the new window, or NULL if ncurses could not create it.
+ */
+WINDOW *create_text_window(void) {
+    WINDOW *win = newwin(LINES - 2, COLS, 1, 0);
+    if (!win)
+        return NULL;
+    keypad(win, TRUE);
+    meta(win, TRUE);
+    wtimeout(win, 10);
+    wbkgd(win, enable_color ? COLOR_PAIR(SYNTAX_BG) : A_NORMAL);
+    return win;
+}
 /**
  * free_file_state - release all resources owned by a FileState.
  * @file_state: FileState to destroy.
  *
  * All line strings in the buffer are freed and the ncurses window is
- * destroyed. Any open FILE handle is closed and undo/redo stacks are
- * disposed of.
+ * destroyed. Any open or parked FILE handle is closed, a running line
+ * index and follow mode are stopped and undo/redo stacks are disposed of.
+ * A save still being written is waited for and the journal of unsaved
+ * changes removed, as closing the file settles them, unless that save
+ * failed. The original a streaming replace kept for undo is removed too.
  *
  * Returns: none.
  * Side effects: deallocates memory and closes the associated FILE.
  */
 
 void free_file_state(FileState *file_state) {
+    /* The changes a failed save did not write stay in the journal */
+    bool unsaved = file_state->save && sv_finish(file_state->save) < 0;
+    jn_close(file_state, unsaved);
+    rw_close(file_state);
+    follow_stop(file_state);
+    hb_discard(file_state);
+    li_free(file_state->line_index);
+    file_state->line_index = NULL;
     lb_free(&file_state->buffer);
     if (file_state->fp) {
         fclose(file_state->fp);
         file_state->fp = NULL;
     }
+    hp_drop(file_state);
     if (file_state->undo_stack) {
         free_stack(file_state->undo_stack);
         file_state->undo_stack = NULL;
@@ -158,125 +198,104 @@ void free_file_state(FileState *file_state) {
     delwin(file_state->text_win);
     free(file_state);
 }
-/**
- * ensure_line_capacity - expand the buffer to hold at least MIN_NEEDED lines.
- * @fs: file whose buffer will grow.
- * @min_needed: minimum number of lines required.
- *
- * Allocates additional line slots and associated memory when necessary.
- * Newly created lines are zero-initialised and owned by @fs.
- *
- * Returns: 0 on success or -1 on allocation failure.
- * Side effects: reallocates fs->buffer.lines and may allocate new line strings.
+/*
+ * Append LINE, LEN bytes read by getline(), to the buffer without its
+ * newline. Lines of any length are stored whole, NUL bytes included. When
+ * the buffer shares lines they are interned in the line pool instead.
  */
+static int read_line_into(FileState *fs, const char *line, size_t len) {
+    if (len > 0 && line[len - 1] == '\n')
+        len--;
 
-int ensure_line_capacity(FileState *fs, int min_needed) {
-    if (min_needed < fs->buffer.capacity)
-        return 0;
-
-    int new_max = fs->buffer.capacity * 2;
-    if (new_max <= min_needed)
-        new_max = min_needed + 1;
-
-    char **new_buffer = realloc(fs->buffer.lines, new_max * sizeof(char *));
-    if (!new_buffer)
+    int rc = fs->buffer.share_lines
+                 ? lb_insert_shared(&fs->buffer, fs->buffer.count, line, len)
+                 : lb_insert_bytes(&fs->buffer, fs->buffer.count, line, len);
+    if (rc < 0)
         return -1;
-    fs->buffer.lines = new_buffer;
 
-    for (int i = fs->buffer.capacity; i < new_max; ++i) {
-        fs->buffer.lines[i] = calloc(fs->line_capacity, sizeof(char));
-        if (!fs->buffer.lines[i]) {
-            for (int j = fs->buffer.capacity; j < i; ++j)
-                free(fs->buffer.lines[j]);
-            char **shrink = realloc(fs->buffer.lines,
-                                   fs->buffer.capacity * sizeof(char *));
-            if (shrink)
-                fs->buffer.lines = shrink;
-            return -1;
-        }
-    }
-
-    fs->buffer.capacity = new_max;
     return 0;
 }
-/**
- * ensure_col_capacity - grow lines to hold at least COLS characters.
- * @fs: file whose lines may be reallocated.
- * @cols: desired minimum column capacity.
- *
- * Each line buffer is resized using realloc. On failure previously
- * resized lines are restored.
- *
- * Returns: 0 on success or -1 on allocation failure.
- * Side effects: reallocates memory for each line in the buffer.
- */
-
-int ensure_col_capacity(FileState *fs, int cols) {
-    if (cols <= fs->line_capacity)
-        return 0;
 
-    int old_capacity = fs->line_capacity;
-    for (int i = 0; i < fs->buffer.capacity; ++i) {
-        char *tmp = realloc(fs->buffer.lines[i], cols);
-        if (!tmp) {
-            for (int j = 0; j < i; ++j) {
-                char *restore = realloc(fs->buffer.lines[j], old_capacity);
-                if (!restore)
-                    return -1;
-                fs->buffer.lines[j] = restore;
-            }
-            return -1;
-        }
-        fs->buffer.lines[i] = tmp;
-        memset(fs->buffer.lines[i] + old_capacity, 0, cols - old_capacity);
+/*
+ * Wait a moment for the background index of FS to find more lines, the
+ * wait having begun at START. A wait longer than INDEX_WAIT_MS shows how
+ * many lines are known so far and can be stopped with Esc, since jumping
+ * far into a huge file waits for the index to get there. Returns false,
+ * with errno set to ECANCELED, once the user has pressed Esc.
+ */
+static bool wait_for_index(FileState *fs, const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited = (now.tv_sec - start->tv_sec) * 1000 +
+                  (now.tv_nsec - start->tv_nsec) / 1000000;
+    if (waited < INDEX_WAIT_MS) {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+        return true;
     }
-
-    fs->line_capacity = cols;
-    return 0;
+    mvprintw(LINES - 2, 0, "Indexing %s: %ld lines (Esc to stop)",
+             fs->filename, fs->buffer.count);
+    clrtoeol();
+    refresh();
+    timeout(SV_PROGRESS_MS);
+    int ch = getch();
+    timeout(-1);
+    if (ch != 27)
+        return true;
+    errno = ECANCELED;
+    return false;
 }
 
-static int read_line_into(FileState *fs, const char *line) {
-    if (ensure_line_capacity(fs, fs->buffer.count + 1) < 0)
-        return -1;
-
-    size_t len = strlen(line);
-    if (len > 0 && line[len - 1] == '\n')
-        len--;
-
-    if (ensure_col_capacity(fs, (int)len + 1) < 0)
-        return -1;
-
-    char tmp[PATH_MAX];
-    if (len >= sizeof(tmp))
-        len = sizeof(tmp) - 1;
-    memcpy(tmp, line, len);
-    tmp[len] = '\0';
-
-    int idx = fs->buffer.count;
-    if (lb_insert(&fs->buffer, idx, tmp) < 0)
-        return -1;
-
-    if ((size_t)fs->line_capacity > len + 1) {
-        char *p = realloc(fs->buffer.lines[idx], fs->line_capacity);
-        if (!p)
+long load_next_lines(FileState *fs, long count) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (fs->buffer.backend == LB_MAP_VIEW) {
+        /* A view's lines are known as soon as its index has found them */
+        long before = fs->buffer.count;
+        int res;
+        while ((res = lb_view_sync(&fs->buffer)) == 0 &&
+               fs->buffer.count - before < count)
+            if (!wait_for_index(fs, &start))
+                return -1;
+        fs->file_complete = res == 1;
+        return fs->buffer.count - before;
+    }
+    if (fs->buffer.pages && fs->line_index) {
+        /* Pages become available as the index covers the file */
+        long before = fs->buffer.count;
+        int res;
+        while ((res = lb_page_sync(&fs->buffer, fs->line_index)) == 0 &&
+               fs->buffer.count - before < count)
+            if (!wait_for_index(fs, &start))
+                return -1;
+        if (res < 0)
             return -1;
-        fs->buffer.lines[idx] = p;
+        fs->file_complete = res == 1;
+        if (fs->file_complete) {
+            li_free(fs->line_index);
+            fs->line_index = NULL;
+        }
+        return fs->buffer.count - before;
+    }
+    if (lb_map_pending(&fs->buffer)) {
+        long loaded = lb_map_lines(&fs->buffer, count);
+        fs->file_complete = !lb_map_pending(&fs->buffer);
+        if (fs->file_complete) {
+            /* Every line is in the buffer, so the count is exact */
+            li_free(fs->line_index);
+            fs->line_index = NULL;
+        }
+        return loaded;
     }
-
-    return 0;
-}
-
-int load_next_lines(FileState *fs, int count) {
     if (!fs->fp)
         return 0;
 
     char *line = NULL;
     size_t len = 0;
-    int loaded = 0;
+    long loaded = 0;
     ssize_t nread;
     while (loaded < count && (nread = getline(&line, &len, fs->fp)) != -1) {
-        (void)nread;
-        if (read_line_into(fs, line) < 0) {
+        if (read_line_into(fs, line, (size_t)nread) < 0) {
             int err = errno; /* preserve errno across cleanup */
             free(line);
             if (fs->fp) {
@@ -289,10 +308,10 @@ int load_next_lines(FileState *fs, int count) {
         }
         loaded++;
         if (fs->fp)
-            fs->file_pos = ftell(fs->fp);
+            fs->file_pos = ftello(fs->fp);
     }
     if (fs->fp)
-        fs->file_pos = ftell(fs->fp);
+        fs->file_pos = ftello(fs->fp);
     free(line);
     if (fs->fp && feof(fs->fp)) {
         fclose(fs->fp);
@@ -308,61 +327,211 @@ int load_next_lines(FileState *fs, int count) {
  * @fs: FileState to load from.
  * @idx: 0-based index of the requested line.
  *
- * Opens the file on demand and reads additional lines as needed using
- * load_next_lines().
+ * Resumes a parked stream on demand and loads additional lines as needed
+ * using load_next_lines().
  *
- * Returns: none.
- * Side effects: may open fs->fp, read from disk and update file_pos.
+ * Returns: 0, or -1 with errno set if the lines could not be loaded,
+ * ECANCELED meaning the user stopped waiting for the line index.
+ * Side effects: may reopen fs->fp, read from disk and update file_pos.
  */
 
-void ensure_line_loaded(FileState *fs, int idx) {
+int ensure_line_loaded(FileState *fs, long idx) {
     if (idx < fs->buffer.count)
-        return;
-    int to_load = idx - fs->buffer.count + 1;
+        return 0;
+    long to_load = idx - fs->buffer.count + 1;
     if (to_load < 0)
         to_load = 0;
-    if (!fs->fp && !fs->file_complete) {
-        fs->fp = fopen(fs->filename, "r");
-        if (fs->fp)
-            fseek(fs->fp, fs->file_pos, SEEK_SET);
-    }
-    load_next_lines(fs, to_load);
+    resume_file(fs);
+    return load_next_lines(fs, to_load) < 0 ? -1 : 0;
 }
 /**
  * load_all_remaining_lines - read the rest of the file into memory.
  * @fs: FileState whose file should be fully loaded.
  *
  * Repeatedly calls load_next_lines() until the end of the file is reached.
- * The file handle is closed when reading completes.
+ * The file is closed when reading completes.
  *
  * Returns: none.
  * Side effects: reads from disk and may close fs->fp.
  */
 
 void load_all_remaining_lines(FileState *fs) {
-    while (!fs->file_complete && fs->fp) {
-        load_next_lines(fs, INT_MAX);
+    while (!fs->file_complete &&
+           (fs->fp || lb_map_pending(&fs->buffer) || fs->line_index ||
+            fs->buffer.backend == LB_MAP_VIEW)) {
+        if (load_next_lines(fs, LONG_MAX) < 0)
+            break;
     }
 }
 
+/**
+ * file_streamed - whether the rest of a partly loaded file is read by stdio.
+ * @fs: FileState to query.
+ *
+ * Mapped, paged and viewed files load their remaining lines without
+ * fs->fp, so only streamed files need the handle reopened after it has
+ * been closed.
+ *
+ * Returns: true if fs->fp supplies the lines not loaded yet.
+ * Side effects: none.
+ */
+bool file_streamed(FileState *fs) {
+    return !fs->file_complete && !lb_map_pending(&fs->buffer) &&
+           !fs->buffer.pages && fs->buffer.backend != LB_MAP_VIEW;
+}
+
+/**
+ * park_file - put away the stream of a partly loaded file.
+ * @fs: FileState the editor is switching away from.
+ *
+ * The stream is handed to the handle pool, which keeps up to
+ * app_config.handle_pool of them open, so switching back costs neither an
+ * open() nor a seek. The offset is recorded in case the pool closes it.
+ *
+ * Returns: none.
+ * Side effects: clears fs->fp and updates file_pos.
+ */
+void park_file(FileState *fs) {
+    if (!fs->fp || fs->file_complete)
+        return;
+    fs->file_pos = ftello(fs->fp);
+    hp_park(fs, fs->fp, app_config.handle_pool);
+    fs->fp = NULL;
+}
+
+/**
+ * resume_file - get back the stream of a partly loaded file.
+ * @fs: FileState to continue loading.
+ *
+ * Takes the stream from the handle pool or, if the pool had to close it,
+ * opens the file again at file_pos. Either way the file must still be the
+ * one loading started on and must not have been written since; otherwise
+ * the remaining lines would not continue the ones already loaded. Loading
+ * then stops for good and the buffer becomes read-only, so the part that
+ * was loaded cannot be saved over the whole file.
+ *
+ * Returns: true if fs->fp is ready to read from.
+ * Side effects: may open a file and tells the user when it changed.
+ */
+bool resume_file(FileState *fs) {
+    if (fs->fp || !file_streamed(fs))
+        return fs->fp != NULL;
+    FILE *fp = hp_take(fs);
+    if (!fp) {
+        fp = fopen(fs->filename, "r");
+        if (!fp)
+            return false; /* perhaps only for now; try again later */
+        if (hp_unchanged(&fs->stamp, fp) &&
+            fseeko(fp, fs->file_pos, SEEK_SET) < 0) {
+            fclose(fp);
+            return false;
+        }
+    }
+    if (!hp_unchanged(&fs->stamp, fp)) {
+        fclose(fp);
+        fs->file_complete = true;
+        fs->read_only = true;
+        mvprintw(LINES - 2, 2, "File changed on disk; showing the %ld lines "
+                               "loaded before (read-only)", fs->buffer.count);
+        wnoutrefresh(stdscr);
+        return false;
+    }
+    fs->fp = fp;
+    return true;
+}
+
+/**
+ * total_line_count - number of lines in the document.
+ * @fs: FileState to query.
+ *
+ * While a mapped file is still being split into lines the count includes
+ * the lines its background index has found beyond the loaded ones, and a
+ * paged or viewed file first takes on the lines indexed since the last
+ * call. Until the index finishes this is a lower bound that grows as
+ * scanning goes on.
+ *
+ * Returns: the line count.
+ * Side effects: may add lines to a paged or viewed buffer without waiting.
+ */
+long total_line_count(FileState *fs) {
+    if ((fs->buffer.pages && fs->line_index) ||
+        (fs->buffer.backend == LB_MAP_VIEW && !fs->file_complete))
+        load_next_lines(fs, 0);
+    long total = fs->buffer.count;
+    if (!fs->file_complete && fs->line_index && !fs->buffer.pages) {
+        long ahead = li_lines(fs->line_index, NULL) - fs->buffer.map_lines;
+        if (ahead > 0)
+            total += ahead;
+    }
+    return total;
+}
+
+/**
+ * reject_read_only - refuse an edit to a read-only file.
+ * @fs: FileState about to be edited.
+ *
+ * Editing commands call this first and give up when it returns true.
+ *
+ * Returns: true if @fs is read-only.
+ * Side effects: tells the user on the message line when the edit is refused.
+ */
+bool reject_read_only(FileState *fs) {
+    if (!fs || !fs->read_only)
+        return false;
+    mvprintw(LINES - 2, 2, "File is read-only");
+    wnoutrefresh(stdscr);
+    return true;
+}
+
+/**
+ * reject_edit - refuse an edit the editor cannot make.
+ * @fs: FileState about to be edited.
+ *
+ * Editing commands call this first and give up when it returns true:
+ * edits to read-only files are refused, and so is every edit while the
+ * open files use more memory than the memory budget allows.
+ *
+ * Returns: true if the edit must not be made.
+ * Side effects: tells the user on the message line when the edit is refused.
+ */
+bool reject_edit(FileState *fs) {
+    if (reject_read_only(fs))
+        return true;
+    if (!mb_over_budget())
+        return false;
+    mvprintw(LINES - 2, 2, "Memory budget of %d MiB exceeded",
+             app_config.memory_budget_mb);
+    wnoutrefresh(stdscr);
+    return true;
+}
+
 /**
  * load_file_into_buffer - read an entire file into the buffer.
  * @file_state: FileState whose filename is used.
  *
- * Opens the file, loads all lines and resets syntax state. The file
+ * Maps regular files with lb_load_mapped() and falls back to reading
+ * through stdio for anything else, then resets syntax state. The file
  * handle is closed when finished and file_complete is set accordingly.
  *
  * Returns: 0 on success or -1 on failure to open or read the file.
  * Side effects: replaces existing buffer contents and modifies fp.
  */
 int load_file_into_buffer(FileState *file_state) {
-    file_state->fp = fopen(file_state->filename, "r");
-    if (!file_state->fp)
-        return -1;
     file_state->file_pos = 0;
-    file_state->file_complete = false;
-    file_state->buffer.count = 0;
-    int res = load_next_lines(file_state, INT_MAX);
+    int res = 0;
+    if (file_state->buffer.backend == LB_LINE_TREE &&
+        lb_load_mapped(&file_state->buffer, file_state->filename) == 0) {
+        file_state->fp = NULL;
+        file_state->file_complete = true;
+    } else {
+        file_state->fp = fopen(file_state->filename, "r");
+        if (!file_state->fp)
+            return -1;
+        hp_stamp(file_state->fp, &file_state->stamp);
+        file_state->file_complete = false;
+        lb_resize(&file_state->buffer, 0);
+        res = load_next_lines(file_state, LONG_MAX) < 0 ? -1 : 0;
+    }
     if (res < 0) {
         if (file_state->fp) {
             fclose(file_state->fp);
@@ -5,50 +5,67 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
 #include "editor.h"
+#include "handle_pool.h"
 #include "line_buffer.h"
 #include "path_utils.h"
 
 typedef struct FileState {
     char filename[PATH_MAX];
     LineBuffer buffer;
-    int start_line;
+    long start_line;
     int scroll_x; /* leftmost visible column */
     int cursor_x, cursor_y;
     int saved_cursor_x, saved_cursor_y;
-    int line_capacity;
+    int line_capacity; /* text columns available; bounds mouse clicks */
     Node *undo_stack;
     Node *redo_stack;
     bool selection_mode;
     int sel_start_x, sel_start_y;
     int sel_end_x, sel_end_y;
     /* Coordinates of the most recent search match within the buffer. */
-    int match_start_x, match_start_y;
-    int match_end_x, match_end_y;
+    int match_start_x, match_end_x;
+    long match_start_y, match_end_y;
     int syntax_mode;
     bool in_multiline_comment;
     bool in_multiline_string;
     char string_delim;
     /* The last line index scanned for multiline comment state */
-    int last_scanned_line;
+    long last_scanned_line;
     /* Comment state after scanning last_scanned_line */
     bool last_comment_state;
     int nested_mode; /* 0=none,1=JS,2=CSS */
     WINDOW *text_win;
     FILE *fp;          /* Open file handle for lazy loading */
-    long file_pos;     /* Offset of fp when partially loaded */
+    struct LineIndex *line_index; /* Line count of a partly mapped file */
+    off_t file_pos;    /* Offset of fp when partially loaded */
+    FileStamp stamp;   /* File fp was opened on, to detect changes */
     bool file_complete;/* True when the entire file is loaded */
     bool modified;     /* True if the buffer has unsaved changes */
+    bool read_only;    /* True if edits to the buffer are refused */
+    struct Follow *follow; /* Set while the file is followed as it grows */
+    struct Swap *swap; /* Set while the file is hibernated (see hibernate.h) */
+    time_t active_at;  /* Monotonic seconds when the file was last shown */
+    struct SaveJob *save; /* Set while the file is saved (see save.h) */
+    struct Journal *journal; /* Unsaved changes kept on disk (see journal.h) */
+    struct Rewrite *rewrite; /* Original kept by a streaming replace (see rewrite.h) */
 } FileState;
 
-FileState *initialize_file_state(const char *filename, int max_lines, int max_cols);
+FileState *initialize_file_state(const char *filename, int max_cols);
+WINDOW *create_text_window(void);
 void free_file_state(FileState *file_state);
 int load_file_into_buffer(FileState *file_state);
-int ensure_line_capacity(FileState *fs, int min_needed);
-int ensure_col_capacity(FileState *fs, int cols);
-int load_next_lines(FileState *fs, int count);
-void ensure_line_loaded(FileState *fs, int idx);
+long load_next_lines(FileState *fs, long count);
+int ensure_line_loaded(FileState *fs, long idx);
 void load_all_remaining_lines(FileState *fs);
+bool file_streamed(FileState *fs);
+void park_file(FileState *fs);
+bool resume_file(FileState *fs);
+long total_line_count(FileState *fs);
+bool reject_read_only(FileState *fs);
+bool reject_edit(FileState *fs);
 void canonicalize_path(const char *path, char *out, size_t out_size);
 
 #endif
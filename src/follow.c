@@ -0,0 +1,290 @@
+/*
+ * follow.c
+ * --------
+ * Follow mode. See follow.h for an overview. Each followed buffer keeps
+ * its own descriptor for the file, which is what makes appends cheap to
+ * pick up and lets a rotated file be told apart from the one at the path:
+ * the descriptor keeps pointing at the file that was loaded, while the
+ * path may be given to a new one.
+ *
+ * Appended text is added through the normal LineBuffer calls, so mapped,
+ * paged and packed buffers simply grow a tree tail. Read-only views are
+ * extended in place with lb_view_append() and never copy a line.
+ */
+
+#include "follow.h"
+#include "files.h"
+#include "line_buffer.h"
+#include "syntax.h"
+#include "undo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define FOLLOW_READ (64 * 1024) /* bytes read per pread() call */
+#define FOLLOW_POLL_MS 250      /* interval between checks without inotify */
+#define FOLLOW_RECHECK_MS 1000  /* interval between checks with inotify */
+
+struct Follow {
+    int fd;             /* the file the buffer was loaded from */
+    int watch;          /* inotify descriptor, or -1 when polling */
+    dev_t dev;          /* identity of that file, to detect rotation */
+    ino_t ino;
+    off_t offset;       /* bytes of the file already in the buffer */
+    bool partial;       /* the last line has not seen its newline yet */
+    struct timespec due; /* when to check the file without an event */
+};
+
+/*
+ * Watch PATH for writes and for being moved or deleted.  Returns the
+ * inotify descriptor or -1 if the file has to be polled instead.
+ */
+static int follow_watch(const char *path) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (inotify_add_watch(fd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                        IN_DELETE_SELF) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+/*
+ * Return true when the file should be looked at: inotify has reported a
+ * change, or the polling interval has passed.  With inotify the file is
+ * still checked now and then, because a new file created at the path
+ * after rotation raises no event on the old one.
+ */
+static bool follow_due(Follow *fw) {
+    bool due = false;
+    if (fw->watch >= 0) {
+        char events[4096];
+        while (read(fw->watch, events, sizeof(events)) > 0)
+            due = true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!due && (now.tv_sec < fw->due.tv_sec ||
+                 (now.tv_sec == fw->due.tv_sec &&
+                  now.tv_nsec < fw->due.tv_nsec)))
+        return false;
+    long ms = fw->watch >= 0 ? FOLLOW_RECHECK_MS : FOLLOW_POLL_MS;
+    fw->due.tv_sec = now.tv_sec + ms / 1000;
+    fw->due.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000L;
+    if (fw->due.tv_nsec >= 1000000000L) {
+        fw->due.tv_sec++;
+        fw->due.tv_nsec -= 1000000000L;
+    }
+    return true;
+}
+
+/*
+ * Add LEN bytes of TEXT, read from the end of the file, to the end of the
+ * buffer.  Text up to the first newline continues the last line when that
+ * line was still unterminated.  fw->offset counts the bytes taken on, so
+ * after an allocation failure the next update carries on from there.
+ */
+static int follow_lines(FileState *fs, Follow *fw, const char *text,
+                        size_t len) {
+    LineBuffer *lb = &fs->buffer;
+    const char *p = text;
+    const char *end = text + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (size_t)((nl ? nl : end) - p);
+        int res;
+        if (fw->partial && lb->count > 0)
+            res = lb_insert_text(lb, lb->count - 1,
+                                 lb_length(lb, lb->count - 1), p, n);
+        else if (lb->share_lines)
+            res = lb_insert_shared(lb, lb->count, p, n);
+        else
+            res = lb_insert_bytes(lb, lb->count, p, n);
+        if (res < 0)
+            return -1;
+        fw->partial = nl == NULL;
+        p += n + (nl ? 1 : 0);
+        fw->offset += (off_t)(n + (nl ? 1 : 0));
+    }
+    return 0;
+}
+
+/* Read the file from fw->offset up to SIZE into the buffer. */
+static int follow_read(FileState *fs, Follow *fw, off_t size) {
+    if (fs->buffer.backend == LB_MAP_VIEW) {
+        if (lb_view_append(&fs->buffer) < 0)
+            return -1;
+        fw->offset = lb_file_bytes(&fs->buffer);
+        return 0;
+    }
+    char *buf = malloc(FOLLOW_READ);
+    if (!buf)
+        return -1;
+    int res = 0;
+    while (res == 0 && fw->offset < size) {
+        size_t want = size - fw->offset < FOLLOW_READ
+                          ? (size_t)(size - fw->offset)
+                          : FOLLOW_READ;
+        ssize_t n = pread(fw->fd, buf, want, fw->offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        res = follow_lines(fs, fw, buf, (size_t)n);
+    }
+    free(buf);
+    return res;
+}
+
+/*
+ * Load the file at the path again from the start, after it was truncated
+ * or replaced.  Returns 1 when the buffer was reloaded, 0 if the path
+ * cannot be opened yet (the next check tries again) or -1 on failure.
+ */
+static int follow_reopen(FileState *fs) {
+    Follow *fw = fs->follow;
+    int fd = open(fs->filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    close(fw->fd);
+    fw->fd = fd;
+    fw->dev = st.st_dev;
+    fw->ino = st.st_ino;
+    fw->offset = 0;
+    fw->partial = false;
+    if (fw->watch >= 0)
+        close(fw->watch);
+    fw->watch = follow_watch(fs->filename);
+
+    /* Undo records refer to lines that are gone */
+    free_stack(fs->undo_stack);
+    fs->undo_stack = NULL;
+    free_stack(fs->redo_stack);
+    fs->redo_stack = NULL;
+    mark_comment_state_dirty(fs);
+
+    bool view = fs->buffer.backend == LB_MAP_VIEW;
+    bool share = fs->buffer.share_lines;
+    lb_free(&fs->buffer);
+    fs->buffer.share_lines = share;
+    int res;
+    if (view) {
+        res = lb_view_file(&fs->buffer, fs->filename);
+        if (res == 0) {
+            fs->file_complete = false;
+            load_all_remaining_lines(fs);
+            fw->offset = lb_file_bytes(&fs->buffer);
+        }
+    } else {
+        res = follow_read(fs, fw, st.st_size);
+    }
+    return res < 0 ? -1 : 1;
+}
+
+/**
+ * Start following the file FS was loaded from. The rest of the file is
+ * loaded first, so appends are always added after the last line. Piece
+ * table buffers and files that are not regular cannot be followed.
+ *
+ * Returns 0 on success, including when FS is already followed, or -1.
+ */
+int follow_start(FileState *fs) {
+    if (fs->follow)
+        return 0;
+    if (fs->buffer.backend == LB_PIECE_TABLE || !fs->filename[0])
+        return -1;
+    load_all_remaining_lines(fs);
+    if (!fs->file_complete)
+        return -1;
+    Follow *fw = calloc(1, sizeof(*fw));
+    if (!fw)
+        return -1;
+    struct stat st;
+    fw->fd = open(fs->filename, O_RDONLY);
+    if (fw->fd < 0 || fstat(fw->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fw->fd >= 0)
+            close(fw->fd);
+        free(fw);
+        return -1;
+    }
+    fw->dev = st.st_dev;
+    fw->ino = st.st_ino;
+    off_t offset = lb_file_bytes(&fs->buffer);
+    fw->offset = offset >= 0 ? offset : fs->file_pos;
+    char last;
+    fw->partial = fw->offset > 0 &&
+                  pread(fw->fd, &last, 1, fw->offset - 1) == 1 &&
+                  last != '\n';
+    fw->watch = follow_watch(fs->filename);
+    fs->follow = fw;
+    return 0;
+}
+
+/** Stop following the file of FS, if it is followed. */
+void follow_stop(FileState *fs) {
+    Follow *fw = fs->follow;
+    if (!fw)
+        return;
+    close(fw->fd);
+    if (fw->watch >= 0)
+        close(fw->watch);
+    free(fw);
+    fs->follow = NULL;
+}
+
+/**
+ * Bring a followed buffer up to date with its file. Cheap enough to call
+ * whenever the editor is idle: nothing is read unless inotify reported a
+ * change or the polling interval has passed.
+ *
+ * A file that shrank or was replaced is loaded again from the start,
+ * unless the buffer has unsaved changes, in which case following stops
+ * rather than lose them.
+ *
+ * Returns 1 if the buffer changed, 0 if it did not, or -1 if following
+ * stopped or the new text could not be added.
+ */
+int follow_update(FileState *fs) {
+    Follow *fw = fs->follow;
+    if (!fw || !follow_due(fw))
+        return 0;
+    struct stat st;
+    struct stat at_path;
+    if (fstat(fw->fd, &st) < 0)
+        return 0;
+    bool replaced = stat(fs->filename, &at_path) == 0 &&
+                    (at_path.st_dev != fw->dev || at_path.st_ino != fw->ino);
+    if (replaced || st.st_size < fw->offset) {
+        if (fs->modified) {
+            follow_stop(fs);
+            return -1;
+        }
+        return follow_reopen(fs);
+    }
+    if (st.st_size == fw->offset)
+        return 0;
+    long before = fs->buffer.count;
+    off_t offset = fw->offset;
+    if (follow_read(fs, fw, st.st_size) < 0)
+        return -1;
+    return fs->buffer.count != before || fw->offset != offset ? 1 : 0;
+}
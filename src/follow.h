@@ -0,0 +1,24 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+/*
+ * Follow mode
+ * -----------
+ * Keeps a buffer in step with a file that grows on disk, the way tail -f
+ * does. The file stays open and bytes appended to it are read from where
+ * the previous read stopped, so each update costs as much as the new text
+ * and never rescans what is already loaded. On Linux inotify reports the
+ * changes; elsewhere the file is polled. A file that shrinks, or whose
+ * path now names a different file (as after log rotation), is reopened
+ * and loaded again from the start.
+ */
+
+struct FileState;
+
+typedef struct Follow Follow;
+
+int follow_start(struct FileState *fs);
+void follow_stop(struct FileState *fs);
+int follow_update(struct FileState *fs);
+
+#endif /* FOLLOW_H */
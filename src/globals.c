@@ -21,7 +21,16 @@ __attribute__((weak)) int enable_mouse = 1;
 __attribute__((weak)) int show_line_numbers = 0;
 
 /* Line number to jump to on file open; cleared after use. */
-__attribute__((weak)) int start_line = 0;
+__attribute__((weak)) long start_line = 0;
+
+/* Open every file read-only; set by the -R command line option. */
+__attribute__((weak)) int read_only_files = 0;
+
+/* Follow every file as it grows; set by the -f command line option. */
+__attribute__((weak)) int follow_files = 0;
+
+/* Replay journals of unsaved changes; set by the --recover option. */
+__attribute__((weak)) int recover_files = 0;
 
 /*
  * Global configuration loaded from the user's config file. The structure is
@@ -47,7 +56,15 @@ __attribute__((weak)) AppConfig app_config = {
     .tab_width = 4,
     .macros_file = "",
     .macro_record_key = KEY_F(2),
-    .macro_play_key = KEY_F(4)
+    .macro_play_key = KEY_F(4),
+    .piece_table = 0,
+    .compress_files = 0,
+    .share_lines = 0,
+    .read_only_mb = 0,
+    .handle_pool = 16,
+    .memory_budget_mb = 0,
+    .hibernate_minutes = 0,
+    .save_fsync = 1
 };
 
 /*
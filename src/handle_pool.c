@@ -0,0 +1,135 @@
+/*
+ * handle_pool.c
+ * -------------
+ * Parked file streams. See handle_pool.h for an overview. The pool is a
+ * small array kept in the order streams were parked, so the front holds
+ * the least recently used one. It only ever holds a handful of entries,
+ * which makes a linear search cheaper than anything more elaborate.
+ */
+
+#include "handle_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct HpEntry {
+    const void *owner;
+    FILE *fp;
+    bool reopenable; /* a regular file, which its owner can open again */
+};
+
+static struct HpEntry *entries;
+static int entry_count;
+static int entry_capacity;
+
+static void hp_remove(int i) {
+    memmove(&entries[i], &entries[i + 1],
+            sizeof(*entries) * (size_t)(entry_count - i - 1));
+    entry_count--;
+}
+
+/* Close the least recently parked stream that can be reopened. */
+static bool hp_evict(void) {
+    for (int i = 0; i < entry_count; ++i) {
+        if (entries[i].reopenable) {
+            fclose(entries[i].fp);
+            hp_remove(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Keep FP open on behalf of OWNER until hp_take() collects it. At most
+ * LIMIT streams of regular files stay open; older ones are closed to make
+ * room, and with a LIMIT of zero FP itself is closed straight away. The
+ * owner must record the stream position first, in case it has to reopen
+ * the file. Streams of other files are always kept.
+ */
+void hp_park(const void *owner, FILE *fp, int limit) {
+    if (!fp)
+        return;
+    hp_drop(owner);
+    struct stat st;
+    bool reopenable = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+    if (reopenable) {
+        if (limit <= 0) {
+            fclose(fp);
+            return;
+        }
+        int open = 0;
+        for (int i = 0; i < entry_count; ++i)
+            open += entries[i].reopenable;
+        while (open >= limit && hp_evict())
+            open--;
+    }
+    if (entry_count == entry_capacity) {
+        int cap = entry_capacity ? entry_capacity * 2 : 8;
+        struct HpEntry *tmp = realloc(entries, sizeof(*entries) * (size_t)cap);
+        if (!tmp) {
+            fclose(fp);
+            return;
+        }
+        entries = tmp;
+        entry_capacity = cap;
+    }
+    entries[entry_count].owner = owner;
+    entries[entry_count].fp = fp;
+    entries[entry_count].reopenable = reopenable;
+    entry_count++;
+}
+
+/**
+ * Remove the stream parked by OWNER from the pool and return it, or NULL
+ * if OWNER has none, in which case it was closed to make room.
+ */
+FILE *hp_take(const void *owner) {
+    for (int i = 0; i < entry_count; ++i) {
+        if (entries[i].owner == owner) {
+            FILE *fp = entries[i].fp;
+            hp_remove(i);
+            return fp;
+        }
+    }
+    return NULL;
+}
+
+/** Close the stream parked by OWNER, if there is one. */
+void hp_drop(const void *owner) {
+    FILE *fp = hp_take(owner);
+    if (fp)
+        fclose(fp);
+}
+
+/** Number of streams currently parked. */
+int hp_count(void) {
+    return entry_count;
+}
+
+/** Record which file FP reads and when it was last modified. */
+void hp_stamp(FILE *fp, FileStamp *stamp) {
+    struct stat st;
+    memset(stamp, 0, sizeof(*stamp));
+    if (!fp || fstat(fileno(fp), &st) < 0 || !S_ISREG(st.st_mode))
+        return;
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->mtime = st.st_mtim;
+    stamp->regular = true;
+}
+
+/**
+ * Return true if FP reads the file STAMP was taken from and that file has
+ * not been written since. Streams of files that are not regular, whose
+ * modification time says nothing about their contents, always match.
+ */
+bool hp_unchanged(const FileStamp *stamp, FILE *fp) {
+    if (!stamp->regular)
+        return true;
+    struct stat st;
+    return fp && fstat(fileno(fp), &st) == 0 && st.st_dev == stamp->dev &&
+           st.st_ino == stamp->ino &&
+           st.st_mtim.tv_sec == stamp->mtime.tv_sec &&
+           st.st_mtim.tv_nsec == stamp->mtime.tv_nsec;
+}
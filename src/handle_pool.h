@@ -0,0 +1,42 @@
+#ifndef HANDLE_POOL_H
+#define HANDLE_POOL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * HandlePool
+ * ----------
+ * Streams of partly loaded files that are not being viewed. Instead of
+ * closing such a stream when the editor switches away from its file and
+ * opening and seeking it again when loading resumes, the owner parks it
+ * with hp_park() and collects it with hp_take(), still positioned where
+ * reading stopped.
+ *
+ * The pool keeps at most the given number of streams open and closes the
+ * least recently parked one to make room; its owner then has to open the
+ * file again. Streams that cannot be reopened, such as pipes, are never
+ * closed that way, as closing them would lose the rest of their input.
+ *
+ * A FileStamp records which file a stream was opened on and when it was
+ * last written, so an owner can tell whether the file was replaced or
+ * rewritten while it was not reading it.
+ */
+
+typedef struct FileStamp {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool regular; /* only regular files are compared */
+} FileStamp;
+
+void hp_park(const void *owner, FILE *fp, int limit);
+FILE *hp_take(const void *owner);
+void hp_drop(const void *owner);
+int hp_count(void);
+void hp_stamp(FILE *fp, FileStamp *stamp);
+bool hp_unchanged(const FileStamp *stamp, FILE *fp);
+
+#endif /* HANDLE_POOL_H */
@@ -0,0 +1,450 @@
+/*
+ * hibernate.c
+ * -----------
+ * Hibernation of files that are not being shown. See hibernate.h for an
+ * overview. A swap file is a sequence of chunks, each an 8 byte header
+ * giving its uncompressed and compressed length followed by its data; a
+ * compressed length of zero marks a chunk stored as is because it did not
+ * compress. Inside, the data is a stream of values: counts and lengths
+ * are written as base-128 varints and text as raw bytes, so the reader
+ * can hand out lines straight from the chunk holding them.
+ */
+
+#include "hibernate.h"
+#include "config.h"
+#include "editor.h"
+#include "files.h"
+#include "line_buffer.h"
+#include "line_pool.h"
+#include "lz.h"
+#include "undo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HB_MAGIC "VENTOSW1"
+#define HB_HEADER 8
+
+struct Swap {
+    char path[PATH_MAX];
+};
+
+typedef struct HbWriter {
+    int fd;
+    char *raw;    /* HB_CHUNK bytes being filled */
+    size_t len;
+    char *packed; /* lz_bound(HB_CHUNK) bytes for the compressed chunk */
+    bool failed;
+} HbWriter;
+
+typedef struct HbReader {
+    int fd;
+    char *raw;    /* the current chunk, uncompressed */
+    size_t len;
+    size_t pos;
+    char *packed;
+    char *scratch; /* values spanning two chunks are gathered here */
+    size_t scratch_cap;
+    bool failed;
+} HbReader;
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void put_u32(unsigned char *p, size_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static size_t get_u32(const unsigned char *p) {
+    size_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= (size_t)p[i] << (8 * i);
+    return v;
+}
+
+/* Compress and write the chunk collected so far. */
+static void hb_flush(HbWriter *w) {
+    if (w->failed || w->len == 0)
+        return;
+    size_t packed = lz_compress(w->raw, w->len, w->packed);
+    bool stored = packed >= w->len;
+    unsigned char header[HB_HEADER];
+    put_u32(header, w->len);
+    put_u32(header + 4, stored ? 0 : packed);
+    if (write_all(w->fd, (char *)header, sizeof(header)) < 0 ||
+        write_all(w->fd, stored ? w->raw : w->packed,
+                  stored ? w->len : packed) < 0)
+        w->failed = true;
+    w->len = 0;
+}
+
+static void hb_put(HbWriter *w, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0 && !w->failed) {
+        size_t n = HB_CHUNK - w->len;
+        if (n > len)
+            n = len;
+        memcpy(w->raw + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+        if (w->len == HB_CHUNK)
+            hb_flush(w);
+    }
+}
+
+static void hb_put_varint(HbWriter *w, uint64_t v) {
+    unsigned char buf[10];
+    size_t n = 0;
+    do {
+        buf[n] = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (v)
+            buf[n] |= 0x80;
+        n++;
+    } while (v);
+    hb_put(w, buf, n);
+}
+
+static void hb_put_text(HbWriter *w, const char *text, size_t len) {
+    hb_put_varint(w, len);
+    hb_put(w, text, len);
+}
+
+/* Read and expand the next chunk. */
+static int hb_refill(HbReader *r) {
+    unsigned char header[HB_HEADER];
+    if (read_all(r->fd, (char *)header, sizeof(header)) < 0)
+        return -1;
+    size_t len = get_u32(header);
+    size_t packed = get_u32(header + 4);
+    if (len == 0 || len > HB_CHUNK || packed > lz_bound(HB_CHUNK))
+        return -1;
+    if (packed == 0) {
+        if (read_all(r->fd, r->raw, len) < 0)
+            return -1;
+    } else if (read_all(r->fd, r->packed, packed) < 0 ||
+               lz_decompress(r->packed, packed, r->raw, len) < 0) {
+        return -1;
+    }
+    r->len = len;
+    r->pos = 0;
+    return 0;
+}
+
+/*
+ * Return the next LEN bytes of the stream, which stay valid until the
+ * next read, or NULL once the swap file turns out to be damaged.
+ */
+static const char *hb_get(HbReader *r, size_t len) {
+    if (r->failed)
+        return NULL;
+    if (r->len - r->pos >= len) {
+        const char *p = r->raw + r->pos;
+        r->pos += len;
+        return p;
+    }
+    if (len > r->scratch_cap) {
+        char *tmp = realloc(r->scratch, len);
+        if (!tmp) {
+            r->failed = true;
+            return NULL;
+        }
+        r->scratch = tmp;
+        r->scratch_cap = len;
+    }
+    size_t got = 0;
+    while (got < len) {
+        if (r->pos == r->len && hb_refill(r) < 0) {
+            r->failed = true;
+            return NULL;
+        }
+        size_t n = r->len - r->pos;
+        if (n > len - got)
+            n = len - got;
+        memcpy(r->scratch + got, r->raw + r->pos, n);
+        r->pos += n;
+        got += n;
+    }
+    return r->scratch;
+}
+
+static uint64_t hb_get_varint(HbReader *r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const unsigned char *b = (const unsigned char *)hb_get(r, 1);
+        if (!b)
+            return 0;
+        v |= (uint64_t)(*b & 0x7f) << shift;
+        if (!(*b & 0x80))
+            return v;
+    }
+    r->failed = true;
+    return 0;
+}
+
+static const char *hb_get_text(HbReader *r, size_t *len) {
+    *len = (size_t)hb_get_varint(r);
+    return hb_get(r, *len);
+}
+
+/*
+ * Line numbers of undo records are zigzag coded in case one is negative.
+ * The column of an in-line record follows its flags.
+ */
+static void hb_put_stack(HbWriter *w, Node *stack) {
+    uint64_t n = 0;
+    for (Node *node = stack; node; node = node->next)
+        n++;
+    hb_put_varint(w, n);
+    for (Node *node = stack; node; node = node->next) {
+        Change *c = &node->change;
+        uint64_t line = (uint64_t)c->line;
+        hb_put_varint(w, c->line < 0 ? ~(line << 1) : line << 1);
+        unsigned char flags = (c->old_text ? 1 : 0) | (c->new_text ? 2 : 0) |
+                              (c->in_line ? 4 : 0);
+        hb_put(w, &flags, 1);
+        if (c->in_line)
+            hb_put_varint(w, c->col);
+        if (c->old_text)
+            hb_put_text(w, c->old_text, pool_length(c->old_text));
+        if (c->new_text)
+            hb_put_text(w, c->new_text, pool_length(c->new_text));
+    }
+}
+
+static char *hb_get_pooled(HbReader *r) {
+    size_t len;
+    const char *text = hb_get_text(r, &len);
+    if (!text)
+        return NULL;
+    char *pooled = pool_intern(text, len);
+    if (!pooled)
+        r->failed = true;
+    return pooled;
+}
+
+/* Rebuild a stack in the order it was written. */
+static Node *hb_get_stack(HbReader *r) {
+    Node *stack = NULL;
+    Node **tail = &stack;
+    uint64_t n = hb_get_varint(r);
+    for (uint64_t i = 0; i < n && !r->failed; ++i) {
+        uint64_t zz = hb_get_varint(r);
+        const unsigned char *flags = (const unsigned char *)hb_get(r, 1);
+        if (!flags)
+            break;
+        unsigned char f = *flags;
+        Node *node = malloc(sizeof(*node));
+        if (!node) {
+            r->failed = true;
+            break;
+        }
+        node->change.line = (long)(zz & 1 ? ~(zz >> 1) : zz >> 1);
+        node->change.in_line = f & 4;
+        node->change.col = f & 4 ? (size_t)hb_get_varint(r) : 0;
+        node->change.old_text = f & 1 ? hb_get_pooled(r) : NULL;
+        node->change.new_text = f & 2 ? hb_get_pooled(r) : NULL;
+        node->next = NULL;
+        *tail = node;
+        tail = &node->next;
+    }
+    return stack;
+}
+
+/**
+ * Return true if FS may hibernate: its lines are all in the tree, it is
+ * neither being loaded, saved nor followed, and keys are not being read from
+ * its window. The caller makes sure FS is not the file being shown.
+ */
+bool hb_can_sleep(FileState *fs) {
+    LineBuffer *lb = &fs->buffer;
+    return !fs->swap && !fs->save && fs->text_win && fs->text_win != text_win &&
+           fs != active_file && fs->file_complete && !fs->fp &&
+           !fs->line_index && !fs->follow && lb->backend == LB_LINE_TREE &&
+           !lb->pages && !lb_map_pending(lb);
+}
+
+/**
+ * Write FS to a new swap file and free its lines, undo and redo history
+ * and window. Returns 0 on success or -1 if FS cannot hibernate or the
+ * swap file could not be written, in which case FS is left as it was.
+ */
+int hb_sleep(FileState *fs) {
+    static unsigned long seq;
+    if (!fs || !hb_can_sleep(fs))
+        return -1;
+    Swap *swap = malloc(sizeof(*swap));
+    HbWriter w = {-1, malloc(HB_CHUNK), 0, malloc(lz_bound(HB_CHUNK)), false};
+    if (!swap || !w.raw || !w.packed) {
+        free(swap);
+        free(w.raw);
+        free(w.packed);
+        return -1;
+    }
+
+    char dir[PATH_MAX - 64]; /* room for the file name */
+    get_swap_dir(dir, sizeof(dir));
+    mkdir(dir, 0700);
+    snprintf(swap->path, sizeof(swap->path), "%s/%ld-%lu.swp", dir,
+             (long)getpid(), ++seq);
+    w.fd = open(swap->path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (w.fd < 0)
+        w.failed = true;
+
+    LineBuffer *lb = &fs->buffer;
+    hb_put(&w, HB_MAGIC, HB_HEADER);
+    hb_put_varint(&w, (uint64_t)lb->count);
+    unsigned char share = lb->share_lines;
+    hb_put(&w, &share, 1);
+    for (long i = 0; i < lb->count && !w.failed; ++i) {
+        const char *text = lb_get(lb, i);
+        hb_put_text(&w, text ? text : "", text ? lb_length(lb, i) : 0);
+        unsigned char state = (unsigned char)(lb_state(lb, i) + 1);
+        hb_put(&w, &state, 1);
+    }
+    hb_put_stack(&w, fs->undo_stack);
+    hb_put_stack(&w, fs->redo_stack);
+    hb_flush(&w);
+    if (w.fd >= 0 && close(w.fd) < 0)
+        w.failed = true;
+    free(w.raw);
+    free(w.packed);
+    if (w.failed) {
+        if (w.fd >= 0)
+            unlink(swap->path);
+        free(swap);
+        return -1;
+    }
+
+    lb_free(lb);
+    lb_init(lb);
+    free_stack(fs->undo_stack);
+    fs->undo_stack = NULL;
+    free_stack(fs->redo_stack);
+    fs->redo_stack = NULL;
+    delwin(fs->text_win);
+    fs->text_win = NULL;
+    fs->swap = swap;
+    return 0;
+}
+
+/* Read the lines of a swap file into LB. */
+static void hb_get_lines(HbReader *r, LineBuffer *lb) {
+    const char *magic = hb_get(r, HB_HEADER);
+    if (!magic || memcmp(magic, HB_MAGIC, HB_HEADER) != 0) {
+        r->failed = true;
+        return;
+    }
+    uint64_t count = hb_get_varint(r);
+    const char *share = hb_get(r, 1);
+    if (!share)
+        return;
+    lb->share_lines = *share != 0;
+    for (uint64_t i = 0; i < count && !r->failed; ++i) {
+        size_t len;
+        const char *text = hb_get_text(r, &len);
+        if (!text)
+            break;
+        int rc = lb->share_lines
+                     ? lb_insert_shared(lb, lb->count, text, len)
+                     : lb_insert_bytes(lb, lb->count, text, len);
+        const char *state = hb_get(r, 1);
+        if (rc < 0 || !state) {
+            r->failed = true;
+            break;
+        }
+        if (*state)
+            lb_set_state(lb, lb->count - 1, (unsigned char)*state - 1);
+    }
+}
+
+/**
+ * Restore FS from its swap file and remove the file. Does nothing for a
+ * file that is not hibernated. Returns 0 on success or -1 if the swap
+ * file could not be read, in which case FS stays hibernated and the user
+ * is told.
+ */
+int hb_wake(FileState *fs) {
+    if (!fs || !fs->swap)
+        return 0;
+    HbReader r = {-1,   malloc(HB_CHUNK), 0, 0, malloc(lz_bound(HB_CHUNK)),
+                  NULL, 0,                false};
+    LineBuffer lb;
+    lb_init(&lb);
+    Node *undo_stack = NULL;
+    Node *redo_stack = NULL;
+    WINDOW *win = NULL;
+
+    r.fd = open(fs->swap->path, O_RDONLY);
+    if (r.fd < 0 || !r.raw || !r.packed)
+        r.failed = true;
+    hb_get_lines(&r, &lb);
+    if (!r.failed)
+        undo_stack = hb_get_stack(&r);
+    if (!r.failed)
+        redo_stack = hb_get_stack(&r);
+    if (!r.failed)
+        win = create_text_window();
+    if (r.fd >= 0)
+        close(r.fd);
+    free(r.raw);
+    free(r.packed);
+    free(r.scratch);
+    if (r.failed || !win) {
+        lb_free(&lb);
+        free_stack(undo_stack);
+        free_stack(redo_stack);
+        mvprintw(LINES - 2, 2, "Unable to restore %s from its swap file",
+                 fs->filename);
+        wnoutrefresh(stdscr);
+        return -1;
+    }
+
+    lb_free(&fs->buffer);
+    fs->buffer = lb;
+    fs->undo_stack = undo_stack;
+    fs->redo_stack = redo_stack;
+    fs->text_win = win;
+    if (COLS - 3 > fs->line_capacity)
+        fs->line_capacity = COLS - 3;
+    hb_discard(fs);
+    return 0;
+}
+
+/** Remove the swap file of FS, if it is hibernated, and forget it. */
+void hb_discard(FileState *fs) {
+    if (!fs || !fs->swap)
+        return;
+    unlink(fs->swap->path);
+    free(fs->swap);
+    fs->swap = NULL;
+}
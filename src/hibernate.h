@@ -0,0 +1,40 @@
+#ifndef HIBERNATE_H
+#define HIBERNATE_H
+
+#include <stdbool.h>
+
+/*
+ * Hibernation
+ * -----------
+ * Moves a file that is not being shown out of memory. hb_sleep() writes
+ * its lines, their syntax state and its undo and redo history to a swap
+ * file in the directory named by get_swap_dir(), then frees the buffer,
+ * the history and the window. Everything else about the file, such as
+ * its name, cursor, selection and modified flag, stays in the FileState.
+ * hb_wake() reads the swap file back and removes it; fm_switch() calls it
+ * when a hibernated file is shown again, so nothing else needs to know a
+ * file was asleep.
+ *
+ * The swap file is written in chunks of HB_CHUNK bytes compressed with
+ * lz_compress() (see lz.h), so a sleeping file costs a fraction of its
+ * size on disk and can be read back in a few milliseconds.
+ *
+ * Only buffers whose lines are all held by the tree can hibernate: files
+ * still being loaded, followed, paged, viewed in place or kept in a piece
+ * table are left alone, as their text lives in the file and the buffer is
+ * small already. A mapped file is woken with its lines on the heap.
+ */
+
+#define HB_CHUNK (256 * 1024) /* uncompressed bytes per swap file chunk */
+#define HB_CHECK_MS 10000     /* interval between checks for idle files */
+
+struct FileState;
+
+typedef struct Swap Swap;
+
+bool hb_can_sleep(struct FileState *fs);
+int hb_sleep(struct FileState *fs);
+int hb_wake(struct FileState *fs);
+void hb_discard(struct FileState *fs);
+
+#endif /* HIBERNATE_H */
@@ -8,6 +8,7 @@
 #include "editor.h"
 #include <ncurses.h>
 #include <wchar.h>
+#include "line_pool.h"
 #include "undo.h"
 #include <string.h>
 #include <stdlib.h>
@@ -134,13 +135,64 @@ void handle_key_left(EditorContext *ctx, FileState *fs) {
  * entry. Redraw only happens if scrolling occurs.
  */
 void handle_key_right(EditorContext *ctx, FileState *fs) {
-    const char *line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
-    if (line && fs->cursor_x < (int)strlen(line) + 1) {
+    long idx = fs->cursor_y - 1 + fs->start_line;
+    if (idx < fs->buffer.count &&
+        fs->cursor_x < (int)lb_length(&fs->buffer, idx) + 1) {
         fs->cursor_x++;
     }
     update_scroll_x(ctx, fs);
 }
 
+/*
+ * Remove the byte at column COL of line IDX and record the edit on the
+ * undo stack. Returns 0 on success or -1 on allocation failure.
+ */
+static int delete_char_at(FileState *fs, long idx, int col) {
+    char *removed = pool_intern(lb_get(&fs->buffer, idx) + col, 1);
+    if (!removed) {
+        allocation_failed("pool_intern failed");
+        return -1;
+    }
+    if (lb_delete_text(&fs->buffer, idx, col, 1) < 0) {
+        pool_release(removed);
+        allocation_failed("lb_delete_text failed");
+        return -1;
+    }
+    record_change(fs, (Change){ idx, removed, NULL, (size_t)col, true });
+    fs->modified = true;
+    return 0;
+}
+
+/*
+ * Append line IDX + 1 to line IDX and remove it, recording both changes
+ * on the undo stack. Only the joined line grows, and its record holds
+ * just the appended text. Returns 0 on success or -1 on allocation
+ * failure.
+ */
+static int join_with_next(FileState *fs, long idx) {
+    size_t len = lb_length(&fs->buffer, idx);
+    char *old_next = lb_share(&fs->buffer, idx + 1);
+    if (!old_next) {
+        allocation_failed("lb_share failed");
+        return -1;
+    }
+
+    if (lb_insert_text(&fs->buffer, idx, len, old_next,
+                       pool_length(old_next)) < 0) {
+        pool_release(old_next);
+        allocation_failed("lb_insert_text failed");
+        return -1;
+    }
+    /* An appended empty line changes nothing but the line count */
+    if (pool_length(old_next) > 0)
+        record_change(fs, (Change){ idx, NULL, pool_retain(old_next), len,
+                                    true });
+    record_change(fs, (Change){ idx + 1, old_next, NULL, 0, false });
+    fs->modified = true;
+    lb_delete(&fs->buffer, idx + 1);
+    return 0;
+}
+
 /*
  * Delete the character before the cursor or join the line with the
  * previous one when at column 1.
@@ -148,86 +200,30 @@ void handle_key_right(EditorContext *ctx, FileState *fs) {
  * ctx - active editor context used for redrawing
  * fs  - file being edited
  *
- * The buffer is modified but no undo entry is pushed. The cursor moves
+ * The buffer is modified and an undo entry is pushed. The cursor moves
  * left or up accordingly and the text window is redrawn. Comment state
  * is marked dirty for syntax highlighting.
  */
 void handle_key_backspace(EditorContext *ctx, FileState *fs) {
+    if (reject_edit(fs))
+        return;
     if (fs->cursor_x > 1) {
-        int idx = fs->cursor_y - 1 + fs->start_line;
-        char *line = fs->buffer.lines[idx];
-        char *old_text = strdup(line);
-        if (!old_text) {
-            allocation_failed("strdup failed");
-            return;
-        }
-
-        char *tmp = strdup(line);
-        if (!tmp) {
-            free(old_text);
-            allocation_failed("strdup failed");
-            return;
-        }
-        memmove(&tmp[fs->cursor_x - 2], &tmp[fs->cursor_x - 1],
-                strlen(tmp) - fs->cursor_x + 2);
-        char *new_text = strdup(tmp);
-        free(tmp);
-        if (!new_text) {
-            free(old_text);
-            allocation_failed("strdup failed");
+        long idx = fs->cursor_y - 1 + fs->start_line;
+        if (delete_char_at(fs, idx, fs->cursor_x - 2) < 0)
             return;
-        }
-        push(&fs->undo_stack, (Change){ idx, old_text, new_text });
-
         fs->cursor_x--;
-        memmove(&line[fs->cursor_x - 1], &line[fs->cursor_x],
-                strlen(line) - fs->cursor_x + 1);
     } else if (fs->cursor_y > 1 || fs->start_line > 0) {
-        int idx = fs->cursor_y - 1 + fs->start_line;
-        char *prev = fs->buffer.lines[idx - 1];
-        char *curr = fs->buffer.lines[idx];
-        size_t prev_len = strlen(prev);
-        if (prev_len + strlen(curr) < (size_t)fs->line_capacity) {
-            char *old_prev = strdup(prev);
-            char *old_curr = strdup(curr);
-            if (!old_prev || !old_curr) {
-                if (old_prev) free(old_prev);
-                if (old_curr) free(old_curr);
-                allocation_failed("strdup failed");
-                return;
-            }
-
-            char *tmp = malloc(fs->line_capacity);
-            if (!tmp) {
-                free(old_prev);
-                free(old_curr);
-                allocation_failed("malloc failed");
-                return;
-            }
-            strncpy(tmp, prev, fs->line_capacity - 1);
-            tmp[fs->line_capacity - 1] = '\0';
-            strncat(tmp, curr, fs->line_capacity - strlen(tmp) - 1);
-            char *new_prev = strdup(tmp);
-            free(tmp);
-            if (!new_prev) {
-                free(old_prev);
-                free(old_curr);
-                allocation_failed("strdup failed");
-                return;
-            }
-            push(&fs->undo_stack, (Change){ idx - 1, old_prev, new_prev });
-            push(&fs->undo_stack, (Change){ idx, old_curr, NULL });
-
-            strcat(prev, curr);
-            lb_delete(&fs->buffer, idx);
-            if (fs->cursor_y > 1) {
-                fs->cursor_y--;
-            } else {
-                fs->start_line--;
-                draw_text_buffer(ctx->active_file, text_win);
-            }
-            fs->cursor_x = prev_len + 1;
+        long idx = fs->cursor_y - 1 + fs->start_line;
+        size_t prev_len = lb_length(&fs->buffer, idx - 1);
+        if (join_with_next(fs, idx - 1) < 0)
+            return;
+        if (fs->cursor_y > 1) {
+            fs->cursor_y--;
+        } else {
+            fs->start_line--;
+            draw_text_buffer(ctx->active_file, text_win);
         }
+        fs->cursor_x = prev_len + 1;
     }
     werase(text_win);
     box(text_win, 0, 0);
@@ -242,91 +238,21 @@ void handle_key_backspace(EditorContext *ctx, FileState *fs) {
  * ctx - active editor context for redraw
  * fs  - file being edited
  *
- * The buffer content changes but no undo entry is pushed. After the
+ * The buffer content changes and an undo entry is pushed. After the
  * deletion the text window is redrawn and the syntax comment state is
  * marked dirty.
  */
 void handle_key_delete(EditorContext *ctx, FileState *fs) {
-    const char *line_curr = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
-    if (line_curr && fs->cursor_x < (int)strlen(line_curr)) {
-        int idx = fs->cursor_y - 1 + fs->start_line;
-        char *line = fs->buffer.lines[idx];
-        char *old_text = strdup(line);
-        if (!old_text) {
-            allocation_failed("strdup failed");
-            return;
-        }
-        char *tmp = strdup(line);
-        if (!tmp) {
-            free(old_text);
-            allocation_failed("strdup failed");
-            return;
-        }
-        memmove(&tmp[fs->cursor_x - 1], &tmp[fs->cursor_x],
-                strlen(tmp) - fs->cursor_x + 1);
-        char *new_text = strdup(tmp);
-        free(tmp);
-        if (!new_text) {
-            free(old_text);
-            allocation_failed("strdup failed");
+    if (reject_edit(fs))
+        return;
+    long idx = fs->cursor_y - 1 + fs->start_line;
+    if (idx < fs->buffer.count &&
+        fs->cursor_x < (int)lb_length(&fs->buffer, idx)) {
+        if (delete_char_at(fs, idx, fs->cursor_x - 1) < 0)
             return;
-        }
-        push(&fs->undo_stack, (Change){ idx, old_text, new_text });
-
-        memmove(&line[fs->cursor_x - 1], &line[fs->cursor_x],
-                strlen(line) - fs->cursor_x + 1);
     } else if (fs->cursor_y + fs->start_line < fs->buffer.count) {
-        int idx = fs->cursor_y - 1 + fs->start_line;
-        char *current = fs->buffer.lines[idx];
-        char *next = fs->buffer.lines[idx + 1];
-        size_t total_len = strlen(current) + strlen(next);
-
-        char *old_current = strdup(current);
-        char *old_next = strdup(next);
-        if (!old_current || !old_next) {
-            if (old_current) free(old_current);
-            if (old_next) free(old_next);
-            allocation_failed("strdup failed");
+        if (join_with_next(fs, idx) < 0)
             return;
-        }
-
-        char *tmp = malloc(fs->line_capacity);
-        if (!tmp) {
-            free(old_current);
-            free(old_next);
-            allocation_failed("malloc failed");
-            return;
-        }
-        strncpy(tmp, current, fs->line_capacity - 1);
-        tmp[fs->line_capacity - 1] = '\0';
-        if (total_len >= (size_t)fs->line_capacity) {
-            size_t space = fs->line_capacity - strlen(current) - 1;
-            if (space > 0)
-                strncat(tmp, next, space);
-            tmp[fs->line_capacity - 1] = '\0';
-        } else {
-            strncat(tmp, next, fs->line_capacity - strlen(tmp) - 1);
-        }
-        char *new_current = strdup(tmp);
-        free(tmp);
-        if (!new_current) {
-            free(old_current);
-            free(old_next);
-            allocation_failed("strdup failed");
-            return;
-        }
-        push(&fs->undo_stack, (Change){ idx, old_current, new_current });
-        push(&fs->undo_stack, (Change){ idx + 1, old_next, NULL });
-
-        if (total_len >= (size_t)fs->line_capacity) {
-            size_t space = fs->line_capacity - strlen(current) - 1;
-            if (space > 0)
-                strncat(current, next, space);
-            current[fs->line_capacity - 1] = '\0';
-        } else {
-            strcat(current, next);
-        }
-        lb_delete(&fs->buffer, idx + 1);
     }
     werase(text_win);
     box(text_win, 0, 0);
@@ -342,72 +268,72 @@ void handle_key_delete(EditorContext *ctx, FileState *fs) {
  * fs  - file being edited
  *
  * The text before the cursor becomes the old line while the remainder is
- * inserted as a new line. Two undo entries record the modification and
- * the insertion. The cursor is moved to the start of the new line and
- * the window is redrawn with comment state marked dirty.
+ * inserted as a new line. Two undo entries record the text removed from
+ * the old line, when there was any, and the insertion. The cursor is
+ * moved to the start of the new line and the window is redrawn with
+ * comment state marked dirty.
  */
 void handle_key_enter(EditorContext *ctx, FileState *fs) {
-    int line_idx = fs->cursor_y - 1 + fs->start_line;
-    char *line = fs->buffer.lines[line_idx];
-    char *old_text = strdup(line);
-    if (!old_text) {
-        allocation_failed("strdup failed");
+    if (reject_edit(fs))
+        return;
+    long line_idx = fs->cursor_y - 1 + fs->start_line;
+    const char *line = lb_get(&fs->buffer, line_idx);
+    size_t len = lb_length(&fs->buffer, line_idx);
+    size_t col = (size_t)(fs->cursor_x - 1);
+    if (col > len)
+        col = len;
+    /* The old line keeps a record of just the text split off it */
+    char *tail = col < len ? pool_intern(line + col, len - col) : NULL;
+    if (col < len && !tail) {
+        allocation_failed("pool_intern failed");
         return;
     }
 
     int indent_len = 0;
     while (line[indent_len] == ' ' || line[indent_len] == '\t')
         indent_len++;
-    char *indent = malloc(indent_len + 1);
-    if (!indent) {
-        free(old_text);
-        allocation_failed("malloc failed");
-        return;
-    }
-    strncpy(indent, line, indent_len);
-    indent[indent_len] = '\0';
 
-    char new_line_tmp[fs->line_capacity];
-    new_line_tmp[0] = '\0';
-    strncat(new_line_tmp, indent, fs->line_capacity - 1);
-
-    char *remainder = &line[fs->cursor_x - 1];
-    int remaining_indent = indent_len - (fs->cursor_x - 1);
+    const char *remainder = &line[col];
+    int remaining_indent = indent_len - (int)col;
     if (remaining_indent > 0)
         remainder += remaining_indent;
-    strncat(new_line_tmp, remainder, fs->line_capacity - strlen(new_line_tmp) - 1);
-
-    line[fs->cursor_x - 1] = '\0';
+    size_t remainder_len = len - (size_t)(remainder - line);
 
-    char *new_text = strdup(line);
-    if (!new_text) {
-        free(old_text);
-        free(indent);
-        allocation_failed("strdup failed");
+    /* The new line holds the indentation followed by the split-off text */
+    size_t new_len = indent_len + remainder_len;
+    char *joined = malloc(new_len + 1);
+    if (!joined) {
+        pool_release(tail);
+        allocation_failed("malloc failed");
         return;
     }
-    push(&fs->undo_stack, (Change){ line_idx, old_text, new_text });
-
-    if (lb_insert(&fs->buffer, line_idx + 1, new_line_tmp) < 0) {
-        free(old_text);
-        free(indent);
-        allocation_failed("lb_insert failed");
+    memcpy(joined, line, indent_len);
+    memcpy(joined + indent_len, remainder, remainder_len + 1);
+    char *new_line = pool_intern(joined, new_len);
+    free(joined);
+    if (!new_line) {
+        pool_release(tail);
+        allocation_failed("pool_intern failed");
         return;
     }
-    char *p = realloc(fs->buffer.lines[line_idx + 1], fs->line_capacity);
-    if (!p) {
-        allocation_failed("realloc failed");
+
+    if (lb_delete_text(&fs->buffer, line_idx, col, len - col) < 0) {
+        pool_release(tail);
+        pool_release(new_line);
+        allocation_failed("lb_delete_text failed");
         return;
     }
-    fs->buffer.lines[line_idx + 1] = p;
+    if (tail)
+        record_change(fs, (Change){ line_idx, tail, NULL, col, true });
 
-    char *insert_text = strdup(new_line_tmp);
-    if (!insert_text) {
-        free(indent);
-        allocation_failed("strdup failed");
+    if (lb_insert_shared(&fs->buffer, line_idx + 1, new_line, new_len) < 0) {
+        pool_release(new_line);
+        allocation_failed("lb_insert_shared failed");
         return;
     }
-    push(&fs->undo_stack, (Change){ line_idx + 1, NULL, insert_text });
+    /* The undo entry takes over the reference to new_line */
+    record_change(fs, (Change){ line_idx + 1, NULL, new_line, 0, false });
+    fs->modified = true;
 
     fs->cursor_x = indent_len + 1;
     if (fs->cursor_y >= LINES - 6) {
@@ -419,7 +345,6 @@ void handle_key_enter(EditorContext *ctx, FileState *fs) {
     box(text_win, 0, 0);
     draw_text_buffer(ctx->active_file, text_win);
     mark_comment_state_dirty(fs);
-    free(indent);
 }
 
 /*
@@ -512,8 +437,7 @@ void handle_ctrl_key_left(EditorContext *ctx, FileState *fs) {
 }
 
 void handle_ctrl_key_right(EditorContext *ctx, FileState *fs) {
-    const char *line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
-    fs->cursor_x = line ? strlen(line) + 1 : 1;
+    fs->cursor_x = lb_length(&fs->buffer, fs->cursor_y - 1 + fs->start_line) + 1;
     update_scroll_x(ctx, fs);
 }
 
@@ -541,60 +465,59 @@ void handle_key_home(EditorContext *ctx, FileState *fs) {
  * called to adjust the viewport. No undo entry is created.
  */
 void handle_key_end(EditorContext *ctx, FileState *fs) {
-    const char *line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
-    fs->cursor_x = line ? strlen(line) + 1 : 1;
+    fs->cursor_x = lb_length(&fs->buffer, fs->cursor_y - 1 + fs->start_line) + 1;
     update_scroll_x(ctx, fs);
 }
 
-void handle_tab_key(EditorContext *ctx, FileState *fs) {
-    int tabsize = app_config.tab_width > 0 ? app_config.tab_width : 4;
-    int inserted = 0;
+/*
+ * Insert LEN bytes of TEXT at the cursor on line IDX, record the edit on
+ * the undo stack and move the cursor past the inserted text. Only the
+ * inserted bytes are recorded, merged with the typing before them into a
+ * word. Returns 0 on success or -1 on allocation failure.
+ */
+static int insert_at_cursor(FileState *fs, long idx, const char *text, size_t len) {
+    size_t col = (size_t)(fs->cursor_x - 1);
+    size_t line_len = lb_length(&fs->buffer, idx);
+    if (col > line_len)
+        col = line_len;
+
+    char *inserted = pool_intern(text, len);
+    if (!inserted) {
+        allocation_failed("pool_intern failed");
+        return -1;
+    }
+    if (lb_insert_text(&fs->buffer, idx, col, text, len) < 0) {
+        pool_release(inserted);
+        allocation_failed("lb_insert_text failed");
+        return -1;
+    }
+    record_change(fs, (Change){ idx, NULL, inserted, col, true });
+    fs->modified = true;
+    fs->cursor_x = (int)(col + len) + 1;
+    return 0;
+}
 
-    if (fs->cursor_x >= fs->line_capacity - 1)
+void handle_tab_key(EditorContext *ctx, FileState *fs) {
+    if (reject_edit(fs))
         return;
+    int tabsize = app_config.tab_width > 0 ? app_config.tab_width : 4;
+    long idx = fs->cursor_y - 1 + fs->start_line;
 
-    char *old_text = strdup(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-    if (!old_text) {
-        allocation_failed("strdup failed");
+    char *spaces = malloc(tabsize);
+    if (!spaces) {
+        allocation_failed("malloc failed");
         return;
     }
+    memset(spaces, ' ', tabsize);
+    int res = insert_at_cursor(fs, idx, spaces, tabsize);
+    free(spaces);
+    if (res < 0)
+        return;
+    mark_comment_state_dirty(fs);
 
-    while (inserted < tabsize && fs->cursor_x < fs->line_capacity - 1) {
-        int len = strlen(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-        if (len > fs->line_capacity - 1)
-            len = fs->line_capacity - 1;
-
-        if (fs->cursor_x <= len) {
-            memmove(&fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x],
-                    &fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x - 1],
-                    len - fs->cursor_x + 1);
-        }
-
-        fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x - 1] = ' ';
-        if (len + 1 < fs->line_capacity)
-            fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][len + 1] = '\0';
-        fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->line_capacity - 1] = '\0';
-        fs->cursor_x++;
-        inserted++;
-    }
-
-    if (inserted > 0) {
-        char *new_text = strdup(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-        if (!new_text) {
-            free(old_text);
-            allocation_failed("strdup failed");
-            return;
-        }
-        Change change = { fs->cursor_y - 1 + fs->start_line, old_text, new_text };
-        push(&fs->undo_stack, change);
-        mark_comment_state_dirty(fs);
-
-        werase(text_win);
-        box(text_win, 0, 0);
-        draw_text_buffer(ctx->active_file, text_win);
-    } else {
-        free(old_text);
-    }
+    werase(text_win);
+    box(text_win, 0, 0);
+    draw_text_buffer(ctx->active_file, text_win);
 }
 
 void handle_default_key(EditorContext *ctx, FileState *fs, wint_t ch) {
@@ -608,39 +531,15 @@ void handle_default_key(EditorContext *ctx, FileState *fs, wint_t ch) {
     }
     if (ch >= KEY_MIN || !iswprint(ch))
         return; /* ignore non-printable or unmapped special keys */
+    if (reject_edit(fs))
+        return;
     char mb[MB_CUR_MAX];
     int mblen = wcrtomb(mb, ch, NULL);
     if (mblen <= 0)
         return;
-    int len = strlen(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-    if (len > fs->line_capacity - 1)
-        len = fs->line_capacity - 1;
-    if (len + mblen >= fs->line_capacity)
+    long idx = fs->cursor_y - 1 + fs->start_line;
+    if (insert_at_cursor(fs, idx, mb, mblen) < 0)
         return;
-    char *old_text = strdup(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-    if (!old_text) {
-        allocation_failed("strdup failed");
-        return;
-    }
-
-    if (fs->cursor_x - 1 <= len) {
-        memmove(&fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x - 1 + mblen],
-                &fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x - 1],
-                len - (fs->cursor_x - 1) + 1);
-    }
-
-    memcpy(&fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->cursor_x - 1], mb, mblen);
-    fs->buffer.lines[fs->cursor_y - 1 + fs->start_line][fs->line_capacity - 1] = '\0';
-    fs->cursor_x += mblen;
-
-    char *new_text = strdup(fs->buffer.lines[fs->cursor_y - 1 + fs->start_line]);
-    if (!new_text) {
-        free(old_text);
-        allocation_failed("strdup failed");
-        return;
-    }
-    Change change = { fs->cursor_y - 1 + fs->start_line, old_text, new_text };
-    push(&fs->undo_stack, change);
     mark_comment_state_dirty(fs);
 
     werase(text_win);
@@ -683,7 +582,7 @@ void move_forward_to_next_word(EditorContext *ctx, FileState *fs) {
         const char *line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
         if (!line)
             break;
-        int len = strlen(line);
+        int len = lb_length(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
         while (fs->cursor_x < len) {
             int idx = fs->cursor_x - 1;
             wchar_t wc;
@@ -723,7 +622,7 @@ void move_backward_to_previous_word(EditorContext *ctx, FileState *fs) {
         const char *line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
         if (!line)
             break;
-        int len = strlen(line);
+        int len = lb_length(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
         while (fs->cursor_x > 1) {
             int prev = prev_utf8_start(line, fs->cursor_x - 1);
             if (prev < 0)
@@ -754,8 +653,8 @@ void move_backward_to_previous_word(EditorContext *ctx, FileState *fs) {
         if (fs->cursor_y > 1 &&
             lb_get(&fs->buffer, fs->cursor_y - 2 + fs->start_line)) {
             fs->cursor_y--;
-            line = lb_get(&fs->buffer, fs->cursor_y - 1 + fs->start_line);
-            fs->cursor_x = line ? strlen(line) + 1 : 1;
+            fs->cursor_x = lb_length(&fs->buffer,
+                                     fs->cursor_y - 1 + fs->start_line) + 1;
         } else {
             fs->cursor_x = 1;
             break;
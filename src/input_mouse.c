@@ -44,8 +44,7 @@ void update_selection_mouse(EditorContext *ctx, FileState *fs, int x, int y) {
     werase(text_win);
     box(text_win, 0, 0);
     draw_text_buffer(fs, text_win);
-    wmove(text_win, fs->cursor_y,
-          fs->cursor_x + get_line_number_offset(fs));
+    wmove(text_win, fs->cursor_y, cursor_screen_x(fs));
     wrefresh(text_win);
 }
 
@@ -68,7 +67,7 @@ void handle_mouse_event(EditorContext *ctx, FileState *fs, MEVENT *ev) {
     int my = ev->y - 1; // account for window border
     int offset = get_line_number_offset(fs);
 
-    int x = mx - offset + 1;
+    int x = mx - offset + 1 + fs->scroll_x;
     int y = my + 1;
 
     if (x < 1)
@@ -0,0 +1,581 @@
+/*
+ * journal.c
+ * ---------
+ * Crash-recovery journals of unsaved edits. See journal.h for an overview.
+ * A journal is JN_MAGIC followed by records, each a type byte and its
+ * values, numbers as base-128 varints and text as a varint length and the
+ * bytes:
+ *
+ *   'F' size inode seconds nanoseconds  the file the changes apply to
+ *   'S'                                  a save took its snapshot here
+ *   'E' line text                        a line was replaced
+ *   'I' line text                        a line was inserted
+ *   'D' line                             a line was deleted
+ *   'T' line column removed text         REMOVED bytes at COLUMN of a line
+ *                                        were replaced by TEXT
+ *
+ * The first record is an 'F'. A save that finishes with no change made
+ * since it started removes the journal; one that raced with typing adds
+ * an 'F' for the saved file, which the changes after the last 'S' apply
+ * to. A crash may cut the last record short, and replay stops there.
+ */
+
+#include "journal.h"
+#include "config.h"
+#include "files.h"
+#include "line_buffer.h"
+#include "line_pool.h"
+#include "undo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JN_MAGIC "VENTOJN1"
+#define JN_MAGIC_LEN 8
+#define JN_ID 4 /* values naming a file in an 'F' record */
+
+struct Journal {
+    char path[PATH_MAX];
+    int fd;            /* -1 if the file is not journaled */
+    bool changed;      /* changes were recorded since the last save began */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; /* a batch is waiting, or the writer is stopping */
+    char *pending;     /* records the writer has not taken yet */
+    size_t len;
+    size_t cap;
+    bool failed;       /* records were lost, so the journal was removed */
+    bool stop;
+};
+
+typedef struct JnReader {
+    const char *p;
+    const char *end;
+} JnReader;
+
+typedef struct JnRecord {
+    char type;
+    uint64_t line;
+    uint64_t col;     /* 'T' records only */
+    uint64_t removed;
+    const char *text;
+    size_t len;
+    uint64_t id[JN_ID];
+} JnRecord;
+
+/*
+ * Build the path of the journal of FILENAME in BUF. Returns -1 if the
+ * path does not fit.
+ */
+static int jn_path(const char *filename, char *buf, size_t size) {
+    char dir[PATH_MAX];
+    get_swap_dir(dir, sizeof(dir));
+    size_t n = (size_t)snprintf(buf, size, "%s/", dir);
+    for (const char *p = filename; *p && n < size; ++p)
+        buf[n++] = *p == '/' ? '%' : *p;
+    if (n + sizeof(".jnl") > size)
+        return -1;
+    memcpy(buf + n, ".jnl", sizeof(".jnl"));
+    return 0;
+}
+
+/* Fill ID with what tells the file at PATH from any other, or zeros. */
+static void jn_identity(const char *path, uint64_t id[JN_ID]) {
+    struct stat st;
+    memset(id, 0, JN_ID * sizeof(*id));
+    if (stat(path, &st) < 0)
+        return;
+    id[0] = (uint64_t)st.st_size;
+    id[1] = (uint64_t)st.st_ino;
+    id[2] = (uint64_t)st.st_mtim.tv_sec;
+    id[3] = (uint64_t)st.st_mtim.tv_nsec;
+}
+
+/* Append LEN bytes to the records waiting for the writer. */
+static void jn_put(Journal *j, const void *data, size_t len) {
+    if (j->failed)
+        return;
+    if (j->len + len > j->cap) {
+        size_t cap = j->cap ? j->cap : 4096;
+        while (cap < j->len + len)
+            cap *= 2;
+        char *tmp = realloc(j->pending, cap);
+        if (!tmp) {
+            j->failed = true;
+            return;
+        }
+        j->pending = tmp;
+        j->cap = cap;
+    }
+    memcpy(j->pending + j->len, data, len);
+    j->len += len;
+}
+
+static void jn_put_varint(Journal *j, uint64_t v) {
+    unsigned char buf[10];
+    size_t n = 0;
+    do {
+        buf[n] = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (v)
+            buf[n] |= 0x80;
+        n++;
+    } while (v);
+    jn_put(j, buf, n);
+}
+
+/* Append an 'F' record naming ID. */
+static void jn_put_file(Journal *j, const uint64_t id[JN_ID]) {
+    jn_put(j, "F", 1);
+    for (int i = 0; i < JN_ID; ++i)
+        jn_put_varint(j, id[i]);
+}
+
+/* Append LEN bytes at BUF to FD and flush them to disk. */
+static bool jn_write(int fd, const char *buf, size_t len) {
+    if (len == 0)
+        return true;
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return fdatasync(fd) == 0;
+}
+
+/*
+ * Write what the editor has recorded every JN_SYNC_MS milliseconds, or
+ * once JN_BATCH bytes are waiting. The writer hands the editor an empty
+ * buffer for each batch it takes, so recording goes on while it writes.
+ */
+static void *jn_writer(void *arg) {
+    Journal *j = arg;
+    char *buf = NULL;
+    size_t cap = 0;
+    bool removed = false;
+    pthread_mutex_lock(&j->lock);
+    for (;;) {
+        if (!j->stop && j->len < JN_BATCH) {
+            struct timespec due;
+            clock_gettime(CLOCK_REALTIME, &due);
+            due.tv_nsec += JN_SYNC_MS * 1000000L;
+            due.tv_sec += due.tv_nsec / 1000000000L;
+            due.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&j->wake, &j->lock, &due);
+        }
+        char *out = j->pending;
+        size_t len = j->len;
+        size_t out_cap = j->cap;
+        j->pending = buf;
+        j->cap = cap;
+        j->len = 0;
+        buf = out;
+        cap = out_cap;
+        bool stop = j->stop;
+        bool failed = j->failed;
+        pthread_mutex_unlock(&j->lock);
+
+        bool written = failed || jn_write(j->fd, buf, len);
+
+        pthread_mutex_lock(&j->lock);
+        if (!written)
+            j->failed = true;
+        if (j->failed && !removed) {
+            /* A journal missing changes would replay the wrong text */
+            unlink(j->path);
+            removed = true;
+        }
+        if (stop)
+            break;
+    }
+    pthread_mutex_unlock(&j->lock);
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Start journaling FS, in a new journal naming the file, or in the one
+ * left behind when EXISTING is set. Returns NULL for a file without a
+ * name. A journal that cannot be created leaves FS unjournaled; a
+ * journal created while FS is being saved applies to the saved file, so
+ * it waits for jn_saved() to name it.
+ */
+static Journal *jn_open(FileState *fs, bool existing) {
+    if (!fs->filename[0])
+        return NULL;
+    Journal *j = calloc(1, sizeof(*j));
+    if (!j)
+        return NULL;
+    j->fd = -1;
+    fs->journal = j;
+
+    char dir[PATH_MAX];
+    get_swap_dir(dir, sizeof(dir));
+    mkdir(dir, 0700);
+    if (jn_path(fs->filename, j->path, sizeof(j->path)) < 0)
+        return j;
+    int flags = O_WRONLY | O_APPEND | (existing ? 0 : O_CREAT | O_EXCL);
+    int fd = open(j->path, flags, 0600);
+    if (fd < 0)
+        return j;
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    if (!existing) {
+        uint64_t id[JN_ID];
+        jn_identity(fs->filename, id);
+        if (fs->save)
+            id[0] = UINT64_MAX;
+        jn_put(j, JN_MAGIC, JN_MAGIC_LEN);
+        jn_put_file(j, id);
+        if (fs->save)
+            jn_put(j, "S", 1);
+    }
+    j->fd = fd;
+    if (j->failed || pthread_create(&j->thread, NULL, jn_writer, j) != 0) {
+        close(fd);
+        if (!existing)
+            unlink(j->path);
+        j->fd = -1;
+        pthread_cond_destroy(&j->wake);
+        pthread_mutex_destroy(&j->lock);
+    }
+    return j;
+}
+
+/**
+ * Journal CHANGE, just made to the buffer of FS (see editor.h): a line
+ * went from its old text to its new one, either of which is NULL for an
+ * insertion or a deletion, or for an in-line change bytes were replaced
+ * at a column. The first change creates the journal.
+ */
+void jn_record(FileState *fs, const Change *change) {
+    const char *old_text = change->old_text;
+    const char *new_text = change->new_text;
+    if (change->line < 0 || (!old_text && !new_text))
+        return;
+    Journal *j = fs->journal ? fs->journal : jn_open(fs, false);
+    if (!j || j->fd < 0)
+        return;
+    char type = change->in_line ? 'T' : !new_text ? 'D' : old_text ? 'E' : 'I';
+    pthread_mutex_lock(&j->lock);
+    jn_put(j, &type, 1);
+    jn_put_varint(j, (uint64_t)change->line);
+    if (change->in_line) {
+        jn_put_varint(j, change->col);
+        jn_put_varint(j, old_text ? pool_length(old_text) : 0);
+    }
+    if (new_text || change->in_line) {
+        size_t len = new_text ? pool_length(new_text) : 0;
+        jn_put_varint(j, len);
+        jn_put(j, new_text, len);
+    }
+    if (j->len >= JN_BATCH)
+        pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    j->changed = true;
+}
+
+/** Note that a snapshot of FS has been taken to be saved. */
+void jn_save_started(FileState *fs) {
+    Journal *j = fs->journal;
+    if (!j || j->fd < 0)
+        return;
+    pthread_mutex_lock(&j->lock);
+    jn_put(j, "S", 1);
+    pthread_mutex_unlock(&j->lock);
+    j->changed = false;
+}
+
+/**
+ * Note that the save begun with jn_save_started() has succeeded. The
+ * journal is removed if nothing changed since, and otherwise named after
+ * the file FS was saved as and told the changes since apply to it.
+ */
+void jn_saved(FileState *fs) {
+    Journal *j = fs->journal;
+    if (!j || j->fd < 0)
+        return;
+    if (!j->changed) {
+        jn_close(fs, false);
+        return;
+    }
+    char path[PATH_MAX];
+    uint64_t id[JN_ID];
+    jn_identity(fs->filename, id);
+    pthread_mutex_lock(&j->lock);
+    if (!j->failed && jn_path(fs->filename, path, sizeof(path)) == 0 &&
+        strcmp(path, j->path) != 0 && rename(j->path, path) == 0)
+        memcpy(j->path, path, sizeof(path));
+    jn_put_file(j, id);
+    pthread_mutex_unlock(&j->lock);
+}
+
+/**
+ * Return true if a journal was left behind for the file of FS. FS is then
+ * not journaled, so the journal stays as it is for jn_recover().
+ */
+bool jn_pending(FileState *fs) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (fs->journal || !fs->filename[0] ||
+        jn_path(fs->filename, path, sizeof(path)) < 0 || stat(path, &st) < 0)
+        return false;
+    Journal *j = calloc(1, sizeof(*j));
+    if (j) {
+        j->fd = -1;
+        fs->journal = j;
+    }
+    return true;
+}
+
+static bool jn_get_varint(JnReader *r, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char b = (unsigned char)*r->p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/* Read the next whole record into REC; false at the end of the journal. */
+static bool jn_next(JnReader *r, JnRecord *rec) {
+    if (r->p >= r->end)
+        return false;
+    rec->type = *r->p++;
+    switch (rec->type) {
+    case 'F':
+        for (int i = 0; i < JN_ID; ++i)
+            if (!jn_get_varint(r, &rec->id[i]))
+                return false;
+        return true;
+    case 'S':
+        return true;
+    case 'D':
+        return jn_get_varint(r, &rec->line);
+    case 'E':
+    case 'I':
+    case 'T': {
+        uint64_t len;
+        if (!jn_get_varint(r, &rec->line) ||
+            (rec->type == 'T' && (!jn_get_varint(r, &rec->col) ||
+                                  !jn_get_varint(r, &rec->removed))) ||
+            !jn_get_varint(r, &len) || len > (uint64_t)(r->end - r->p))
+            return false;
+        rec->text = r->p;
+        rec->len = (size_t)len;
+        r->p += len;
+        return true;
+    }
+    }
+    return false;
+}
+
+/*
+ * Return where the changes that apply to the file at PATH as it is now
+ * begin, or NULL with errno set to EINVAL if R is no journal and to ESTALE
+ * if none of its changes apply to the file.
+ */
+static const char *jn_find_start(JnReader *r, const char *path) {
+    if (r->end - r->p < JN_MAGIC_LEN ||
+        memcmp(r->p, JN_MAGIC, JN_MAGIC_LEN) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    r->p += JN_MAGIC_LEN;
+    uint64_t id[JN_ID];
+    jn_identity(path, id);
+    const char *start = NULL;
+    const char *snapshot = NULL;
+    bool named = false;
+    JnRecord rec;
+    while (jn_next(r, &rec)) {
+        if (rec.type == 'S') {
+            snapshot = r->p;
+        } else if (rec.type == 'F') {
+            named = true;
+            if (memcmp(rec.id, id, sizeof(id)) == 0)
+                start = snapshot ? snapshot : r->p;
+        }
+    }
+    if (!start)
+        errno = named ? ESTALE : EINVAL;
+    return start;
+}
+
+/*
+ * Apply the 'T' record REC to FS and push it onto its undo stack, merged
+ * with the keystrokes before it as when it was typed. Returns 0, or -1 if
+ * it does not fit the buffer.
+ */
+static int jn_replay_bytes(FileState *fs, const JnRecord *rec) {
+    LineBuffer *lb = &fs->buffer;
+    if (rec->line >= (uint64_t)lb->count)
+        return -1;
+    long line = (long)rec->line;
+    size_t len = lb_length(lb, line);
+    if (rec->col > len || rec->removed > len - rec->col)
+        return -1;
+    size_t col = (size_t)rec->col;
+    size_t removed = (size_t)rec->removed;
+    char *old_text = removed ? pool_intern(lb_get(lb, line) + col, removed)
+                             : NULL;
+    char *new_text = rec->len ? pool_intern(rec->text, rec->len) : NULL;
+    if ((removed && !old_text) || (rec->len && !new_text) ||
+        (removed && lb_delete_text(lb, line, col, removed) < 0) ||
+        (new_text && lb_insert_text(lb, line, col, new_text, rec->len) < 0)) {
+        pool_release(old_text);
+        pool_release(new_text);
+        return -1;
+    }
+    push_edit(&fs->undo_stack, (Change){ line, old_text, new_text, col, true });
+    return 0;
+}
+
+/*
+ * Apply the changes read from R to FS, each pushed onto its undo stack.
+ * Stops at a change that does not fit the buffer. Returns how many were
+ * applied.
+ */
+static long jn_replay(JnReader *r, FileState *fs) {
+    LineBuffer *lb = &fs->buffer;
+    long applied = 0;
+    JnRecord rec;
+    while (jn_next(r, &rec)) {
+        if (rec.type == 'S' || rec.type == 'F')
+            continue;
+        if (rec.type == 'T') {
+            if (jn_replay_bytes(fs, &rec) < 0)
+                break;
+            applied++;
+            continue;
+        }
+        if (rec.line > (uint64_t)lb->count ||
+            (rec.type != 'I' && rec.line == (uint64_t)lb->count))
+            break;
+        long line = (long)rec.line;
+        char *old_text = rec.type == 'I' ? NULL : lb_share(lb, line);
+        char *new_text = rec.type == 'D' ? NULL : pool_intern(rec.text, rec.len);
+        int rc = 0;
+        if ((rec.type != 'I' && !old_text) || (rec.type != 'D' && !new_text))
+            rc = -1;
+        else if (rec.type == 'E')
+            rc = lb_set_shared(lb, line, new_text, rec.len);
+        else if (rec.type == 'I')
+            rc = lb_insert_shared(lb, line, new_text, rec.len);
+        else
+            lb_delete(lb, line);
+        if (rc < 0) {
+            pool_release(old_text);
+            pool_release(new_text);
+            break;
+        }
+        push(&fs->undo_stack, (Change){ line, old_text, new_text, 0, false });
+        applied++;
+    }
+    return applied;
+}
+
+/* Read the file at PATH into memory, storing its size in *SIZE. */
+static char *jn_slurp(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    char *data = NULL;
+    size_t got = 0;
+    if (fstat(fd, &st) == 0 && (data = malloc((size_t)st.st_size + 1))) {
+        while (got < (size_t)st.st_size) {
+            ssize_t n = read(fd, data + got, (size_t)st.st_size - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            got += (size_t)n;
+        }
+    }
+    int err = errno;
+    close(fd);
+    errno = err;
+    *size = got;
+    return data;
+}
+
+/**
+ * Replay the journal left behind for the file of FS into its buffer,
+ * which is loaded to its end first, and go on journaling FS in it.
+ * Returns the number of changes replayed, which are on the undo stack
+ * and leave FS modified, or -1 with errno set: ENOENT if there is no
+ * journal, ESTALE if the file is no longer the one the journal applies
+ * to and EINVAL if the journal is damaged. A journal with no changes to
+ * replay is removed.
+ */
+long jn_recover(FileState *fs) {
+    char path[PATH_MAX];
+    if (fs->journal || !fs->filename[0] ||
+        jn_path(fs->filename, path, sizeof(path)) < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    size_t size;
+    char *data = jn_slurp(path, &size);
+    if (!data)
+        return -1;
+    JnReader r = {data, data + size};
+    const char *start = jn_find_start(&r, fs->filename);
+    long applied = -1;
+    if (start) {
+        if (file_streamed(fs))
+            resume_file(fs);
+        load_all_remaining_lines(fs);
+        r.p = start;
+        applied = jn_replay(&r, fs);
+    }
+    int err = errno;
+    free(data);
+    if (applied > 0) {
+        fs->modified = true;
+        jn_open(fs, true);
+    } else if (applied == 0) {
+        unlink(path);
+    }
+    errno = err;
+    return applied;
+}
+
+/**
+ * Stop journaling FS and remove its journal, once the writer is done
+ * with it, unless KEEP is set. A journal FS found and left alone is kept.
+ */
+void jn_close(FileState *fs, bool keep) {
+    Journal *j = fs->journal;
+    if (!j)
+        return;
+    fs->journal = NULL;
+    if (j->fd >= 0) {
+        pthread_mutex_lock(&j->lock);
+        j->stop = true;
+        pthread_cond_signal(&j->wake);
+        pthread_mutex_unlock(&j->lock);
+        pthread_join(j->thread, NULL);
+        close(j->fd);
+        if (!keep)
+            unlink(j->path);
+        pthread_cond_destroy(&j->wake);
+        pthread_mutex_destroy(&j->lock);
+    }
+    free(j->pending);
+    free(j);
+}
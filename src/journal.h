@@ -0,0 +1,46 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include "editor.h"
+
+/*
+ * Edit journal
+ * ------------
+ * Keeps the unsaved edits of a file safe from a crash of the editor or of
+ * the session it runs in. Every change recorded for undo (see undo.h) is
+ * also appended to a journal in the swap directory (see get_swap_dir()),
+ * named after the path of the file with each '/' turned into '%'. The
+ * first change to a file creates its journal, a save starts it afresh and
+ * closing the file, saved or not, removes it, so a journal left behind
+ * holds the edits of a file whose editor never closed it.
+ *
+ * The editor only copies each change into memory. A writer thread appends
+ * what has gathered and flushes it to disk every JN_SYNC_MS milliseconds,
+ * or as soon as JN_BATCH bytes are waiting, so one fdatasync() covers many
+ * keystrokes and typing never waits for the disk. A crash loses at most
+ * the changes of the last JN_SYNC_MS milliseconds.
+ *
+ * A journal names the size, inode and modification time of the file its
+ * changes apply to, which a save brings up to date. jn_recover(), run for
+ * `vento --recover`, checks the file is still that one and replays the
+ * changes into its buffer, leaving them to be reviewed, undone or saved.
+ * A file opened without --recover leaves a journal it finds alone and is
+ * not journaled itself, so the journal survives until it is recovered.
+ */
+
+#define JN_SYNC_MS 250         /* longest wait before changes reach disk */
+#define JN_BATCH (64 * 1024)   /* bytes of changes that are written at once */
+
+struct FileState;
+
+typedef struct Journal Journal;
+
+void jn_record(struct FileState *fs, const Change *change);
+void jn_save_started(struct FileState *fs);
+void jn_saved(struct FileState *fs);
+bool jn_pending(struct FileState *fs);
+long jn_recover(struct FileState *fs);
+void jn_close(struct FileState *fs, bool keep);
+
+#endif /* JOURNAL_H */
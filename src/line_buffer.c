@@ -1,165 +1,1945 @@
 /*
  * line_buffer.c
  * -------------
- * Implementation of the LineBuffer structure, a dynamic array of strings
- * used to hold the text contents of a file. Each entry in the array
- * represents one line. The helpers here manage allocation, resizing and
- * basic editing operations on that array.
+ * Implementation of the LineBuffer structure, the sequence of strings used
+ * to hold the text contents of a file. Each entry represents one line and
+ * is stored in a LineTree so edits anywhere in a large file stay cheap.
+ * The helpers here manage allocation and basic editing operations on the
+ * lines.
+ *
+ * The same API is also implemented on top of a PieceTable document. Lines
+ * are then separated by '\n' bytes inside the document and lb_get() copies
+ * the requested line into one of a few reusable view buffers. Read-only
+ * views of a file mapping hand out lines the same way.
  */
 
 #include "line_buffer.h"
+#include "piece_table.h"
+#include "line_tree.h"
+#include "line_index.h"
+#include "lz.h"
+#include "line_pool.h"
+#include "read_ahead.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define INITIAL_CAPACITY 16
+/* Allocation size recorded for a line whose text belongs to the line pool */
+#define SHARED_LINE ((size_t)-1)
 
-/**
- * Ensure the line buffer has at least MIN_CAPACITY slots.
- *
- * The function reallocates the internal array when needed and initialises
- * any newly created entries to NULL. On success the buffer's capacity is
- * updated. Returns 0 on success or -1 if memory allocation fails.
+/* Private state of a LineBuffer using the LB_PIECE_TABLE backend. */
+struct PieceLines {
+    PieceTable *pt;
+    char *views[LB_VIEW_SLOTS];      /* NUL terminated copies of lines */
+    size_t view_cap[LB_VIEW_SLOTS];
+    long view_line[LB_VIEW_SLOTS];   /* line held by each view or -1 */
+    int next_view;
+    long cached_line;                /* line whose start offset is cached */
+    size_t cached_start;
+};
+
+/* Private state of a LineBuffer using the LB_MAP_VIEW backend. */
+struct MapView {
+    LineIndex *li;                   /* start of every LI_STRIDE'th line */
+    int fd;                          /* the mapped file */
+    size_t size;                     /* bytes of the mapping still in the file */
+    char *views[LB_VIEW_SLOTS];      /* NUL terminated copies of lines */
+    size_t view_cap[LB_VIEW_SLOTS];
+    size_t view_len[LB_VIEW_SLOTS];
+    long view_line[LB_VIEW_SLOTS];   /* line held by each view or -1 */
+    int next_view;
+    long cached_line;                /* line whose start offset is cached */
+    size_t cached_start;
+};
+
+/* One page of a buffer loaded with lb_page_file() or lb_pack_file(). */
+struct LinePage {
+    off_t offset;       /* where the page's text starts in the file */
+    size_t bytes;       /* length of that text */
+    int lines;          /* lines currently in the page */
+    char *text;         /* text read from the file while resident */
+    char *packed;       /* compressed text of a packed buffer's page */
+    size_t packed_bytes;
+    bool resident;      /* the page's lines are in the tree */
+    bool dirty;         /* edited since it was read or packed */
+    unsigned long used; /* stamp of the most recent access */
+};
+
+/* Private state of a LineBuffer loaded with lb_page_file(). */
+struct LinePages {
+    int fd;                  /* the file, or -1 once a buffer is packed */
+    off_t size;              /* file size when it was opened */
+    struct LinePage *page;   /* every page in document order */
+    int n;
+    int cap;
+    long *all;               /* Fenwick sums of the lines in each page */
+    long *res;               /* the same, counting resident pages only */
+    int *live;               /* resident pages */
+    int n_live;
+    int clean;               /* resident pages that may be evicted */
+    unsigned long clock;
+    int errors;              /* page reads that failed */
+    ReadAhead *ahead;        /* background reader of upcoming pages */
+};
+
+/*
+ * The lines of a paged buffer are counted per page in two Fenwick trees
+ * (1-based arrays), one over all pages and one over resident pages only.
+ * The first maps a line number to its page, the second gives the position
+ * of a resident page's lines in the tree, both in O(log pages).
  */
-static int lb_grow(LineBuffer *lb, int min_capacity) {
-    int new_cap = lb->capacity ? lb->capacity * 2 : INITIAL_CAPACITY;
-    if (new_cap < min_capacity)
-        new_cap = min_capacity;
-    char **tmp = realloc(lb->lines, new_cap * sizeof(char *));
-    if (!tmp)
+static void fw_add(long *fw, int n, int i, long delta) {
+    for (i++; i <= n; i += i & -i)
+        fw[i] += delta;
+}
+
+/* Sum of entries [0, I) of FW. */
+static long fw_sum(const long *fw, int i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += fw[i];
+    return sum;
+}
+
+/* Make VALUE entry N of FW, which holds N entries so far. */
+static void fw_append(long *fw, int n, long value) {
+    int i = n + 1;
+    fw[i] = value + fw_sum(fw, n) - fw_sum(fw, i - (i & -i));
+}
+
+/*
+ * Return the entry of FW holding item *INDEX and make *INDEX relative to
+ * that entry. Entries holding no items are skipped.
+ */
+static int fw_find(const long *fw, int n, long *index) {
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= n)
+        step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && fw[pos + step] <= *index) {
+            pos += step;
+            *index -= fw[pos];
+        }
+    }
+    return pos;
+}
+
+/* Add a non-resident page of LINES lines stored at OFFSET. */
+static int lp_append(struct LinePages *lp, off_t offset, size_t bytes,
+                     int lines) {
+    if (lp->n == lp->cap) {
+        int cap = lp->cap ? lp->cap * 2 : 64;
+        struct LinePage *page = realloc(lp->page, cap * sizeof(*page));
+        if (!page)
+            return -1;
+        lp->page = page;
+        long *all = realloc(lp->all, (cap + 1) * sizeof(long));
+        if (!all)
+            return -1;
+        lp->all = all;
+        long *res = realloc(lp->res, (cap + 1) * sizeof(long));
+        if (!res)
+            return -1;
+        lp->res = res;
+        int *live = realloc(lp->live, cap * sizeof(int));
+        if (!live)
+            return -1;
+        lp->live = live;
+        lp->cap = cap;
+    }
+    struct LinePage *pg = &lp->page[lp->n];
+    memset(pg, 0, sizeof(*pg));
+    pg->offset = offset;
+    pg->bytes = bytes;
+    pg->lines = lines;
+    fw_append(lp->all, lp->n, lines);
+    fw_append(lp->res, lp->n, 0);
+    lp->n++;
+    return 0;
+}
+
+/* Record that page P gained DELTA lines. */
+static void lp_adjust(struct LinePages *lp, int p, int delta) {
+    lp->page[p].lines += delta;
+    fw_add(lp->all, lp->n, p, delta);
+    fw_add(lp->res, lp->n, p, delta);
+}
+
+/* Release TEXT, the storage of a line that was SIZE bytes large. */
+static void lb_drop(LineBuffer *lb, char *text, size_t size) {
+    if (size == SHARED_LINE) {
+        pool_release(text);
+        lb->shared--;
+    } else {
+        arena_free(&lb->arena, text, size);
+    }
+}
+
+/*
+ * Drop the lines of the page at position L of the live list. The page must
+ * be clean, or belong to a packed buffer and have just been packed.
+ */
+static void lp_evict(LineBuffer *lb, int l) {
+    struct LinePages *lp = lb->pages;
+    int p = lp->live[l];
+    struct LinePage *pg = &lp->page[p];
+    long base = fw_sum(lp->res, p);
+    size_t size;
+    for (int i = pg->lines; i-- > 0;) {
+        char *text = lt_remove(&lb->tree, base + i, &size);
+        lb_drop(lb, text, size);
+    }
+    fw_add(lp->res, lp->n, p, -pg->lines);
+    free(pg->text);
+    pg->text = NULL;
+    pg->resident = false;
+    lp->live[l] = lp->live[--lp->n_live];
+    if (!pg->dirty)
+        lp->clean--;
+    pg->dirty = false;
+}
+
+/*
+ * Compress the BYTES bytes at TEXT into a block of their own. The size of
+ * the block is stored in *PACKED. Returns NULL on allocation failure.
+ */
+static char *lp_compress(const char *text, size_t bytes, size_t *packed) {
+    char *buf = malloc(lz_bound(bytes));
+    if (!buf)
+        return NULL;
+    *packed = lz_compress(text, bytes, buf);
+    char *tmp = realloc(buf, *packed ? *packed : 1);
+    return tmp ? tmp : buf;
+}
+
+/*
+ * Replace the compressed text of resident page P of a packed buffer with
+ * its current lines, so it can be dropped like a clean page. Returns -1
+ * on allocation failure, leaving the page as it was.
+ */
+static int lp_pack(LineBuffer *lb, int p) {
+    struct LinePages *lp = lb->pages;
+    struct LinePage *pg = &lp->page[p];
+    long base = fw_sum(lp->res, p);
+    LineMeta meta;
+    size_t bytes = 0;
+    for (int i = 0; i < pg->lines; ++i) {
+        lt_slot(&lb->tree, base + i, &meta);
+        bytes += *meta.len + 1;
+    }
+    char *text = malloc(bytes ? bytes : 1);
+    if (!text)
+        return -1;
+    char *s = text;
+    for (int i = 0; i < pg->lines; ++i) {
+        char *line = *lt_slot(&lb->tree, base + i, &meta);
+        if (line)
+            memcpy(s, line, *meta.len);
+        s += *meta.len;
+        *s++ = '\n';
+    }
+    size_t packed_bytes;
+    char *packed = lp_compress(text, bytes, &packed_bytes);
+    free(text);
+    if (!packed)
+        return -1;
+    free(pg->packed);
+    pg->packed = packed;
+    pg->packed_bytes = packed_bytes;
+    pg->bytes = bytes;
+    return 0;
+}
+
+/*
+ * Read page P back from the file, or expand it for packed buffers, and
+ * insert its lines into the tree. A page the read-ahead worker has
+ * already read is taken from it instead. When LB_PAGE_BUDGET clean pages are
+ * already resident the least recently used one is evicted first; packed
+ * buffers keep LB_PACK_BUDGET pages of any kind and pack an edited page
+ * again before evicting it. Lines point into the page's text like mapped
+ * lines do, so they are copied into the arena by their first edit.
+ */
+static int lp_load(LineBuffer *lb, int p) {
+    struct LinePages *lp = lb->pages;
+    bool packed = lp->fd < 0;
+    if (packed ? lp->n_live >= LB_PACK_BUDGET : lp->clean >= LB_PAGE_BUDGET) {
+        int victim = -1;
+        for (int l = 0; l < lp->n_live; ++l) {
+            struct LinePage *c = &lp->page[lp->live[l]];
+            if ((packed || !c->dirty) &&
+                (victim < 0 || c->used < lp->page[lp->live[victim]].used))
+                victim = l;
+        }
+        if (victim >= 0 && (!lp->page[lp->live[victim]].dirty ||
+                            lp_pack(lb, lp->live[victim]) == 0))
+            lp_evict(lb, victim);
+    }
+
+    struct LinePage *pg = &lp->page[p];
+    char *text = packed ? NULL : ra_take(lp->ahead, pg->offset, pg->bytes);
+    size_t got = text || pg->packed ? pg->bytes : 0;
+    if (!text && !(text = malloc(pg->bytes + 1)))
+        return -1;
+    if (pg->packed &&
+        lz_decompress(pg->packed, pg->packed_bytes, text, pg->bytes) < 0)
+        got = 0;
+    while (!packed && got < pg->bytes) {
+        ssize_t n = pread(lp->fd, text + got, pg->bytes - got,
+                          pg->offset + (off_t)got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+    }
+    if (got < pg->bytes) {
+        /* The file shrank underneath us, or the page was damaged */
+        free(text);
+        return -1;
+    }
+    text[pg->bytes] = '\0';
+
+    long base = fw_sum(lp->res, p);
+    char *s = text;
+    char *end = text + pg->bytes;
+    for (int i = 0; i < pg->lines; ++i) {
+        char *nl = memchr(s, '\n', end - s);
+        char *next = end;
+        if (nl) {
+            *nl = '\0';
+            next = nl + 1;
+        } else {
+            nl = end;
+        }
+        if (lt_insert(&lb->tree, base + i, s, 0, nl - s) < 0) {
+            size_t size;
+            while (i-- > 0)
+                lt_remove(&lb->tree, base + i, &size);
+            free(text);
+            return -1;
+        }
+        s = next;
+    }
+    fw_add(lp->res, lp->n, p, pg->lines);
+    pg->text = text;
+    pg->resident = true;
+    lp->live[lp->n_live++] = p;
+    lp->clean++;
+    return 0;
+}
+
+/*
+ * Ask the read-ahead worker of a paged buffer for pages FIRST to LAST that
+ * are not in memory, starting it on first use. Packed buffers keep their
+ * pages in memory and read nothing.
+ */
+static void lp_ahead(struct LinePages *lp, int first, int last) {
+    if (lp->fd < 0)
+        return;
+    if (first < 0)
+        first = 0;
+    if (last >= lp->n)
+        last = lp->n - 1;
+    for (int p = first; p <= last; ++p) {
+        if (lp->page[p].resident)
+            continue;
+        if (!lp->ahead && !(lp->ahead = ra_start(lp->fd)))
+            return;
+        ra_request(lp->ahead, lp->page[p].offset, lp->page[p].bytes);
+    }
+}
+
+/*
+ * Translate line INDEX of a paged buffer into its position in the tree,
+ * reading its page in first. An INDEX equal to count refers to the end of
+ * the last page. A page about to be modified (WRITE) is pinned in memory.
+ * The page is stored in *PAGE. Returns -1 if the page cannot be read.
+ */
+static long lp_locate(LineBuffer *lb, long index, bool write, int *page) {
+    struct LinePages *lp = lb->pages;
+    if (lp->n == 0 && lp_append(lp, lp->size, 0, 0) < 0)
+        return -1;
+    long local = index;
+    int p;
+    if (index >= lb->count) {
+        p = lp->n - 1;
+        local = lp->page[p].lines;
+    } else {
+        p = fw_find(lp->all, lp->n, &local);
+    }
+    struct LinePage *pg = &lp->page[p];
+    if (!pg->resident) {
+        if (lp_load(lb, p) < 0) {
+            lp->errors++;
+            return -1;
+        }
+        lp_ahead(lp, p + 1, p + LB_AHEAD_PAGES);
+    }
+    pg->used = ++lp->clock;
+    if (write && !pg->dirty) {
+        pg->dirty = true;
+        lp->clean--;
+    }
+    *page = p;
+    return fw_sum(lp->res, p) + local;
+}
+
+/*
+ * Return the tree slot of line INDEX and point META, when not NULL, at its
+ * metadata, reading its page in first for paged buffers. WRITE marks the
+ * line as about to be modified. Returns NULL if the line's page cannot be
+ * read.
+ */
+static char **lb_slot(LineBuffer *lb, long index, LineMeta *meta, bool write) {
+    if (lb->pages) {
+        int page;
+        index = lp_locate(lb, index, write, &page);
+        if (index < 0)
+            return NULL;
+    }
+    return lt_slot(&lb->tree, index, meta);
+}
+
+/*
+ * Copy LEN bytes of TEXT into line INDEX, growing its allocation when it is
+ * too small. Storing an empty string releases the line's block. TEXT must
+ * not point into the line itself.
+ */
+static int lb_store(LineBuffer *lb, long index, const char *text, size_t len) {
+    LineMeta meta;
+    if (len == 0) {
+        char **slot = lb_slot(lb, index, &meta, true);
+        if (!slot)
+            return -1;
+        lb_drop(lb, *slot, *meta.size);
+        *slot = NULL;
+        *meta.size = 0;
+    } else {
+        if (lb_reserve(lb, index, len + 1) < 0)
+            return -1;
+        char *line = *lb_slot(lb, index, &meta, true);
+        memcpy(line, text, len);
+        line[len] = '\0';
+    }
+    *meta.len = len;
+    *meta.hash = 0;
+    return 0;
+}
+
+/* Forget every cached view after the piece table has been modified. */
+static void pl_invalidate(struct PieceLines *pl) {
+    for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+        pl->view_line[i] = -1;
+    pl->cached_line = -1;
+}
+
+/*
+ * Locate line INDEX inside the piece table. *START receives its byte
+ * offset and *LEN its length without the separating newline. Consecutive
+ * lookups of increasing lines reuse the previously computed offset.
+ */
+static void pl_extent(LineBuffer *lb, long index, size_t *start, size_t *len) {
+    struct PieceLines *pl = lb->pieces;
+    size_t s = pl->cached_line == index ? pl->cached_start
+                                        : pt_line_start(pl->pt, index);
+    size_t next = index + 1 < lb->count ? pt_line_start(pl->pt, index + 1)
+                                        : pt_length(pl->pt) + 1;
+    *start = s;
+    *len = next - 1 - s;
+    pl->cached_line = index + 1;
+    pl->cached_start = next;
+}
+
+static const char *pl_get(LineBuffer *lb, long index) {
+    struct PieceLines *pl = lb->pieces;
+    for (int i = 0; i < LB_VIEW_SLOTS; ++i) {
+        if (pl->view_line[i] == index)
+            return pl->views[i];
+    }
+    int slot = pl->next_view;
+    pl->next_view = (slot + 1) % LB_VIEW_SLOTS;
+
+    size_t start, len;
+    pl_extent(lb, index, &start, &len);
+    if (pl->view_cap[slot] < len + 1) {
+        char *tmp = realloc(pl->views[slot], len + 1);
+        if (!tmp)
+            return NULL;
+        pl->views[slot] = tmp;
+        pl->view_cap[slot] = len + 1;
+    }
+    pt_copy(pl->pt, start, len, pl->views[slot]);
+    pl->views[slot][len] = '\0';
+    pl->view_line[slot] = index;
+    return pl->views[slot];
+}
+
+static int pl_insert(LineBuffer *lb, long index, const char *line,
+                     size_t len) {
+    struct PieceLines *pl = lb->pieces;
+    size_t offset;
+    size_t pad = 0;   /* newlines placed before LINE */
+    size_t trail = 0; /* newline placed after LINE */
+
+    if (lb->count == 0) {
+        offset = 0;
+        pad = index;
+    } else if (index >= lb->count) {
+        offset = pt_length(pl->pt);
+        pad = index - lb->count + 1;
+    } else {
+        offset = pt_line_start(pl->pt, index);
+        trail = 1;
+    }
+
+    char *text = malloc(pad + len + trail + 1);
+    if (!text)
+        return -1;
+    memset(text, '\n', pad);
+    memcpy(text + pad, line, len);
+    if (trail)
+        text[pad + len] = '\n';
+    int res = pt_insert(pl->pt, offset, text, pad + len + trail);
+    free(text);
+    if (res < 0)
+        return -1;
+    pl_invalidate(pl);
+    lb->count = lb->count < index + 1 ? index + 1 : lb->count + 1;
+    return 0;
+}
+
+static int pl_delete(LineBuffer *lb, long index) {
+    struct PieceLines *pl = lb->pieces;
+    size_t start, len;
+    pl_extent(lb, index, &start, &len);
+    if (lb->count == 1) {
+        /* keep start/len: the whole document */
+    } else if (index == lb->count - 1) {
+        start--;  /* remove the newline preceding the last line */
+        len++;
+    } else {
+        len++;    /* remove the line together with its newline */
+    }
+    if (pt_delete(pl->pt, start, len) < 0)
         return -1;
-    lb->lines = tmp;
-    for (int i = lb->capacity; i < new_cap; ++i)
-        lb->lines[i] = NULL;
-    lb->capacity = new_cap;
+    pl_invalidate(pl);
+    lb->count--;
     return 0;
 }
 
+static int pl_set(LineBuffer *lb, long index, const char *line,
+                  size_t len) {
+    struct PieceLines *pl = lb->pieces;
+    size_t start, old_len;
+    pl_extent(lb, index, &start, &old_len);
+    pl_invalidate(pl);
+    if (pt_delete(pl->pt, start, old_len) < 0)
+        return -1;
+    return pt_insert(pl->pt, start, line, len);
+}
+
+/* Forget every view of a view buffer and the cached line offset. */
+static void mv_invalidate(struct MapView *mv) {
+    for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+        mv->view_line[i] = -1;
+    mv->cached_line = -1;
+}
+
+/*
+ * Locate line INDEX of a view buffer in the mapping. The scan for its
+ * start begins at the closest indexed line, or at the line located last
+ * when that is closer, so walking down the file costs one memchr() per
+ * line. *START receives the line's offset and *LEN its length without
+ * the newline.
+ */
+static void mv_extent(LineBuffer *lb, long index, size_t *start, size_t *len) {
+    struct MapView *mv = lb->view;
+    if (!lb->map) {
+        *start = *len = 0;
+        return;
+    }
+    off_t offset;
+    long line = li_offset(mv->li, index, &offset);
+    size_t pos = (size_t)offset;
+    if (mv->cached_line <= index && mv->cached_line > line) {
+        line = mv->cached_line;
+        pos = mv->cached_start;
+    }
+    const char *end = lb->map + mv->size;
+    const char *p = lb->map + (pos < mv->size ? pos : mv->size);
+    for (; line < index && p < end; ++line) {
+        const char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+    const char *nl = memchr(p, '\n', end - p);
+    *start = p - lb->map;
+    *len = (nl ? nl : end) - p;
+    mv->cached_line = index;
+    mv->cached_start = *start;
+}
+
+static const char *mv_get(LineBuffer *lb, long index) {
+    struct MapView *mv = lb->view;
+    for (int i = 0; i < LB_VIEW_SLOTS; ++i) {
+        if (mv->view_line[i] == index)
+            return mv->views[i];
+    }
+    int slot = mv->next_view;
+    mv->next_view = (slot + 1) % LB_VIEW_SLOTS;
+
+    size_t start, len;
+    mv_extent(lb, index, &start, &len);
+    if (mv->view_cap[slot] < len + 1) {
+        char *tmp = realloc(mv->views[slot], len + 1);
+        if (!tmp)
+            return NULL;
+        mv->views[slot] = tmp;
+        mv->view_cap[slot] = len + 1;
+    }
+    memcpy(mv->views[slot], lb->map + start, len);
+    mv->views[slot][len] = '\0';
+    mv->view_len[slot] = len;
+    mv->view_line[slot] = index;
+    return mv->views[slot];
+}
+
+static size_t mv_length(LineBuffer *lb, long index) {
+    struct MapView *mv = lb->view;
+    for (int i = 0; i < LB_VIEW_SLOTS; ++i) {
+        if (mv->view_line[i] == index)
+            return mv->view_len[i];
+    }
+    size_t start, len;
+    mv_extent(lb, index, &start, &len);
+    return len;
+}
+
 /**
- * Allocate and initialise a new LineBuffer.
+ * Allocate and initialise a new, empty LineBuffer.
  *
- * If INITIAL_CAPACITY is non-positive a default value is used. The returned
- * buffer owns its internal memory and should be released with lb_free().
- * Returns NULL on allocation failure.
+ * The returned buffer owns its internal memory and should be released with
+ * lb_free() followed by free(). Returns NULL on allocation failure.
  */
-LineBuffer *lb_create(int initial_capacity) {
+LineBuffer *lb_create(void) {
     LineBuffer *lb = malloc(sizeof(LineBuffer));
     if (!lb)
         return NULL;
-    lb_init(lb, initial_capacity);
-    if (!lb->lines) {
-        free(lb);
-        return NULL;
-    }
+    lb_init(lb);
     return lb;
 }
 
 /**
- * Initialise an existing LineBuffer structure.
+ * Initialise an existing LineBuffer structure as an empty line tree.
  *
- * Memory for the line array is allocated using calloc so all slots start as
- * NULL. The count is reset to zero and capacity reflects the number of
- * allocated slots. A non-positive INITIAL_CAPACITY falls back to the default.
+ * No memory is allocated until the first line is inserted.
  */
-void lb_init(LineBuffer *lb, int initial_capacity) {
+void lb_init(LineBuffer *lb) {
     if (!lb)
         return;
-    if (initial_capacity <= 0)
-        initial_capacity = INITIAL_CAPACITY;
-    lb->lines = calloc(initial_capacity, sizeof(char *));
-    if (!lb->lines) {
+    lb->backend = LB_LINE_TREE;
+    lb->pieces = NULL;
+    lb->view = NULL;
+    lb->count = 0;
+    lt_init(&lb->tree);
+    arena_init(&lb->arena);
+    lb->map = NULL;
+    lb->map_len = 0;
+    lb->map_pos = 0;
+    lb->map_end = 0;
+    lb->map_lines = 0;
+    lb->map_fd = -1;
+    lb->share_lines = false;
+    lb->shared = 0;
+    lb->pages = NULL;
+}
+
+/**
+ * Switch LB to a piece-table document loaded from PATH.
+ *
+ * Any existing contents are released first. The file is opened with
+ * pt_open() so no per-line allocations are made; a single trailing newline
+ * terminates the last line rather than starting a new one. A NULL PATH
+ * creates an empty document holding one blank line. Returns 0 on success
+ * or -1 if the file cannot be read, leaving LB empty but usable.
+ */
+int lb_init_piece_table(LineBuffer *lb, const char *path) {
+    if (!lb)
+        return -1;
+    lb_free(lb);
+
+    struct PieceLines *pl = calloc(1, sizeof(struct PieceLines));
+    if (!pl)
+        return -1;
+    pl->pt = path ? pt_open(path) : pt_create();
+    if (!pl->pt) {
+        free(pl);
+        return -1;
+    }
+    pl_invalidate(pl);
+    lb->pieces = pl;
+    lb->backend = LB_PIECE_TABLE;
+
+    size_t len = pt_length(pl->pt);
+    if (!path) {
+        lb->count = 1;
+    } else if (len == 0) {
         lb->count = 0;
-        lb->capacity = 0;
+    } else {
+        char last;
+        pt_copy(pl->pt, len - 1, 1, &last);
+        if (last == '\n' && pt_delete(pl->pt, len - 1, 1) < 0) {
+            lb_free(lb);
+            return -1;
+        }
+        lb->count = (long)pt_newlines(pl->pt) + 1;
+    }
+    return 0;
+}
+
+/*
+ * Append LEN bytes of TEXT as a new last line owned by the arena. Used for
+ * a final line that has no newline byte to turn into its terminator.
+ */
+static int lb_append_copy(LineBuffer *lb, const char *text, size_t len) {
+    size_t size;
+    char *copy = arena_alloc(&lb->arena, len + 1, &size);
+    if (!copy)
+        return -1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    if (lt_insert(&lb->tree, lb->count, copy, size, len) < 0) {
+        arena_free(&lb->arena, copy, size);
+        return -1;
+    }
+    lb->count++;
+    return 0;
+}
+
+/**
+ * Replace the contents of LB with an empty buffer backed by a private
+ * mapping of the regular file at PATH. No lines are created yet: they are
+ * split off the front of the mapping by lb_map_lines(), so opening a file
+ * costs the same no matter how large it is. The file stays open until the
+ * whole mapping has been split.
+ *
+ * Only tree buffers are supported. Returns 0 on success or -1 if PATH is
+ * not a regular file or cannot be mapped, leaving LB empty so the caller
+ * can fall back to reading it with stdio.
+ */
+int lb_map_file(LineBuffer *lb, const char *path) {
+    if (!lb || !path || lb->backend != LB_LINE_TREE)
+        return -1;
+    /* Opening a FIFO would wait for, and then lose, its writer */
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    lb_free(lb);
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    lb->map = map;
+    lb->map_len = size;
+    lb->map_end = size;
+    lb->map_fd = fd;
+    return 0;
+}
+
+/**
+ * Append up to MAX further lines of the mapped file to LB.
+ *
+ * The mapping is scanned with memchr(); every newline is overwritten with
+ * a terminator so each line can be referenced in place without allocating
+ * or copying it. Writing the terminators gives the process its own copy of
+ * each page, and pages holding no newline are touched as well, so lines
+ * already split off never depend on the file staying unchanged on disk.
+ * Lines are copied into the arena by their first edit. If the file has
+ * shrunk since it was mapped, splitting stops at its new end, as reading
+ * the mapping beyond it would fault.
+ *
+ * When share_lines is set the lines are stored in the line pool instead
+ * (see lb_insert_shared()), so the mapping is only read and is released
+ * as soon as it has been split completely.
+ *
+ * Returns the number of lines added or -1 on allocation failure, in which
+ * case the lines added so far are kept.
+ */
+long lb_map_lines(LineBuffer *lb, long max) {
+    if (!lb_map_pending(lb))
+        return 0;
+    struct stat st;
+    if (fstat(lb->map_fd, &st) == 0 && (size_t)st.st_size < lb->map_end)
+        lb->map_end = (size_t)st.st_size > lb->map_pos ? (size_t)st.st_size
+                                                       : lb->map_pos;
+    char *start = lb->map + lb->map_pos;
+    char *p = start;
+    char *end = lb->map + lb->map_end;
+    long added = 0;
+    while (p < end && added < max) {
+        char *nl = memchr(p, '\n', end - p);
+        int res;
+        if (lb->share_lines) {
+            size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+            res = lb_insert_shared(lb, lb->count, p, len);
+            nl = nl ? nl : end - 1;
+        } else if (nl) {
+            *nl = '\0';
+            res = lt_insert(&lb->tree, lb->count, p, 0, nl - p);
+            if (res == 0)
+                lb->count++;
+            else
+                *nl = '\n';
+        } else {
+            res = lb_append_copy(lb, p, end - p);
+            nl = end - 1;
+        }
+        if (res < 0)
+            break;
+        p = nl + 1;
+        added++;
+    }
+    lb->map_pos = p - lb->map;
+    lb->map_lines += added;
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0)
+        page = 4096;
+    size_t off = (size_t)(start - lb->map) / (size_t)page * (size_t)page;
+    for (; !lb->share_lines && off < lb->map_pos; off += (size_t)page) {
+        volatile char *byte = lb->map + off;
+        *byte = *byte;
+    }
+    if (lb->map_pos == lb->map_end) {
+        posix_madvise(lb->map, lb->map_len, POSIX_MADV_NORMAL);
+        close(lb->map_fd);
+        lb->map_fd = -1;
+        if (lb->share_lines) {
+            /* No line points into the mapping */
+            munmap(lb->map, lb->map_len);
+            lb->map = NULL;
+            lb->map_len = 0;
+        }
+    }
+    return added < max && p < end ? -1 : added;
+}
+
+/** Return true while part of the mapped file has not been split into lines. */
+bool lb_map_pending(const LineBuffer *lb) {
+    return lb->map_pos < lb->map_end;
+}
+
+/**
+ * Replace the contents of LB with all lines of the regular file at PATH,
+ * using lb_map_file() and lb_map_lines(). Returns 0 on success or -1 on
+ * failure, leaving LB empty.
+ */
+int lb_load_mapped(LineBuffer *lb, const char *path) {
+    if (lb_map_file(lb, path) < 0)
+        return -1;
+    if (lb_map_lines(lb, INT_MAX) < 0) {
+        lb_free(lb);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Replace the contents of LB with an empty paged view of the regular file
+ * at PATH. Lines are described page by page with lb_page_sync() as a
+ * LineIndex covers the file and are only read when they are accessed.
+ *
+ * Only tree buffers are supported. Returns 0 on success or -1 if PATH is
+ * not a regular file, leaving LB untouched.
+ */
+int lb_page_file(LineBuffer *lb, const char *path) {
+    if (!lb || !path || lb->backend != LB_LINE_TREE)
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    struct LinePages *lp = NULL;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !(lp = calloc(1, sizeof(*lp)))) {
+        close(fd);
+        return -1;
+    }
+    lb_free(lb);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    lp->fd = fd;
+    lp->size = st.st_size;
+    lb->pages = lp;
+    return 0;
+}
+
+/**
+ * Add the pages of a paged buffer that LI has indexed since the last call.
+ * Every page spans LI_STRIDE lines of the file except the last one, which
+ * is added once the index is complete and ends where the index does.
+ *
+ * Returns 1 once the whole file is described, 0 while the index is still
+ * running or -1 on allocation failure.
+ */
+int lb_page_sync(LineBuffer *lb, LineIndex *li) {
+    struct LinePages *lp = lb->pages;
+    bool complete;
+    long total = li_lines(li, &complete);
+    for (;;) {
+        long first = (long)lp->n * LI_STRIDE;
+        off_t start;
+        off_t end;
+        int lines;
+        if (complete && first >= total)
+            return 1;
+        if (li_offset(li, first, &start) != first)
+            return 0;
+        if (li_offset(li, first + LI_STRIDE, &end) == first + LI_STRIDE) {
+            lines = LI_STRIDE;
+        } else if (complete) {
+            end = lp->size = li_size(li);
+            lines = total - first;
+        } else {
+            return 0;
+        }
+        if (lp_append(lp, start, (size_t)(end - start), lines) < 0)
+            return -1;
+        lb->count += lines;
+    }
+}
+
+/**
+ * Replace the contents of LB with a read-only view of the regular file at
+ * PATH. The file is mapped read-only and a LineIndex starts counting its
+ * lines in the background; lb_view_sync() takes them on as they are found.
+ * Lines are only ever copied into a few temporary views, so the buffer
+ * costs the same however large the file is, and the mapped pages belong
+ * to the page cache rather than to the editor.
+ *
+ * Only tree buffers are supported. Returns 0 on success or -1 if PATH is
+ * not a regular file or cannot be mapped, leaving LB untouched.
+ */
+int lb_view_file(LineBuffer *lb, const char *path) {
+    if (!lb || !path || lb->backend != LB_LINE_TREE)
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    struct MapView *mv = NULL;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !(mv = calloc(1, sizeof(*mv)))) {
+        close(fd);
+        return -1;
+    }
+    if (!(mv->li = li_start(path))) {
+        free(mv);
+        close(fd);
+        return -1;
+    }
+    /* Map exactly what the index will cover so lb_view_append() can go on
+     * from its end. */
+    size_t size = (size_t)li_size(mv->li);
+    char *map = NULL;
+    if (size > 0 &&
+        (map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        li_free(mv->li);
+        free(mv);
+        close(fd);
+        return -1;
+    }
+    lb_free(lb);
+    mv->fd = fd;
+    mv->size = size;
+    mv_invalidate(mv);
+    lb->map = map;
+    lb->map_len = size;
+    lb->view = mv;
+    lb->backend = LB_MAP_VIEW;
+    return 0;
+}
+
+/**
+ * Add the lines that the index of view buffer LB has found since the last
+ * call. The file is expected to stay as it is while it is viewed; if it
+ * has shrunk, only the part still in the file is read and lines beyond
+ * its new end appear empty.
+ *
+ * Returns 1 once the whole file is indexed or 0 while the index is still
+ * running.
+ */
+int lb_view_sync(LineBuffer *lb) {
+    struct MapView *mv = lb->view;
+    struct stat st;
+    if (fstat(mv->fd, &st) == 0 && (size_t)st.st_size < mv->size) {
+        mv->size = (size_t)st.st_size;
+        mv_invalidate(mv);
+    }
+    bool complete;
+    long lines = li_lines(mv->li, &complete);
+    if (lines > lb->count)
+        lb->count = lines;
+    return complete ? 1 : 0;
+}
+
+/**
+ * Take on the bytes appended to the file of view buffer LB since it was
+ * indexed. Once the index is complete the file is mapped again at its new
+ * size and only the new bytes are scanned for lines, so the cost follows
+ * the size of the addition rather than of the file.
+ *
+ * Returns 1 if lines were added, 0 if there was nothing to add yet or -1
+ * if the file could not be mapped again, leaving LB as it was.
+ */
+int lb_view_append(LineBuffer *lb) {
+    struct MapView *mv = lb->view;
+    struct stat st;
+    if (lb_view_sync(lb) != 1 || fstat(mv->fd, &st) < 0 ||
+        (size_t)st.st_size <= mv->size)
+        return 0;
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, mv->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    if (li_extend(mv->li, map + mv->size, size - mv->size) < 0) {
+        munmap(map, size);
+        return -1;
+    }
+    if (lb->map)
+        munmap(lb->map, lb->map_len);
+    lb->map = map;
+    lb->map_len = size;
+    mv->size = size;
+    mv_invalidate(mv);
+    lb_view_sync(lb);
+    return 1;
+}
+
+/**
+ * Return how many bytes at the start of its file LB holds as lines: the
+ * part of a mapping split so far, or everything a paged, packed or viewed
+ * buffer has described. Returns -1 for buffers that were not read through
+ * a mapping or pages; their loader keeps track of the offset itself.
+ */
+off_t lb_file_bytes(const LineBuffer *lb) {
+    if (lb->backend == LB_MAP_VIEW)
+        return (off_t)lb->view->size;
+    if (lb->pages) {
+        const struct LinePages *lp = lb->pages;
+        if (lp->n == 0)
+            return 0;
+        return lp->page[lp->n - 1].offset + (off_t)lp->page[lp->n - 1].bytes;
+    }
+    if (lb->map_end > 0)
+        return (off_t)lb->map_pos;
+    return -1;
+}
+
+/**
+ * Return true if LB reads its lines from the pages of a file it keeps open,
+ * as a buffer from lb_page_file() does and one from lb_pack_file() does not.
+ */
+bool lb_paged(const LineBuffer *lb) {
+    return lb->pages && lb->pages->fd >= 0;
+}
+
+/**
+ * Describe in RUN the lines from INDEX on that LB holds exactly as they
+ * are in the file it was read from: RUN->lines lines whose text, each line
+ * followed by its newline, is the RUN->bytes bytes at RUN->offset of
+ * RUN->fd. Paged buffers report a run of clean pages starting with line
+ * INDEX and viewed files every line from INDEX on. With INDEX equal to
+ * count, RUN describes the rest of the file that has not been loaded as
+ * lines yet and holds no lines. The file may lack the newline of its last
+ * line.
+ *
+ * Returns false if line INDEX has to be read with lb_get() instead, or if
+ * there is nothing left to load.
+ */
+bool lb_file_run(LineBuffer *lb, long index, FileRun *run) {
+    run->lines = 0;
+    if (lb->backend == LB_MAP_VIEW) {
+        struct MapView *mv = lb->view;
+        size_t start = 0;
+        size_t len = 0;
+        size_t end = 0;
+        if (lb->count > 0) {
+            mv_extent(lb, lb->count - 1, &start, &len);
+            end = start + len < mv->size ? start + len + 1 : start + len;
+        }
+        run->fd = mv->fd;
+        if (index >= lb->count) {
+            run->offset = (off_t)end;
+            run->bytes = (off_t)(mv->size - end);
+            return run->bytes > 0;
+        }
+        mv_extent(lb, index, &start, &len);
+        run->offset = (off_t)start;
+        run->bytes = (off_t)(end - start);
+        run->lines = lb->count - index;
+        return true;
+    }
+    if (lb->pages && lb->pages->fd >= 0) {
+        struct LinePages *lp = lb->pages;
+        off_t end = lb_file_bytes(lb);
+        run->fd = lp->fd;
+        if (index >= lb->count) {
+            run->offset = end;
+            run->bytes = lp->size - end;
+            return run->bytes > 0;
+        }
+        long local = index;
+        int p = fw_find(lp->all, lp->n, &local);
+        if (local != 0 || lp->page[p].dirty)
+            return false;
+        run->offset = lp->page[p].offset;
+        for (; p < lp->n && !lp->page[p].dirty; ++p)
+            run->lines += lp->page[p].lines;
+        run->bytes = (p < lp->n ? lp->page[p].offset : end) - run->offset;
+        return true;
+    }
+    if (index >= lb->count && lb_map_pending(lb)) {
+        run->fd = lb->map_fd;
+        run->offset = (off_t)lb->map_pos;
+        run->bytes = (off_t)(lb->map_end - lb->map_pos);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Hint that lines FIRST to LAST of LB are about to be shown, typically the
+ * screens around the viewport. Paged buffers have the pages holding them
+ * read by their read-ahead worker; mapped and viewed files have the kernel
+ * start reading the part of the mapping they are in. Buffers already held
+ * in memory ignore the hint. Never waits for the disk.
+ */
+void lb_read_ahead(LineBuffer *lb, long first, long last) {
+    if (!lb || last < first || last < 0)
+        return;
+    if (first < 0)
+        first = 0;
+    if (lb->pages) {
+        struct LinePages *lp = lb->pages;
+        if (lp->n == 0 || first >= lb->count)
+            return;
+        if (last >= lb->count)
+            last = lb->count - 1;
+        int p = fw_find(lp->all, lp->n, &first);
+        int q = fw_find(lp->all, lp->n, &last);
+        lp_ahead(lp, p, q < p + LB_AHEAD_PAGES ? q : p + LB_AHEAD_PAGES - 1);
         return;
     }
-    lb->count = 0;
-    lb->capacity = initial_capacity;
+
+    size_t start;
+    size_t end;
+    if (lb->backend == LB_MAP_VIEW) {
+        off_t offset;
+        li_offset(lb->view->li, first, &offset);
+        start = (size_t)offset;
+        end = li_offset(lb->view->li, last + LI_STRIDE, &offset) > last
+                  ? (size_t)offset
+                  : lb->view->size;
+        if (end > lb->view->size)
+            end = lb->view->size;
+    } else if (lb_map_pending(lb) && last >= lb->count) {
+        start = lb->map_pos;
+        end = lb->map_end;
+    } else {
+        return;
+    }
+    if (!lb->map || end <= start)
+        return;
+    if (end - start > LB_AHEAD_BYTES)
+        end = start + LB_AHEAD_BYTES;
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0)
+        page = 4096;
+    start = start / (size_t)page * (size_t)page;
+    posix_madvise(lb->map + start, end - start, POSIX_MADV_WILLNEED);
+}
+
+/*
+ * Compress the BYTES bytes at TEXT, holding LINES lines that start at
+ * OFFSET in the file, into a new page of a packed buffer.
+ */
+static int lp_append_packed(LineBuffer *lb, off_t offset, const char *text,
+                            size_t bytes, int lines) {
+    struct LinePages *lp = lb->pages;
+    size_t packed_bytes;
+    char *packed = lp_compress(text, bytes, &packed_bytes);
+    if (!packed)
+        return -1;
+    if (lp_append(lp, offset, bytes, lines) < 0) {
+        free(packed);
+        return -1;
+    }
+    lp->page[lp->n - 1].packed = packed;
+    lp->page[lp->n - 1].packed_bytes = packed_bytes;
+    lb->count += lines;
+    return 0;
+}
+
+/**
+ * Replace the contents of LB with the regular file at PATH, compressed in
+ * pages of LB_PACK_LINES lines. The file is read once from start to end,
+ * one block at a time, so it never has to fit in memory uncompressed, and
+ * is closed again before returning: the buffer no longer depends on it.
+ *
+ * Only tree buffers are supported. Returns 0 on success or -1 if PATH is
+ * not a regular file, leaving LB untouched, or cannot be read, leaving LB
+ * empty.
+ */
+int lb_pack_file(LineBuffer *lb, const char *path) {
+    if (lb_page_file(lb, path) < 0)
+        return -1;
+    struct LinePages *lp = lb->pages;
+    int fd = lp->fd;
+    lp->fd = -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t cap = LB_PACK_READ;
+    char *buf = malloc(cap);
+    size_t bytes = 0;  /* bytes in buf */
+    size_t start = 0;  /* first byte of buf not in a page yet */
+    size_t scan = 0;   /* first byte of buf not searched for newlines */
+    off_t offset = 0;  /* file offset of buf[start] */
+    int lines = 0;     /* newlines between start and scan */
+    int res = buf ? 0 : -1;
+    while (res == 0) {
+        if (cap - bytes < LB_PACK_READ) {
+            /* Make room by discarding packed text, then by growing */
+            memmove(buf, buf + start, bytes - start);
+            bytes -= start;
+            scan -= start;
+            start = 0;
+            if (cap - bytes < LB_PACK_READ) {
+                char *tmp = realloc(buf, cap * 2);
+                if (!tmp) {
+                    res = -1;
+                    break;
+                }
+                buf = tmp;
+                cap *= 2;
+            }
+        }
+        ssize_t n = read(fd, buf + bytes, LB_PACK_READ);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            res = -1;
+        if (n <= 0)
+            break;
+        bytes += (size_t)n;
+
+        char *nl;
+        while ((nl = memchr(buf + scan, '\n', bytes - scan)) != NULL) {
+            scan = nl + 1 - buf;
+            if (++lines < LB_PACK_LINES)
+                continue;
+            if (lp_append_packed(lb, offset, buf + start, scan - start,
+                                 lines) < 0) {
+                res = -1;
+                break;
+            }
+            offset += (off_t)(scan - start);
+            start = scan;
+            lines = 0;
+        }
+    }
+    if (res == 0 && start < bytes) {
+        /* The rest of the file, with a last line missing its newline */
+        if (buf[bytes - 1] != '\n')
+            lines++;
+        res = lp_append_packed(lb, offset, buf + start, bytes - start, lines);
+    }
+    free(buf);
+    close(fd);
+    if (res < 0)
+        lb_free(lb);
+    return res;
+}
+
+/**
+ * Return how many page reads of LB have failed since the last call. Lines
+ * of a page that could not be read appear empty, so callers writing the
+ * buffer out check this before trusting the result.
+ */
+int lb_page_errors(LineBuffer *lb) {
+    if (!lb->pages)
+        return 0;
+    int errors = lb->pages->errors;
+    lb->pages->errors = 0;
+    return errors;
 }
 
 /**
  * Release all memory owned by LB.
  *
- * Each stored line is freed and the underlying array is released. The
- * structure's count and capacity fields are reset to zero so the buffer can
- * be safely reused or discarded.
+ * Every tree node is freed and the line text goes back to the system with
+ * the arena's slabs and the file mapping, without visiting each line
+ * unless some lines hold references into the line pool. The count is
+ * reset to zero so the buffer can be safely reused or discarded.
+ * Piece-table buffers release the document and its views, and view
+ * buffers their index and views; either way LB reverts to an empty line
+ * tree.
  */
 void lb_free(LineBuffer *lb) {
     if (!lb)
         return;
-    for (int i = 0; i < lb->capacity; ++i)
-        free(lb->lines[i]);
-    free(lb->lines);
-    lb->lines = NULL;
-    lb->count = 0;
-    lb->capacity = 0;
+    if (lb->backend == LB_PIECE_TABLE && lb->pieces) {
+        pt_free(lb->pieces->pt);
+        for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+            free(lb->pieces->views[i]);
+        free(lb->pieces);
+    }
+    if (lb->backend == LB_MAP_VIEW && lb->view) {
+        li_free(lb->view->li);
+        close(lb->view->fd);
+        for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+            free(lb->view->views[i]);
+        free(lb->view);
+    }
+    for (long i = 0; lb->shared > 0 && i < lb->tree.count; ++i) {
+        LineMeta meta;
+        char **slot = lt_slot(&lb->tree, i, &meta);
+        if (*meta.size == SHARED_LINE)
+            lb_drop(lb, *slot, *meta.size);
+    }
+    lt_free(&lb->tree, NULL);
+    arena_release(&lb->arena);
+    if (lb->map)
+        munmap(lb->map, lb->map_len);
+    if (lb->map_fd >= 0)
+        close(lb->map_fd);
+    if (lb->pages) {
+        for (int i = 0; i < lb->pages->n_live; ++i)
+            free(lb->pages->page[lb->pages->live[i]].text);
+        for (int i = 0; i < lb->pages->n; ++i)
+            free(lb->pages->page[i].packed);
+        free(lb->pages->page);
+        free(lb->pages->all);
+        free(lb->pages->res);
+        free(lb->pages->live);
+        ra_free(lb->pages->ahead);
+        if (lb->pages->fd >= 0)
+            close(lb->pages->fd);
+        free(lb->pages);
+    }
+    lb_init(lb);
+}
+
+/**
+ * Return the heap bytes used by LB. When MEM is not NULL they are also
+ * broken down into text and slack, which visits every line in memory,
+ * and the size of file mappings is reported. Lines split off a private
+ * mapping count as heap, since splitting them wrote to those pages.
+ */
+size_t lb_memory(LineBuffer *lb, LineMemory *mem) {
+    LineMemory m = {0, 0, 0};
+    size_t meta;
+    size_t nodes = lt_memory(&lb->tree, &meta);
+    m.text = meta;
+    m.slack = nodes - meta;
+    if (mem) {
+        size_t owned = 0;
+        LineMeta lm;
+        for (long i = 0; i < lb->tree.count; ++i) {
+            lt_slot(&lb->tree, i, &lm);
+            if (*lm.size != 0 && *lm.size != SHARED_LINE)
+                owned += *lm.len + 1;
+        }
+        m.text += owned;
+        m.slack += lb->arena.reserved - owned;
+    } else {
+        m.text += lb->arena.reserved;
+    }
+    if (lb->map && (lb->backend == LB_MAP_VIEW || lb->share_lines)) {
+        m.mapped += lb->map_len;
+    } else if (lb->map) {
+        m.text += lb->map_pos;
+        m.mapped += lb->map_len - lb->map_pos;
+    }
+    if (lb->pages) {
+        struct LinePages *lp = lb->pages;
+        m.text += sizeof(*lp) + (size_t)lp->cap * (sizeof(struct LinePage) +
+                                                   2 * sizeof(long) + sizeof(int));
+        for (int i = 0; i < lp->n; ++i)
+            m.text += lp->page[i].packed_bytes;
+        for (int l = 0; l < lp->n_live; ++l) {
+            struct LinePage *pg = &lp->page[lp->live[l]];
+            if (pg->text)
+                m.text += pg->bytes + 1;
+        }
+    }
+    if (lb->pieces) {
+        size_t heap, slack, mapped;
+        pt_memory(lb->pieces->pt, &heap, &slack, &mapped);
+        m.text += sizeof(*lb->pieces) + heap;
+        m.slack += slack;
+        m.mapped += mapped;
+        for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+            m.slack += lb->pieces->view_cap[i];
+    }
+    if (lb->view) {
+        m.text += sizeof(*lb->view);
+        for (int i = 0; i < LB_VIEW_SLOTS; ++i)
+            m.slack += lb->view->view_cap[i];
+    }
+    if (mem)
+        *mem = m;
+    return m.text + m.slack;
+}
+
+/*
+ * Drop the unmodified pages of a paged buffer, and pack and drop the
+ * pages of a packed one, except the LB_TRIM_KEEP most recently used.
+ * Pages staged by the read-ahead worker are discarded with it.
+ */
+static void lp_trim(LineBuffer *lb) {
+    struct LinePages *lp = lb->pages;
+    bool packed = lp->fd < 0;
+    ra_free(lp->ahead);
+    lp->ahead = NULL;
+    unsigned long recent[LB_TRIM_KEEP] = {0};
+    for (int l = 0; l < lp->n_live; ++l) {
+        unsigned long used = lp->page[lp->live[l]].used;
+        for (int k = 0; k < LB_TRIM_KEEP; ++k) {
+            if (used > recent[k]) {
+                unsigned long tmp = recent[k];
+                recent[k] = used;
+                used = tmp;
+            }
+        }
+    }
+    /* Evicting moves the last live page into the freed position */
+    for (int l = lp->n_live; l-- > 0;) {
+        int p = lp->live[l];
+        struct LinePage *pg = &lp->page[p];
+        if (pg->used >= recent[LB_TRIM_KEEP - 1] || (!packed && pg->dirty))
+            continue;
+        if (!pg->dirty || lp_pack(lb, p) == 0)
+            lp_evict(lb, l);
+    }
+}
+
+/*
+ * Move the lines LB owns into a new arena with no free blocks and
+ * release the old one. If an allocation fails the lines moved so far stay
+ * where they are and both arenas are merged.
+ */
+static void lb_compact(LineBuffer *lb) {
+    Arena fresh;
+    arena_init(&fresh);
+    LineMeta meta;
+    for (long i = 0; i < lb->tree.count; ++i) {
+        char **slot = lt_slot(&lb->tree, i, &meta);
+        if (*meta.size == 0 || *meta.size == SHARED_LINE)
+            continue;
+        size_t granted;
+        char *copy = arena_alloc(&fresh, *meta.len + 1, &granted);
+        if (!copy) {
+            arena_adopt(&lb->arena, &fresh);
+            return;
+        }
+        memcpy(copy, *slot, *meta.len + 1);
+        arena_free(&lb->arena, *slot, *meta.size);
+        *slot = copy;
+        *meta.size = granted;
+    }
+    arena_release(&lb->arena);
+    lb->arena = fresh;
+}
+
+/**
+ * Give back the memory LB holds without needing it: lines are compacted
+ * into a tight arena, and paged buffers drop pages that can be read or
+ * expanded again, keeping the LB_TRIM_KEEP most recently used. Strings
+ * previously returned by lb_get() become invalid. Returns the number of
+ * heap bytes released.
+ */
+size_t lb_trim(LineBuffer *lb) {
+    if (!lb)
+        return 0;
+    size_t before = lb_memory(lb, NULL);
+    if (lb->pages)
+        lp_trim(lb);
+    if (lb->arena.reserved > 0)
+        lb_compact(lb);
+    size_t after = lb_memory(lb, NULL);
+    return before > after ? before - after : 0;
 }
 
 /**
  * Retrieve the string at INDEX from the buffer.
  *
  * Returns NULL if INDEX is out of range or if LB is NULL. The returned
- * pointer remains owned by the buffer.
+ * pointer remains owned by the buffer. For piece-table and view buffers
+ * the string is a temporary view that is invalidated by the next
+ * modification or once LB_VIEW_SLOTS further lines have been fetched.
  */
-const char *lb_get(LineBuffer *lb, int index) {
+const char *lb_get(LineBuffer *lb, long index) {
     if (!lb || index < 0 || index >= lb->count)
         return NULL;
-    return lb->lines[index];
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_get(lb, index);
+    if (lb->backend == LB_MAP_VIEW)
+        return mv_get(lb, index);
+    char **slot = lb_slot(lb, index, NULL, false);
+    if (!slot)
+        return ""; /* the page could not be read; see lb_page_errors() */
+    return *slot ? *slot : ""; /* empty lines have no storage */
+}
+
+/**
+ * Replace the contents of the line at INDEX with LINE.
+ *
+ * Setting a line past the end behaves like lb_insert(). LINE must not
+ * point into the buffer itself. Returns 0 on success or -1 on memory
+ * allocation failure or for a read-only view, in which case the previous
+ * text is kept.
+ */
+int lb_set(LineBuffer *lb, long index, const char *line) {
+    if (!lb || !line || index < 0 || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (index >= lb->count)
+        return lb_insert(lb, index, line);
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_set(lb, index, line, strlen(line));
+    return lb_store(lb, index, line, strlen(line));
 }
 
 /**
  * Insert LINE at the given INDEX within the buffer.
  *
- * The buffer grows if necessary and newly created slots are initialised
- * to NULL. When inserting past the current end, missing lines are created
- * and count is updated to index + 1. Returns 0 on success or -1 on memory
- * allocation failure.
+ * Later lines move down by one. When inserting past the current end,
+ * missing lines are created empty and count becomes index + 1. Returns 0
+ * on success or -1 on memory allocation failure, in which case no line is
+ * added by this call.
  */
-int lb_insert(LineBuffer *lb, int index, const char *line) {
+int lb_insert(LineBuffer *lb, long index, const char *line) {
     if (!lb || !line)
         return -1;
+    return lb_insert_bytes(lb, index, line, strlen(line));
+}
+
+/*
+ * Insert LEN bytes of TEXT as line INDEX of a tree buffer, copied into the
+ * arena or, when SHARED, interned in the line pool.
+ */
+static int lb_insert_line(LineBuffer *lb, long index, const char *text,
+                          size_t len, bool shared) {
+    while (lb->count < index) {
+        if (lb_insert_line(lb, lb->count, "", 0, false) < 0)
+            return -1;
+    }
+    long pos = index;
+    int page = -1;
+    if (lb->pages && (pos = lp_locate(lb, index, true, &page)) < 0)
+        return -1;
+    size_t size = 0;
+    char *copy = NULL;
+    if (len > 0 && shared) {
+        copy = pool_intern(text, len);
+        if (!copy)
+            return -1;
+        size = SHARED_LINE;
+        lb->shared++;
+    } else if (len > 0) {
+        copy = arena_alloc(&lb->arena, len + 1, &size);
+        if (!copy)
+            return -1;
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+    }
+    if (lt_insert(&lb->tree, pos, copy, size, len) < 0) {
+        lb_drop(lb, copy, size);
+        return -1;
+    }
+    lb->count++;
+    if (lb->pages)
+        lp_adjust(lb->pages, page, 1);
+    return 0;
+}
+
+/**
+ * Insert the LEN bytes at TEXT as line INDEX, like lb_insert(). TEXT need
+ * not be terminated and may contain NUL bytes, which are kept as part of
+ * the line.
+ */
+int lb_insert_bytes(LineBuffer *lb, long index, const char *text,
+                    size_t len) {
+    if (!lb || !text || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (index < 0)
+        index = 0;
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_insert(lb, index, text, len);
+    return lb_insert_line(lb, index, text, len, false);
+}
+
+/**
+ * Insert the LEN bytes at TEXT as line INDEX like lb_insert_bytes(), but
+ * keep them in the line pool (see line_pool.h) rather than the arena. A
+ * line identical to one already pooled, in this buffer or elsewhere, then
+ * shares its storage; it is copied into the arena by its first edit like
+ * a mapped line. Piece-table buffers insert the text as usual.
+ */
+int lb_insert_shared(LineBuffer *lb, long index, const char *text,
+                     size_t len) {
+    if (!lb || !text || lb->backend == LB_MAP_VIEW)
+        return -1;
     if (index < 0)
         index = 0;
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_insert(lb, index, text, len);
+    return lb_insert_line(lb, index, text, len, true);
+}
 
-    /* Insert beyond current count means append and ensure space */
-    if (index >= lb->count) {
-        if (index >= lb->capacity) {
-            if (lb_grow(lb, index + 1) < 0)
-                return -1;
-        }
-        for (int i = lb->count; i < index; ++i)
-            lb->lines[i] = NULL;
-        lb->lines[index] = strdup(line);
-        if (!lb->lines[index])
+/**
+ * Replace line INDEX with the LEN bytes at TEXT kept in the line pool, as
+ * lb_insert_shared() does for new lines. Returns 0 on success or -1 on
+ * allocation failure, in which case the previous text is kept.
+ */
+int lb_set_shared(LineBuffer *lb, long index, const char *text, size_t len) {
+    if (!lb || !text || index < 0 || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (index >= lb->count)
+        return lb_insert_shared(lb, index, text, len);
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_set(lb, index, text, len);
+
+    char *ref = NULL;
+    if (len > 0 && !(ref = pool_intern(text, len)))
+        return -1;
+    LineMeta meta;
+    char **slot = lb_slot(lb, index, &meta, true);
+    if (!slot) {
+        pool_release(ref);
+        return -1;
+    }
+    lb_drop(lb, *slot, *meta.size);
+    *slot = ref;
+    *meta.size = ref ? SHARED_LINE : 0;
+    *meta.len = len;
+    *meta.hash = 0;
+    if (ref)
+        lb->shared++;
+    return 0;
+}
+
+/**
+ * Return a reference to the text of line INDEX in the line pool, which the
+ * caller releases with pool_release(). A line already kept in the pool is
+ * not copied again. Returns NULL on allocation failure.
+ */
+char *lb_share(LineBuffer *lb, long index) {
+    if (!lb || index < 0 || index >= lb->count)
+        return pool_intern("", 0);
+    if (lb->backend != LB_LINE_TREE) {
+        const char *text = lb_get(lb, index);
+        return text ? pool_intern(text, lb_length(lb, index)) : NULL;
+    }
+    LineMeta meta;
+    char **slot = lb_slot(lb, index, &meta, false);
+    if (!slot || !*slot)
+        return pool_intern("", 0);
+    if (*meta.size == SHARED_LINE)
+        return pool_retain(*slot);
+    return pool_intern(*slot, *meta.len);
+}
+
+/**
+ * Remove the line at INDEX from the buffer.
+ *
+ * The stored string is freed and subsequent lines move up to fill the gap.
+ * Read-only views are left unchanged. Returns 0 on success or -1 if the
+ * line could not be removed: out of range, in a read-only view, or on a
+ * page or in a piece table that failed to change.
+ */
+int lb_delete(LineBuffer *lb, long index) {
+    if (!lb || index < 0 || index >= lb->count || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (lb->backend == LB_PIECE_TABLE)
+        return pl_delete(lb, index);
+    long pos = index;
+    int page = -1;
+    if (lb->pages && (pos = lp_locate(lb, index, true, &page)) < 0)
+        return -1;
+    size_t size;
+    char *text = lt_remove(&lb->tree, pos, &size);
+    lb_drop(lb, text, size);
+    lb->count--;
+    if (lb->pages)
+        lp_adjust(lb->pages, page, -1);
+    return 0;
+}
+
+/**
+ * Set the number of lines in LB to COUNT.
+ *
+ * Surplus lines are deleted from the end and missing lines are appended
+ * empty. Returns 0 on success or -1 on memory allocation failure, when a
+ * line cannot be deleted or for a read-only view.
+ */
+int lb_resize(LineBuffer *lb, long count) {
+    if (!lb || count < 0 || lb->backend == LB_MAP_VIEW)
+        return -1;
+    while (lb->count > count)
+        if (lb_delete(lb, lb->count - 1) < 0)
             return -1;
-        lb->count = index + 1;
+    if (lb->count < count)
+        return lb_insert(lb, count - 1, "");
+    return 0;
+}
+
+/**
+ * Discard the contents of LB, leaving a single empty line.
+ *
+ * The buffer keeps its backend, except that a read-only view becomes an
+ * ordinary line tree. Returns 0 on success or -1 on memory allocation
+ * failure.
+ */
+int lb_reset(LineBuffer *lb) {
+    if (!lb)
+        return -1;
+    if (lb->backend == LB_PIECE_TABLE)
+        return lb_init_piece_table(lb, NULL);
+    lb_free(lb);
+    return lb_insert(lb, 0, "");
+}
+
+/**
+ * Make sure line INDEX can hold at least SIZE bytes.
+ *
+ * Each line owns its own arena block which grows geometrically so repeated
+ * typing does not reallocate on every keystroke. Empty lines have no block
+ * until the first reservation, and lines still in the file mapping or in
+ * the line pool are copied into the arena here, on their first edit.
+ * Piece-table buffers have no per-line storage and always succeed, while
+ * read-only views always fail. Returns 0 on success or -1 on failure, in
+ * which case the line is left untouched.
+ */
+int lb_reserve(LineBuffer *lb, long index, size_t size) {
+    if (!lb || index < 0 || index >= lb->count || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (lb->backend == LB_PIECE_TABLE)
         return 0;
+    LineMeta meta;
+    char **slot = lb_slot(lb, index, &meta, true);
+    if (!slot)
+        return -1;
+    size_t *cap = meta.size;
+    bool shared = *cap == SHARED_LINE;
+    if (!shared && *cap >= size)
+        return 0;
+
+    size_t grown = shared ? 0 : *cap + *cap / 2;
+    if (grown > size)
+        size = grown;
+    size_t granted;
+    char *tmp;
+    if (*slot && (*cap == 0 || shared)) {
+        size_t len = *meta.len + 1;
+        tmp = arena_alloc(&lb->arena, len > size ? len : size, &granted);
+        if (tmp)
+            memcpy(tmp, *slot, len);
+        if (tmp && shared)
+            lb_drop(lb, *slot, *cap);
+    } else {
+        tmp = arena_resize(&lb->arena, *slot, *cap, size, &granted);
+        if (tmp && !*slot)
+            tmp[0] = '\0';
     }
+    if (!tmp)
+        return -1;
+    *slot = tmp;
+    *cap = granted;
+    return 0;
+}
 
-    /* Regular insertion in the middle */
-    if (lb->count >= lb->capacity) {
-        if (lb_grow(lb, lb->count + 1) < 0)
-            return -1;
+/**
+ * Return the number of bytes allocated for line INDEX, or 0 for lines out
+ * of range, lines the buffer does not own and buffers that are not trees.
+ */
+size_t lb_capacity(LineBuffer *lb, long index) {
+    if (!lb || lb->backend != LB_LINE_TREE || index < 0 || index >= lb->count)
+        return 0;
+    LineMeta meta;
+    if (!lb_slot(lb, index, &meta, false) || *meta.size == SHARED_LINE)
+        return 0;
+    return *meta.size;
+}
+
+/**
+ * Insert LEN bytes of TEXT into line INDEX before column COL.
+ *
+ * COL is clamped to the line length. TEXT must not contain newlines and
+ * must not point into the line being edited. Only the affected line is
+ * touched: tree buffers grow that line's allocation in place while
+ * piece-table buffers record a single insertion. Returns 0 on success or
+ * -1 on failure, which read-only views always report.
+ */
+int lb_insert_text(LineBuffer *lb, long index, size_t col,
+                   const char *text, size_t len) {
+    if (!lb || !text || index < 0 || index >= lb->count ||
+        lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (lb->backend == LB_PIECE_TABLE) {
+        size_t start, line_len;
+        pl_extent(lb, index, &start, &line_len);
+        if (col > line_len)
+            col = line_len;
+        pl_invalidate(lb->pieces);
+        return pt_insert(lb->pieces->pt, start + col, text, len);
     }
-    memmove(&lb->lines[index + 1], &lb->lines[index],
-            (lb->count - index) * sizeof(char *));
-    lb->lines[index] = strdup(line);
-    if (!lb->lines[index])
+
+    if (len == 0)
+        return 0;
+    size_t line_len = lb_length(lb, index);
+    if (col > line_len)
+        col = line_len;
+    if (lb_reserve(lb, index, line_len + len + 1) < 0)
         return -1;
-    lb->count++;
+    LineMeta meta;
+    char *line = *lb_slot(lb, index, &meta, true);
+    memmove(line + col + len, line + col, line_len - col + 1);
+    memcpy(line + col, text, len);
+    *meta.len = line_len + len;
+    *meta.hash = 0;
     return 0;
 }
 
 /**
- * Remove the line at INDEX from the buffer.
+ * Remove up to LEN bytes from line INDEX starting at column COL.
  *
- * The stored string is freed and subsequent lines are shifted up to fill the
- * gap. The count field is decremented; capacity is left unchanged.
+ * The range is clipped to the end of the line. Returns 0 on success or -1
+ * if INDEX is out of range or the line cannot be made writable.
  */
-void lb_delete(LineBuffer *lb, int index) {
+int lb_delete_text(LineBuffer *lb, long index, size_t col, size_t len) {
+    if (!lb || index < 0 || index >= lb->count || lb->backend == LB_MAP_VIEW)
+        return -1;
+    if (lb->backend == LB_PIECE_TABLE) {
+        size_t start, line_len;
+        pl_extent(lb, index, &start, &line_len);
+        if (col >= line_len)
+            return 0;
+        if (len > line_len - col)
+            len = line_len - col;
+        pl_invalidate(lb->pieces);
+        return pt_delete(lb->pieces->pt, start + col, len);
+    }
+
+    size_t line_len = lb_length(lb, index);
+    if (col >= line_len)
+        return 0;
+    if (len > line_len - col)
+        len = line_len - col;
+    if (lb_reserve(lb, index, line_len + 1) < 0)
+        return -1;
+    LineMeta meta;
+    char *line = *lb_slot(lb, index, &meta, true);
+    memmove(line + col, line + col + len, line_len - col - len + 1);
+    *meta.len = line_len - len;
+    *meta.hash = 0;
+    return 0;
+}
+
+/**
+ * Return the length of line INDEX in bytes, or 0 for lines out of range.
+ *
+ * Tree buffers record every line's length as it is stored or edited, so
+ * this never scans the text, and NUL bytes inside the line are counted.
+ */
+size_t lb_length(LineBuffer *lb, long index) {
     if (!lb || index < 0 || index >= lb->count)
+        return 0;
+    if (lb->backend == LB_PIECE_TABLE) {
+        size_t start, len;
+        pl_extent(lb, index, &start, &len);
+        return len;
+    }
+    if (lb->backend == LB_MAP_VIEW)
+        return mv_length(lb, index);
+    LineMeta meta;
+    if (!lb_slot(lb, index, &meta, false))
+        return 0;
+    return *meta.len;
+}
+
+/**
+ * Return a 32-bit FNV-1a hash of the text of line INDEX. The value is never
+ * 0. Tree buffers compute it on first use and keep it until the line is
+ * modified; other buffers hash the line on every call.
+ */
+unsigned lb_hash(LineBuffer *lb, long index) {
+    LineMeta meta = {0};
+    const char *text;
+    size_t len;
+    if (!lb || index < 0 || index >= lb->count)
+        return 1;
+    if (lb->backend != LB_LINE_TREE) {
+        text = lb_get(lb, index);
+        len = lb_length(lb, index);
+        if (!text)
+            return 1;
+    } else {
+        char **slot = lb_slot(lb, index, &meta, false);
+        if (!slot)
+            return 1;
+        if (*meta.hash)
+            return *meta.hash;
+        text = *slot;
+        len = *meta.len;
+    }
+
+    unsigned hash = pool_hash(text, len);
+    if (meta.hash)
+        *meta.hash = hash;
+    return hash;
+}
+
+/**
+ * Return the state recorded for line INDEX with lb_set_state(), or -1 if
+ * none is known. States are not tied to the line's text: callers decide
+ * when they become stale. They are lost when a paged buffer drops the
+ * line's page and are only kept by tree buffers.
+ */
+int lb_state(LineBuffer *lb, long index) {
+    if (!lb || lb->backend != LB_LINE_TREE || index < 0 ||
+        index >= lb->count)
+        return -1;
+    LineMeta meta;
+    if (!lb_slot(lb, index, &meta, false))
+        return -1;
+    return (int)*meta.state - 1;
+}
+
+/** Record STATE, a value from 0 to LB_STATE_MAX, for line INDEX. */
+void lb_set_state(LineBuffer *lb, long index, int state) {
+    if (!lb || lb->backend != LB_LINE_TREE || index < 0 ||
+        index >= lb->count || state < 0 || state > LB_STATE_MAX)
         return;
-    free(lb->lines[index]);
-    for (int i = index; i < lb->count - 1; ++i)
-        lb->lines[i] = lb->lines[i + 1];
-    lb->lines[lb->count - 1] = NULL;
-    lb->count--;
+    LineMeta meta;
+    if (lb_slot(lb, index, &meta, false))
+        *meta.state = (unsigned char)(state + 1);
 }
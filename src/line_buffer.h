@@ -1,28 +1,186 @@
 #ifndef LINE_BUFFER_H
 #define LINE_BUFFER_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include "line_tree.h"
+#include "arena.h"
+#include "line_index.h"
 
 /*
  * LineBuffer
  * ----------
- * A lightweight dynamic array of strings used by the editor to store
- * the contents of files. Each entry corresponds to a single line and
- * the structure tracks how many lines are in use as well as the
- * currently allocated capacity.
+ * The sequence of strings used by the editor to store the contents of
+ * files. Each entry corresponds to a single line. Lines are kept in a
+ * chunked B-tree (see line_tree.h) so inserting or deleting a line
+ * anywhere costs O(log n) instead of shifting the rest of the file, and
+ * reading consecutive lines stays O(1). Every line has its own allocation
+ * size and grows independently, so one long line never widens the others.
+ * Line text is carved from a per-buffer Arena (see arena.h) and released
+ * in bulk when the buffer is freed. Empty lines own no storage at all, and
+ * lines loaded with lb_load_mapped() point straight into a private mapping
+ * of the file until they are first edited. A mapped file can also be split
+ * into lines on demand with lb_map_file() and lb_map_lines().
+ *
+ * Lines may also be kept in the process-wide line pool (see line_pool.h)
+ * with lb_insert_shared() and lb_set_shared(), so that identical lines
+ * share one reference counted copy. Like mapped lines they are copied
+ * into the arena by their first edit. lb_share() hands out pool
+ * references to a line's text, which is how undo records avoid copying
+ * lines the buffer already shares.
+ *
+ * Files too large to keep in memory are opened with lb_page_file() instead.
+ * The file is then divided into pages of LI_STRIDE lines located by a
+ * LineIndex, and only the pages being looked at are read into the tree.
+ * Once more than LB_PAGE_BUDGET unmodified pages are resident, the least
+ * recently used one is dropped and read back by offset when it is needed
+ * again. A page is pinned in memory from its first edit on. Strings
+ * returned by lb_get() stay valid while their page is among the most
+ * recently used ones. A ReadAhead worker (see read_ahead.h) reads the
+ * pages following one that had to be read, and those lb_read_ahead() is
+ * told will be shown next, so scrolling through the file finds them
+ * already in memory.
+ *
+ * lb_pack_file() uses the same pages without relying on the file staying
+ * unchanged: it reads the file once and compresses every page of
+ * LB_PACK_LINES lines with lz_compress() (see lz.h). Pages are expanded
+ * into the tree as they are accessed, and once LB_PACK_BUDGET of them are
+ * resident the least recently used one is compressed again, edits and
+ * all, and dropped. The whole buffer then costs roughly its compressed
+ * size plus a few expanded pages around the viewport.
+ *
+ * lb_view_file() opens a file read-only, for inspecting it rather than
+ * editing it. Lines are read in place from a read-only mapping: a
+ * LineIndex locates the LI_STRIDE'th lines and the rest are found with
+ * memchr() from the nearest indexed one, so the buffer makes no per-line
+ * allocations at all and its size does not depend on the file's. Like
+ * piece-table lines, lb_get() returns temporary copies. Every edit is
+ * refused, but text appended to the file can be taken on with
+ * lb_view_append().
+ *
+ * A buffer may alternatively be backed by a PieceTable document (see
+ * piece_table.h). In that mode the tree is unused and lb_get() returns a
+ * temporary copy of the requested line which stays valid until the buffer
+ * is modified or LB_VIEW_SLOTS further lines have been fetched. Code that
+ * must work with either backend reads through lb_get() and writes through
+ * lb_set(), lb_insert() and lb_delete().
+ *
+ * Tree buffers also keep metadata for every line next to its text: the
+ * length, the allocation size, a content hash computed on demand and a
+ * small state value owned by the caller (the syntax highlighter records
+ * whether a line starts inside a block comment). Lengths are maintained
+ * by the edit primitives, so lb_length() is O(1) and a line may contain
+ * NUL bytes; lb_get() still appends a terminator after the last byte.
+ *
+ * Buffers read from a file also know which of their lines are still
+ * exactly as they are there: the clean pages of a paged buffer, every line
+ * of a view, and the part of a mapped, paged or viewed file that has not
+ * been loaded as lines yet. lb_file_run() describes them as byte ranges of
+ * the file so a save can copy them across without reading them in.
+ *
+ * lb_memory() reports what a buffer costs, whatever its backend, and
+ * lb_trim() gives back what it can without losing anything: the lines
+ * are copied into a new arena that fits them tightly, which returns the
+ * room left by deleted and shortened lines, and unmodified pages other
+ * than the most recently used are dropped to be read again when needed.
+ * Text held by the line pool is shared between buffers and counted by
+ * pool_bytes() instead.
  */
 
+#define LB_VIEW_SLOTS 8 /* temporary line views of piece-table and view buffers */
+#define LB_PAGE_BUDGET 64 /* unmodified pages kept by paged buffers */
+#define LB_PACK_LINES 1024 /* lines per page of a packed buffer */
+#define LB_PACK_BUDGET 8   /* pages kept expanded by packed buffers */
+#define LB_AHEAD_PAGES 4   /* pages of a paged buffer read in the background */
+#define LB_AHEAD_BYTES (1 << 20) /* bytes of a mapping prefetched at a time */
+#define LB_PACK_READ (1 << 20) /* bytes read at a time by lb_pack_file() */
+#define LB_STATE_MAX 254  /* largest value accepted by lb_set_state() */
+#define LB_TRIM_KEEP 2    /* pages a paged buffer keeps through lb_trim() */
+
+typedef enum {
+    LB_LINE_TREE,   /* one heap string per line, indexed by a B-tree */
+    LB_PIECE_TABLE, /* lines are views into a piece-table document */
+    LB_MAP_VIEW     /* read-only lines found in a file mapping */
+} LineBufferBackend;
+
+/* Lines of a buffer stored unchanged in its file, see lb_file_run(). */
+typedef struct FileRun {
+    int fd;       /* the file holding them */
+    off_t offset; /* where their text starts */
+    off_t bytes;  /* length of the text, newlines included */
+    long lines;   /* buffer lines the text makes up */
+} FileRun;
+
+struct PieceLines;
+struct LinePages;
+struct MapView;
+
+/* Memory used by a LineBuffer, as reported by lb_memory(). */
+typedef struct LineMemory {
+    size_t text;   /* bytes of line text and the structures indexing it */
+    size_t slack;  /* bytes allocated for lines but not holding any */
+    size_t mapped; /* file mappings, which the kernel may page out */
+} LineMemory;
+
 typedef struct LineBuffer {
-    char **lines;   /* array of allocated strings */
-    int count;      /* number of valid lines stored */
-    int capacity;   /* total slots allocated in lines */
+    long count;     /* number of valid lines stored */
+    LineBufferBackend backend;
+    LineTree tree;  /* line storage for LB_LINE_TREE */
+    Arena arena;    /* bytes of the lines stored in tree */
+    char *map;      /* file mapping referenced by unedited lines */
+    size_t map_len;
+    size_t map_pos; /* bytes of the mapping already split into lines */
+    size_t map_end; /* bytes of the mapping that may be split */
+    long map_lines; /* lines split off the mapping so far */
+    int map_fd;     /* mapped file, open while lines remain to be split */
+    bool share_lines; /* lines split off the mapping go to the line pool */
+    long shared;    /* lines whose text is in the line pool */
+    struct LinePages *pages; /* page table of a buffer from lb_page_file() */
+    struct PieceLines *pieces; /* document state for LB_PIECE_TABLE */
+    struct MapView *view; /* index and line views for LB_MAP_VIEW */
 } LineBuffer;
 
-LineBuffer *lb_create(int initial_capacity);
-void lb_init(LineBuffer *lb, int initial_capacity);
+LineBuffer *lb_create(void);
+void lb_init(LineBuffer *lb);
+int lb_init_piece_table(LineBuffer *lb, const char *path);
+int lb_map_file(LineBuffer *lb, const char *path);
+long lb_map_lines(LineBuffer *lb, long max);
+bool lb_map_pending(const LineBuffer *lb);
+int lb_load_mapped(LineBuffer *lb, const char *path);
+int lb_page_file(LineBuffer *lb, const char *path);
+int lb_page_sync(LineBuffer *lb, LineIndex *li);
+int lb_pack_file(LineBuffer *lb, const char *path);
+int lb_view_file(LineBuffer *lb, const char *path);
+int lb_view_sync(LineBuffer *lb);
+int lb_view_append(LineBuffer *lb);
+off_t lb_file_bytes(const LineBuffer *lb);
+bool lb_paged(const LineBuffer *lb);
+bool lb_file_run(LineBuffer *lb, long index, FileRun *run);
+void lb_read_ahead(LineBuffer *lb, long first, long last);
+int lb_page_errors(LineBuffer *lb);
+size_t lb_memory(LineBuffer *lb, LineMemory *mem);
+size_t lb_trim(LineBuffer *lb);
 void lb_free(LineBuffer *lb);
-const char *lb_get(LineBuffer *lb, int index);
-int lb_insert(LineBuffer *lb, int index, const char *line);
-void lb_delete(LineBuffer *lb, int index);
+const char *lb_get(LineBuffer *lb, long index);
+int lb_set(LineBuffer *lb, long index, const char *line);
+int lb_insert(LineBuffer *lb, long index, const char *line);
+int lb_insert_bytes(LineBuffer *lb, long index, const char *text,
+                    size_t len);
+int lb_insert_shared(LineBuffer *lb, long index, const char *text,
+                     size_t len);
+int lb_set_shared(LineBuffer *lb, long index, const char *text, size_t len);
+char *lb_share(LineBuffer *lb, long index);
+int lb_delete(LineBuffer *lb, long index);
+int lb_resize(LineBuffer *lb, long count);
+int lb_reset(LineBuffer *lb);
+int lb_reserve(LineBuffer *lb, long index, size_t size);
+size_t lb_capacity(LineBuffer *lb, long index);
+int lb_insert_text(LineBuffer *lb, long index, size_t col,
+                   const char *text, size_t len);
+int lb_delete_text(LineBuffer *lb, long index, size_t col, size_t len);
+size_t lb_length(LineBuffer *lb, long index);
+unsigned lb_hash(LineBuffer *lb, long index);
+int lb_state(LineBuffer *lb, long index);
+void lb_set_state(LineBuffer *lb, long index, int state);
 
 #endif /* LINE_BUFFER_H */
@@ -0,0 +1,250 @@
+/*
+ * line_index.c
+ * ------------
+ * Background newline scanner. See line_index.h for an overview. The worker
+ * thread owns the file descriptor and the read buffer; the line count and
+ * the table of checkpoint offsets are shared with the editor and guarded
+ * by a mutex, which is only taken once per block and once per checkpoint.
+ * Holes in a sparse file are skipped with SEEK_DATA where it is available:
+ * they read back as NUL bytes and so can hold no newline.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* SEEK_DATA */
+#endif
+
+#include "line_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LI_BLOCK (1 << 20) /* bytes read per pread() call */
+
+struct LineIndex {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int fd;
+    bool cancel;     /* set by li_free() to stop the worker */
+    bool complete;   /* the whole file has been scanned */
+    bool partial;    /* the last byte scanned was not a newline */
+    off_t size;      /* bytes of the file covered by the index */
+    long lines;      /* newlines seen so far */
+    off_t *offsets;  /* offsets[k] is where line k * LI_STRIDE starts */
+    int n_offsets;
+    int cap_offsets;
+};
+
+/* Record OFFSET as the start of the next checkpoint line. */
+static int li_record(LineIndex *li, off_t offset) {
+    pthread_mutex_lock(&li->lock);
+    if (li->n_offsets == li->cap_offsets) {
+        int cap = li->cap_offsets ? li->cap_offsets * 2 : 64;
+        off_t *tmp = realloc(li->offsets, cap * sizeof(off_t));
+        if (!tmp) {
+            pthread_mutex_unlock(&li->lock);
+            return -1;
+        }
+        li->offsets = tmp;
+        li->cap_offsets = cap;
+    }
+    li->offsets[li->n_offsets++] = offset;
+    pthread_mutex_unlock(&li->lock);
+    return 0;
+}
+
+static void *li_scan(void *arg) {
+    LineIndex *li = arg;
+    char *buf = malloc(LI_BLOCK);
+    off_t pos = 0;
+    long lines = 0;
+    bool partial = false;
+
+    while (buf && pos < li->size) {
+        pthread_mutex_lock(&li->lock);
+        bool cancel = li->cancel;
+        pthread_mutex_unlock(&li->lock);
+        if (cancel)
+            break;
+
+#ifdef SEEK_DATA
+        off_t data = lseek(li->fd, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            data = li->size; /* nothing but a hole, if anything, is left */
+        if (data > pos) {
+            pos = data < li->size ? data : li->size;
+            partial = true;
+        }
+        if (pos == li->size)
+            break;
+#endif
+
+        size_t want = li->size - pos < LI_BLOCK ? (size_t)(li->size - pos)
+                                                : LI_BLOCK;
+        ssize_t n = pread(li->fd, buf, want, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        char *p = buf;
+        char *end = buf + n;
+        char *nl;
+        while ((nl = memchr(p, '\n', end - p)) != NULL) {
+            lines++;
+            p = nl + 1;
+            if (lines % LI_STRIDE == 0 &&
+                li_record(li, pos + (p - buf)) < 0) {
+                end = p;
+                n = 0;
+                break;
+            }
+        }
+        partial = n > 0 && end[-1] != '\n';
+        pos += end - buf;
+
+        pthread_mutex_lock(&li->lock);
+        li->lines = lines;
+        li->partial = partial;
+        pthread_mutex_unlock(&li->lock);
+        if (n == 0)
+            break;
+    }
+
+    free(buf);
+    pthread_mutex_lock(&li->lock);
+    li->partial = partial;
+    if (pos < li->size)
+        li->size = pos; /* the file shrank, or could not be read */
+    li->complete = true;
+    pthread_mutex_unlock(&li->lock);
+    return NULL;
+}
+
+/**
+ * Open PATH and start indexing it on a background thread, up to its
+ * current size. Returns NULL if the file cannot be opened or the thread
+ * cannot be started.
+ */
+LineIndex *li_start(const char *path) {
+    LineIndex *li = calloc(1, sizeof(LineIndex));
+    if (!li)
+        return NULL;
+    li->fd = open(path, O_RDONLY);
+    struct stat st;
+    if (li->fd < 0 || fstat(li->fd, &st) < 0) {
+        if (li->fd >= 0)
+            close(li->fd);
+        free(li);
+        return NULL;
+    }
+    li->size = st.st_size;
+    posix_fadvise(li->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    pthread_mutex_init(&li->lock, NULL);
+    if (li_record(li, 0) < 0 ||
+        pthread_create(&li->thread, NULL, li_scan, li) != 0) {
+        pthread_mutex_destroy(&li->lock);
+        close(li->fd);
+        free(li->offsets);
+        free(li);
+        return NULL;
+    }
+    return li;
+}
+
+/** Stop the scan if it is still running and release LI. */
+void li_free(LineIndex *li) {
+    if (!li)
+        return;
+    pthread_mutex_lock(&li->lock);
+    li->cancel = true;
+    pthread_mutex_unlock(&li->lock);
+    pthread_join(li->thread, NULL);
+    pthread_mutex_destroy(&li->lock);
+    close(li->fd);
+    free(li->offsets);
+    free(li);
+}
+
+/**
+ * Return the number of lines found so far. A final line without a trailing
+ * newline is counted once the scan reaches it. *COMPLETE, when not NULL,
+ * is set once the whole file has been indexed.
+ */
+long li_lines(LineIndex *li, bool *complete) {
+    pthread_mutex_lock(&li->lock);
+    long lines = li->lines + (li->complete && li->partial ? 1 : 0);
+    if (complete)
+        *complete = li->complete;
+    pthread_mutex_unlock(&li->lock);
+    return lines;
+}
+
+/**
+ * Find the closest indexed line at or before LINE. Its byte offset is
+ * stored in *OFFSET and its line number is returned; reading forward from
+ * there reaches LINE after fewer than LI_STRIDE newlines once the scan has
+ * covered it.
+ */
+long li_offset(LineIndex *li, long line, off_t *offset) {
+    pthread_mutex_lock(&li->lock);
+    long k = line > 0 ? line / LI_STRIDE : 0;
+    if (k >= li->n_offsets)
+        k = li->n_offsets - 1;
+    *offset = li->offsets[k];
+    pthread_mutex_unlock(&li->lock);
+    return k * (long)LI_STRIDE;
+}
+
+/**
+ * Return the number of bytes of the file the index describes: its size
+ * when li_start() was called, or less if the scan found it shorter, plus
+ * any bytes added with li_extend(). Only final once the scan is complete.
+ */
+off_t li_size(LineIndex *li) {
+    pthread_mutex_lock(&li->lock);
+    off_t size = li->size;
+    pthread_mutex_unlock(&li->lock);
+    return size;
+}
+
+/**
+ * Index LEN bytes of TEXT that were appended to the file right after the
+ * part already indexed, as if the scan had covered them. Returns 0 on
+ * success, or -1 if the scan is still running or an offset cannot be
+ * recorded, in which case the index is left as it was.
+ */
+int li_extend(LineIndex *li, const char *text, size_t len) {
+    pthread_mutex_lock(&li->lock);
+    bool complete = li->complete;
+    off_t base = li->size;
+    long lines = li->lines;
+    int n_offsets = li->n_offsets;
+    pthread_mutex_unlock(&li->lock);
+    if (!complete)
+        return -1;
+
+    const char *p = text;
+    const char *end = text + len;
+    const char *nl;
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        lines++;
+        p = nl + 1;
+        if (lines % LI_STRIDE == 0 && li_record(li, base + (p - text)) < 0) {
+            pthread_mutex_lock(&li->lock);
+            li->n_offsets = n_offsets;
+            pthread_mutex_unlock(&li->lock);
+            return -1;
+        }
+    }
+    pthread_mutex_lock(&li->lock);
+    li->lines = lines;
+    if (len > 0)
+        li->partial = end[-1] != '\n';
+    li->size = base + (off_t)len;
+    pthread_mutex_unlock(&li->lock);
+    return 0;
+}
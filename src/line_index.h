@@ -0,0 +1,35 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * LineIndex
+ * ---------
+ * A sparse newline index built by a background thread. The scanner reads
+ * the file with pread() in large blocks, counts newlines with memchr() and
+ * records the byte offset at which every LI_STRIDE'th line starts, so the
+ * editor knows how long a huge file is, and where any line roughly lives,
+ * long before the lines themselves have been loaded. The index reads the
+ * file through its own descriptor and never touches the buffer.
+ *
+ * li_lines() and li_offset() may be called at any time; until the scan
+ * completes they describe the part of the file covered so far. The scan
+ * stops at the size the file had when indexing started, which li_size()
+ * reports. Bytes appended later can be added with li_extend() once the
+ * scan is complete, without reading the file again.
+ */
+
+#define LI_STRIDE 4096 /* lines between recorded offsets */
+
+typedef struct LineIndex LineIndex;
+
+LineIndex *li_start(const char *path);
+void li_free(LineIndex *li);
+long li_lines(LineIndex *li, bool *complete);
+long li_offset(LineIndex *li, long line, off_t *offset);
+off_t li_size(LineIndex *li);
+int li_extend(LineIndex *li, const char *text, size_t len);
+
+#endif /* LINE_INDEX_H */
@@ -0,0 +1,144 @@
+/*
+ * line_pool.c
+ * -----------
+ * Hash-consed, reference counted line storage. See line_pool.h for an
+ * overview. Every string lives in its own PoolEntry, right behind a small
+ * header, so a text pointer leads back to its entry without a lookup.
+ * Entries are chained in a bucket table that doubles whenever it holds as
+ * many entries as buckets.
+ */
+
+#include "line_pool.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_MIN_BUCKETS 1024
+
+struct PoolEntry {
+    struct PoolEntry *next; /* next entry of the same bucket */
+    unsigned hash;
+    unsigned refs;
+    size_t len;
+    char text[];
+};
+
+static struct PoolEntry **buckets;
+static size_t n_buckets;
+static size_t n_entries;
+static size_t n_bytes; /* entries and their text */
+
+static struct PoolEntry *pool_entry(const char *text) {
+    return (struct PoolEntry *)(text - offsetof(struct PoolEntry, text));
+}
+
+/* Double the bucket table, keeping the old one if that fails. */
+static void pool_grow(void) {
+    size_t n = n_buckets ? n_buckets * 2 : POOL_MIN_BUCKETS;
+    struct PoolEntry **table = calloc(n, sizeof(*table));
+    if (!table)
+        return;
+    for (size_t b = 0; b < n_buckets; ++b) {
+        struct PoolEntry *e = buckets[b];
+        while (e) {
+            struct PoolEntry *next = e->next;
+            e->next = table[e->hash & (n - 1)];
+            table[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    n_buckets = n;
+}
+
+/**
+ * Return the 32-bit FNV-1a hash of the LEN bytes at TEXT. The value is
+ * never 0, so 0 can stand for a hash that has not been computed.
+ */
+unsigned pool_hash(const char *text, size_t len) {
+    unsigned hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+/**
+ * Return the pooled copy of the LEN bytes at TEXT with one more reference
+ * counted on it, creating it if no identical string is pooled yet. Returns
+ * NULL on allocation failure.
+ */
+char *pool_intern(const char *text, size_t len) {
+    unsigned hash = pool_hash(text, len);
+    if (n_buckets) {
+        for (struct PoolEntry *e = buckets[hash & (n_buckets - 1)]; e;
+             e = e->next) {
+            if (e->hash == hash && e->len == len &&
+                memcmp(e->text, text, len) == 0) {
+                e->refs++;
+                return e->text;
+            }
+        }
+    }
+    if (n_entries >= n_buckets)
+        pool_grow();
+    if (!n_buckets)
+        return NULL;
+
+    struct PoolEntry *e = malloc(sizeof(*e) + len + 1);
+    if (!e)
+        return NULL;
+    e->hash = hash;
+    e->refs = 1;
+    e->len = len;
+    memcpy(e->text, text, len);
+    e->text[len] = '\0';
+    e->next = buckets[hash & (n_buckets - 1)];
+    buckets[hash & (n_buckets - 1)] = e;
+    n_entries++;
+    n_bytes += sizeof(*e) + len + 1;
+    return e->text;
+}
+
+/** Count another reference to the pooled string TEXT and return it. */
+char *pool_retain(char *text) {
+    if (text)
+        pool_entry(text)->refs++;
+    return text;
+}
+
+/**
+ * Drop a reference to the pooled string TEXT, freeing it once none are
+ * left. NULL is ignored.
+ */
+void pool_release(char *text) {
+    if (!text)
+        return;
+    struct PoolEntry *e = pool_entry(text);
+    if (--e->refs > 0)
+        return;
+    struct PoolEntry **link = &buckets[e->hash & (n_buckets - 1)];
+    while (*link != e)
+        link = &(*link)->next;
+    *link = e->next;
+    n_bytes -= sizeof(*e) + e->len + 1;
+    free(e);
+    n_entries--;
+}
+
+/** Return the length of the pooled string TEXT, NUL bytes included. */
+size_t pool_length(const char *text) {
+    return pool_entry(text)->len;
+}
+
+/** Return the number of distinct strings in the pool. */
+size_t pool_count(void) {
+    return n_entries;
+}
+
+/** Return the bytes held by the pool, its strings and bucket table. */
+size_t pool_bytes(void) {
+    return n_bytes + n_buckets * sizeof(*buckets);
+}
@@ -0,0 +1,29 @@
+#ifndef LINE_POOL_H
+#define LINE_POOL_H
+
+#include <stddef.h>
+
+/*
+ * LinePool
+ * --------
+ * A process-wide table of hash-consed line texts. pool_intern() returns
+ * the one shared copy of a given byte string, creating it on first use,
+ * and counts a reference to it; pool_retain() adds further references to
+ * a string already in the pool and pool_release() drops one, freeing the
+ * string with its last reference. Identical lines of a file and the undo
+ * records that mention them can thus all point at a single allocation.
+ *
+ * Pooled strings are NUL terminated, may contain NUL bytes of their own
+ * (pool_length() gives their full length) and must never be modified.
+ * The pool is not thread safe; it is only used by the editor thread.
+ */
+
+char *pool_intern(const char *text, size_t len);
+char *pool_retain(char *text);
+void pool_release(char *text);
+size_t pool_length(const char *text);
+size_t pool_count(void);
+size_t pool_bytes(void);
+unsigned pool_hash(const char *text, size_t len);
+
+#endif /* LINE_POOL_H */
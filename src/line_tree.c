@@ -0,0 +1,431 @@
+/*
+ * line_tree.c
+ * -----------
+ * Chunked B-tree used by LineBuffer to store line pointers. Every leaf holds
+ * a run of consecutive lines and every interior node records how many lines
+ * live below each of its children, so a line number is resolved by walking
+ * down from the root while subtracting child counts. Insertions split full
+ * nodes on the way back up and removals merge or rebalance nodes that fall
+ * below the minimum fill, keeping the tree height logarithmic.
+ */
+
+#include "line_tree.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LT_MAX_DEPTH 16
+
+struct LineNode {
+    int leaf;       /* non-zero for leaves */
+    int n;          /* entries used in text/size or child */
+    long count;     /* lines stored in this subtree */
+    LineNode *prev; /* neighbouring leaves in document order */
+    LineNode *next;
+    union {
+        struct {
+            char *text[LT_LEAF_MAX];
+            size_t size[LT_LEAF_MAX];
+            size_t len[LT_LEAF_MAX];
+            unsigned hash[LT_LEAF_MAX];
+            unsigned char state[LT_LEAF_MAX];
+        } l;
+        LineNode *child[LT_NODE_MAX];
+    } u;
+};
+
+/* Move K lines of leaf SRC starting at SPOS to DPOS of leaf DST. */
+static void leaf_move(LineNode *dst, int dpos, LineNode *src, int spos, int k) {
+    memmove(&dst->u.l.text[dpos], &src->u.l.text[spos], k * sizeof(char *));
+    memmove(&dst->u.l.size[dpos], &src->u.l.size[spos], k * sizeof(size_t));
+    memmove(&dst->u.l.len[dpos], &src->u.l.len[spos], k * sizeof(size_t));
+    memmove(&dst->u.l.hash[dpos], &src->u.l.hash[spos], k * sizeof(unsigned));
+    memmove(&dst->u.l.state[dpos], &src->u.l.state[spos], k);
+}
+
+/*
+ * Move entries [FROM, n) of NODE by DELTA positions. A positive DELTA opens
+ * a gap before FROM, a negative one drops the entries just before FROM.
+ */
+static void node_shift(LineNode *node, int from, int delta) {
+    int k = node->n - from;
+    if (node->leaf) {
+        leaf_move(node, from + delta, node, from, k);
+    } else {
+        memmove(&node->u.child[from + delta], &node->u.child[from],
+                k * sizeof(LineNode *));
+    }
+    node->n += delta;
+}
+
+/* Copy K entries of SRC starting at SPOS into DST at DPOS. */
+static void node_copy(LineNode *dst, int dpos, LineNode *src, int spos, int k) {
+    if (src->leaf) {
+        leaf_move(dst, dpos, src, spos, k);
+    } else {
+        memcpy(&dst->u.child[dpos], &src->u.child[spos],
+               k * sizeof(LineNode *));
+    }
+}
+
+/* Number of lines held by entry I of NODE. */
+static long entry_lines(const LineNode *node, int i) {
+    return node->leaf ? 1 : node->u.child[i]->count;
+}
+
+/* Recompute the line count of NODE from its entries. */
+static void node_recount(LineNode *node) {
+    if (node->leaf) {
+        node->count = node->n;
+        return;
+    }
+    node->count = 0;
+    for (int i = 0; i < node->n; ++i)
+        node->count += node->u.child[i]->count;
+}
+
+static void node_free(LineNode *node, void (*free_text)(void *)) {
+    if (!node)
+        return;
+    if (node->leaf) {
+        if (free_text) {
+            for (int i = 0; i < node->n; ++i)
+                free_text(node->u.l.text[i]);
+        }
+    } else {
+        for (int i = 0; i < node->n; ++i)
+            node_free(node->u.child[i], free_text);
+    }
+    free(node);
+}
+
+/*
+ * Return the leaf holding line INDEX and store its position inside that
+ * leaf in *POS. The cached leaf and its neighbours are tried first so
+ * walking through the document line by line never descends the tree.
+ */
+static LineNode *lt_find(LineTree *t, long index, int *pos) {
+    LineNode *leaf = t->leaf;
+    if (leaf) {
+        long start = t->leaf_start;
+        if (index >= start + leaf->n && leaf->next &&
+            index < start + leaf->n + leaf->next->n) {
+            start += leaf->n;
+            leaf = leaf->next;
+        } else if (index < start && leaf->prev &&
+                   index >= start - leaf->prev->n) {
+            leaf = leaf->prev;
+            start -= leaf->n;
+        }
+        if (index >= start && index < start + leaf->n) {
+            t->leaf = leaf;
+            t->leaf_start = start;
+            *pos = index - start;
+            return leaf;
+        }
+    }
+
+    LineNode *node = t->root;
+    long start = 0;
+    while (!node->leaf) {
+        int i = 0;
+        while (i < node->n - 1 && index - start >= node->u.child[i]->count) {
+            start += node->u.child[i]->count;
+            i++;
+        }
+        node = node->u.child[i];
+    }
+    t->leaf = node;
+    t->leaf_start = start;
+    *pos = index - start;
+    return node;
+}
+
+/** Initialise T as an empty tree. */
+void lt_init(LineTree *t) {
+    t->root = NULL;
+    t->count = 0;
+    t->leaf = NULL;
+    t->leaf_start = 0;
+}
+
+/**
+ * Release every node of T. FREE_TEXT, when not NULL, is called for each
+ * stored line pointer. T is left empty and ready for reuse.
+ */
+void lt_free(LineTree *t, void (*free_text)(void *)) {
+    node_free(t->root, free_text);
+    lt_init(t);
+}
+
+static size_t node_count(const LineNode *node) {
+    if (!node)
+        return 0;
+    size_t n = 1;
+    for (int i = 0; !node->leaf && i < node->n; ++i)
+        n += node_count(node->u.child[i]);
+    return n;
+}
+
+/**
+ * Return the bytes taken by the nodes of T. *USED receives the part that
+ * holds the metadata of stored lines; the rest is room left in leaves
+ * that are not full and the interior nodes.
+ */
+size_t lt_memory(const LineTree *t, size_t *used) {
+    *used = (size_t)t->count * (sizeof(char *) + 2 * sizeof(size_t) +
+                                sizeof(unsigned) + sizeof(unsigned char));
+    return node_count(t->root) * sizeof(LineNode);
+}
+
+/**
+ * Return the storage slot of line INDEX.
+ *
+ * The slot holds the line's text pointer and, when META is not NULL, its
+ * members are pointed at the line's metadata, so callers may grow or
+ * replace the text in place and keep the metadata in step. Returns NULL
+ * if INDEX is out of range. Slots stay valid until the next lt_insert()
+ * or lt_remove().
+ */
+char **lt_slot(LineTree *t, long index, LineMeta *meta) {
+    if (index < 0 || index >= t->count)
+        return NULL;
+    int pos;
+    LineNode *leaf = lt_find(t, index, &pos);
+    if (meta) {
+        meta->size = &leaf->u.l.size[pos];
+        meta->len = &leaf->u.l.len[pos];
+        meta->hash = &leaf->u.l.hash[pos];
+        meta->state = &leaf->u.l.state[pos];
+    }
+    return &leaf->u.l.text[pos];
+}
+
+/**
+ * Insert TEXT (with allocation size SIZE and length LEN) as line INDEX,
+ * shifting later lines down by one. INDEX may equal the current count to
+ * append. The line's hash and state start out as 0.
+ *
+ * Every node a split may need is allocated before the tree is touched, so
+ * on failure -1 is returned and T is unchanged. Appends walk straight down
+ * the right edge and start a fresh leaf instead of halving the last one,
+ * so loading a file line by line builds completely filled leaves. Returns
+ * 0 on success.
+ */
+int lt_insert(LineTree *t, long index, char *text, size_t size, size_t len) {
+    LineNode *path[LT_MAX_DEPTH];
+    int slot[LT_MAX_DEPTH];
+    LineNode *spare[LT_MAX_DEPTH + 2];
+    int depth = 0;
+    int need = 0;
+
+    if (index < 0 || index > t->count)
+        return -1;
+    int tail = index == t->count;
+    if (!t->root) {
+        t->root = calloc(1, sizeof(LineNode));
+        if (!t->root)
+            return -1;
+        t->root->leaf = 1;
+    }
+
+    LineNode *node = t->root;
+    long pos = index;
+    while (!node->leaf) {
+        int i = 0;
+        if (tail) {
+            i = node->n - 1;
+            pos -= node->count - node->u.child[i]->count;
+        }
+        while (i < node->n - 1 && pos > node->u.child[i]->count) {
+            pos -= node->u.child[i]->count;
+            i++;
+        }
+        if (depth == LT_MAX_DEPTH)
+            return -1;
+        path[depth] = node;
+        slot[depth++] = i;
+        node = node->u.child[i];
+    }
+
+    /* A full leaf splits, as does every full ancestor above it */
+    if (node->n == LT_LEAF_MAX) {
+        int k = depth - 1;
+        need = 1;
+        while (k >= 0 && path[k]->n == LT_NODE_MAX) {
+            need++;
+            k--;
+        }
+        if (k < 0)
+            need++; /* new root */
+    }
+    for (int i = 0; i < need; ++i) {
+        spare[i] = calloc(1, sizeof(LineNode));
+        if (!spare[i]) {
+            while (i-- > 0)
+                free(spare[i]);
+            return -1;
+        }
+    }
+
+    int used = 0;
+    LineNode *leaf = node;
+    LineNode *sib = NULL;
+    if (node->n == LT_LEAF_MAX) {
+        int half = tail ? LT_LEAF_MAX : LT_LEAF_MAX / 2;
+        sib = spare[used++];
+        sib->leaf = 1;
+        node_copy(sib, 0, node, half, node->n - half);
+        sib->n = node->n - half;
+        node->n = half;
+        sib->prev = node;
+        sib->next = node->next;
+        if (node->next)
+            node->next->prev = sib;
+        node->next = sib;
+        if (pos > half || (tail && pos == half)) {
+            node = sib;
+            pos -= half;
+        }
+    }
+    node_shift(node, pos, 1);
+    node->u.l.text[pos] = text;
+    node->u.l.size[pos] = size;
+    node->u.l.len[pos] = len;
+    node->u.l.hash[pos] = 0;
+    node->u.l.state[pos] = 0;
+    node_recount(leaf);
+    if (sib)
+        node_recount(sib);
+
+    while (depth-- > 0) {
+        LineNode *parent = path[depth];
+        int i = slot[depth] + 1;
+        if (!sib) {
+            parent->count++;
+            continue;
+        }
+        if (parent->n < LT_NODE_MAX) {
+            node_shift(parent, i, 1);
+            parent->u.child[i] = sib;
+            parent->count++;
+            sib = NULL;
+            continue;
+        }
+        int half = LT_NODE_MAX / 2;
+        LineNode *split = spare[used++];
+        node_copy(split, 0, parent, half, parent->n - half);
+        split->n = parent->n - half;
+        parent->n = half;
+        LineNode *target = i <= half ? parent : split;
+        if (target == split)
+            i -= half;
+        node_shift(target, i, 1);
+        target->u.child[i] = sib;
+        node_recount(parent);
+        node_recount(split);
+        sib = split;
+    }
+    if (sib) {
+        LineNode *root = spare[used++];
+        root->u.child[0] = t->root;
+        root->u.child[1] = sib;
+        root->n = 2;
+        node_recount(root);
+        t->root = root;
+    }
+
+    t->count++;
+    t->leaf = NULL;
+    return 0;
+}
+
+/**
+ * Remove line INDEX from T and return its text pointer, which the caller
+ * now owns, storing its allocation size in *SIZE. Nodes left under-filled
+ * are merged with or refilled from a sibling. Returns NULL if INDEX is out
+ * of range.
+ */
+char *lt_remove(LineTree *t, long index, size_t *size) {
+    LineNode *path[LT_MAX_DEPTH];
+    int slot[LT_MAX_DEPTH];
+    int depth = 0;
+
+    if (index < 0 || index >= t->count)
+        return NULL;
+
+    LineNode *node = t->root;
+    long pos = index;
+    while (!node->leaf) {
+        int i = 0;
+        while (i < node->n - 1 && pos >= node->u.child[i]->count) {
+            pos -= node->u.child[i]->count;
+            i++;
+        }
+        node->count--;
+        path[depth] = node;
+        slot[depth++] = i;
+        node = node->u.child[i];
+    }
+
+    char *text = node->u.l.text[pos];
+    *size = node->u.l.size[pos];
+    node_shift(node, pos + 1, -1);
+    node->count--;
+
+    while (depth-- > 0) {
+        LineNode *parent = path[depth];
+        int min = node->leaf ? LT_LEAF_MIN : LT_NODE_MIN;
+        int max = node->leaf ? LT_LEAF_MAX : LT_NODE_MAX;
+        if (node->n >= min)
+            break;
+
+        int li = slot[depth] > 0 ? slot[depth] - 1 : 0;
+        LineNode *left = parent->u.child[li];
+        LineNode *right = parent->u.child[li + 1];
+        if (left->n + right->n <= max) {
+            node_copy(left, left->n, right, 0, right->n);
+            left->n += right->n;
+            left->count += right->count;
+            if (left->leaf) {
+                left->next = right->next;
+                if (right->next)
+                    right->next->prev = left;
+            }
+            free(right);
+            node_shift(parent, li + 2, -1);
+            node = parent;
+            continue;
+        }
+
+        long moved;
+        if (node == left) {
+            moved = entry_lines(right, 0);
+            node_copy(left, left->n, right, 0, 1);
+            left->n++;
+            node_shift(right, 1, -1);
+        } else {
+            moved = entry_lines(left, left->n - 1);
+            node_shift(right, 0, 1);
+            node_copy(right, 0, left, left->n - 1, 1);
+            left->n--;
+            moved = -moved;
+        }
+        left->count += moved;
+        right->count -= moved;
+        break;
+    }
+
+    while (!t->root->leaf && t->root->n == 1) {
+        LineNode *old = t->root;
+        t->root = old->u.child[0];
+        free(old);
+    }
+    if (t->root->leaf && t->root->n == 0) {
+        free(t->root);
+        t->root = NULL;
+    }
+
+    t->count--;
+    t->leaf = NULL;
+    return text;
+}
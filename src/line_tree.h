@@ -0,0 +1,52 @@
+#ifndef LINE_TREE_H
+#define LINE_TREE_H
+
+#include <stddef.h>
+
+/*
+ * LineTree
+ * --------
+ * A chunked B-tree holding the lines of a LineBuffer. Leaves store up to
+ * LT_LEAF_MAX line pointers together with metadata about each line, and
+ * interior nodes store the number of lines below each child, so
+ * finding, inserting or removing line N is O(log n). Leaves are linked in
+ * document order and the most recently used leaf is cached, which keeps
+ * the sequential lookups made while drawing the screen O(1).
+ *
+ * The tree only manages structure: text pointers are owned by the caller,
+ * which allocates them before lt_insert() and frees what lt_remove()
+ * returns. The metadata is kept as one array per field in every leaf, so
+ * scanning a single field, such as the lengths, only touches that field's
+ * memory. lt_slot() hands out pointers into those arrays.
+ */
+
+#define LT_LEAF_MAX 256
+#define LT_LEAF_MIN 64
+#define LT_NODE_MAX 64
+#define LT_NODE_MIN 16
+
+typedef struct LineNode LineNode;
+
+/* Metadata of one line; each member points into its leaf's array. */
+typedef struct LineMeta {
+    size_t *size;         /* bytes allocated for the text, 0 if not owned */
+    size_t *len;          /* bytes of text, not counting the terminator */
+    unsigned *hash;       /* content hash, 0 until computed */
+    unsigned char *state; /* caller-defined state, 0 until set */
+} LineMeta;
+
+typedef struct LineTree {
+    LineNode *root;
+    long count;      /* total number of lines */
+    LineNode *leaf;  /* leaf of the most recent lookup */
+    long leaf_start; /* index of the first line stored in leaf */
+} LineTree;
+
+void lt_init(LineTree *t);
+void lt_free(LineTree *t, void (*free_text)(void *));
+char **lt_slot(LineTree *t, long index, LineMeta *meta);
+int lt_insert(LineTree *t, long index, char *text, size_t size, size_t len);
+char *lt_remove(LineTree *t, long index, size_t *size);
+size_t lt_memory(const LineTree *t, size_t *used);
+
+#endif /* LINE_TREE_H */
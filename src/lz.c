@@ -0,0 +1,151 @@
+/*
+ * lz.c
+ * ----
+ * LZ77 compressor for cold text. See lz.h for an overview. Every sequence
+ * starts with a token byte whose high nibble is the number of literals and
+ * whose low nibble is the match length minus LZ_MIN_MATCH; a nibble of 15
+ * is continued by bytes that are added to it until one is below 255. The
+ * literals follow, then the two-byte little-endian distance of the match.
+ * The last sequence holds literals only and ends the input.
+ */
+
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+
+static unsigned lz_hash(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write the continuation bytes of a length whose nibble saturated. */
+static size_t lz_put_length(unsigned char *out, size_t o, size_t n) {
+    for (; n >= 255; n -= 255)
+        out[o++] = 255;
+    out[o++] = (unsigned char)n;
+    return o;
+}
+
+/* Read the continuation of a saturated nibble into *N. */
+static int lz_get_length(const unsigned char *in, size_t len, size_t *i,
+                         size_t *n) {
+    unsigned char b;
+    do {
+        if (*i >= len)
+            return -1;
+        b = in[(*i)++];
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+/*
+ * Emit LIT literals from SRC followed by a match of MATCH bytes DIST back.
+ * A MATCH of zero ends the stream after the literals.
+ */
+static size_t lz_emit(unsigned char *out, size_t o, const unsigned char *src,
+                      size_t lit, size_t dist, size_t match) {
+    size_t m = match ? match - LZ_MIN_MATCH : 0;
+    out[o++] = (unsigned char)((lit < 15 ? lit : 15) << 4 | (m < 15 ? m : 15));
+    if (lit >= 15)
+        o = lz_put_length(out, o, lit - 15);
+    memcpy(out + o, src, lit);
+    o += lit;
+    if (!match)
+        return o;
+    out[o++] = (unsigned char)(dist & 0xff);
+    out[o++] = (unsigned char)(dist >> 8);
+    if (m >= 15)
+        o = lz_put_length(out, o, m - 15);
+    return o;
+}
+
+/** Return the largest compressed size of LEN input bytes. */
+size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+/**
+ * Compress the LEN bytes at SRC into DST, which must have room for
+ * lz_bound(LEN) bytes, and return the compressed size. Runs of input in
+ * which no match is found are skipped over in growing steps, so text that
+ * does not compress costs little more than a copy.
+ */
+size_t lz_compress(const char *src, size_t len, char *dst) {
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+    size_t table[1 << LZ_HASH_BITS]; /* last position + 1 of each hash */
+    size_t anchor = 0; /* first byte not yet emitted */
+    size_t i = 0;
+    size_t o = 0;
+
+    memset(table, 0, sizeof(table));
+    while (i + LZ_MIN_MATCH <= len) {
+        unsigned h = lz_hash(in + i);
+        size_t cand = table[h];
+        table[h] = i + 1;
+        if (!cand || i - (cand - 1) > LZ_WINDOW ||
+            memcmp(in + cand - 1, in + i, LZ_MIN_MATCH) != 0) {
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        size_t ref = cand - 1;
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < len && in[ref + match] == in[i + match])
+            match++;
+        o = lz_emit(out, o, in + anchor, i - anchor, i - ref, match);
+        i += match;
+        anchor = i;
+        if (i >= 2 && i + LZ_MIN_MATCH <= len)
+            table[lz_hash(in + i - 2)] = i - 1;
+    }
+    return lz_emit(out, o, in + anchor, len - anchor, 0, 0);
+}
+
+/**
+ * Expand the LEN bytes of compressed data at SRC into exactly OUT bytes at
+ * DST. Returns 0 on success or -1 if the data is damaged or does not
+ * decode to OUT bytes.
+ */
+int lz_decompress(const char *src, size_t len, char *dst, size_t out) {
+    const unsigned char *in = (const unsigned char *)src;
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < len) {
+        unsigned token = in[i++];
+        size_t lit = token >> 4;
+        if (lit == 15 && lz_get_length(in, len, &i, &lit) < 0)
+            return -1;
+        if (lit > len - i || lit > out - o)
+            return -1;
+        memcpy(dst + o, in + i, lit);
+        i += lit;
+        o += lit;
+        if (i == len)
+            break;
+
+        if (len - i < 2)
+            return -1;
+        size_t dist = in[i] | (size_t)in[i + 1] << 8;
+        i += 2;
+        size_t match = token & 15;
+        if (match == 15 && lz_get_length(in, len, &i, &match) < 0)
+            return -1;
+        match += LZ_MIN_MATCH;
+        if (dist == 0 || dist > o || match > out - o)
+            return -1;
+        if (dist >= match) {
+            memcpy(dst + o, dst + o - dist, match);
+            o += match;
+        } else {
+            /* The copy overlaps its own output */
+            for (size_t k = 0; k < match; ++k, ++o)
+                dst[o] = dst[o - dist];
+        }
+    }
+    return o == out ? 0 : -1;
+}
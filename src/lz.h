@@ -0,0 +1,29 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/*
+ * LZ
+ * --
+ * A small byte-oriented LZ77 compressor used to keep text that is not
+ * being looked at in memory at a fraction of its size. The input is coded
+ * as a sequence of literal runs, each followed by a copy of at least
+ * LZ_MIN_MATCH earlier bytes found through a hash of the next four bytes,
+ * at most LZ_WINDOW bytes back. There is no entropy coding stage: the aim
+ * is to compress and, above all, decompress a few hundred kilobytes fast
+ * enough to do it on every page access.
+ *
+ * Compressed data carries no header; the caller keeps the original length
+ * and passes it to lz_decompress(), which checks every copy against both
+ * buffers so damaged input is rejected rather than read past.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_WINDOW 65535
+
+size_t lz_bound(size_t len);
+size_t lz_compress(const char *src, size_t len, char *dst);
+int lz_decompress(const char *src, size_t len, char *dst, size_t out);
+
+#endif /* LZ_H */
@@ -0,0 +1,147 @@
+/*
+ * mem_budget.c
+ * ------------
+ * Memory accounting and the memory budget. See mem_budget.h for an
+ * overview. The figures are what the editor's data structures hold, not
+ * what the allocator has obtained from the system, so they do not depend
+ * on the C library and are the same for every run over the same files.
+ */
+
+#include "mem_budget.h"
+#include "config.h"
+#include "editor.h"
+#include "file_manager.h"
+#include "files.h"
+#include "hibernate.h"
+#include "line_buffer.h"
+#include "line_pool.h"
+#include <ncurses.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* ncursesw keeps a cchar_t and the change bounds of every window line */
+#define MB_CELL_BYTES 28
+#define MB_ROW_BYTES 24
+
+static bool over_budget;
+static size_t trimmed_to; /* usage after the last trim, 0 if none */
+
+static size_t mb_stack(Node *stack) {
+    size_t bytes = 0;
+    for (; stack; stack = stack->next)
+        bytes += sizeof(*stack);
+    return bytes;
+}
+
+/**
+ * Return the bytes FS costs, not counting mappings or shared pool text.
+ * When MEM is not NULL the figure is broken down there; that visits every
+ * line in memory, whereas the total alone is found without doing so.
+ */
+size_t mb_file_usage(FileState *fs, FileMemory *mem) {
+    FileMemory m = {0, 0, 0, 0, 0};
+    LineMemory lm;
+    m.lines = lb_memory(&fs->buffer, mem ? &lm : NULL);
+    if (mem) {
+        m.lines = lm.text;
+        m.slack = lm.slack;
+        m.mapped = lm.mapped;
+    }
+    m.lines += sizeof(*fs);
+    m.undo = mb_stack(fs->undo_stack) + mb_stack(fs->redo_stack);
+    if (fs->text_win)
+        m.window = (size_t)getmaxy(fs->text_win) *
+                   ((size_t)getmaxx(fs->text_win) * MB_CELL_BYTES +
+                    MB_ROW_BYTES);
+    if (mem)
+        *mem = m;
+    return m.lines + m.slack + m.undo + m.window;
+}
+
+/** Return the bytes used by all files of FM and the shared line pool. */
+size_t mb_usage(FileManager *fm) {
+    size_t bytes = pool_bytes();
+    for (int i = 0; i < fm->count; ++i)
+        if (fm->files[i])
+            bytes += mb_file_usage(fm->files[i], NULL);
+    return bytes;
+}
+
+/*
+ * Hibernate the files other than ACTIVE, least recently shown first,
+ * until USED bytes fall within BUDGET, and return the bytes then in use.
+ */
+static size_t mb_hibernate(FileManager *fm, FileState *active, size_t used,
+                           size_t budget) {
+    while (used > budget) {
+        FileState *oldest = NULL;
+        for (int i = 0; i < fm->count; ++i) {
+            FileState *fs = fm->files[i];
+            if (fs && fs != active && hb_can_sleep(fs) &&
+                (!oldest || fs->active_at < oldest->active_at))
+                oldest = fs;
+        }
+        if (!oldest)
+            break;
+        if (hb_sleep(oldest) < 0)
+            break;
+        used = mb_usage(fm);
+    }
+    return used;
+}
+
+/*
+ * Trim every file, ACTIVE last, until USED bytes fall within BUDGET, and
+ * return the bytes then in use. Files that are not shown are hibernated
+ * before the active one is trimmed.
+ */
+static size_t mb_trim(FileManager *fm, FileState *active, size_t used,
+                      size_t budget) {
+    for (int i = 0; i < fm->count && used > budget; ++i) {
+        FileState *fs = fm->files[i];
+        if (fs && fs != active)
+            used -= lb_trim(&fs->buffer);
+    }
+    used = mb_hibernate(fm, active, used, budget);
+    if (active && used > budget)
+        lb_trim(&active->buffer);
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return mb_usage(fm);
+}
+
+/**
+ * Enforce app_config.memory_budget_mb over the files of FM, ACTIVE being
+ * the one shown. Files are trimmed when they use more than the budget,
+ * but not again until something has been freed or usage has grown by a
+ * sixteenth of the budget since, so a buffer that cannot get any smaller
+ * is not copied over and over.
+ *
+ * Returns 1 if the editor has just gone over budget, 0 otherwise.
+ */
+int mb_check(FileManager *fm, FileState *active) {
+    bool was_over = over_budget;
+    size_t budget = (size_t)app_config.memory_budget_mb << 20;
+    if (budget == 0) {
+        over_budget = false;
+        trimmed_to = 0;
+        return 0;
+    }
+    size_t used = mb_usage(fm);
+    if (used > budget &&
+        (used < trimmed_to || used > trimmed_to + budget / 16)) {
+        used = mb_trim(fm, active, used, budget);
+        trimmed_to = used;
+    } else if (used <= budget) {
+        trimmed_to = 0;
+    }
+    over_budget = used > budget;
+    return over_budget && !was_over ? 1 : 0;
+}
+
+/** Return true while the files use more memory than the budget allows. */
+bool mb_over_budget(void) {
+    return over_budget;
+}
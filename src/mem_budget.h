@@ -0,0 +1,43 @@
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Memory budget
+ * -------------
+ * Accounts for the memory held by every open file and keeps the editor
+ * within app_config.memory_budget_mb. mb_file_usage() breaks a file's
+ * cost down into its lines, the slack allocated around them, its undo
+ * and redo records and its window. Text in the line pool, which buffers
+ * and undo records share, is counted once for the whole editor.
+ *
+ * mb_check() is called while the editor is idle. Once the files use more
+ * than the budget it trims them, inactive files first (see lb_trim()),
+ * then hibernates the files not shown, least recently shown first (see
+ * hibernate.h), and hands freed memory back to the system. If that is not
+ * enough the editor is over budget until memory is freed otherwise, for
+ * instance by closing a file, and mb_over_budget() tells editing commands
+ * to refuse anything that would allocate more.
+ */
+
+#define MB_CHECK_MS 1000 /* interval between checks of the budget */
+
+struct FileState;
+struct FileManager;
+
+typedef struct FileMemory {
+    size_t lines;  /* line text and the structures indexing it */
+    size_t slack;  /* room allocated for lines beyond their text */
+    size_t undo;   /* undo and redo records */
+    size_t window; /* the file's ncurses window */
+    size_t mapped; /* file mappings, which are not counted */
+} FileMemory;
+
+size_t mb_file_usage(struct FileState *fs, FileMemory *mem);
+size_t mb_usage(struct FileManager *fm);
+int mb_check(struct FileManager *fm, struct FileState *active);
+bool mb_over_budget(void);
+
+#endif /* MEM_BUDGET_H */
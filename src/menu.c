@@ -48,6 +48,7 @@ static void menuMacroStart(EditorContext *ctx);
 static void menuMacroStop(EditorContext *ctx);
 static void menuMacroPlay(EditorContext *ctx);
 static void menuManageMacros(EditorContext *ctx);
+static void menuMemoryUsage(EditorContext *ctx);
 
 
 static void menuNewFile_cb(void)    { menuNewFile(menu_ctx); }
@@ -57,7 +58,9 @@ static void menuSaveAs_cb(void)     { menuSaveAs(menu_ctx); }
 static void menuCloseFile_cb(void)  { menuCloseFile(menu_ctx); }
 static void menuNextFile_cb(void)   { menuNextFile(menu_ctx); }
 static void menuPrevFile_cb(void)   { menuPrevFile(menu_ctx); }
+static void menuFollow_cb(void)     { menuFollow(menu_ctx); }
 static void menuSettings_cb(void)   { menuSettings(menu_ctx); }
+static void menuMemory_cb(void)     { menuMemoryUsage(menu_ctx); }
 static void menuQuitEditor_cb(void) { menuQuitEditor(menu_ctx); }
 static void menuUndo_cb(void)       { menuUndo(menu_ctx); }
 static void menuRedo_cb(void)       { menuRedo(menu_ctx); }
@@ -101,11 +104,13 @@ static MenuItem edit_items[] = {
 static MenuItem nav_items[] = {
     {"Next File", "F6", menuNextFile_cb, false},
     {"Previous File", "F7", menuPrevFile_cb, false},
+    {"Follow File", "F8", menuFollow_cb, false},
 };
 
-/* Options menu currently only exposes the settings dialog. */
+/* Options menu exposes the settings dialog and the memory report. */
 static MenuItem opt_items[] = {
     {"Settings", NULL, menuSettings_cb, false},
+    {"Memory Usage...", NULL, menuMemory_cb, false},
 };
 
 /* Macros menu controls recording and playback of macros. */
@@ -454,6 +459,18 @@ void menuPrevFile(EditorContext *ctx) {
     (void)prev_file(ctx);
 }
 
+/**
+ * Callback for Navigate -> "Follow File".
+ *
+ * Turns follow mode on or off for the active file, so text appended to
+ * it on disk shows up as it is written.
+ *
+ * @param ctx Editor context that tracks the active file.
+ */
+void menuFollow(EditorContext *ctx) {
+    toggle_follow(ctx, ctx->active_file);
+}
+
 /**
  * Callback for Macros -> "Start Recording".
  *
@@ -513,6 +530,19 @@ static void menuManageMacros(EditorContext *ctx) {
     update_status_bar(menu_ctx, menu_ctx->active_file);
 }
 
+/**
+ * Callback for Options -> "Memory Usage...".
+ *
+ * Shows how much memory each open file uses and how that compares with
+ * the configured memory budget.
+ *
+ * @param ctx Editor context used for drawing.
+ */
+static void menuMemoryUsage(EditorContext *ctx) {
+    show_memory_usage(ctx);
+    update_status_bar(menu_ctx, menu_ctx->active_file);
+}
+
 /**
  * Callback for Options -> "Settings".
  *
@@ -28,6 +28,7 @@ void menuSaveAs(EditorContext *ctx);
 void menuCloseFile(EditorContext *ctx);
 void menuNextFile(EditorContext *ctx);
 void menuPrevFile(EditorContext *ctx);
+void menuFollow(EditorContext *ctx);
 void menuSettings(EditorContext *ctx);
 void menuQuitEditor(EditorContext *ctx);
 void menuUndo(EditorContext *ctx);
@@ -0,0 +1,508 @@
+/*
+ * piece_table.c
+ * -------------
+ * Implementation of the PieceTable document model.  The original file is
+ * mapped read-only (or read into memory when mapping is not possible, for
+ * example for pipes and special files) and split into pieces of at most
+ * PT_CHUNK_SIZE bytes so that scanning inside a single piece stays cheap.
+ * Inserted text is appended to the add buffer and referenced by new pieces.
+ *
+ * Pieces live in a treap keyed implicitly by document position.  Each node
+ * caches the byte length and newline count of its subtree which lets
+ * pt_line_start() and the split/merge based editing operations run in
+ * O(log n) expected time.
+ */
+
+#include "piece_table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PT_CHUNK_SIZE (64 * 1024)
+#define PT_ADD_INITIAL 4096
+#define PT_READ_CHUNK 65536
+
+enum { PT_ORIGINAL, PT_ADD };
+
+typedef struct PieceNode {
+    struct PieceNode *left;
+    struct PieceNode *right;
+    unsigned int priority;
+    int source;            /* PT_ORIGINAL or PT_ADD */
+    size_t start;          /* offset of the span inside its source buffer */
+    size_t len;            /* bytes covered by this piece */
+    size_t newlines;       /* '\n' bytes inside this piece */
+    size_t total_len;      /* bytes covered by the whole subtree */
+    size_t total_newlines; /* newlines inside the whole subtree */
+} PieceNode;
+
+struct PieceTable {
+    const char *original;  /* read-only original file contents */
+    size_t original_len;
+    int mapped;            /* original is an mmap region, not heap memory */
+    char *add;             /* append-only buffer of inserted text */
+    size_t add_len;
+    size_t add_cap;
+    PieceNode *root;
+    PieceNode *spare;      /* preallocated node consumed when splitting */
+    unsigned int seed;
+};
+
+/* Simple xorshift generator used for treap priorities. */
+static unsigned int next_priority(PieceTable *pt) {
+    unsigned int x = pt->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->seed = x;
+    return x;
+}
+
+static const char *piece_data(const PieceTable *pt, const PieceNode *n) {
+    return (n->source == PT_ORIGINAL ? pt->original : pt->add) + n->start;
+}
+
+static size_t count_newlines(const char *p, size_t len) {
+    size_t count = 0;
+    const char *end = p + len;
+    while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+/* Recompute the cached subtree totals of N from its children. */
+static void update(PieceNode *n) {
+    n->total_len = n->len;
+    n->total_newlines = n->newlines;
+    if (n->left) {
+        n->total_len += n->left->total_len;
+        n->total_newlines += n->left->total_newlines;
+    }
+    if (n->right) {
+        n->total_len += n->right->total_len;
+        n->total_newlines += n->right->total_newlines;
+    }
+}
+
+static PieceNode *node_new(PieceTable *pt, int source, size_t start, size_t len) {
+    PieceNode *n = malloc(sizeof(PieceNode));
+    if (!n)
+        return NULL;
+    n->left = n->right = NULL;
+    n->priority = next_priority(pt);
+    n->source = source;
+    n->start = start;
+    n->len = len;
+    n->newlines = count_newlines(piece_data(pt, n), len);
+    update(n);
+    return n;
+}
+
+static void free_tree(PieceNode *n) {
+    while (n) {
+        free_tree(n->left);
+        PieceNode *right = n->right;
+        free(n);
+        n = right;
+    }
+}
+
+/* Concatenate two treaps where every piece of A precedes every piece of B. */
+static PieceNode *merge(PieceNode *a, PieceNode *b) {
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->priority > b->priority) {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    update(b);
+    return b;
+}
+
+/*
+ * Split T so that *L holds the first OFFSET bytes and *R the rest.  When
+ * OFFSET falls inside a piece that piece is cut in two; the tail reuses
+ * pt->spare, which the caller must have allocated beforehand.
+ */
+static void split(PieceTable *pt, PieceNode *t, size_t offset,
+                  PieceNode **l, PieceNode **r) {
+    if (!t) {
+        *l = *r = NULL;
+        return;
+    }
+    size_t left_len = t->left ? t->left->total_len : 0;
+    if (offset <= left_len) {
+        split(pt, t->left, offset, l, &t->left);
+        update(t);
+        *r = t;
+    } else if (offset >= left_len + t->len) {
+        split(pt, t->right, offset - left_len - t->len, &t->right, r);
+        update(t);
+        *l = t;
+    } else {
+        size_t cut = offset - left_len;
+        PieceNode *tail = pt->spare;
+        pt->spare = NULL;
+        tail->left = NULL;
+        tail->right = t->right;
+        tail->priority = t->priority;
+        tail->source = t->source;
+        tail->start = t->start + cut;
+        tail->len = t->len - cut;
+        tail->newlines = count_newlines(piece_data(pt, tail), tail->len);
+        t->len = cut;
+        t->newlines -= tail->newlines;
+        t->right = NULL;
+        update(tail);
+        update(t);
+        *l = t;
+        *r = tail;
+    }
+}
+
+static int reserve_spare(PieceTable *pt) {
+    if (!pt->spare)
+        pt->spare = malloc(sizeof(PieceNode));
+    return pt->spare ? 0 : -1;
+}
+
+static int grow_add(PieceTable *pt, size_t extra) {
+    if (pt->add_len + extra <= pt->add_cap)
+        return 0;
+    size_t cap = pt->add_cap ? pt->add_cap : PT_ADD_INITIAL;
+    while (cap < pt->add_len + extra)
+        cap *= 2;
+    char *tmp = realloc(pt->add, cap);
+    if (!tmp)
+        return -1;
+    pt->add = tmp;
+    pt->add_cap = cap;
+    return 0;
+}
+
+/*
+ * Extend the piece ending at OFFSET when it is the most recent span of the
+ * add buffer.  This keeps consecutive typing inside a single piece.
+ * Returns 1 when a piece was extended and 0 otherwise.
+ */
+static int extend_piece(PieceNode *n, size_t offset, size_t add_start,
+                        size_t len, size_t newlines) {
+    if (!n || offset == 0)
+        return 0;
+    size_t left_len = n->left ? n->left->total_len : 0;
+    int done;
+    if (offset <= left_len) {
+        done = extend_piece(n->left, offset, add_start, len, newlines);
+    } else if (offset <= left_len + n->len) {
+        if (offset != left_len + n->len || n->source != PT_ADD ||
+            n->start + n->len != add_start)
+            return 0;
+        n->len += len;
+        n->newlines += newlines;
+        done = 1;
+    } else {
+        done = extend_piece(n->right, offset - left_len - n->len, add_start,
+                            len, newlines);
+    }
+    if (done)
+        update(n);
+    return done;
+}
+
+/* Read the whole of FD into a heap buffer. Used when mmap is unavailable. */
+static int read_all(int fd, char **out, size_t *out_len) {
+    size_t cap = PT_READ_CHUNK;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    if (!buf)
+        return -1;
+    for (;;) {
+        if (len == cap) {
+            char *tmp = realloc(buf, cap * 2);
+            if (!tmp) {
+                free(buf);
+                return -1;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += (size_t)n;
+    }
+    *out = buf;
+    *out_len = len;
+    return 0;
+}
+
+/**
+ * Create an empty piece table.
+ *
+ * The table has no original span and an empty add buffer. Returns NULL on
+ * allocation failure. Release the table with pt_free().
+ */
+PieceTable *pt_create(void) {
+    PieceTable *pt = calloc(1, sizeof(PieceTable));
+    if (!pt)
+        return NULL;
+    pt->seed = 0x9E3779B9u;
+    return pt;
+}
+
+/**
+ * Open PATH as the original span of a new piece table.
+ *
+ * Regular files are memory mapped read-only; pipes, special files and
+ * mapping failures fall back to reading the data into memory. Returns NULL
+ * if the file cannot be read or memory is exhausted.
+ */
+PieceTable *pt_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    PieceTable *pt = pt_create();
+    if (!pt) {
+        close(fd);
+        return NULL;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            pt->original = map;
+            pt->original_len = (size_t)st.st_size;
+            pt->mapped = 1;
+        }
+    }
+    if (!pt->mapped) {
+        char *buf;
+        size_t len;
+        if (read_all(fd, &buf, &len) < 0) {
+            close(fd);
+            pt_free(pt);
+            return NULL;
+        }
+        pt->original = buf;
+        pt->original_len = len;
+    }
+    close(fd);
+
+    size_t len = pt->original_len;
+    for (size_t off = 0; off < len; off += PT_CHUNK_SIZE) {
+        size_t n = len - off < PT_CHUNK_SIZE ? len - off : PT_CHUNK_SIZE;
+        PieceNode *node = node_new(pt, PT_ORIGINAL, off, n);
+        if (!node) {
+            pt_free(pt);
+            return NULL;
+        }
+        pt->root = merge(pt->root, node);
+    }
+    return pt;
+}
+
+/**
+ * Release a piece table along with its pieces, add buffer and mapping.
+ */
+void pt_free(PieceTable *pt) {
+    if (!pt)
+        return;
+    free_tree(pt->root);
+    free(pt->spare);
+    free(pt->add);
+    if (pt->mapped)
+        munmap((void *)pt->original, pt->original_len);
+    else
+        free((void *)pt->original);
+    free(pt);
+}
+
+/** Return the number of bytes in the document. */
+size_t pt_length(const PieceTable *pt) {
+    return pt && pt->root ? pt->root->total_len : 0;
+}
+
+/** Return the number of '\n' bytes in the document. */
+size_t pt_newlines(const PieceTable *pt) {
+    return pt && pt->root ? pt->root->total_newlines : 0;
+}
+
+/**
+ * Return the byte offset at which line LINE (0-based) starts.
+ *
+ * Line 0 always starts at offset 0; line N starts just after the Nth
+ * newline. Returns (size_t)-1 when the document has fewer than LINE
+ * newlines.
+ */
+size_t pt_line_start(const PieceTable *pt, size_t line) {
+    if (line == 0)
+        return 0;
+    const PieceNode *n = pt->root;
+    size_t base = 0;
+    while (n) {
+        size_t left_nl = n->left ? n->left->total_newlines : 0;
+        size_t left_len = n->left ? n->left->total_len : 0;
+        if (line <= left_nl) {
+            n = n->left;
+            continue;
+        }
+        line -= left_nl;
+        if (line <= n->newlines) {
+            const char *p = piece_data(pt, n);
+            const char *end = p + n->len;
+            const char *q = p;
+            for (;;) {
+                q = memchr(q, '\n', (size_t)(end - q));
+                if (--line == 0)
+                    break;
+                q++;
+            }
+            return base + left_len + (size_t)(q - p) + 1;
+        }
+        line -= n->newlines;
+        base += left_len + n->len;
+        n = n->right;
+    }
+    return (size_t)-1;
+}
+
+/**
+ * Copy up to LEN bytes starting at OFFSET into OUT.
+ *
+ * OUT is not NUL terminated. Returns the number of bytes copied which is
+ * smaller than LEN only when the range extends past the end of the document.
+ */
+size_t pt_copy(const PieceTable *pt, size_t offset, size_t len, char *out) {
+    size_t copied = 0;
+    while (copied < len) {
+        const PieceNode *n = pt->root;
+        size_t off = offset + copied;
+        while (n) {
+            size_t left_len = n->left ? n->left->total_len : 0;
+            if (off < left_len) {
+                n = n->left;
+            } else if (off < left_len + n->len) {
+                off -= left_len;
+                break;
+            } else {
+                off -= left_len + n->len;
+                n = n->right;
+            }
+        }
+        if (!n)
+            break;
+        size_t chunk = n->len - off;
+        if (chunk > len - copied)
+            chunk = len - copied;
+        memcpy(out + copied, piece_data(pt, n) + off, chunk);
+        copied += chunk;
+    }
+    return copied;
+}
+
+/**
+ * Insert LEN bytes of TEXT at byte OFFSET.
+ *
+ * The text is appended to the add buffer and referenced by a new piece, or
+ * by extending the previous piece when typing continues at the same spot.
+ * OFFSET values past the end append to the document. Returns 0 on success
+ * or -1 on allocation failure, in which case the document is unchanged.
+ */
+int pt_insert(PieceTable *pt, size_t offset, const char *text, size_t len) {
+    if (!pt || (!text && len))
+        return -1;
+    if (len == 0)
+        return 0;
+    size_t total = pt_length(pt);
+    if (offset > total)
+        offset = total;
+    if (reserve_spare(pt) < 0 || grow_add(pt, len) < 0)
+        return -1;
+
+    size_t add_start = pt->add_len;
+    memcpy(pt->add + add_start, text, len);
+    pt->add_len += len;
+
+    if (extend_piece(pt->root, offset, add_start, len, count_newlines(text, len)))
+        return 0;
+
+    PieceNode *node = node_new(pt, PT_ADD, add_start, len);
+    if (!node)
+        return -1;
+    PieceNode *l, *r;
+    split(pt, pt->root, offset, &l, &r);
+    pt->root = merge(merge(l, node), r);
+    return 0;
+}
+
+/**
+ * Remove LEN bytes starting at byte OFFSET.
+ *
+ * Ranges extending past the end are clipped. The bytes remain in their
+ * source buffers; only the pieces referencing them are dropped. Returns 0
+ * on success or -1 on allocation failure with the document unchanged.
+ */
+int pt_delete(PieceTable *pt, size_t offset, size_t len) {
+    if (!pt)
+        return -1;
+    size_t total = pt_length(pt);
+    if (offset >= total || len == 0)
+        return 0;
+    if (len > total - offset)
+        len = total - offset;
+    if (reserve_spare(pt) < 0)
+        return -1;
+
+    PieceNode *l, *rest, *mid, *r;
+    split(pt, pt->root, offset, &l, &rest);
+    if (reserve_spare(pt) < 0) {
+        pt->root = merge(l, rest);
+        return -1;
+    }
+    split(pt, rest, len, &mid, &r);
+    free_tree(mid);
+    pt->root = merge(l, r);
+    return 0;
+}
+
+/* Number of pieces in the subtree rooted at NODE. */
+static size_t pt_pieces(const PieceNode *node) {
+    return node ? 1 + pt_pieces(node->left) + pt_pieces(node->right) : 0;
+}
+
+/**
+ * Report the memory used by PT: *HEAP receives the bytes of text and
+ * pieces held on the heap, *SLACK the unused capacity of the add buffer
+ * and *MAPPED the size of a mapped original file, which the kernel can
+ * page out at will.
+ */
+void pt_memory(const PieceTable *pt, size_t *heap, size_t *slack,
+               size_t *mapped) {
+    *heap = *slack = *mapped = 0;
+    if (!pt)
+        return;
+    *heap = sizeof(*pt) + pt->add_len +
+            (pt_pieces(pt->root) + (pt->spare ? 1 : 0)) * sizeof(PieceNode);
+    *slack = pt->add_cap - pt->add_len;
+    if (pt->mapped)
+        *mapped = pt->original_len;
+    else
+        *heap += pt->original_len;
+}
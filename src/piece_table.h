@@ -0,0 +1,33 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include <stddef.h>
+
+/*
+ * PieceTable
+ * ----------
+ * A piece-table document model.  The original file contents are kept as a
+ * single read-only span (memory mapped when possible) and every inserted
+ * byte is appended to a separate add buffer.  The document itself is a
+ * sequence of pieces referencing ranges of those two buffers.  Pieces are
+ * stored in a balanced tree (a treap ordered by document position) where
+ * each node caches the byte length and newline count of its subtree, so
+ * locating an offset or the start of a line and editing at any position
+ * are O(log n) in the number of pieces regardless of file size.
+ */
+
+typedef struct PieceTable PieceTable;
+
+PieceTable *pt_create(void);
+PieceTable *pt_open(const char *path);
+void pt_free(PieceTable *pt);
+size_t pt_length(const PieceTable *pt);
+size_t pt_newlines(const PieceTable *pt);
+size_t pt_line_start(const PieceTable *pt, size_t line);
+size_t pt_copy(const PieceTable *pt, size_t offset, size_t len, char *out);
+int pt_insert(PieceTable *pt, size_t offset, const char *text, size_t len);
+int pt_delete(PieceTable *pt, size_t offset, size_t len);
+void pt_memory(const PieceTable *pt, size_t *heap, size_t *slack,
+               size_t *mapped);
+
+#endif /* PIECE_TABLE_H */
@@ -0,0 +1,194 @@
+/*
+ * read_ahead.c
+ * ------------
+ * Background read-ahead. See read_ahead.h for an overview. The slots are
+ * shared between the editor and the worker and guarded by a mutex that is
+ * never held across a read: a slot being read is marked as such, and
+ * ra_take() waits for it rather than reading the same bytes a second time.
+ * Only one thread may request and take ranges, so a slot being read is
+ * never reused while ra_take() waits for it.
+ */
+
+#include "read_ahead.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+enum { RA_FREE, RA_QUEUED, RA_READING, RA_READY };
+
+struct RaSlot {
+    int state;
+    off_t offset;
+    size_t bytes;
+    char *text;          /* the range, NUL terminated, once RA_READY */
+    unsigned long stamp; /* when the range was requested */
+};
+
+struct ReadAhead {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; /* a range was queued, or the reader is stopping */
+    pthread_cond_t done; /* a read has finished */
+    int fd;
+    bool cancel;         /* set by ra_free() to stop the worker */
+    unsigned long clock;
+    struct RaSlot slot[RA_SLOTS];
+};
+
+/* Read BYTES bytes at OFFSET into a new buffer, or return NULL. */
+static char *ra_read(int fd, off_t offset, size_t bytes) {
+    posix_fadvise(fd, offset, (off_t)bytes, POSIX_FADV_WILLNEED);
+    char *text = malloc(bytes + 1);
+    size_t got = 0;
+    while (text && got < bytes) {
+        ssize_t n = pread(fd, text + got, bytes - got, offset + (off_t)got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+    }
+    if (text && got < bytes) {
+        free(text);
+        return NULL;
+    }
+    if (text)
+        text[bytes] = '\0';
+    return text;
+}
+
+static void *ra_worker(void *arg) {
+    ReadAhead *ra = arg;
+    pthread_mutex_lock(&ra->lock);
+    for (;;) {
+        /* Serve requests in the order they were made */
+        struct RaSlot *next = NULL;
+        for (int i = 0; i < RA_SLOTS; ++i)
+            if (ra->slot[i].state == RA_QUEUED &&
+                (!next || ra->slot[i].stamp < next->stamp))
+                next = &ra->slot[i];
+        if (ra->cancel)
+            break;
+        if (!next) {
+            pthread_cond_wait(&ra->wake, &ra->lock);
+            continue;
+        }
+        next->state = RA_READING;
+        off_t offset = next->offset;
+        size_t bytes = next->bytes;
+        pthread_mutex_unlock(&ra->lock);
+
+        char *text = ra_read(ra->fd, offset, bytes);
+
+        pthread_mutex_lock(&ra->lock);
+        next->text = text;
+        next->state = text ? RA_READY : RA_FREE;
+        pthread_cond_broadcast(&ra->done);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+/**
+ * Start a read-ahead worker for the open file FD. Returns NULL if the
+ * worker cannot be started; callers then simply read everything
+ * themselves.
+ */
+ReadAhead *ra_start(int fd) {
+    ReadAhead *ra = calloc(1, sizeof(ReadAhead));
+    if (!ra)
+        return NULL;
+    ra->fd = fd;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->wake, NULL);
+    pthread_cond_init(&ra->done, NULL);
+    if (pthread_create(&ra->thread, NULL, ra_worker, ra) != 0) {
+        pthread_cond_destroy(&ra->done);
+        pthread_cond_destroy(&ra->wake);
+        pthread_mutex_destroy(&ra->lock);
+        free(ra);
+        return NULL;
+    }
+    return ra;
+}
+
+/** Stop the worker, waiting for a read in progress, and release RA. */
+void ra_free(ReadAhead *ra) {
+    if (!ra)
+        return;
+    pthread_mutex_lock(&ra->lock);
+    ra->cancel = true;
+    pthread_cond_signal(&ra->wake);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    for (int i = 0; i < RA_SLOTS; ++i)
+        free(ra->slot[i].text);
+    pthread_cond_destroy(&ra->done);
+    pthread_cond_destroy(&ra->wake);
+    pthread_mutex_destroy(&ra->lock);
+    free(ra);
+}
+
+/**
+ * Queue the BYTES bytes at OFFSET to be read in the background. A range
+ * that is already queued, being read or staged is left alone. When every
+ * slot is taken the oldest range not being read is dropped for this one.
+ */
+void ra_request(ReadAhead *ra, off_t offset, size_t bytes) {
+    if (!ra)
+        return;
+    pthread_mutex_lock(&ra->lock);
+    struct RaSlot *use = NULL;
+    for (int i = 0; i < RA_SLOTS; ++i) {
+        struct RaSlot *s = &ra->slot[i];
+        if (s->state != RA_FREE && s->offset == offset && s->bytes == bytes) {
+            pthread_mutex_unlock(&ra->lock);
+            return;
+        }
+        if (use && use->state == RA_FREE)
+            continue; /* keep the first free slot, but look for a match */
+        if (s->state == RA_FREE ||
+            (s->state != RA_READING && (!use || s->stamp < use->stamp)))
+            use = s;
+    }
+    if (use) {
+        free(use->text);
+        use->text = NULL;
+        use->state = RA_QUEUED;
+        use->offset = offset;
+        use->bytes = bytes;
+        use->stamp = ++ra->clock;
+        pthread_cond_signal(&ra->wake);
+    }
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/**
+ * Collect the BYTES bytes at OFFSET if they were requested. A range still
+ * being read is waited for; one that was read is returned as a buffer of
+ * BYTES + 1 bytes ending in a NUL, which the caller must free. Returns
+ * NULL if the range was never requested, has not been started yet (the
+ * request is then withdrawn) or could not be read.
+ */
+char *ra_take(ReadAhead *ra, off_t offset, size_t bytes) {
+    if (!ra)
+        return NULL;
+    char *text = NULL;
+    pthread_mutex_lock(&ra->lock);
+    for (int i = 0; i < RA_SLOTS; ++i) {
+        struct RaSlot *s = &ra->slot[i];
+        if (s->state == RA_FREE || s->offset != offset || s->bytes != bytes)
+            continue;
+        while (s->state == RA_READING)
+            pthread_cond_wait(&ra->done, &ra->lock);
+        text = s->text;
+        s->text = NULL;
+        s->state = RA_FREE;
+        break;
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return text;
+}
@@ -0,0 +1,31 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * ReadAhead
+ * ---------
+ * A background reader that fetches ranges of a file before the editor
+ * needs them. Ranges are queued with ra_request(); a worker thread hints
+ * each one to the kernel with posix_fadvise(), reads it with pread() into
+ * a staging buffer and keeps it until ra_take() collects it. The editor
+ * therefore only waits for the disk when it reaches text that was not
+ * requested in time.
+ *
+ * At most RA_SLOTS ranges are staged or queued at once; a new request
+ * replaces the oldest one that nobody has collected. The worker reads
+ * through the descriptor it was given, which stays owned by the caller.
+ */
+
+#define RA_SLOTS 8 /* ranges queued or staged at once */
+
+typedef struct ReadAhead ReadAhead;
+
+ReadAhead *ra_start(int fd);
+void ra_free(ReadAhead *ra);
+void ra_request(ReadAhead *ra, off_t offset, size_t bytes);
+char *ra_take(ReadAhead *ra, off_t offset, size_t bytes);
+
+#endif /* READ_AHEAD_H */
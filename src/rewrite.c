@@ -0,0 +1,509 @@
+/*
+ * rewrite.c
+ * ---------
+ * Streaming replace-all for huge files. See rewrite.h for an overview.
+ * Chunk K covers RW_CHUNK bytes from K * RW_CHUNK plus the overlap; only
+ * matches starting in its first RW_CHUNK bytes are its own, and a match
+ * running into the next chunk makes that chunk skip the bytes it covered.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* renameat2 */
+#endif
+
+#include "rewrite.h"
+#include "files.h"
+#include "journal.h"
+#include "line_index.h"
+#include "read_ahead.h"
+#include "save.h"
+#include "syntax.h"
+#include "undo.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RW_LOAD_LINES 1024 /* lines past the cursor loaded after a swap */
+
+struct RewriteJob {
+    pthread_t thread;
+    bool threaded;    /* thread was started and must be joined */
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    char backup[PATH_MAX]; /* where the original was kept */
+    char *search;     /* lower case when ignore_case is set */
+    size_t slen;
+    char *replacement;
+    size_t rlen;
+    bool ignore_case;
+    bool sync;
+    off_t total;      /* bytes of the file */
+    off_t read;       /* bytes the matcher has been through */
+    long count;       /* occurrences replaced */
+    bool cancel;      /* set by rw_cancel() */
+    bool done;
+    int err;          /* errno of the failure, 0 on success */
+};
+
+/* The original kept by the latest replacement in a file. */
+struct Rewrite {
+    char backup[PATH_MAX];
+    long mark;        /* line of the undo record marking the replacement */
+    dev_t dev;        /* the file at the path, to tell it was not saved */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+static long rw_marks; /* replacements made, each marked by its negation */
+
+/* Bytes of the chunk of JOB's file at OFFSET, overlap included. */
+static size_t rw_span(const RewriteJob *job, off_t offset) {
+    off_t len = RW_CHUNK + (off_t)job->slen - 1;
+    return (size_t)(job->total - offset < len ? job->total - offset : len);
+}
+
+/*
+ * Return the LEN bytes at OFFSET of IN in a buffer the caller frees,
+ * taken from RA when it has read them already, or NULL with errno set.
+ */
+static char *rw_chunk(ReadAhead *ra, int in, off_t offset, size_t len) {
+    char *text = ra_take(ra, offset, len);
+    if (text)
+        return text;
+    text = malloc(len + 1);
+    size_t got = 0;
+    while (text && got < len) {
+        ssize_t n = pread(in, text + got, len - got, offset + (off_t)got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            /* The file shrank under the matcher */
+            int err = n < 0 ? errno : EIO;
+            free(text);
+            errno = err;
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+    return text;
+}
+
+/*
+ * Find the first match starting at or after POS and before LIMIT in the
+ * LEN bytes at TEXT, or return NULL.
+ */
+static const char *rw_find(const RewriteJob *job, const char *text,
+                           size_t pos, size_t limit, size_t len) {
+    const char *s = job->search;
+    size_t slen = job->slen;
+    if (len < slen)
+        return NULL;
+    if (limit > len - slen + 1)
+        limit = len - slen + 1;
+    const char *p = text + pos;
+    const char *end = text + limit;
+    if (!job->ignore_case) {
+        while (p < end && (p = memchr(p, s[0], (size_t)(end - p)))) {
+            if (memcmp(p + 1, s + 1, slen - 1) == 0)
+                return p;
+            p++;
+        }
+        return NULL;
+    }
+    for (; p < end; ++p) {
+        size_t i = 0;
+        while (i < slen && tolower((unsigned char)p[i]) == s[i])
+            i++;
+        if (i == slen)
+            return p;
+    }
+    return NULL;
+}
+
+/*
+ * Stream IN through the matcher to OUT, the replacement written in place
+ * of each match. Returns 0 or an errno value.
+ */
+static int rw_stream(RewriteJob *job, int in, int out) {
+    SvBatch *b = calloc(1, sizeof(*b));
+    if (!b)
+        return ENOMEM;
+    b->fd = out;
+    ReadAhead *ra = ra_start(in);
+    for (int k = 1; k < RW_AHEAD; ++k)
+        if ((off_t)k * RW_CHUNK < job->total)
+            ra_request(ra, (off_t)k * RW_CHUNK,
+                       rw_span(job, (off_t)k * RW_CHUNK));
+    int err = 0;
+    size_t skip = 0; /* bytes of the chunk the last match covered */
+    for (off_t base = 0; base < job->total && !err; base += RW_CHUNK) {
+        pthread_mutex_lock(&job->lock);
+        bool cancel = job->cancel;
+        pthread_mutex_unlock(&job->lock);
+        if (cancel) {
+            err = ECANCELED;
+            break;
+        }
+        off_t ahead = base + (off_t)RW_AHEAD * RW_CHUNK;
+        if (ahead < job->total)
+            ra_request(ra, ahead, rw_span(job, ahead));
+        size_t len = rw_span(job, base);
+        char *text = rw_chunk(ra, in, base, len);
+        if (!text) {
+            err = errno;
+            break;
+        }
+        size_t limit = len < (size_t)RW_CHUNK ? len : (size_t)RW_CHUNK;
+        size_t from = skip;
+        long found = 0;
+        const char *m;
+        while ((m = rw_find(job, text, from, limit, len))) {
+            sv_piece(b, text + from, (size_t)(m - text) - from);
+            sv_piece(b, job->replacement, job->rlen);
+            from = (size_t)(m - text) + job->slen;
+            found++;
+        }
+        if (from < limit)
+            sv_piece(b, text + from, limit - from);
+        skip = from > limit ? from - limit : 0;
+        sv_flush(b);
+        free(text);
+        err = b->err;
+        pthread_mutex_lock(&job->lock);
+        job->count += found;
+        job->read = base + (off_t)limit;
+        pthread_mutex_unlock(&job->lock);
+    }
+    ra_free(ra);
+    free(b);
+    return err;
+}
+
+/*
+ * Keep the file at PATH under a new name, filled in BACKUP, and rename
+ * TMP over it. The original is kept through a hard link, so PATH names a
+ * complete file throughout; where links are not supported it is renamed
+ * aside instead. Returns 0 or an errno value.
+ */
+static int rw_replace(const char *path, const char *tmp, char *backup,
+                      size_t size) {
+    snprintf(backup, size, "%s.orig-XXXXXX", path);
+    int fd = mkstemp(backup);
+    if (fd < 0)
+        return errno;
+    close(fd);
+    unlink(backup);
+    int err;
+    if (link(path, backup) == 0) {
+        if (rename(tmp, path) == 0)
+            return 0;
+        err = errno;
+        unlink(backup);
+        return err;
+    }
+    if (rename(path, backup) < 0)
+        return errno;
+    if (rename(tmp, path) == 0)
+        return 0;
+    err = errno;
+    rename(backup, path);
+    return err;
+}
+
+/*
+ * Write the file of JOB with every match replaced and put it in place.
+ * Returns 0 or an errno value; on failure the file is left untouched.
+ */
+static int rw_write(RewriteJob *job) {
+    int in = open(job->path, O_RDONLY);
+    if (in < 0)
+        return errno;
+    struct stat st;
+    int err = 0;
+    if (fstat(in, &st) < 0)
+        err = errno;
+    else if (!S_ISREG(st.st_mode))
+        err = EINVAL;
+    else if (st.st_nlink > 1)
+        err = EMLINK; /* a rename would part the file from its other links */
+    if (err) {
+        close(in);
+        return err;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->total = st.st_size;
+    pthread_mutex_unlock(&job->lock);
+
+    char tmp[PATH_MAX + 8];
+    int out = sv_temp(job->path, tmp, sizeof(tmp), &st, true);
+    if (out < 0) {
+        err = out == -2 ? EPERM : errno;
+        close(in);
+        return err;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    err = rw_stream(job, in, out);
+    close(in);
+    if (!err && job->sync && fsync(out) < 0 && errno != EINVAL)
+        err = errno;
+    if (close(out) < 0 && !err)
+        err = errno;
+    if (!err && job->count > 0)
+        err = rw_replace(job->path, tmp, job->backup, sizeof(job->backup));
+    if (err || job->count == 0)
+        unlink(tmp);
+    else if (job->sync)
+        sv_sync_dir(job->path);
+    return err;
+}
+
+/* Body of the worker thread. */
+static void *rw_worker(void *arg) {
+    RewriteJob *job = arg;
+    int err = rw_write(job);
+    pthread_mutex_lock(&job->lock);
+    job->err = err;
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Release JOB. */
+static void rw_free(RewriteJob *job) {
+    free(job->search);
+    free(job->replacement);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+/* Note in RW the file ST describes as the one at the path. */
+static void rw_identify(Rewrite *rw, const struct stat *st) {
+    rw->dev = st->st_dev;
+    rw->ino = st->st_ino;
+    rw->size = st->st_size;
+    rw->mtime = st->st_mtim;
+}
+
+/*
+ * Read the buffer of FS again from its file, keeping the lines up to the
+ * cursor loaded. Returns 0 or -1 with errno set.
+ */
+static int rw_reopen(FileState *fs) {
+    if (lb_page_file(&fs->buffer, fs->filename) < 0)
+        return -1;
+    li_free(fs->line_index);
+    fs->line_index = li_start(fs->filename);
+    fs->file_complete = false;
+    mark_comment_state_dirty(fs);
+    if (!fs->line_index) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (load_next_lines(fs, fs->start_line + fs->cursor_y + RW_LOAD_LINES) < 0)
+        return -1;
+    fs->modified = false;
+    return 0;
+}
+
+/*
+ * Swap the files at PATH and BACKUP, with one atomic exchange where the
+ * system has it. Returns 0 or -1 with errno set.
+ */
+static int rw_exchange(const char *path, const char *backup) {
+#if defined(__linux__) && defined(RENAME_EXCHANGE)
+    if (renameat2(AT_FDCWD, path, AT_FDCWD, backup, RENAME_EXCHANGE) == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return -1;
+#endif
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    if (rename(path, tmp) < 0) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    if (rename(backup, path) < 0) {
+        int err = errno;
+        rename(tmp, path);
+        errno = err;
+        return -1;
+    }
+    return rename(tmp, backup);
+}
+
+/*
+ * Take over the file JOB wrote for FS: keep its backup in place of any
+ * older one, mark the replacement for undo and read the buffer again.
+ * Returns 0 or an errno value.
+ */
+static int rw_install(RewriteJob *job, FileState *fs) {
+    rw_close(fs);
+    Rewrite *rw = calloc(1, sizeof(*rw));
+    struct stat st;
+    if (rw && stat(job->path, &st) == 0) {
+        strcpy(rw->backup, job->backup);
+        rw->mark = -++rw_marks;
+        rw_identify(rw, &st);
+        fs->rewrite = rw;
+        push(&fs->undo_stack, (Change){ rw->mark, NULL, NULL, 0, false });
+    } else {
+        /* Without a record the original cannot be brought back */
+        free(rw);
+        unlink(job->backup);
+    }
+    /* Undone edits no longer apply, and nothing is left unsaved */
+    free_stack(fs->redo_stack);
+    fs->redo_stack = NULL;
+    jn_close(fs, false);
+    return rw_reopen(fs) < 0 ? errno : 0;
+}
+
+/**
+ * Start replacing every occurrence of SEARCH in the file at PATH with
+ * REPLACEMENT, ignoring case with IGNORE_CASE, and flushing the result to
+ * disk first with SYNC. SEARCH must be non-empty and hold no newline.
+ * Should the worker not start, the file is rewritten before this returns.
+ *
+ * Returns the job, to be passed to rw_done() and rw_finish(), or NULL with
+ * errno set.
+ */
+RewriteJob *rw_start(const char *path, const char *search,
+                     const char *replacement, bool ignore_case, bool sync) {
+    if (!*search || strchr(search, '\n')) {
+        errno = EINVAL;
+        return NULL;
+    }
+    RewriteJob *job = calloc(1, sizeof(*job));
+    if (!job)
+        return NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    strncpy(job->path, path, sizeof(job->path) - 1);
+    job->search = strdup(search);
+    job->replacement = strdup(replacement);
+    if (!job->search || !job->replacement) {
+        rw_free(job);
+        errno = ENOMEM;
+        return NULL;
+    }
+    job->slen = strlen(search);
+    job->rlen = strlen(replacement);
+    job->ignore_case = ignore_case;
+    job->sync = sync;
+    if (ignore_case)
+        for (char *p = job->search; *p; ++p)
+            *p = (char)tolower((unsigned char)*p);
+    job->threaded = pthread_create(&job->thread, NULL, rw_worker, job) == 0;
+    if (!job->threaded)
+        rw_worker(job);
+    return job;
+}
+
+/**
+ * Return true once JOB has finished. READ and TOTAL, when not NULL,
+ * receive the bytes of the file the matcher has been through and its size.
+ */
+bool rw_done(RewriteJob *job, off_t *read, off_t *total) {
+    pthread_mutex_lock(&job->lock);
+    bool done = job->done;
+    if (read)
+        *read = job->read;
+    if (total)
+        *total = job->total;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+/**
+ * Ask JOB to stop before its next chunk. A job stopped in time leaves the
+ * file untouched and rw_finish() fails with ECANCELED.
+ */
+void rw_cancel(RewriteJob *job) {
+    pthread_mutex_lock(&job->lock);
+    job->cancel = true;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * Wait for JOB to finish and release it. When occurrences were replaced,
+ * FS, the buffer of the file, is read again from the new file, with the
+ * replacement marked on its undo stack and the original kept for it.
+ *
+ * Returns the number of occurrences replaced, or -1 with errno set, in
+ * which case the file keeps its old contents unless the buffer could not
+ * be read again.
+ */
+long rw_finish(RewriteJob *job, FileState *fs) {
+    if (job->threaded)
+        pthread_join(job->thread, NULL);
+    int err = job->err;
+    long count = job->count;
+    if (!err && count > 0)
+        err = rw_install(job, fs);
+    rw_free(job);
+    errno = err;
+    return err ? -1 : count;
+}
+
+/**
+ * Undo or redo the replacement marked MARK on the undo stacks of FS by
+ * exchanging its file with the other version kept, then read the buffer
+ * again. Fails with EBUSY while the buffer has unsaved edits or is being
+ * saved, as reading it again would lose them, with ENOENT if a later
+ * replacement dropped that version and with ESTALE if the file was saved
+ * or changed since.
+ *
+ * Returns 0 or -1 with errno set.
+ */
+int rw_swap(FileState *fs, long mark) {
+    Rewrite *rw = fs->rewrite;
+    struct stat st;
+    if (!rw || rw->mark != mark) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (fs->modified || fs->save) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (stat(fs->filename, &st) < 0)
+        return -1;
+    if (st.st_dev != rw->dev || st.st_ino != rw->ino ||
+        st.st_size != rw->size || st.st_mtim.tv_sec != rw->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != rw->mtime.tv_nsec) {
+        errno = ESTALE;
+        return -1;
+    }
+    if (rw_exchange(fs->filename, rw->backup) < 0)
+        return -1;
+    if (stat(fs->filename, &st) == 0)
+        rw_identify(rw, &st);
+    /* The journal names the file the path held until now */
+    jn_close(fs, false);
+    return rw_reopen(fs);
+}
+
+/**
+ * Remove the original kept by the latest replacement in FS, if any.
+ * Called when the file is closed or replaced again.
+ */
+void rw_close(FileState *fs) {
+    if (!fs->rewrite)
+        return;
+    unlink(fs->rewrite->backup);
+    free(fs->rewrite);
+    fs->rewrite = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Streaming replace
+ * -----------------
+ * Replaces every occurrence of a string in a file too big to be edited
+ * line by line in memory. rw_start() hands the job to a worker thread
+ * that streams the file through the matcher into a temporary file next
+ * to it: a ReadAhead (see read_ahead.h) reads chunks of RW_CHUNK bytes
+ * up to RW_AHEAD chunks before the matcher reaches them, and the text
+ * between matches goes out with writev() straight from those chunks, so
+ * neither the LineBuffer nor a copy of the file is ever built in memory.
+ * rw_done() reports the progress, rw_cancel() stops the worker and
+ * rw_finish() collects the result.
+ *
+ * Chunks overlap by the length of the search string less one byte, so
+ * matches that straddle two chunks are found. The search string cannot
+ * hold a newline, which keeps the lines of the file where they were.
+ *
+ * Once the whole file is written the worker keeps the original under a
+ * hard link named after the file, renames the new file over it, and the
+ * buffer is read again from the result. A single undo record marks the
+ * replacement, and undoing or redoing it exchanges the file with the kept
+ * original (rw_swap()). Only the latest replacement of a file keeps its
+ * original, which is removed when the file is closed.
+ */
+
+#define RW_CHUNK (4L << 20) /* bytes the matcher takes at a time */
+#define RW_AHEAD 2          /* chunks read ahead of the matcher */
+
+struct FileState;
+
+typedef struct RewriteJob RewriteJob;
+typedef struct Rewrite Rewrite;
+
+RewriteJob *rw_start(const char *path, const char *search,
+                     const char *replacement, bool ignore_case, bool sync);
+bool rw_done(RewriteJob *job, off_t *read, off_t *total);
+void rw_cancel(RewriteJob *job);
+long rw_finish(RewriteJob *job, struct FileState *fs);
+int rw_swap(struct FileState *fs, long mark);
+void rw_close(struct FileState *fs);
+
+#endif /* REWRITE_H */
@@ -0,0 +1,600 @@
+/*
+ * save.c
+ * ------
+ * The save engine. See save.h for an overview. Everything here works on
+ * file descriptors: stdio would copy every line into its own buffer
+ * before writing it, which is exactly the work writev() avoids.
+ *
+ * sv_start() runs on the editor's thread and only takes the snapshot; the
+ * writer thread owns the job from then on until it sets done. The counts
+ * read by sv_done() are guarded by the job's mutex. A job that writes
+ * from the buffer itself never gets a thread.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* copy_file_range */
+#endif
+
+#include "save.h"
+#include "path_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A stretch of the snapshot: TEXT holds LEN bytes of copied lines, each
+ * with its newline, LINES lines from FIRST are read from the job's buffer
+ * as they are written, or, failing both, BYTES bytes at OFFSET of the
+ * job's source file are copied.
+ */
+typedef struct SvPart {
+    char *text;
+    size_t len;
+    size_t cap;
+    long first;
+    long lines;
+    off_t offset;
+    off_t bytes;
+} SvPart;
+
+struct SaveJob {
+    pthread_t thread;
+    bool threaded;   /* thread was started and must be joined */
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    bool sync;
+    bool reads_file; /* the buffer still reads the file being replaced */
+    int src;         /* file the runs are copied from, or -1 */
+    LineBuffer *lb;  /* buffer written from directly, or NULL */
+    size_t copy;     /* bytes the snapshot may still copy */
+    SvPart *part;
+    size_t n;
+    size_t cap;
+    off_t total;     /* bytes the saved file will hold */
+    off_t written;   /* bytes written so far */
+    bool done;
+    int err;         /* errno of the failure, 0 on success */
+};
+
+static char sv_newline = '\n';
+
+/* Add N bytes to the progress of JOB, the SaveJob ARG. */
+static void sv_progress(void *arg, off_t n) {
+    SaveJob *job = arg;
+    pthread_mutex_lock(&job->lock);
+    job->written += n;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * Write out the pieces collected in B so far, resuming after short writes
+ * and passing the bytes written to its progress callback. The first
+ * failure is kept in B->err, after which nothing more is written.
+ */
+void sv_flush(SvBatch *b) {
+    struct iovec *iov = b->iov;
+    int n = b->n;
+    while (n > 0 && !b->err) {
+        ssize_t w = writev(b->fd, iov, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            b->err = w < 0 ? errno : EIO;
+            break;
+        }
+        if (b->progress)
+            b->progress(b->arg, w);
+        size_t left = (size_t)w;
+        while (n > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    b->n = 0;
+}
+
+/**
+ * Queue LEN bytes at BASE in B, flushing it first when it is full. The
+ * bytes have to stay put until B is flushed.
+ */
+void sv_piece(SvBatch *b, const char *base, size_t len) {
+    if (len == 0)
+        return;
+    if (b->n == SV_PIECES)
+        sv_flush(b);
+    b->iov[b->n].iov_base = (char *)base;
+    b->iov[b->n].iov_len = len;
+    b->n++;
+}
+
+/* Copy LEN bytes at OFFSET of IN to the batch's file with read and write. */
+static void sv_copy_bytes(SvBatch *b, int in, off_t offset, off_t len) {
+    char *buf = malloc(SV_STAGE);
+    if (!buf) {
+        b->err = ENOMEM;
+        return;
+    }
+    while (len > 0 && !b->err) {
+        ssize_t n = pread(in, buf, len < SV_STAGE ? (size_t)len : SV_STAGE,
+                          offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            /* The file shrank: its end cannot be saved */
+            b->err = n < 0 ? errno : EIO;
+            break;
+        }
+        sv_piece(b, buf, (size_t)n);
+        sv_flush(b);
+        offset += n;
+        len -= n;
+    }
+    free(buf);
+}
+
+/*
+ * Write the file run PART from the job's source file. The kernel copies
+ * the bytes, or on file systems that support it shares them with the new
+ * file, so they never pass through the editor; they go SV_COPY bytes at a
+ * time so progress can be shown. A newline is added if the file lacks the
+ * one of its last line.
+ */
+static void sv_copy(SvBatch *b, SaveJob *job, const SvPart *part) {
+    int in = job->src;
+    off_t offset = part->offset;
+    off_t len = part->bytes;
+    sv_flush(b);
+#ifdef __linux__
+    while (len > 0 && !b->err) {
+        ssize_t n = copy_file_range(in, &offset, b->fd, NULL,
+                                    len < SV_COPY ? (size_t)len : SV_COPY, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && offset == part->offset &&
+            (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+             errno == EOPNOTSUPP))
+            break; /* not across these files: copy by hand */
+        if (n <= 0) {
+            b->err = n < 0 ? errno : EIO;
+        } else {
+            len -= n;
+            sv_progress(job, n);
+        }
+    }
+#endif
+    sv_copy_bytes(b, in, offset, len);
+    char last;
+    if (!b->err && part->bytes > 0 &&
+        pread(in, &last, 1, part->offset + part->bytes - 1) == 1 &&
+        last != '\n')
+        sv_piece(b, &sv_newline, 1);
+}
+
+/*
+ * Write the lines of PART from the job's buffer. They are gathered into
+ * one SV_STAGE block, written out whenever it fills, as the buffer may
+ * reuse the text lb_get() returns; a longer line goes out on its own.
+ */
+static void sv_lines(SvBatch *b, SaveJob *job, const SvPart *part,
+                     char *stage) {
+    size_t used = 0;
+    sv_flush(b);
+    for (long i = part->first; i < part->first + part->lines && !b->err;
+         ++i) {
+        const char *text = lb_get(job->lb, i);
+        size_t len = text ? lb_length(job->lb, i) : 0;
+        if (used + len + 1 > SV_STAGE) {
+            sv_piece(b, stage, used);
+            sv_flush(b);
+            used = 0;
+        }
+        if (len + 1 > SV_STAGE) {
+            sv_piece(b, text, len);
+            sv_piece(b, &sv_newline, 1);
+            sv_flush(b);
+            continue;
+        }
+        memcpy(stage + used, text, len);
+        stage[used + len] = '\n';
+        used += len + 1;
+    }
+    sv_piece(b, stage, used);
+    sv_flush(b);
+    /* Lines that could not be read back would have been saved empty */
+    if (!b->err && lb_page_errors(job->lb) > 0)
+        b->err = EIO;
+}
+
+/* Write the snapshot of JOB to FD. Returns 0 or an errno value. */
+static int sv_write_parts(SaveJob *job, int fd) {
+    SvBatch *b = malloc(sizeof(*b));
+    if (!b)
+        return ENOMEM;
+    b->fd = fd;
+    b->n = 0;
+    b->err = 0;
+    b->progress = sv_progress;
+    b->arg = job;
+    char *stage = job->lb ? malloc(SV_STAGE) : NULL;
+    if (job->lb && !stage)
+        b->err = ENOMEM;
+    for (size_t i = 0; i < job->n && !b->err; ++i) {
+        if (job->part[i].text)
+            sv_piece(b, job->part[i].text, job->part[i].len);
+        else if (job->part[i].lines > 0)
+            sv_lines(b, job, &job->part[i], stage);
+        else
+            sv_copy(b, job, &job->part[i]);
+    }
+    sv_flush(b);
+    int err = b->err;
+    free(stage);
+    free(b);
+    return err;
+}
+
+/* Make room for one more part. Returns -1 on allocation failure. */
+static int sv_grow(SaveJob *job) {
+    if (job->n < job->cap)
+        return 0;
+    size_t cap = job->cap ? job->cap * 2 : 64;
+    SvPart *part = realloc(job->part, cap * sizeof(*part));
+    if (!part)
+        return -1;
+    job->part = part;
+    job->cap = cap;
+    return 0;
+}
+
+/*
+ * Add a copy of LEN bytes of TEXT and a newline to the snapshot. Lines are
+ * gathered into blocks of SV_STAGE bytes, or one of their own if larger,
+ * so a few hundred lines make one piece of a writev() batch. Fails with
+ * ENOBUFS once the job may copy no more.
+ */
+static int sv_add_line(SaveJob *job, const char *text, size_t len) {
+    if (job->copy < len + 1) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    job->copy -= len + 1;
+    SvPart *last = job->n > 0 ? &job->part[job->n - 1] : NULL;
+    if (!last || !last->text || last->cap - last->len < len + 1) {
+        if (sv_grow(job) < 0)
+            return -1;
+        size_t cap = len + 1 > SV_STAGE ? len + 1 : SV_STAGE;
+        last = &job->part[job->n];
+        memset(last, 0, sizeof(*last));
+        if (!(last->text = malloc(cap)))
+            return -1;
+        last->cap = cap;
+        job->n++;
+    }
+    memcpy(last->text + last->len, text, len);
+    last->text[last->len + len] = '\n';
+    last->len += len + 1;
+    job->total += (off_t)len + 1;
+    return 0;
+}
+
+/*
+ * Add line INDEX, LEN bytes long, of the job's buffer to the snapshot
+ * without copying it, extending the part of the line before.
+ */
+static int sv_add_ref(SaveJob *job, long index, size_t len) {
+    SvPart *last = job->n > 0 ? &job->part[job->n - 1] : NULL;
+    if (!last || last->lines == 0 || last->first + last->lines != index) {
+        if (sv_grow(job) < 0)
+            return -1;
+        last = &job->part[job->n++];
+        memset(last, 0, sizeof(*last));
+        last->first = index;
+    }
+    last->lines++;
+    job->total += (off_t)len + 1;
+    return 0;
+}
+
+/*
+ * Add the file run RUN to the snapshot. The first run takes a descriptor
+ * of its own for the file, so the buffer may close or drop its file while
+ * the writer copies from it; every run of a buffer is in the same file.
+ */
+static int sv_add_run(SaveJob *job, const FileRun *run) {
+    if (job->src < 0 && (job->src = dup(run->fd)) < 0)
+        return -1;
+    if (sv_grow(job) < 0)
+        return -1;
+    SvPart *part = &job->part[job->n++];
+    memset(part, 0, sizeof(*part));
+    part->offset = run->offset;
+    part->bytes = run->bytes;
+    job->total += run->bytes;
+    return 0;
+}
+
+/*
+ * Record the contents of LB in JOB: file runs for what the buffer holds
+ * unchanged from its file (see lb_file_run()) and copies of every other
+ * line, or references to them if the job writes from LB. Returns 0 or -1
+ * with errno set, ENOBUFS if the copies would exceed JOB->copy.
+ */
+static int sv_snapshot(SaveJob *job, LineBuffer *lb) {
+    lb_page_errors(lb);
+    FileRun run;
+    long i = 0;
+    while (i < lb->count) {
+        if (lb_file_run(lb, i, &run)) {
+            if (sv_add_run(job, &run) < 0)
+                return -1;
+            i += run.lines;
+            continue;
+        }
+        if (job->lb) {
+            if (sv_add_ref(job, i, lb_length(lb, i)) < 0)
+                return -1;
+            i++;
+            continue;
+        }
+        const char *text = lb_get(lb, i);
+        if (sv_add_line(job, text ? text : "",
+                        text ? lb_length(lb, i) : 0) < 0)
+            return -1;
+        i++;
+    }
+    /* What is not loaded yet comes straight from the file as well */
+    if (lb_file_run(lb, lb->count, &run) && sv_add_run(job, &run) < 0)
+        return -1;
+    /* Lines that could not be read back would have been saved empty */
+    if (lb_page_errors(lb) > 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/** Flush the directory holding PATH so a rename into it is durable. */
+void sv_sync_dir(const char *path) {
+    char dir[PATH_MAX];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    char *slash = strrchr(dir, '/');
+    if (!slash)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/*
+ * Create a file named after PATH in TMP with mode 0666, which the kernel
+ * narrows by the umask as for any new file. mkstemp() would create it
+ * 0600, and the umask can only be read by setting it, which would race
+ * with the other threads. Returns its descriptor or -1 with errno set.
+ */
+static int sv_create(const char *path, char *tmp, size_t size) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    /* Threads differ in the address of TMP; O_EXCL settles any clash */
+    uint64_t seed = (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 32) ^
+                    (uint64_t)(uintptr_t)tmp;
+    for (int tries = 0; tries < 100; ++tries) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(tmp, size, "%s.%06lx", path,
+                 (unsigned long)(seed >> 40) & 0xffffffUL);
+        int fd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0 || errno != EEXIST)
+            return fd;
+    }
+    return -1;
+}
+
+/**
+ * Create a temporary file next to PATH, named in TMP, with the mode and
+ * owner of ST when EXISTS or the default mode of a new file otherwise.
+ * Returns its descriptor, -1 with errno set if it could not be created,
+ * or -2 if the owner of PATH could not be given to it.
+ */
+int sv_temp(const char *path, char *tmp, size_t size, const struct stat *st,
+            bool exists) {
+    if (!exists)
+        return sv_create(path, tmp, size);
+    snprintf(tmp, size, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+    /* Ownership first: changing it may clear set-user-ID bits */
+    if (fchown(fd, st->st_uid, st->st_gid) < 0 && st->st_uid != geteuid()) {
+        close(fd);
+        unlink(tmp);
+        return -2;
+    }
+    if (st->st_gid != getegid())
+        fchown(fd, (uid_t)-1, st->st_gid);
+    fchmod(fd, st->st_mode & 07777);
+    return fd;
+}
+
+/*
+ * Write the snapshot of JOB to its file, through a temporary file and
+ * rename() where possible and in place otherwise (see save.h). Returns 0
+ * or an errno value; on failure a renamed file is left untouched.
+ */
+static int sv_write(SaveJob *job) {
+    const char *path = job->path;
+    char real[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode) &&
+        vento_realpath(path, real))
+        path = real;
+    bool exists = stat(path, &st) == 0;
+    /* Buffers that still read the file must not see it truncated */
+    bool in_place = exists && (!S_ISREG(st.st_mode) ||
+                               (st.st_nlink > 1 && !job->reads_file));
+    int fd = -1;
+    if (!in_place) {
+        fd = sv_temp(path, tmp, sizeof(tmp), &st, exists);
+        if (fd == -2 || (fd < 0 && (errno == EACCES || errno == EPERM))) {
+            if (job->reads_file)
+                return fd == -2 ? EPERM : errno;
+            in_place = true;
+        } else if (fd < 0) {
+            return errno;
+        }
+    }
+    if (in_place) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return errno;
+    }
+
+    int err = sv_write_parts(job, fd);
+    if (!err && job->sync && fsync(fd) < 0 && errno != EINVAL)
+        err = errno;
+    if (close(fd) < 0 && !err)
+        err = errno;
+    if (!in_place) {
+        if (!err && rename(tmp, path) < 0)
+            err = errno;
+        if (err)
+            unlink(tmp);
+        else if (job->sync)
+            sv_sync_dir(path);
+    }
+    return err;
+}
+
+/* Body of the writer thread. */
+static void *sv_worker(void *arg) {
+    SaveJob *job = arg;
+    int err = sv_write(job);
+    pthread_mutex_lock(&job->lock);
+    job->err = err;
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Drop the snapshot of JOB. */
+static void sv_clear(SaveJob *job) {
+    for (size_t i = 0; i < job->n; ++i)
+        free(job->part[i].text);
+    free(job->part);
+    job->part = NULL;
+    job->n = job->cap = 0;
+    job->total = 0;
+    if (job->src >= 0)
+        close(job->src);
+    job->src = -1;
+}
+
+/* Release JOB and everything its snapshot holds. */
+static void sv_free(SaveJob *job) {
+    sv_clear(job);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+/**
+ * Start saving the lines of LB to PATH, each followed by a newline. The
+ * contents are taken now, copying at most COPY bytes of lines, so LB may
+ * be edited, or freed, as soon as this returns; a writer thread then
+ * replaces the file as described in save.h, flushing it to disk first
+ * with SYNC. Should the lines not fit in COPY bytes, or the thread not
+ * start, the file is written before this returns.
+ *
+ * Returns the job, to be passed to sv_done() and sv_finish(), or NULL with
+ * errno set if the contents could not be taken.
+ */
+SaveJob *sv_start(LineBuffer *lb, const char *path, bool sync, size_t copy) {
+    SaveJob *job = calloc(1, sizeof(*job));
+    if (!job)
+        return NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    job->src = -1;
+    strncpy(job->path, path, sizeof(job->path) - 1);
+    job->sync = sync;
+    job->reads_file = lb->map || lb->pages || lb->pieces || lb->view;
+    job->copy = copy;
+    job->lb = copy > 0 ? NULL : lb;
+    int rc = sv_snapshot(job, lb);
+    if (rc < 0 && errno == ENOBUFS && !job->lb) {
+        /* No room for a copy: write from LB while the caller waits */
+        sv_clear(job);
+        job->lb = lb;
+        rc = sv_snapshot(job, lb);
+    }
+    if (rc < 0) {
+        int err = errno;
+        sv_free(job);
+        errno = err;
+        return NULL;
+    }
+    if (!job->lb)
+        job->threaded =
+            pthread_create(&job->thread, NULL, sv_worker, job) == 0;
+    if (!job->threaded)
+        sv_worker(job);
+    return job;
+}
+
+/**
+ * Return true once JOB has finished. WRITTEN and TOTAL, when not NULL,
+ * receive the bytes written so far and the size the file will have.
+ */
+bool sv_done(SaveJob *job, off_t *written, off_t *total) {
+    pthread_mutex_lock(&job->lock);
+    bool done = job->done;
+    if (written)
+        *written = job->written;
+    if (total)
+        *total = job->total;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+/**
+ * Wait for JOB to finish and release it.
+ *
+ * Returns 0 if the file was saved or -1 with errno set, in which case a
+ * file replaced through a rename keeps its old contents.
+ */
+int sv_finish(SaveJob *job) {
+    if (job->threaded)
+        pthread_join(job->thread, NULL);
+    int err = job->err;
+    sv_free(job);
+    errno = err;
+    return err ? -1 : 0;
+}
+
+/**
+ * Write the lines of LB to PATH and wait for it: sv_start() followed by
+ * sv_finish(), writing from LB as there is no point in a copy. Returns 0
+ * on success or -1 with errno set.
+ */
+int sv_save(LineBuffer *lb, const char *path, bool sync) {
+    SaveJob *job = sv_start(lb, path, sync, 0);
+    return job ? sv_finish(job) : -1;
+}
@@ -0,0 +1,89 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "line_buffer.h"
+
+/*
+ * Save engine
+ * -----------
+ * Writes a LineBuffer to a file in the background without ever leaving a
+ * half written file behind. sv_start() takes a snapshot of the buffer and
+ * hands it to a writer thread, so the editor goes on taking keystrokes,
+ * and edits, while the file is written; sv_done() reports the progress
+ * and sv_finish() collects the result. sv_save() does both and waits.
+ *
+ * The writer puts the lines in a temporary file in the target's
+ * directory, gives it the mode and, where permitted, the owner and group
+ * of the file it replaces, optionally flushes it to disk and renames it
+ * over the target, so a crash or a full disk leaves the old contents
+ * intact. The buffer's own mapping or paged file keeps the old contents
+ * readable until the buffer lets go of it.
+ *
+ * The snapshot copies the lines held in memory into blocks of SV_STAGE
+ * bytes, each line followed by its newline, which go out with writev() in
+ * batches of up to SV_IOV blocks. Lines the buffer holds exactly as they
+ * are in the file it was read from, and the part of that file not loaded
+ * yet, are not copied at all: lb_file_run() describes them as byte ranges,
+ * which the writer copies from the old file with copy_file_range() where
+ * the system has it and with pread() otherwise. Fixing one line of a huge
+ * paged file therefore copies the one page holding it, and the kernel
+ * copies, or shares, the rest.
+ *
+ * What the snapshot copies is therefore the text of every edited line, and
+ * of every line of a buffer not read from a file or held in a piece table,
+ * or read from a stream: the memory it takes, and the time sv_start()
+ * takes on the editor's thread, grow with that text. The caller bounds
+ * both with the bytes it lets sv_start() copy, for the editor what is left
+ * of the memory budget. A buffer that does not fit is written straight
+ * from its lines before sv_start() returns, through one SV_STAGE block, so
+ * the editor waits for the save instead of running past the budget.
+ *
+ * Renaming cannot keep hard links to the file, a directory the user may
+ * not create files in, or an owner the user cannot give away. In those
+ * cases the file is rewritten in place instead, unless the buffer still
+ * reads from it.
+ *
+ * sv_temp() and sv_sync_dir() are the temporary file and directory flush
+ * of the writer, and an SvBatch with sv_piece() and sv_flush() its
+ * batched writev(), for other code replacing a file the same way.
+ */
+
+#define SV_IOV 1024           /* pieces written by one writev() */
+#define SV_STAGE (256 * 1024) /* bytes of copied lines gathered per block */
+#define SV_COPY (8L << 20)    /* bytes copied from the old file at a time */
+#define SV_PROGRESS_MS 250    /* interval between progress reports */
+
+#if defined(IOV_MAX) && IOV_MAX < SV_IOV
+#define SV_PIECES IOV_MAX
+#else
+#define SV_PIECES SV_IOV
+#endif
+
+typedef struct SaveJob SaveJob;
+
+/* Pieces of a file gathered to go out with one writev(). */
+typedef struct SvBatch {
+    int fd;
+    struct iovec iov[SV_PIECES];
+    int n;
+    int err;       /* errno of the first failed write, 0 if none */
+    void (*progress)(void *arg, off_t n); /* told of bytes written, or NULL */
+    void *arg;
+} SvBatch;
+
+SaveJob *sv_start(LineBuffer *lb, const char *path, bool sync, size_t copy);
+bool sv_done(SaveJob *job, off_t *written, off_t *total);
+int sv_finish(SaveJob *job);
+int sv_save(LineBuffer *lb, const char *path, bool sync);
+int sv_temp(const char *path, char *tmp, size_t size, const struct stat *st,
+            bool exists);
+void sv_sync_dir(const char *path);
+void sv_flush(SvBatch *b);
+void sv_piece(SvBatch *b, const char *base, size_t len);
+
+#endif /* SAVE_H */
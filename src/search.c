@@ -3,15 +3,20 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "editor.h"
 #include "ui.h"
 #include "search.h"
 #include "files.h"
+#include "line_pool.h"
 #include "undo.h"
 #include "syntax.h"
 #include "config.h"
 #include "editor_state.h"
+#include "file_ops.h"
+#include "rewrite.h"
+#include "save.h"
 
 /*
  * Search and replace implementation.
@@ -62,12 +67,14 @@ static char *strcasestr_simple(const char *h, const char *n) {
  * `app_config.search_ignore_case`.  When a match is found `*found_line` is set
  * to the matching line index and a pointer to the match inside that line is
  * returned.  The function performs no cursor movement or state updates and
- * returns NULL when no match exists.
+ * returns NULL when no match exists or the user stopped the search with Esc.
  */
-static char *scan_next(FileState *fs, const char *word, int start_search,
-                       int cursor_x, int *found_line) {
-    for (int line = start_search;; ++line) {
-        ensure_line_loaded(fs, line + SEARCH_LOAD_BATCH - 1);
+static char *scan_next(FileState *fs, const char *word, long start_search,
+                       int cursor_x, long *found_line) {
+    for (long line = start_search;; ++line) {
+        if (ensure_line_loaded(fs, line + SEARCH_LOAD_BATCH - 1) < 0 &&
+            errno == ECANCELED)
+            return NULL; /* Esc while waiting for the line index */
         if (line >= fs->buffer.count)
             break;
 
@@ -85,7 +92,7 @@ static char *scan_next(FileState *fs, const char *word, int start_search,
         }
     }
 
-    for (int line = 0; line < start_search; ++line) {
+    for (long line = 0; line < start_search; ++line) {
         ensure_line_loaded(fs, line + SEARCH_LOAD_BATCH - 1);
         if (line >= fs->buffer.count)
             break;
@@ -115,9 +122,9 @@ void find_next_occurrence(FileState *fs, const char *word) {
     int *cursor_y = &fs->cursor_y;
     int lines_per_screen = LINES - 3;  // Lines available in a single screen view
     int middle_line = lines_per_screen / 2; // Calculate middle line position
-    int start_search = *cursor_y + fs->start_line;
+    long start_search = *cursor_y + fs->start_line;
 
-    int found_line = -1;
+    long found_line = -1;
     char *found_position = scan_next(fs, word, start_search, *cursor_x, &found_line);
 
     if (!found_position) {
@@ -150,13 +157,16 @@ void find_next_occurrence(FileState *fs, const char *word) {
         fs->match_start_x = found_position - found_line_text;
         fs->match_end_x = fs->match_start_x + strlen(word) - 1;
 
-        mvprintw(LINES - 2, 0, "Found at Line: %d, Column: %d", *cursor_y + fs->start_line + 1, *cursor_x + 1);
+        /* Scroll sideways when the match lies off screen in a long line */
+        clamp_scroll_x(fs);
+
+        mvprintw(LINES - 2, 0, "Found at Line: %ld, Column: %d", *cursor_y + fs->start_line + 1, *cursor_x + 1);
         clrtoeol();
         refresh();
     }
     int off = get_line_number_offset ? get_line_number_offset(fs) : 0;
     wmove(text_win, *cursor_y,
-          *cursor_x + off);
+          *cursor_x - fs->scroll_x + off);
     wrefresh(text_win);
 }
 
@@ -194,50 +204,39 @@ void find(EditorContext *ctx, FileState *fs, int new_search)
     }
 }
 
-static void replace_in_line(FileState *fs, int line, char *pos,
+static void replace_in_line(FileState *fs, long line, char *pos,
                              const char *search, const char *replacement) {
     char *line_text = (char *)lb_get(&fs->buffer, line);
-    char *old_text = strdup(line_text);
-
     size_t prefix_len = pos - line_text;
     size_t search_len = strlen(search);
-    size_t suffix_len = strlen(pos + search_len);
     size_t replacement_len = strlen(replacement);
-
-    char *new_line = malloc(fs->line_capacity);
-    if (!new_line) {
-        free(old_text);
-        allocation_failed("replace_in_line malloc");
+    char *old_text = lb_share(&fs->buffer, line);
+    char *matched = pool_intern(pos, search_len);
+    char *inserted = replacement_len ? pool_intern(replacement, replacement_len)
+                                     : NULL;
+    if (!old_text || !matched || (replacement_len && !inserted)) {
+        pool_release(old_text);
+        pool_release(matched);
+        pool_release(inserted);
+        allocation_failed("pool_intern failed");
+        return;
     }
 
-    if (prefix_len >= (size_t)fs->line_capacity)
-        prefix_len = fs->line_capacity - 1;
-    strncpy(new_line, line_text, prefix_len);
-    size_t idx = prefix_len;
-
-    if (idx < (size_t)fs->line_capacity - 1) {
-        size_t to_copy = replacement_len;
-        if (idx + to_copy >= (size_t)fs->line_capacity)
-            to_copy = fs->line_capacity - idx - 1;
-        memcpy(new_line + idx, replacement, to_copy);
-        idx += to_copy;
+    if (lb_delete_text(&fs->buffer, line, prefix_len, search_len) < 0 ||
+        lb_insert_text(&fs->buffer, line, prefix_len, replacement,
+                       replacement_len) < 0) {
+        lb_set_shared(&fs->buffer, line, old_text, pool_length(old_text));
+        pool_release(old_text);
+        pool_release(matched);
+        pool_release(inserted);
+        allocation_failed("replace_in_line failed");
+        return;
     }
+    pool_release(old_text);
 
-    if (idx < (size_t)fs->line_capacity - 1) {
-        size_t to_copy = suffix_len;
-        if (idx + to_copy >= (size_t)fs->line_capacity)
-            to_copy = fs->line_capacity - idx - 1;
-        memcpy(new_line + idx, pos + search_len, to_copy);
-        idx += to_copy;
-    }
-    new_line[idx] = '\0';
-
-    char *new_text = strdup(new_line);
-    Change change = { line, old_text, new_text };
-    push(&fs->undo_stack, change);
-    strncpy(fs->buffer.lines[line], new_line, fs->line_capacity - 1);
-    fs->buffer.lines[line][fs->line_capacity - 1] = '\0';
-    free(new_line);
+    /* Only the matched bytes and their replacement are kept for undo */
+    Change change = { line, matched, inserted, prefix_len, true };
+    record_change(fs, change);
     fs->modified = true;
     mark_comment_state_dirty(fs);
 }
@@ -257,12 +256,12 @@ void replace_next_occurrence(FileState *fs, const char *search,
     int *cursor_y = &fs->cursor_y;
     int lines_per_screen = LINES - 3;
     int middle_line = lines_per_screen / 2;
-    int start_search = *cursor_y + fs->start_line;
+    long start_search = *cursor_y + fs->start_line;
 
-    int found_line = -1;
+    long found_line = -1;
     char *found_position = NULL;
 
-    for (int line = start_search;; ++line) {
+    for (long line = start_search;; ++line) {
         ensure_line_loaded(fs, line);
         if (line >= fs->buffer.count) {
             if (fs->file_complete)
@@ -284,7 +283,7 @@ void replace_next_occurrence(FileState *fs, const char *search,
     }
 
     if (!found_position) {
-        for (int line = 0; line < start_search; ++line) {
+        for (long line = 0; line < start_search; ++line) {
             ensure_line_loaded(fs, line);
             if (line >= fs->buffer.count) {
                 if (fs->file_complete)
@@ -310,6 +309,7 @@ void replace_next_occurrence(FileState *fs, const char *search,
         return;
     }
 
+    size_t found_col = found_position - lb_get(&fs->buffer, found_line);
     replace_in_line(fs, found_line, found_position, search, replacement);
     fs->modified = true;
 
@@ -326,15 +326,15 @@ void replace_next_occurrence(FileState *fs, const char *search,
     }
 
     *cursor_y = found_line - fs->start_line + 1;
-    const char *found_line_text2 = lb_get(&fs->buffer, found_line);
-    int desired_x = (found_position - found_line_text2) + strlen(replacement) + 1;
-    int line_len = strlen(found_line_text2);
+    int desired_x = found_col + strlen(replacement) + 1;
+    int line_len = lb_length(&fs->buffer, found_line);
     if (desired_x > line_len + 1)
         *cursor_x = line_len + 1;
     else
         *cursor_x = desired_x;
+    clamp_scroll_x(fs);
 
-    mvprintw(LINES - 2, 0, "Replaced at Line: %d, Column: %d", *cursor_y + fs->start_line + 1, *cursor_x);
+    mvprintw(LINES - 2, 0, "Replaced at Line: %ld, Column: %d", *cursor_y + fs->start_line + 1, *cursor_x);
     clrtoeol();
     refresh();
     werase(text_win);
@@ -342,13 +342,75 @@ void replace_next_occurrence(FileState *fs, const char *search,
     draw_text_buffer(active_file, text_win);
     int off = get_line_number_offset ? get_line_number_offset(fs) : 0;
     wmove(text_win, *cursor_y,
-          *cursor_x + off);
+          *cursor_x - fs->scroll_x + off);
     wrefresh(text_win);
 
     fs->match_start_x = fs->match_end_x = -1;
     fs->match_start_y = fs->match_end_y = -1;
 }
 
+/*
+ * Replace every occurrence of `search` in a paged file by streaming it to a
+ * new file (see rewrite.h) instead of loading and changing each line.  The
+ * buffer is read again from the result, so unsaved edits have to be saved
+ * first.  Progress is shown while the file is written and Esc stops the
+ * replacement, leaving the file as it was.
+ */
+static void replace_all_streamed(FileState *fs, const char *search,
+                                 const char *replacement) {
+    if (fs->save)
+        finish_save(fs, true);
+    if (fs->modified) {
+        mvprintw(LINES - 2, 0, "Save %s before replacing in all of it",
+                 fs->filename);
+        clrtoeol();
+        refresh();
+        return;
+    }
+    RewriteJob *job = rw_start(fs->filename, search, replacement,
+                               app_config.search_ignore_case,
+                               app_config.save_fsync);
+    if (!job) {
+        mvprintw(LINES - 2, 0, "Cannot replace in %s: %s", fs->filename,
+                 strerror(errno));
+        clrtoeol();
+        refresh();
+        return;
+    }
+    off_t done = 0;
+    off_t total = 0;
+    timeout(SV_PROGRESS_MS);
+    while (!rw_done(job, &done, &total)) {
+        mvprintw(LINES - 2, 0, "Replacing in %s: %d%% (Esc to stop)",
+                 fs->filename, total > 0 ? (int)(done * 100 / total) : 0);
+        clrtoeol();
+        refresh();
+        if (getch() == 27)
+            rw_cancel(job);
+    }
+    timeout(-1);
+    long count = rw_finish(job, fs);
+    int err = errno;
+
+    fs->match_start_x = fs->match_end_x = -1;
+    fs->match_start_y = fs->match_end_y = -1;
+
+    werase(text_win);
+    box(text_win, 0, 0);
+    draw_text_buffer(active_file, text_win);
+    if (count >= 0)
+        mvprintw(LINES - 2, 0, "Replaced %ld occurrences.", count);
+    else if (err == ECANCELED)
+        mvprintw(LINES - 2, 0, "Replace stopped; %s is unchanged.",
+                 fs->filename);
+    else
+        mvprintw(LINES - 2, 0, "Cannot replace in %s: %s", fs->filename,
+                 strerror(err));
+    clrtoeol();
+    refresh();
+    wrefresh(text_win);
+}
+
 /**
  * Replace every occurrence of `search` in the buffer.
  *
@@ -356,12 +418,17 @@ void replace_next_occurrence(FileState *fs, const char *search,
  * a match is found the text is rewritten.  Every change is pushed onto the undo
  * stack.  When finished the current match highlight is cleared, `fs->modified`
  * is set if replacements occurred and the window is redrawn to reflect the
- * changes.
+ * changes.  Paged files, which are too big to hold every changed line, are
+ * rewritten on disk by `replace_all_streamed` instead.
  */
 void replace_all_occurrences(FileState *fs, const char *search,
                              const char *replacement) {
+    if (lb_paged(&fs->buffer) && !fs->follow) {
+        replace_all_streamed(fs, search, replacement);
+        return;
+    }
     bool replaced = false;
-    for (int line = 0; ; ++line) {
+    for (long line = 0; ; ++line) {
         ensure_line_loaded(fs, line);
         if (line >= fs->buffer.count) {
             if (fs->file_complete)
@@ -376,7 +443,7 @@ void replace_all_occurrences(FileState *fs, const char *search,
         if (!pos)
             continue;
 
-        char *old_text = strdup(line_text);
+        char *old_text = lb_share(&fs->buffer, line);
         if (!old_text) {
             mvprintw(LINES - 2, 0, "Memory allocation failed");
             clrtoeol();
@@ -386,10 +453,19 @@ void replace_all_occurrences(FileState *fs, const char *search,
 
         size_t search_len = strlen(search);
         size_t replacement_len = strlen(replacement);
-        size_t buf_size = fs->line_capacity;
-        char *new_line = calloc(buf_size, 1);
+        /* Size the result exactly so long lines are never truncated */
+        size_t matches = 0;
+        for (char *m = pos; m; matches++)
+            m = app_config.search_ignore_case ?
+                    strcasestr_simple(m + search_len, search) :
+                    strstr(m + search_len, search);
+        size_t line_len = lb_length(&fs->buffer, line);
+        size_t buf_size = line_len + 1;
+        if (replacement_len > search_len)
+            buf_size += matches * (replacement_len - search_len);
+        char *new_line = malloc(buf_size);
         if (!new_line) {
-            free(old_text);
+            pool_release(old_text);
             mvprintw(LINES - 2, 0, "Memory allocation failed");
             clrtoeol();
             refresh();
@@ -399,45 +475,33 @@ void replace_all_occurrences(FileState *fs, const char *search,
         char *cursor = line_text;
         while (pos) {
             size_t prefix_len = pos - cursor;
-            if (idx + prefix_len >= buf_size - 1) {
-                prefix_len = buf_size - 1 - idx;
-            }
             memcpy(new_line + idx, cursor, prefix_len);
             idx += prefix_len;
-
-            if (idx < buf_size - 1) {
-                size_t to_copy = replacement_len;
-                if (idx + to_copy >= buf_size - 1)
-                    to_copy = buf_size - 1 - idx;
-                memcpy(new_line + idx, replacement, to_copy);
-                idx += to_copy;
-            }
+            memcpy(new_line + idx, replacement, replacement_len);
+            idx += replacement_len;
 
             cursor = pos + search_len;
             pos = app_config.search_ignore_case ?
                     strcasestr_simple(cursor, search) :
                     strstr(cursor, search);
         }
-        size_t tail_len = strlen(cursor);
-        if (idx + tail_len >= buf_size - 1)
-            tail_len = buf_size - 1 - idx;
+        size_t tail_len = line_len - (size_t)(cursor - line_text);
         memcpy(new_line + idx, cursor, tail_len);
         idx += tail_len;
         new_line[idx] = '\0';
 
-        char *new_text = strdup(new_line);
+        char *new_text = pool_intern(new_line, idx);
+        free(new_line);
         if (!new_text) {
-            free(old_text);
-            free(new_line);
+            pool_release(old_text);
             mvprintw(LINES - 2, 0, "Memory allocation failed");
             clrtoeol();
             refresh();
             continue;
         }
-        push(&fs->undo_stack, (Change){ line, old_text, new_text });
-        strncpy(fs->buffer.lines[line], new_line, fs->line_capacity - 1);
-        fs->buffer.lines[line][fs->line_capacity - 1] = '\0';
-        free(new_line);
+        record_change(fs, (Change){ line, old_text, new_text, 0, false });
+        if (lb_set_shared(&fs->buffer, line, new_text, idx) < 0)
+            allocation_failed("lb_set_shared failed");
         mark_comment_state_dirty(fs);
         replaced = true;
     }
@@ -467,9 +531,11 @@ void replace_all_occurrences(FileState *fs, const char *search,
  * chosen option.
  */
 void replace(EditorContext *ctx, FileState *fs) {
-    char search[256];
-    char replacement[256];
+    char search[256] = "";
+    char replacement[256] = "";
 
+    if (reject_edit(fs))
+        return;
     if (!show_replace_dialog(ctx, search, sizeof(search), replacement,
                              sizeof(replacement)))
         return;
@@ -56,7 +56,7 @@ void print_char_with_attr(WINDOW *win, int y, int *x, char c, int attr);
 void highlight_no_syntax(WINDOW *win, const char *line, int y);
 void highlight_with_keywords(struct FileState *fs, WINDOW *win, const char *line,
                              int y, const char **keywords, int keyword_count);
-void sync_multiline_comment(struct FileState *fs, int line);
+void sync_multiline_comment(struct FileState *fs, long line);
 void mark_comment_state_dirty(struct FileState *fs);
 
 /* Token scanning helpers shared by highlight implementations */
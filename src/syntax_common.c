@@ -6,6 +6,8 @@
 #include "editor.h"
 #include "files.h"
 
+#define VIEW_SYNC_LINES 500 /* lines scanned above a view or paged line */
+
 /*
  * Common syntax scanning and highlighting helpers.
  *
@@ -116,30 +118,56 @@ int scan_multiline_string(const char *line, int start, char quote, bool *closed)
  * Update fs->in_multiline_comment by scanning lines up to 'line'.
  * This allows language modules to know whether a block comment is
  * currently open when highlighting subsequent lines.
+ *
+ * The comment state at the start of every scanned line is recorded in the
+ * buffer's line metadata, so returning to a line above last_scanned_line
+ * is a single lookup rather than a rescan from the top of the file. Only
+ * when that state has been dropped, as happens when a paged buffer evicts
+ * the line, does the scan start over.
+ *
+ * Read-only views keep no line metadata and, like paged buffers, may be far
+ * too large to scan from the top, so for them the scan starts at most
+ * VIEW_SYNC_LINES above LINE, outside any comment. A comment opened further up is then not
+ * noticed, as in pagers that highlight only what they show.
  */
-void sync_multiline_comment(FileState *fs, int line) {
+void sync_multiline_comment(FileState *fs, long line) {
     bool in_comment;
     bool in_string = false;
     char quote = '\0';
 
-    int start;
+    long start;
+    long max = line < fs->buffer.count ? line : fs->buffer.count;
 
-    if (line < fs->last_scanned_line) {
+    if (max <= fs->last_scanned_line) {
+        int state = max < fs->last_scanned_line ? lb_state(&fs->buffer, max)
+                                                : fs->last_comment_state;
+        if (state >= 0) {
+            fs->in_multiline_comment = state != 0;
+            return;
+        }
         start = 0;
         in_comment = false;
     } else {
         start = fs->last_scanned_line;
         in_comment = fs->last_comment_state;
     }
+    if ((fs->buffer.backend == LB_MAP_VIEW || fs->buffer.pages) &&
+        max - start > VIEW_SYNC_LINES) {
+        start = max - VIEW_SYNC_LINES;
+        in_comment = false;
+    }
 
-    int max = line < fs->buffer.count ? line : fs->buffer.count;
-    for (int l = start; l < max; l++) {
-        char *p = fs->buffer.lines[l];
-        for (int i = 0; p[i] != '\0'; i++) {
+    for (long l = start; l < max; l++) {
+        lb_set_state(&fs->buffer, l, in_comment);
+        const char *p = lb_get(&fs->buffer, l);
+        if (!p)
+            continue;
+        int len = lb_length(&fs->buffer, l);
+        for (int i = 0; i < len; i++) {
             char c = p[i];
 
             if (in_string) {
-                if (c == '\\' && p[i + 1] != '\0') {
+                if (c == '\\' && i + 1 < len) {
                     i++; // Skip escaped char
                     continue;
                 } else if (c == quote) {
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <errno.h>
 #include "config.h"
 #include "editor.h"
 #include "ui.h"
@@ -131,7 +132,7 @@ int show_replace_dialog(EditorContext *ctx, char *search, int max_search_len,
  * The dialog itself is implemented with create_dialog() which in turn
  * uses the dialog.c helpers to manage the popup.
  */
-int show_goto_dialog(EditorContext *ctx, int *line_number) {
+int show_goto_dialog(EditorContext *ctx, long *line_number) {
     char buf[32];
 
     create_dialog(ctx, "Go To Line:", buf, sizeof(buf));
@@ -141,12 +142,13 @@ int show_goto_dialog(EditorContext *ctx, int *line_number) {
     }
 
     char *endptr;
+    errno = 0;
     long val = strtol(buf, &endptr, 10);
 
-    if (*endptr != '\0' || val < 1 || val > INT_MAX) {
+    if (*endptr != '\0' || val < 1 || errno == ERANGE) {
         return 0;
     }
 
-    *line_number = (int)val;
+    *line_number = val;
     return 1;
 }
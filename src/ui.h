@@ -15,10 +15,11 @@ int show_find_dialog(EditorContext *ctx, char *output, int max_input_len,
                      const char *preset);
 int show_replace_dialog(EditorContext *ctx, char *search, int max_search_len,
                         char *replace, int max_replace_len);
-int show_goto_dialog(EditorContext *ctx, int *line_number);
+int show_goto_dialog(EditorContext *ctx, long *line_number);
 int show_open_file_dialog(EditorContext *ctx, char *path, int max_len);
 int show_save_file_dialog(EditorContext *ctx, char *path, int max_len);
 int show_settings_dialog(EditorContext *ctx, AppConfig *cfg);
 void show_manage_macros(EditorContext *ctx);
+void show_memory_usage(EditorContext *ctx);
 
 #endif // UI_H
@@ -1,8 +1,8 @@
 /*
  * Informational dialogs
  * ---------------------
- * Implements the help screen, about dialog and startup warning
- * shown by the editor at various times.
+ * Implements the help screen, about dialog, memory usage report and
+ * startup warning shown by the editor at various times.
  */
 #include "editor.h"
 #include "config.h"
@@ -11,7 +11,12 @@
 #include "syntax.h"
 #include "dialog.h"
 #include "menu.h"
+#include "files.h"
+#include "mem_budget.h"
+#include "line_pool.h"
 #include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /*
@@ -56,6 +61,7 @@ void show_help(EditorContext *ctx) {
         "CTRL-PgDn: Move to end of doc",
         "F6: Next file",
         "F7: Previous file",
+        "F8: Follow file as it grows",
         "CTRL-T/F10: Open menus",
         "Left/Right: Switch menus",
         "Up/Down: Choose item",
@@ -193,3 +199,96 @@ void show_warning_dialog(EditorContext *ctx) {
     wnoutrefresh(stdscr);
     doupdate();
 }
+
+#define MEM_ROW 128
+
+/* Format BYTES into OUT as bytes, KiB, MiB or GiB. */
+static void format_bytes(char *out, size_t size, size_t bytes) {
+    if (bytes < 1024)
+        snprintf(out, size, "%zu B", bytes);
+    else if (bytes < (size_t)1 << 20)
+        snprintf(out, size, "%.1f KiB", bytes / 1024.0);
+    else if (bytes < (size_t)1 << 30)
+        snprintf(out, size, "%.1f MiB", bytes / (1024.0 * 1024.0));
+    else
+        snprintf(out, size, "%.1f GiB", bytes / (1024.0 * 1024.0 * 1024.0));
+}
+
+/*
+ * Display how much memory every open file uses, split into its lines,
+ * their slack, its undo history and its window, followed by the shared
+ * line pool, the total and the memory budget.
+ *
+ * Invoked from Options -> "Memory Usage...".
+ */
+void show_memory_usage(EditorContext *ctx) {
+    int files = file_manager.count;
+    int count = files + 7;
+    char (*rows)[MEM_ROW] = malloc(sizeof(*rows) * (size_t)count);
+    const char **lines = malloc(sizeof(*lines) * (size_t)count);
+    if (!rows || !lines) {
+        free(rows);
+        free(lines);
+        show_message("Unable to create window");
+        return;
+    }
+    curs_set(0);
+    wbkgd(stdscr, ctx->enable_color ? COLOR_PAIR(SYNTAX_BG) : A_NORMAL);
+
+    int n = 0;
+    snprintf(rows[n++], MEM_ROW, "%-20s %9s %9s %9s %9s %9s %9s", "File",
+             "Lines", "Slack", "Undo", "Window", "Total", "Mapped");
+    for (int i = 0; i < files; ++i) {
+        FileState *fs = file_manager.files[i];
+        if (!fs)
+            continue;
+        FileMemory mem;
+        size_t total = mb_file_usage(fs, &mem);
+        const char *name = "untitled";
+        if (fs->filename[0] != '\0') {
+            const char *slash = strrchr(fs->filename, '/');
+            name = slash ? slash + 1 : fs->filename;
+        }
+        char col[6][16];
+        format_bytes(col[0], sizeof(col[0]), mem.lines);
+        format_bytes(col[1], sizeof(col[1]), mem.slack);
+        format_bytes(col[2], sizeof(col[2]), mem.undo);
+        format_bytes(col[3], sizeof(col[3]), mem.window);
+        format_bytes(col[4], sizeof(col[4]), total);
+        format_bytes(col[5], sizeof(col[5]), mem.mapped);
+        snprintf(rows[n++], MEM_ROW, "%-20.20s %9s %9s %9s %9s %9s %9s%s",
+                 name, col[0], col[1], col[2], col[3], col[4], col[5],
+                 fs->swap ? " (hibernated)" : "");
+    }
+
+    char size[16];
+    rows[n++][0] = '\0';
+    format_bytes(size, sizeof(size), pool_bytes());
+    snprintf(rows[n++], MEM_ROW, "Shared line pool: %s", size);
+    format_bytes(size, sizeof(size), mb_usage(&file_manager));
+    if (app_config.memory_budget_mb > 0)
+        snprintf(rows[n++], MEM_ROW, "Total: %s of a %d MiB budget", size,
+                 app_config.memory_budget_mb);
+    else
+        snprintf(rows[n++], MEM_ROW, "Total: %s (no budget set)", size);
+    if (mb_over_budget())
+        snprintf(rows[n++], MEM_ROW, "Over budget: edits are refused");
+    snprintf(rows[n++], MEM_ROW, "Mapped file text is not counted.");
+
+    int max_len = 0;
+    for (int i = 0; i < n; ++i) {
+        lines[i] = rows[i];
+        int len = (int)strlen(rows[i]);
+        if (len > max_len)
+            max_len = len;
+    }
+    int win_width = max_len + 4;
+    if (win_width > COLS - 2)
+        win_width = COLS - 2;
+
+    show_scrollable_window(lines, n, NULL, win_width);
+    free(lines);
+    free(rows);
+    wrefresh(stdscr);
+    curs_set(1);
+}
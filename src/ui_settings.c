@@ -75,6 +75,14 @@ static const Option options[] = {
     {"Search color", OPT_COLOR, offsetof(AppConfig, search_color), NULL},
     {"Macro record key", OPT_INT, offsetof(AppConfig, macro_record_key), NULL},
     {"Macro play key", OPT_INT, offsetof(AppConfig, macro_play_key), NULL},
+    {"Piece table buffers", OPT_BOOL, offsetof(AppConfig, piece_table), NULL},
+    {"Compress large files", OPT_BOOL, offsetof(AppConfig, compress_files), NULL},
+    {"Share identical lines", OPT_BOOL, offsetof(AppConfig, share_lines), NULL},
+    {"Read-only from MiB (0 = off)", OPT_INT, offsetof(AppConfig, read_only_mb), NULL},
+    {"Parked file handles", OPT_INT, offsetof(AppConfig, handle_pool), NULL},
+    {"Memory budget MiB (0 = off)", OPT_INT, offsetof(AppConfig, memory_budget_mb), NULL},
+    {"Hibernate tabs after min (0 = off)", OPT_INT, offsetof(AppConfig, hibernate_minutes), NULL},
+    {"Sync saved files to disk", OPT_BOOL, offsetof(AppConfig, save_fsync), NULL},
 };
 
 #define FIELD_COUNT ((int)(sizeof(options) / sizeof(options[0])))
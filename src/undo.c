@@ -1,3 +1,5 @@
+#include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ncurses.h>
@@ -6,17 +8,29 @@
 #include "files.h"
 #include "editor_state.h"
 #include "line_buffer.h"
+#include "line_pool.h"
+#include "journal.h"
+#include "rewrite.h"
 
 /*
  * Undo/Redo Data Structures
  * -------------------------
  * The editor maintains two singly linked stacks per file: one for undo and one
  * for redo.  Each stack node stores a `Change` describing how a single line was
- * modified.  A `Change` contains dynamically allocated strings for the text
- * before and after the modification.  When a node is pushed onto a stack it
- * assumes ownership of those strings and releases them when popped or when the
- * stack is destroyed.  The head pointers of these stacks may be NULL when no
- * history exists.
+ * modified, either as its whole text before and after or, for typing and
+ * deleting characters, as the bytes removed and inserted at one column.  The
+ * texts are held as references into the line pool (see line_pool.h), so a
+ * record costs no more than the text it names and an unchanged line is shared
+ * with the buffer instead of being copied.  When a node is pushed onto a stack
+ * it takes over those references and releases them when popped or when the
+ * stack is destroyed.
+ * Moving a change from one stack to the other hands the references across
+ * without copying any text.  The head pointers of these stacks may be NULL
+ * when no history exists.
+ *
+ * A change with a negative line and no text marks a streaming replace of
+ * the whole file (see rewrite.h), which is undone and redone by exchanging
+ * the file with the version kept beside it.
  */
 
 /**
@@ -25,11 +39,14 @@
  * The stack parameter points to either a FileState undo or redo list.  The
  * function allocates a new Node, stores the Change and makes it the new head.
  * Only the pointers inside the Change are stored; the Node becomes responsible
- * for freeing that text when removed.
+ * for releasing that text when removed.  If the Node cannot be allocated the
+ * references are released straight away.
  */
 void push(Node **stack, Change change) {
     Node *new_node = (Node *)malloc(sizeof(Node));
     if (new_node == NULL) {
+        pool_release(change.old_text);
+        pool_release(change.new_text);
         allocation_failed("push malloc failed");
         return;
     }
@@ -38,16 +55,102 @@ void push(Node **stack, Change change) {
     *stack = new_node;
 }
 
+/* Bytes of words: letters, digits, '_' and anything beyond ASCII. */
+static bool word_byte(char c) {
+    unsigned char u = (unsigned char)c;
+    return isalnum(u) || u == '_' || u >= 0x80;
+}
+
+/*
+ * Merge the in-line change `change` into `top`, the record on top of a
+ * stack, when one continues the other: text typed where the text of `top`
+ * ends, or a byte deleted just before (backspace) or at (delete) the bytes
+ * `top` removed.  The merged bytes must fit in UNDO_WORD and not start a new
+ * word, so a record covers a word and the spaces after it.  Returns true if
+ * the change was merged, its references then being released.
+ */
+static bool merge_edit(Change *top, Change change) {
+    if (!top->in_line || !change.in_line || top->line != change.line)
+        return false;
+    const char *left;
+    const char *right;
+    char **text;
+    size_t col = top->col;
+    if (!top->old_text && !change.old_text && top->new_text &&
+        change.new_text) {
+        if (change.col != top->col + pool_length(top->new_text))
+            return false;
+        left = top->new_text;
+        right = change.new_text;
+        text = &top->new_text;
+    } else if (!top->new_text && !change.new_text && top->old_text &&
+               change.old_text) {
+        if (change.col == top->col) {
+            left = top->old_text;
+            right = change.old_text;
+        } else if (change.col + pool_length(change.old_text) == top->col) {
+            left = change.old_text;
+            right = top->old_text;
+            col = change.col;
+        } else {
+            return false;
+        }
+        text = &top->old_text;
+    } else {
+        return false;
+    }
+
+    size_t left_len = pool_length(left);
+    size_t right_len = pool_length(right);
+    if (left_len + right_len > UNDO_WORD ||
+        (!word_byte(left[left_len - 1]) && word_byte(right[0])))
+        return false;
+    char joined[UNDO_WORD];
+    memcpy(joined, left, left_len);
+    memcpy(joined + left_len, right, right_len);
+    char *merged = pool_intern(joined, left_len + right_len);
+    if (!merged)
+        return false;
+    pool_release(*text);
+    *text = merged;
+    top->col = col;
+    pool_release(change.old_text);
+    pool_release(change.new_text);
+    return true;
+}
+
+/**
+ * Push `change` onto a stack, merged into the record on top when it
+ * continues the typing or deleting that record holds (see merge_edit()).
+ */
+void push_edit(Node **stack, Change change) {
+    if (*stack && merge_edit(&(*stack)->change, change))
+        return;
+    push(stack, change);
+}
+
+/**
+ * Record a change made to the buffer of `fs`.
+ *
+ * Every edit goes through here, so the journal sees the same changes as the
+ * undo history.  The journal copies the text it needs before the change is
+ * pushed onto `fs->undo_stack`.
+ */
+void record_change(FileState *fs, Change change) {
+    jn_record(fs, &change);
+    push_edit(&fs->undo_stack, change);
+}
+
 /**
  * Remove and return the most recent change from a stack.
  *
  * If the stack is empty an empty Change with NULL pointers is returned.  The
- * caller becomes the owner of any text in the returned Change and must free it
- * after applying the change.
+ * caller takes over the pool references in the returned Change and must
+ * release or push them after applying the change.
  */
 Change pop(Node **stack) {
     if (*stack == NULL) {
-        Change empty_change = {0, NULL, NULL};
+        Change empty_change = {0, NULL, NULL, 0, false};
         return empty_change;
     }
     Node *top = *stack;
@@ -67,12 +170,80 @@ int is_empty(Node *stack) {
     return stack == NULL;
 }
 
+/* Insert pooled TEXT as line LINE, sharing it with the undo record. */
+static void insert_shared(FileState *fs, long line, char *text) {
+    if (lb_insert_shared(&fs->buffer, line, text, pool_length(text)) < 0)
+        allocation_failed("lb_insert_shared failed");
+}
+
+/* Replace line LINE with pooled TEXT, sharing it with the undo record. */
+static void set_shared(FileState *fs, long line, char *text) {
+    if (line < fs->buffer.count &&
+        lb_set_shared(&fs->buffer, line, text, pool_length(text)) < 0)
+        allocation_failed("lb_set_shared failed");
+}
+
+/*
+ * Undo or redo the streaming replace marked by `change`, moving it from
+ * `from` to `to`.  If the file cannot be exchanged the change goes back
+ * where it came from and the reason is shown.
+ */
+static void swap_file(FileState *fs, Change change, Node **from, Node **to) {
+    if (rw_swap(fs, change.line) < 0) {
+        int err = errno;
+        push(from, change);
+        const char *why = err == EBUSY ? "save the file first" :
+                          err == ESTALE ? "the file was saved since" :
+                          err == ENOENT ? "a later replacement dropped it" :
+                          strerror(err);
+        mvprintw(LINES - 2, 2, "Cannot restore the other version of %s: %s",
+                 fs->filename, why);
+        clrtoeol();
+        refresh();
+        return;
+    }
+    push(to, change);
+    werase(text_win);
+    box(text_win, 0, 0);
+    draw_text_buffer(active_file, text_win);
+    wrefresh(text_win);
+}
+
+/*
+ * Replace the bytes `removed` at the column of in-line change `change` with
+ * `inserted`, either of which may be NULL.  A change that no longer fits
+ * the line is skipped.
+ */
+static void edit_bytes(FileState *fs, const Change *change,
+                       const char *removed, const char *inserted) {
+    size_t removed_len = removed ? pool_length(removed) : 0;
+    if (change->line >= fs->buffer.count ||
+        change->col + removed_len > lb_length(&fs->buffer, change->line))
+        return;
+    if (removed_len &&
+        lb_delete_text(&fs->buffer, change->line, change->col,
+                       removed_len) < 0)
+        allocation_failed("lb_delete_text failed");
+    else if (inserted &&
+             lb_insert_text(&fs->buffer, change->line, change->col, inserted,
+                            pool_length(inserted)) < 0)
+        allocation_failed("lb_insert_text failed");
+}
+
+/* The change that takes back `change`. */
+static Change reverse(Change change) {
+    char *text = change.old_text;
+    change.old_text = change.new_text;
+    change.new_text = text;
+    return change;
+}
+
 /**
  * Undo the most recent action on `fs`.
  *
  * A change is popped from `fs->undo_stack` and applied in reverse to
- * `fs->buffer`.  The inverse of that change is pushed onto `fs->redo_stack` so
- * it can be redone later.  If there is no undo history the function simply
+ * `fs->buffer`.  The same change is then pushed onto `fs->redo_stack` so it
+ * can be redone later.  If there is no undo history the function simply
  * returns.  A screen redraw is triggered and `fs->modified` is set whenever a
  * change is undone.
  */
@@ -81,55 +252,22 @@ void undo(FileState *fs) {
         return;
 
     Change change = pop(&fs->undo_stack);
+    if (change.line < 0) {
+        swap_file(fs, change, &fs->undo_stack, &fs->redo_stack);
+        return;
+    }
 
-    if (change.old_text && !change.new_text) { /* Deletion */
-        if (lb_insert(&fs->buffer, change.line, change.old_text) < 0)
-            allocation_failed("lb_insert failed");
-        char *p = realloc(fs->buffer.lines[change.line], fs->line_capacity);
-        if (!p)
-            allocation_failed("realloc failed");
-        fs->buffer.lines[change.line] = p;
-        fs->buffer.lines[change.line][fs->line_capacity - 1] = '\0';
-
-        char *dup = strdup(change.old_text);
-        if (!dup) {
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->redo_stack, (Change){ change.line, dup, NULL });
-        }
-        free(change.old_text);
-    } else if (!change.old_text && change.new_text) { /* Insertion */
+    if (change.in_line) /* Bytes within the line */
+        edit_bytes(fs, &change, change.new_text, change.old_text);
+    else if (change.old_text && !change.new_text) /* Deletion */
+        insert_shared(fs, change.line, change.old_text);
+    else if (!change.old_text && change.new_text) /* Insertion */
         lb_delete(&fs->buffer, change.line);
-
-        char *dup = strdup(change.new_text);
-        if (!dup) {
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->redo_stack, (Change){ change.line, NULL, dup });
-        }
-        free(change.new_text);
-    } else if (change.old_text && change.new_text) { /* Edit */
-        char *line = (char *)lb_get(&fs->buffer, change.line);
-        if (line) {
-            strncpy(line, change.old_text, fs->line_capacity - 1);
-            line[fs->line_capacity - 1] = '\0';
-        }
-
-        char *dup_old = strdup(change.old_text);
-        char *dup_new = strdup(change.new_text);
-        if (!dup_old || !dup_new) {
-            if (dup_old)
-                free(dup_old);
-            if (dup_new)
-                free(dup_new);
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->redo_stack,
-                 (Change){ change.line, dup_old, dup_new });
-        }
-        free(change.old_text);
-        free(change.new_text);
-    }
+    else if (change.old_text && change.new_text) /* Edit */
+        set_shared(fs, change.line, change.old_text);
+    Change undone = reverse(change);
+    jn_record(fs, &undone);
+    push(&fs->redo_stack, change);
 
     werase(text_win);
     box(text_win, 0, 0);
@@ -142,61 +280,30 @@ void undo(FileState *fs) {
  * Redo the last undone action on `fs`.
  *
  * A change is popped from `fs->redo_stack` and re-applied to `fs->buffer`.  The
- * inverse operation is then pushed back onto `fs->undo_stack`.  If there is no
- * redo history the function returns immediately.  As with undo, the text window
- * is redrawn and the file marked modified whenever a redo occurs.
+ * change is then pushed back onto `fs->undo_stack`.  If there is no redo
+ * history the function returns immediately.  As with undo, the text window is
+ * redrawn and the file marked modified whenever a redo occurs.
  */
 void redo(FileState *fs) {
     if (fs->redo_stack == NULL)
         return;
 
     Change change = pop(&fs->redo_stack);
+    if (change.line < 0) {
+        swap_file(fs, change, &fs->redo_stack, &fs->undo_stack);
+        return;
+    }
 
-    if (change.old_text && !change.new_text) { /* Deletion */
-        char *dup = strdup(change.old_text);
-        if (!dup) {
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->undo_stack, (Change){ change.line, dup, NULL });
-        }
+    if (change.in_line) /* Bytes within the line */
+        edit_bytes(fs, &change, change.old_text, change.new_text);
+    else if (change.old_text && !change.new_text) /* Deletion */
         lb_delete(&fs->buffer, change.line);
-        free(change.old_text);
-    } else if (!change.old_text && change.new_text) { /* Insertion */
-        if (lb_insert(&fs->buffer, change.line, change.new_text) < 0)
-            allocation_failed("lb_insert failed");
-        char *p = realloc(fs->buffer.lines[change.line], fs->line_capacity);
-        if (!p)
-            allocation_failed("realloc failed");
-        fs->buffer.lines[change.line] = p;
-        fs->buffer.lines[change.line][fs->line_capacity - 1] = '\0';
-        char *dup = strdup(change.new_text);
-        if (!dup) {
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->undo_stack, (Change){ change.line, NULL, dup });
-        }
-        free(change.new_text);
-    } else if (change.old_text && change.new_text) { /* Edit */
-        char *dup_old = strdup(change.old_text);
-        char *dup_new = strdup(change.new_text);
-        if (!dup_old || !dup_new) {
-            if (dup_old)
-                free(dup_old);
-            if (dup_new)
-                free(dup_new);
-            allocation_failed("strdup failed");
-        } else {
-            push(&fs->undo_stack,
-                 (Change){ change.line, dup_old, dup_new });
-        }
-        char *line = (char *)lb_get(&fs->buffer, change.line);
-        if (line) {
-            strncpy(line, change.new_text, fs->line_capacity - 1);
-            line[fs->line_capacity - 1] = '\0';
-        }
-        free(change.old_text);
-        free(change.new_text);
-    }
+    else if (!change.old_text && change.new_text) /* Insertion */
+        insert_shared(fs, change.line, change.new_text);
+    else if (change.old_text && change.new_text) /* Edit */
+        set_shared(fs, change.line, change.new_text);
+    jn_record(fs, &change);
+    push(&fs->undo_stack, change);
 
     werase(text_win);
     box(text_win, 0, 0);
@@ -208,23 +315,16 @@ void redo(FileState *fs) {
 /**
  * Free an entire change stack.
  *
- * All nodes are removed and any text stored within them is released.
- * This should be called when a FileState is destroyed to avoid leaking
- * memory associated with undo and redo history.
+ * All nodes are removed and the pool references stored within them are
+ * released.  This should be called when a FileState is destroyed to avoid
+ * leaking memory associated with undo and redo history.
  */
 void free_stack(Node *stack) {
     while (stack) {
         Node *next = stack->next;
-        if (stack->change.old_text) {
-            free(stack->change.old_text);
-            stack->change.old_text = NULL;
-        }
-        if (stack->change.new_text) {
-            free(stack->change.new_text);
-            stack->change.new_text = NULL;
-        }
+        pool_release(stack->change.old_text);
+        pool_release(stack->change.new_text);
         free(stack);
         stack = next;
     }
 }
-
@@ -7,16 +7,34 @@
 /**
  * Pushes a change onto the given stack.
  *
- * Ownership of any strings inside the Change is transferred to the stack. The
- * function allocates a new Node and places it at the head of the list.
+ * The line pool references inside the Change are transferred to the stack.
+ * The function allocates a new Node and places it at the head of the list.
  */
 void push(Node **stack, Change change);
 
+#define UNDO_WORD 32 /* most bytes one merged typing or deleting record holds */
+
+/**
+ * Pushes a change onto the given stack, merging an in-line change into the
+ * record on top when both type, or both delete, adjacent bytes of one word.
+ * Merged records hold at most UNDO_WORD bytes.
+ */
+void push_edit(Node **stack, Change change);
+
+/**
+ * Records a change made to `fs->buffer`.
+ *
+ * The change is pushed onto `fs->undo_stack` with push_edit(), which takes
+ * over its pool references, and appended to the crash-recovery journal of the file (see
+ * journal.h).
+ */
+void record_change(FileState *fs, Change change);
+
 /**
  * Pops the most recent change from the stack.
  *
  * If the stack is empty an empty Change with NULL strings is returned. The
- * caller becomes responsible for freeing the returned Change contents.
+ * caller becomes responsible for releasing the returned pool references.
  */
 Change pop(Node **stack);
 
@@ -24,7 +42,7 @@ Change pop(Node **stack);
 int is_empty(Node *stack);
 
 /**
- * Frees all nodes in the stack and any text they own.
+ * Frees all nodes in the stack and releases the text they reference.
  */
 void free_stack(Node *stack);
 
@@ -26,14 +26,18 @@ extern void load_theme(const char *name, AppConfig *cfg) __attribute__((weak));
 extern void apply_colors(void) __attribute__((weak));
 
 EditorContext editor;
-extern int start_line;
+extern long start_line;
 
 /*
- * Prompt the user before exiting when unsaved changes exist.
+ * Prompt the user before exiting when unsaved changes exist, once the
+ * files still being saved have been written.
  * Returns true to proceed with quit when no files are modified or
  * the user answers yes. Returns false otherwise.
  */
 bool confirm_quit(void) {
+    for (int i = 0; i < file_manager.count; ++i)
+        if (file_manager.files[i])
+            finish_save(file_manager.files[i], true);
     if (!any_file_modified(&file_manager))
         return true;
 
@@ -72,6 +76,9 @@ int main(int argc, char *argv[]) {
             printf("  -v, --version  Print version information and exit\n");
             printf("  -t, --theme    Load a color theme before opening files\n");
             printf("  +N, --line=N   Start editing at line N\n");
+            printf("  -R, --read-only  Open files read-only\n");
+            printf("  -f, --follow   Follow files as they grow, like tail -f\n");
+            printf("      --recover  Restore unsaved changes lost in a crash\n");
             printf("      --macro=<name>=<key>  Create empty macro bound to key\n");
             return 0;
         } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
@@ -82,7 +89,13 @@ int main(int argc, char *argv[]) {
         } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--theme") == 0) && i + 1 < argc) {
             theme_name = argv[++i];
         } else if (strncmp(argv[i], "--line=", 7) == 0) {
-            start_line = atoi(argv[i] + 7);
+            start_line = atol(argv[i] + 7);
+        } else if (strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "--read-only") == 0) {
+            read_only_files = 1;
+        } else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--follow") == 0) {
+            follow_files = 1;
+        } else if (strcmp(argv[i], "--recover") == 0) {
+            recover_files = 1;
         } else if (strncmp(argv[i], "--macro=", 8) == 0) {
             const char *spec = argv[i] + 8;
             char *eq = strchr(spec, '=');
@@ -96,7 +109,7 @@ int main(int argc, char *argv[]) {
                 macro_count_cli++;
             }
         } else if (argv[i][0] == '+' && isdigit((unsigned char)argv[i][1])) {
-            start_line = atoi(argv[i] + 1);
+            start_line = atol(argv[i] + 1);
         }
     }
 
@@ -135,7 +148,10 @@ int main(int argc, char *argv[]) {
         if (strncmp(argv[i], "--line=", 7) == 0 || (argv[i][0] == '+' && isdigit((unsigned char)argv[i][1]))) {
             continue;
         }
-        if (strncmp(argv[i], "--macro=", 8) == 0) {
+        if (strncmp(argv[i], "--macro=", 8) == 0 ||
+            strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "--read-only") == 0 ||
+            strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--follow") == 0 ||
+            strcmp(argv[i], "--recover") == 0) {
             continue;
         }
 
@@ -144,11 +160,8 @@ int main(int argc, char *argv[]) {
                 first_index = file_manager.active_index;
             } else {
                 FileState *loaded = fm_current(&file_manager);
-                if (loaded && loaded->fp && !loaded->file_complete) {
-                    loaded->file_pos = ftell(loaded->fp);
-                    fclose(loaded->fp);
-                    loaded->fp = NULL;
-                }
+                if (loaded)
+                    park_file(loaded);
                 fm_switch(&file_manager, first_index);
                 sync_editor_context(&editor);
             }
@@ -162,6 +175,7 @@ int main(int argc, char *argv[]) {
     }
 
     active_file = fm_current(&file_manager);
+    text_win = active_file ? active_file->text_win : NULL;
     editor.active_file = active_file;
     editor.text_win = text_win;
     editor.file_manager = file_manager;
@@ -0,0 +1,107 @@
+#include "minunit.h"
+#include "arena.h"
+#include <stdio.h>
+#include <string.h>
+
+int tests_run = 0;
+
+static char *test_size_classes_reuse() {
+    Arena a;
+    size_t got;
+    arena_init(&a);
+
+    char *p = arena_alloc(&a, 5, &got);
+    mu_assert("small alloc", p != NULL && got == ARENA_MIN_CLASS);
+    strcpy(p, "four");
+    char *q = arena_alloc(&a, 17, &got);
+    mu_assert("next class", q != NULL && got == 32);
+    mu_assert("distinct", q != p);
+
+    arena_free(&a, p, ARENA_MIN_CLASS);
+    char *r = arena_alloc(&a, 9, &got);
+    mu_assert("freed block reused", r == p);
+
+    /* Growing copies the contents into the larger class */
+    strcpy(r, "grow");
+    char *s = arena_resize(&a, r, got, 100, &got);
+    mu_assert("resized", s != NULL && got == 128);
+    mu_assert("contents kept", strcmp(s, "grow") == 0);
+
+    arena_release(&a);
+    mu_assert("released", a.slabs == NULL && a.big == NULL);
+    return 0;
+}
+
+static char *test_large_blocks() {
+    Arena a;
+    size_t got;
+    arena_init(&a);
+
+    char *big = arena_alloc(&a, ARENA_MAX_CLASS + 1, &got);
+    mu_assert("big alloc", big != NULL && got == ARENA_MAX_CLASS + 1);
+    memset(big, 'x', got);
+    char *bigger = arena_resize(&a, big, got, 100000, &got);
+    mu_assert("big resize", bigger != NULL && got == 100000);
+    mu_assert("big contents", bigger[ARENA_MAX_CLASS] == 'x');
+
+    /* Fill several slabs so the bump region is retired and refilled */
+    for (int i = 0; i < 10000; ++i) {
+        char *p = arena_alloc(&a, 1 + i % 3000, &got);
+        mu_assert("many allocs", p != NULL);
+        p[got - 1] = 'y';
+    }
+    arena_free(&a, bigger, 100000);
+    mu_assert("big unlinked", a.big == NULL);
+    arena_release(&a);
+    return 0;
+}
+
+static char *test_counters_and_adopt() {
+    Arena a, b;
+    size_t got, big_got;
+    arena_init(&a);
+    arena_init(&b);
+
+    char *p = arena_alloc(&a, 100, &got);
+    mu_assert("granted counted", p != NULL && a.granted == got);
+    mu_assert("slab reserved", a.reserved >= got);
+    char *big = arena_alloc(&a, ARENA_MAX_CLASS + 10, &big_got);
+    mu_assert("big counted", big && a.granted == got + big_got);
+    arena_free(&a, p, got);
+    mu_assert("freed uncounted", a.granted == big_got);
+
+    size_t held = a.reserved;
+    char *q = arena_alloc(&b, 40, &got);
+    mu_assert("other arena", q != NULL);
+    size_t other = b.reserved;
+    arena_adopt(&a, &b);
+    mu_assert("from emptied", b.slabs == NULL && b.reserved == 0 &&
+                                  b.granted == 0);
+    mu_assert("counters merged", a.reserved == held + other &&
+                                     a.granted == big_got + got);
+    arena_free(&a, q, got);
+    char *r = arena_alloc(&a, 40, &got);
+    mu_assert("adopted block reused", r == q);
+    arena_free(&a, big, big_got);
+    arena_release(&a);
+    mu_assert("released", a.reserved == 0 && a.granted == 0);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_size_classes_reuse);
+    mu_run_test(test_large_blocks);
+    mu_run_test(test_counters_and_adopt);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -2,6 +2,7 @@
 #include "files.h"
 #include "file_manager.h"
 #include "undo.h"
+#include "line_pool.h"
 #include "editor.h"
 #include <ncurses.h>
 #include <string.h>
@@ -12,11 +13,11 @@ static char *test_cleanup_frees_stacks() {
     initscr();
     FileManager fm;
     fm_init(&fm);
-    FileState *fs = initialize_file_state("", 2, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
 
-    char *u = strdup("u");
-    char *r = strdup("r");
+    char *u = pool_intern("u", 1);
+    char *r = pool_intern("r", 1);
     mu_assert("allocated", u && r);
     push(&fs->undo_stack, (Change){0, u, NULL});
     push(&fs->redo_stack, (Change){0, NULL, r});
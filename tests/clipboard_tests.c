@@ -14,12 +14,12 @@ extern int strdup_call_count;
 
 static char *test_paste_cursor_clamped() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "hello");
+    lb_set(&fs->buffer, 0, "hello");
     strncpy(global_clipboard, "world", sizeof(global_clipboard) - 1);
     global_clipboard[sizeof(global_clipboard) - 1] = '\0';
 
@@ -27,7 +27,7 @@ static char *test_paste_cursor_clamped() {
     int cy = 1;
     paste_clipboard(fs, &cx, &cy);
 
-    mu_assert("pasted at end", strcmp(fs->buffer.lines[0], "helloworld") == 0);
+    mu_assert("pasted at end", strcmp(lb_get(&fs->buffer, 0), "helloworld") == 0);
     mu_assert("cursor at end", cx == (int)strlen("helloworld") + 1);
     mu_assert("y unchanged", cy == 1);
 
@@ -38,13 +38,13 @@ static char *test_paste_cursor_clamped() {
 
 static char *test_paste_grows_capacity() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abc");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abc");
+    lb_resize(&fs->buffer, 1);
 
     char paste[201];
     memset(paste, 'x', sizeof(paste) - 1);
@@ -59,7 +59,7 @@ static char *test_paste_grows_capacity() {
 
     char expected[256];
     snprintf(expected, sizeof(expected), "abc%s", paste);
-    mu_assert("long paste", strcmp(fs->buffer.lines[0], expected) == 0);
+    mu_assert("long paste", strcmp(lb_get(&fs->buffer, 0), expected) == 0);
 
     free_file_state(fs);
     endwin();
@@ -68,12 +68,12 @@ static char *test_paste_grows_capacity() {
 
 static char *test_strdup_failure_old_text() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "hello");
+    lb_set(&fs->buffer, 0, "hello");
     strncpy(global_clipboard, "abc", sizeof(global_clipboard) - 1);
     global_clipboard[sizeof(global_clipboard) - 1] = '\0';
 
@@ -92,12 +92,12 @@ static char *test_strdup_failure_old_text() {
 
 static char *test_strdup_failure_new_text() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "hello");
+    lb_set(&fs->buffer, 0, "hello");
     strncpy(global_clipboard, "abc", sizeof(global_clipboard) - 1);
     global_clipboard[sizeof(global_clipboard) - 1] = '\0';
 
@@ -116,15 +116,15 @@ static char *test_strdup_failure_new_text() {
 
 static char *test_copy_selection_backward_multiline() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcde");
-    strcpy(fs->buffer.lines[1], "fghij");
-    strcpy(fs->buffer.lines[2], "klmno");
-    fs->buffer.count = 3;
+    lb_set(&fs->buffer, 0, "abcde");
+    lb_set(&fs->buffer, 1, "fghij");
+    lb_set(&fs->buffer, 2, "klmno");
+    lb_resize(&fs->buffer, 3);
 
     fs->sel_start_x = 4;
     fs->sel_start_y = 3;
@@ -143,13 +143,13 @@ static char *test_copy_selection_backward_multiline() {
 
 static char *test_copy_selection_backward_same_line() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcdef");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abcdef");
+    lb_resize(&fs->buffer, 1);
 
     fs->sel_start_x = 6;
     fs->sel_start_y = 1;
@@ -167,13 +167,13 @@ static char *test_copy_selection_backward_same_line() {
 
 static char *test_cut_selection_undo_single_line() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 20);
+    FileState *fs = initialize_file_state("", 20);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "hello world");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "hello world");
+    lb_resize(&fs->buffer, 1);
 
     fs->selection_mode = true;
     fs->sel_start_x = 7;
@@ -183,13 +183,13 @@ static char *test_cut_selection_undo_single_line() {
 
     cut_selection(fs);
 
-    mu_assert("cut buffer", strcmp(fs->buffer.lines[0], "hello ") == 0);
+    mu_assert("cut buffer", strcmp(lb_get(&fs->buffer, 0), "hello ") == 0);
     mu_assert("clipboard", strcmp(global_clipboard, "world") == 0);
     mu_assert("modified", fs->modified);
 
     undo(fs);
 
-    mu_assert("undo restored", strcmp(fs->buffer.lines[0], "hello world") == 0);
+    mu_assert("undo restored", strcmp(lb_get(&fs->buffer, 0), "hello world") == 0);
 
     free_file_state(fs);
     endwin();
@@ -198,15 +198,15 @@ static char *test_cut_selection_undo_single_line() {
 
 static char *test_cut_selection_undo_multiline() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcde");
-    strcpy(fs->buffer.lines[1], "fghij");
-    strcpy(fs->buffer.lines[2], "klmno");
-    fs->buffer.count = 3;
+    lb_set(&fs->buffer, 0, "abcde");
+    lb_set(&fs->buffer, 1, "fghij");
+    lb_set(&fs->buffer, 2, "klmno");
+    lb_resize(&fs->buffer, 3);
 
     fs->selection_mode = true;
     fs->sel_start_x = 3;
@@ -216,16 +216,16 @@ static char *test_cut_selection_undo_multiline() {
 
     cut_selection(fs);
 
-    mu_assert("first line", strcmp(fs->buffer.lines[0], "abno") == 0);
+    mu_assert("first line", strcmp(lb_get(&fs->buffer, 0), "abno") == 0);
     mu_assert("line count", fs->buffer.count == 1);
     mu_assert("clipboard", strcmp(global_clipboard, "cde\nfghij\nklm") == 0);
 
     for (int i = 0; i < 3; ++i)
         undo(fs);
 
-    mu_assert("line1 restored", strcmp(fs->buffer.lines[0], "abcde") == 0);
-    mu_assert("line2 restored", strcmp(fs->buffer.lines[1], "fghij") == 0);
-    mu_assert("line3 restored", strcmp(fs->buffer.lines[2], "klmno") == 0);
+    mu_assert("line1 restored", strcmp(lb_get(&fs->buffer, 0), "abcde") == 0);
+    mu_assert("line2 restored", strcmp(lb_get(&fs->buffer, 1), "fghij") == 0);
+    mu_assert("line3 restored", strcmp(lb_get(&fs->buffer, 2), "klmno") == 0);
     mu_assert("count restored", fs->buffer.count == 3);
 
     free_file_state(fs);
@@ -243,7 +243,7 @@ static char *test_copy_selection_lazy_load() {
     fclose(f);
 
     initscr();
-    FileState *fs = initialize_file_state(path, 10, 20);
+    FileState *fs = initialize_file_state(path, 20);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -252,7 +252,7 @@ static char *test_copy_selection_lazy_load() {
     mu_assert("fp open", fs->fp != NULL);
     fs->file_pos = 0;
     fs->file_complete = false;
-    fs->buffer.count = 0;
+    lb_resize(&fs->buffer, 0);
 
     load_next_lines(fs, 3);
 
@@ -283,7 +283,7 @@ static char *test_cut_selection_lazy_load() {
     fclose(f);
 
     initscr();
-    FileState *fs = initialize_file_state(path, 10, 20);
+    FileState *fs = initialize_file_state(path, 20);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -292,7 +292,7 @@ static char *test_cut_selection_lazy_load() {
     mu_assert("fp open", fs->fp != NULL);
     fs->file_pos = 0;
     fs->file_complete = false;
-    fs->buffer.count = 0;
+    lb_resize(&fs->buffer, 0);
 
     load_next_lines(fs, 3);
 
@@ -307,7 +307,7 @@ static char *test_cut_selection_lazy_load() {
     mu_assert("clipboard lazy cut", strcmp(global_clipboard,
                 "line2\nline3\nline4\nline5\nline6") == 0);
     mu_assert("lines loaded", fs->buffer.count >= 6);
-    mu_assert("line2 after cut", strcmp(fs->buffer.lines[1], "") == 0);
+    mu_assert("line2 after cut", strcmp(lb_get(&fs->buffer, 1), "") == 0);
     mu_assert("line count", fs->buffer.count == 6);
 
     free_file_state(fs);
@@ -318,7 +318,7 @@ static char *test_cut_selection_lazy_load() {
 
 static char *test_paste_many_new_lines() {
     initscr();
-    FileState *fs = initialize_file_state("", 2, 16);
+    FileState *fs = initialize_file_state("", 16);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -339,7 +339,7 @@ static char *test_paste_many_new_lines() {
     paste_clipboard(fs, &cx, &cy);
 
     mu_assert("line count", fs->buffer.count == 30);
-    mu_assert("last line", strcmp(fs->buffer.lines[29], "l30") == 0);
+    mu_assert("last line", strcmp(lb_get(&fs->buffer, 29), "l30") == 0);
 
     free_file_state(fs);
     endwin();
@@ -8,22 +8,24 @@
 
 int tests_run = 0;
 
-static char *test_delete_join_truncate() {
+static char *test_delete_join_past_capacity() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "hello");
-    strcpy(fs->buffer.lines[1], "world");
-    fs->buffer.count = 2;
+    lb_set(&fs->buffer, 0, "hello");
+    lb_set(&fs->buffer, 1, "world");
+    lb_resize(&fs->buffer, 2);
     fs->cursor_y = 1;
-    fs->cursor_x = strlen(fs->buffer.lines[0]) + 1;
+    fs->cursor_x = strlen(lb_get(&fs->buffer, 0)) + 1;
 
-    handle_key_delete(NULL, fs);
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    handle_key_delete(&ctx, fs);
 
-    mu_assert("line truncated", strcmp(fs->buffer.lines[0], "hellowo") == 0);
+    mu_assert("line grown", strcmp(lb_get(&fs->buffer, 0), "helloworld") == 0);
     mu_assert("line count", fs->buffer.count == 1);
 
     free_file_state(fs);
@@ -33,20 +35,22 @@ static char *test_delete_join_truncate() {
 
 static char *test_delete_join_exact_capacity() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abc");
-    strcpy(fs->buffer.lines[1], "defg");
-    fs->buffer.count = 2;
+    lb_set(&fs->buffer, 0, "abc");
+    lb_set(&fs->buffer, 1, "defg");
+    lb_resize(&fs->buffer, 2);
     fs->cursor_y = 1;
-    fs->cursor_x = strlen(fs->buffer.lines[0]) + 1;
+    fs->cursor_x = strlen(lb_get(&fs->buffer, 0)) + 1;
 
-    handle_key_delete(NULL, fs);
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    handle_key_delete(&ctx, fs);
 
-    mu_assert("line joined", strcmp(fs->buffer.lines[0], "abcdefg") == 0);
+    mu_assert("line joined", strcmp(lb_get(&fs->buffer, 0), "abcdefg") == 0);
     mu_assert("line count", fs->buffer.count == 1);
 
     free_file_state(fs);
@@ -55,7 +59,7 @@ static char *test_delete_join_exact_capacity() {
 }
 
 static char *all_tests() {
-    mu_run_test(test_delete_join_truncate);
+    mu_run_test(test_delete_join_past_capacity);
     mu_run_test(test_delete_join_exact_capacity);
     return 0;
 }
@@ -9,7 +9,7 @@ int tests_run = 0;
 
 static char *test_insert_new_line_cursor_stays() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -28,8 +28,47 @@ static char *test_insert_new_line_cursor_stays() {
     return 0;
 }
 
+static char *test_read_only_view_refuses_edits() {
+    const char *path = "read_only_view.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    fputs("first\nsecond\nthird\n", fp);
+    fclose(fp);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    active_file = fs;
+    text_win = fs->text_win;
+    EditorContext ctx = {0};
+    sync_editor_context(&ctx);
+
+    mu_assert("viewed", lb_view_file(&fs->buffer, path) == 0);
+    fs->read_only = true;
+    fs->file_complete = false;
+    load_all_remaining_lines(fs);
+    mu_assert("complete", fs->file_complete);
+    mu_assert("three lines", fs->buffer.count == 3);
+
+    insert_new_line(&ctx, fs);
+    delete_current_line(&ctx, fs);
+    handle_key_enter(&ctx, fs);
+    handle_key_backspace(&ctx, fs);
+    handle_default_key(&ctx, fs, 'x');
+    mu_assert("line count kept", fs->buffer.count == 3);
+    mu_assert("text kept", strcmp(lb_get(&fs->buffer, 0), "first") == 0);
+    mu_assert("no undo records", fs->undo_stack == NULL);
+    mu_assert("not modified", !fs->modified);
+
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    return 0;
+}
+
 static char *all_tests() {
     mu_run_test(test_insert_new_line_cursor_stays);
+    mu_run_test(test_read_only_view_refuses_edits);
     return 0;
 }
 
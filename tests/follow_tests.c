@@ -0,0 +1,132 @@
+#include "minunit.h"
+#include "files.h"
+#include "follow.h"
+#include "line_buffer.h"
+#include "line_index.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+
+int tests_run = 0;
+
+static void write_text(const char *path, const char *mode, const char *text) {
+    FILE *fp = fopen(path, mode);
+    if (fp) {
+        fputs(text, fp);
+        fclose(fp);
+    }
+}
+
+static char *test_follow_mapped_file() {
+    const char *path = "follow_mapped.tmp";
+    const char *old_path = "follow_mapped.old.tmp";
+    write_text(path, "w", "one\ntw");
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    mu_assert("mapped", lb_map_file(&fs->buffer, path) == 0);
+    fs->file_complete = false;
+    mu_assert("started", follow_start(fs) == 0);
+    mu_assert("loaded", fs->file_complete && fs->buffer.count == 2);
+    mu_assert("nothing new", follow_update(fs) == 0);
+
+    write_text(path, "a", "o\nthree\n");
+    mu_assert("appended", follow_update(fs) == 1);
+    mu_assert("three lines", fs->buffer.count == 3);
+    mu_assert("last line finished", strcmp(lb_get(&fs->buffer, 1), "two") == 0);
+    mu_assert("new line", strcmp(lb_get(&fs->buffer, 2), "three") == 0);
+    write_text(path, "a", "four\n");
+    mu_assert("appended again", follow_update(fs) == 1);
+    mu_assert("four lines", fs->buffer.count == 4);
+
+    write_text(path, "w", "fresh\n");
+    mu_assert("truncated", follow_update(fs) == 1);
+    mu_assert("reloaded", fs->buffer.count == 1 &&
+                              strcmp(lb_get(&fs->buffer, 0), "fresh") == 0);
+
+    rename(path, old_path);
+    write_text(path, "w", "rotated\nfile\n");
+    mu_assert("rotated", follow_update(fs) == 1);
+    mu_assert("new file", fs->buffer.count == 2 &&
+                              strcmp(lb_get(&fs->buffer, 0), "rotated") == 0);
+
+    fs->modified = true;
+    rename(path, old_path);
+    write_text(path, "w", "again\n");
+    mu_assert("stopped", follow_update(fs) == -1 && fs->follow == NULL);
+    mu_assert("edits kept", fs->buffer.count == 2);
+
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    remove(old_path);
+    return 0;
+}
+
+static char *test_follow_view() {
+    const char *path = "follow_view.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < LI_STRIDE + 10; ++i)
+        fprintf(fp, "line %d\n", i);
+    fclose(fp);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    mu_assert("viewed", lb_view_file(&fs->buffer, path) == 0);
+    fs->read_only = true;
+    fs->file_complete = false;
+    mu_assert("started", follow_start(fs) == 0);
+    mu_assert("indexed", fs->buffer.count == LI_STRIDE + 10);
+
+    fp = fopen(path, "a");
+    mu_assert("file reopened", fp != NULL);
+    for (int i = LI_STRIDE + 10; i < 3 * LI_STRIDE; ++i)
+        fprintf(fp, "line %d\n", i);
+    fputs("partial", fp);
+    fclose(fp);
+    mu_assert("appended", follow_update(fs) == 1);
+    mu_assert("count", fs->buffer.count == 3 * LI_STRIDE + 1);
+    mu_assert("indexed line", strcmp(lb_get(&fs->buffer, 2 * LI_STRIDE + 5),
+                                     "line 8197") == 0);
+    mu_assert("partial line",
+              strcmp(lb_get(&fs->buffer, 3 * LI_STRIDE), "partial") == 0);
+
+    write_text(path, "a", " done\n");
+    mu_assert("finished", follow_update(fs) == 1);
+    mu_assert("count kept", fs->buffer.count == 3 * LI_STRIDE + 1);
+    mu_assert("line finished",
+              strcmp(lb_get(&fs->buffer, 3 * LI_STRIDE), "partial done") == 0);
+    mu_assert("still a view", fs->buffer.backend == LB_MAP_VIEW &&
+                                  fs->buffer.tree.count == 0);
+
+    write_text(path, "w", "short\n");
+    mu_assert("truncated", follow_update(fs) == 1);
+    mu_assert("viewed again", fs->buffer.backend == LB_MAP_VIEW &&
+                                  fs->buffer.count == 1 &&
+                                  strcmp(lb_get(&fs->buffer, 0), "short") == 0);
+
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_follow_mapped_file);
+    mu_run_test(test_follow_view);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -21,14 +21,26 @@ void __wrap_create_dialog(EditorContext *ctx, const char *message, char *output,
 
 int tests_run = 0;
 
-static char *test_reject_int_overflow() {
+static char *test_accept_line_past_int_max() {
     initscr();
     EditorContext ctx = {0};
     char buf[64];
     long long big = (long long)INT_MAX + 1LL;
     snprintf(buf, sizeof(buf), "%lld", big);
     dialog_input = buf;
-    int line = 0;
+    long line = 0;
+    int res = show_goto_dialog(&ctx, &line);
+    dialog_input = NULL;
+    endwin();
+    mu_assert("large line accepted", res == 1 && line == big);
+    return 0;
+}
+
+static char *test_reject_long_overflow() {
+    initscr();
+    EditorContext ctx = {0};
+    dialog_input = "99999999999999999999999";
+    long line = 0;
     int res = show_goto_dialog(&ctx, &line);
     dialog_input = NULL;
     endwin();
@@ -37,7 +49,8 @@ static char *test_reject_int_overflow() {
 }
 
 static char *all_tests() {
-    mu_run_test(test_reject_int_overflow);
+    mu_run_test(test_accept_line_past_int_max);
+    mu_run_test(test_reject_long_overflow);
     return 0;
 }
 
@@ -0,0 +1,140 @@
+#include "minunit.h"
+#include "config.h"
+#include "files.h"
+#include "handle_pool.h"
+#include <fcntl.h>
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+static void write_lines(const char *path, const char *word, int count) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return;
+    for (int i = 0; i < count; ++i)
+        fprintf(fp, "%s %d\n", word, i);
+    fclose(fp);
+}
+
+static char *test_pool_keeps_recent_streams() {
+    const char *paths[] = {"pool_a.tmp", "pool_b.tmp", "pool_c.tmp"};
+    FILE *fp[3];
+    int owner[3];
+    for (int i = 0; i < 3; ++i) {
+        write_lines(paths[i], "line", 10);
+        fp[i] = fopen(paths[i], "r");
+        mu_assert("opened", fp[i] != NULL);
+        fseek(fp[i], 7 * i, SEEK_SET);
+        hp_park(&owner[i], fp[i], 2);
+    }
+    mu_assert("oldest closed", hp_take(&owner[0]) == NULL);
+    mu_assert("two parked", hp_count() == 2);
+    FILE *got = hp_take(&owner[2]);
+    mu_assert("newest kept", got == fp[2] && ftell(got) == 14);
+    hp_park(&owner[2], got, 2);
+    hp_park(&owner[0], fopen(paths[0], "r"), 2);
+    mu_assert("least recent closed", hp_take(&owner[1]) == NULL);
+    mu_assert("recent kept", hp_count() == 2);
+
+    int fds[2];
+    mu_assert("pipe", pipe(fds) == 0);
+    FILE *in = fdopen(fds[0], "r");
+    int pipe_owner;
+    hp_park(&pipe_owner, in, 1);
+    mu_assert("pipe kept over the limit", hp_count() == 3);
+    hp_park(&owner[1], fopen(paths[1], "r"), 0);
+    mu_assert("limit of zero", hp_take(&owner[1]) == NULL);
+    mu_assert("pipe kept", hp_take(&pipe_owner) == in);
+    fclose(in);
+    close(fds[1]);
+
+    hp_drop(&owner[0]);
+    hp_drop(&owner[2]);
+    mu_assert("empty", hp_count() == 0);
+    for (int i = 0; i < 3; ++i)
+        remove(paths[i]);
+    return 0;
+}
+
+/* A FileState reading PATH through stdio, as pipes are loaded. */
+static FileState *stream_file(const char *path) {
+    FileState *fs = initialize_file_state(path, 80);
+    if (!fs)
+        return NULL;
+    fs->fp = fopen(path, "r");
+    hp_stamp(fs->fp, &fs->stamp);
+    fs->file_complete = false;
+    lb_resize(&fs->buffer, 0);
+    load_next_lines(fs, 3);
+    return fs;
+}
+
+static char *test_loading_resumes_and_detects_changes() {
+    const char *path = "pool_file.tmp";
+    const char *moved = "pool_file.old.tmp";
+    write_lines(path, "line", 10);
+    initscr();
+    app_config.handle_pool = 4;
+
+    FileState *fs = stream_file(path);
+    mu_assert("loaded", fs && fs->buffer.count == 3);
+    park_file(fs);
+    mu_assert("parked", fs->fp == NULL && hp_count() == 1);
+    ensure_line_loaded(fs, 5);
+    mu_assert("resumed", fs->fp != NULL && hp_count() == 0);
+    mu_assert("continues", strcmp(lb_get(&fs->buffer, 3), "line 3") == 0 &&
+                               strcmp(lb_get(&fs->buffer, 5), "line 5") == 0);
+
+    /* Rewritten while parked */
+    park_file(fs);
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000, 0}};
+    mu_assert("touched", utimensat(AT_FDCWD, path, times, 0) == 0);
+    ensure_line_loaded(fs, 8);
+    mu_assert("stopped", fs->fp == NULL && fs->file_complete &&
+                             fs->buffer.count == 6 && fs->read_only);
+    free_file_state(fs);
+
+    /* Closed by the pool, then replaced */
+    fs = stream_file(path);
+    mu_assert("loaded again", fs && fs->buffer.count == 3);
+    app_config.handle_pool = 0;
+    park_file(fs);
+    mu_assert("closed", hp_count() == 0 && fs->file_pos == 21);
+    ensure_line_loaded(fs, 4);
+    mu_assert("reopened", fs->buffer.count == 5 &&
+                              strcmp(lb_get(&fs->buffer, 4), "line 4") == 0);
+    park_file(fs);
+    rename(path, moved);
+    write_lines(path, "other", 10);
+    ensure_line_loaded(fs, 6);
+    mu_assert("replaced", fs->file_complete && fs->buffer.count == 5 &&
+                              fs->read_only);
+    free_file_state(fs);
+    app_config.handle_pool = 16;
+
+    endwin();
+    remove(path);
+    remove(moved);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_pool_keeps_recent_streams);
+    mu_run_test(test_loading_resumes_and_detects_changes);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
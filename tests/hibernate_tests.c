@@ -0,0 +1,191 @@
+#include "minunit.h"
+#include "config.h"
+#include "editor_state.h"
+#include "file_ops.h"
+#include "file_manager.h"
+#include "files.h"
+#include "hibernate.h"
+#include "line_pool.h"
+#include "mem_budget.h"
+#include "undo.h"
+#include <dirent.h>
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+/* fm_switch() is wrapped by the test build; this is the editor's own. */
+int __real_fm_switch(FileManager *fm, int index);
+
+#define SWAP_DIR "hibernate_swap.tmp"
+
+/* Number of swap files left in SWAP_DIR. */
+static int swap_files(void) {
+    DIR *dir = opendir(SWAP_DIR);
+    if (!dir)
+        return 0;
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)))
+        if (e->d_name[0] != '.')
+            n++;
+    closedir(dir);
+    return n;
+}
+
+static Change change(long line, const char *old_text, const char *new_text) {
+    Change c = {line, old_text ? pool_intern(old_text, strlen(old_text)) : NULL,
+                new_text ? pool_intern(new_text, strlen(new_text)) : NULL};
+    return c;
+}
+
+static char *test_sleep_and_wake() {
+    FileState *fs = initialize_file_state("hibernate.tmp", 80);
+    mu_assert("file state", fs != NULL);
+    lb_resize(&fs->buffer, 0);
+    char line[64];
+    for (int i = 0; i < 20000; ++i) {
+        snprintf(line, sizeof(line), "line %d of a file being hibernated", i);
+        lb_insert(&fs->buffer, i, line);
+    }
+    lb_insert_bytes(&fs->buffer, 3, "nul\0byte", 8);
+    lb_set_state(&fs->buffer, 7, 1);
+    push(&fs->undo_stack, change(2, "older", "newer"));
+    push(&fs->undo_stack, change(-1, NULL, "inserted"));
+    push(&fs->redo_stack, change(5, "redo", NULL));
+    fs->redo_stack->change.col = 300;
+    fs->redo_stack->change.in_line = true;
+    fs->cursor_x = 4;
+    fs->start_line = 100;
+    fs->modified = true;
+
+    mu_assert("can sleep", hb_can_sleep(fs));
+    mu_assert("slept", hb_sleep(fs) == 0);
+    mu_assert("freed", fs->swap && fs->buffer.count == 0 && !fs->text_win &&
+                           !fs->undo_stack && !fs->redo_stack);
+    mu_assert("swap written", swap_files() == 1);
+    mu_assert("not twice", !hb_can_sleep(fs) && hb_sleep(fs) < 0);
+
+    mu_assert("woke", hb_wake(fs) == 0 && fs->swap == NULL && fs->text_win);
+    mu_assert("swap removed", swap_files() == 0);
+    mu_assert("line count", fs->buffer.count == 20001);
+    mu_assert("lines", strcmp(lb_get(&fs->buffer, 0),
+                              "line 0 of a file being hibernated") == 0 &&
+                           strcmp(lb_get(&fs->buffer, 20000),
+                                  "line 19999 of a file being hibernated") == 0);
+    mu_assert("nul kept", lb_length(&fs->buffer, 3) == 8 &&
+                              memcmp(lb_get(&fs->buffer, 3), "nul\0byte", 8) == 0);
+    mu_assert("state kept", lb_state(&fs->buffer, 7) == 1 &&
+                                lb_state(&fs->buffer, 8) == -1);
+    Node *u = fs->undo_stack;
+    mu_assert("undo order", u && u->change.line == -1 && !u->change.old_text &&
+                                strcmp(u->change.new_text, "inserted") == 0);
+    u = u->next;
+    mu_assert("undo texts", u && u->change.line == 2 &&
+                                strcmp(u->change.old_text, "older") == 0 &&
+                                strcmp(u->change.new_text, "newer") == 0 &&
+                                !u->next);
+    Node *r = fs->redo_stack;
+    mu_assert("redo", r && r->change.line == 5 && !r->change.new_text &&
+                          strcmp(r->change.old_text, "redo") == 0);
+    mu_assert("in-line record", r->change.in_line && r->change.col == 300 &&
+                                    !u->change.in_line);
+    mu_assert("state untouched", fs->cursor_x == 4 && fs->start_line == 100 &&
+                                     fs->modified);
+    mu_assert("awake is a no-op", hb_wake(fs) == 0);
+
+    /* Closing a sleeping file removes its swap file */
+    mu_assert("slept again", hb_sleep(fs) == 0 && swap_files() == 1);
+    free_file_state(fs);
+    mu_assert("discarded", swap_files() == 0);
+    return 0;
+}
+
+static char *test_switch_and_budget() {
+    FileState *a = initialize_file_state("hibernate_a.tmp", 80);
+    FileState *b = initialize_file_state("hibernate_b.tmp", 80);
+    mu_assert("file states", a && b);
+    char line[1024];
+    memset(line, 'z', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    for (int i = 0; i < 2048; ++i)
+        lb_insert(&b->buffer, i, line);
+    FileState **files = malloc(2 * sizeof(*files));
+    mu_assert("files", files != NULL);
+    files[0] = a;
+    files[1] = b;
+    FileManager fm = {files, 2, 0, 2};
+
+    /* The inactive file goes to swap rather than the budget being exceeded */
+    app_config.memory_budget_mb = 1;
+    mu_assert("within budget", mb_check(&fm, a) == 0 && !mb_over_budget());
+    mu_assert("hibernated", b->swap && !a->swap && swap_files() == 1);
+
+    app_config.memory_budget_mb = 0;
+    mu_assert("switched", __real_fm_switch(&fm, 1) == 1 && !b->swap);
+    mu_assert("restored", b->buffer.count == 2049 &&
+                              strcmp(lb_get(&b->buffer, 2047), line) == 0);
+
+    /* Files still being loaded stay in memory */
+    a->file_complete = false;
+    mu_assert("loading", !hb_can_sleep(a) && hb_sleep(a) < 0);
+    a->file_complete = true;
+
+    fm_close(&fm, 1);
+    fm_close(&fm, 0);
+    mu_assert("clean", swap_files() == 0);
+    return 0;
+}
+
+static char *test_close_next_to_sleeping() {
+    FileState *a = initialize_file_state("hibernate_a.tmp", 80);
+    FileState *b = initialize_file_state("hibernate_b.tmp", 80);
+    mu_assert("file states", a && b);
+    lb_set(&a->buffer, 0, "kept");
+    FileState **files = malloc(2 * sizeof(*files));
+    mu_assert("files", files != NULL);
+    files[0] = a;
+    files[1] = b;
+    file_manager = (FileManager){files, 2, 1, 2};
+    active_file = b;
+    text_win = b->text_win;
+    mu_assert("slept", hb_sleep(a) == 0 && a->swap);
+
+    /* The neighbour that takes the closed tab's place is woken */
+    EditorContext ctx = {0};
+    close_current_file(&ctx, b, NULL, NULL);
+    mu_assert("one file", file_manager.count == 1 && active_file == a);
+    mu_assert("woken", !a->swap && swap_files() == 0 && a->text_win &&
+                           text_win == a->text_win);
+    mu_assert("text back", strcmp(lb_get(&a->buffer, 0), "kept") == 0);
+
+    fm_close(&file_manager, 0);
+    active_file = NULL;
+    text_win = NULL;
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_sleep_and_wake);
+    mu_run_test(test_switch_and_budget);
+    mu_run_test(test_close_next_to_sleeping);
+    return 0;
+}
+
+int main(void) {
+    setenv("VENTO_SWAP", SWAP_DIR, 1);
+    initscr();
+    char *result = all_tests();
+    endwin();
+    rmdir(SWAP_DIR);
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
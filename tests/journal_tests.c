@@ -0,0 +1,255 @@
+#include "minunit.h"
+#include "files.h"
+#include "input.h"
+#include "journal.h"
+#include "line_pool.h"
+#include "save.h"
+#include "undo.h"
+#include <errno.h>
+#include <ncurses.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+#define SWAP_DIR "journal_swap.tmp"
+#define FILE_PATH "journal.tmp"
+#define JOURNAL_PATH SWAP_DIR "/" FILE_PATH ".jnl"
+
+static void write_text(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    if (fp) {
+        fputs(text, fp);
+        fclose(fp);
+    }
+}
+
+/* A FileState with PATH mapped but none of its lines split off yet. */
+static FileState *open_file(const char *path) {
+    FileState *fs = initialize_file_state(path, 80);
+    if (fs && lb_map_file(&fs->buffer, path) < 0) {
+        free_file_state(fs);
+        return NULL;
+    }
+    if (fs)
+        fs->file_complete = false;
+    return fs;
+}
+
+/* Replace line LINE of FS with TEXT, or insert it when INSERT is set. */
+static void edit(FileState *fs, long line, const char *text, bool insert) {
+    char *old_text = insert ? NULL : lb_share(&fs->buffer, line);
+    char *new_text = pool_intern(text, strlen(text));
+    if (insert)
+        lb_insert_shared(&fs->buffer, line, new_text, strlen(text));
+    else
+        lb_set_shared(&fs->buffer, line, new_text, strlen(text));
+    record_change(fs, (Change){ line, old_text, new_text });
+}
+
+static void remove_line(FileState *fs, long line) {
+    record_change(fs, (Change){ line, lb_share(&fs->buffer, line), NULL });
+    lb_delete(&fs->buffer, line);
+}
+
+/*
+ * Let the writer catch up, then close FS the way a crash would: its
+ * journal stays behind.
+ */
+static void crash(FileState *fs) {
+    struct timespec ts = {0, (JN_SYNC_MS + 150) * 1000000L};
+    nanosleep(&ts, NULL);
+    FILE *fp = fopen(JOURNAL_PATH, "rb");
+    char buf[4096];
+    size_t n = fp ? fread(buf, 1, sizeof(buf), fp) : 0;
+    if (fp)
+        fclose(fp);
+    free_file_state(fs);
+    fp = fopen(JOURNAL_PATH, "wb");
+    if (fp) {
+        fwrite(buf, 1, n, fp);
+        fclose(fp);
+    }
+}
+
+static bool same_lines(LineBuffer *a, LineBuffer *b) {
+    if (a->count != b->count)
+        return false;
+    for (long i = 0; i < a->count; ++i) {
+        size_t len = lb_length(a, i);
+        if (len != lb_length(b, i) || memcmp(lb_get(a, i), lb_get(b, i), len))
+            return false;
+    }
+    return true;
+}
+
+static bool journal_exists(void) {
+    struct stat st;
+    return stat(JOURNAL_PATH, &st) == 0;
+}
+
+static char *test_recover_after_crash() {
+    write_text(FILE_PATH, "alpha\nbeta\ngamma\n");
+    FileState *fs = open_file(FILE_PATH);
+    mu_assert("opened", fs != NULL);
+    load_all_remaining_lines(fs);
+    edit(fs, 1, "BETA", false);
+    edit(fs, 3, "delta", true);
+    remove_line(fs, 0);
+    edit(fs, 0, "undone", false);
+    undo(fs);
+    mu_assert("journal written", journal_exists());
+
+    LineBuffer expect;
+    lb_init(&expect);
+    for (long i = 0; i < fs->buffer.count; ++i)
+        lb_insert(&expect, i, lb_get(&fs->buffer, i));
+    crash(fs);
+    mu_assert("journal left behind", journal_exists());
+
+    /* Opened as usual, the journal is found and left alone */
+    fs = open_file(FILE_PATH);
+    mu_assert("reopened", fs != NULL);
+    mu_assert("pending", jn_pending(fs));
+    free_file_state(fs);
+    mu_assert("journal kept", journal_exists());
+
+    fs = open_file(FILE_PATH);
+    mu_assert("recovering", fs != NULL);
+    mu_assert("changes replayed", jn_recover(fs) == 5);
+    mu_assert("same text", same_lines(&fs->buffer, &expect));
+    mu_assert("modified", fs->modified);
+    undo(fs);
+    mu_assert("undoable", strcmp(lb_get(&fs->buffer, 0), "undone") == 0);
+
+    /* Edits after recovery go on in the same journal */
+    edit(fs, 0, "again", false);
+    crash(fs);
+    fs = open_file(FILE_PATH);
+    mu_assert("recovered again", jn_recover(fs) == 7);
+    mu_assert("latest edit", strcmp(lb_get(&fs->buffer, 0), "again") == 0);
+    free_file_state(fs);
+    mu_assert("closing removes it", !journal_exists());
+
+    /* A journal does not apply to a file changed since */
+    fs = open_file(FILE_PATH);
+    load_all_remaining_lines(fs);
+    edit(fs, 0, "lost", false);
+    crash(fs);
+    write_text(FILE_PATH, "replaced\n");
+    fs = open_file(FILE_PATH);
+    mu_assert("stale", jn_recover(fs) == -1 && errno == ESTALE);
+    free_file_state(fs);
+    unlink(JOURNAL_PATH);
+    fs = open_file(FILE_PATH);
+    mu_assert("nothing to recover", jn_recover(fs) == -1 && errno == ENOENT);
+    free_file_state(fs);
+
+    lb_free(&expect);
+    remove(FILE_PATH);
+    return 0;
+}
+
+static char *test_saves_update_journal() {
+    write_text(FILE_PATH, "one\ntwo\nthree\n");
+    FileState *fs = open_file(FILE_PATH);
+    mu_assert("opened", fs != NULL);
+    load_all_remaining_lines(fs);
+    edit(fs, 0, "ONE", false);
+
+    /* A change made while the file is written applies to the saved file */
+    SaveJob *job = sv_start(&fs->buffer, FILE_PATH, false, SIZE_MAX);
+    mu_assert("saving", job != NULL);
+    jn_save_started(fs);
+    edit(fs, 2, "THREE", false);
+    mu_assert("saved", sv_finish(job) == 0);
+    jn_saved(fs);
+    crash(fs);
+    fs = open_file(FILE_PATH);
+    mu_assert("one change replayed", jn_recover(fs) == 1);
+    mu_assert("saved text kept", strcmp(lb_get(&fs->buffer, 0), "ONE") == 0);
+    mu_assert("later change", strcmp(lb_get(&fs->buffer, 2), "THREE") == 0);
+
+    /* A save with nothing changed meanwhile leaves no journal */
+    mu_assert("saved again", sv_save(&fs->buffer, FILE_PATH, false) == 0);
+    jn_save_started(fs);
+    jn_saved(fs);
+    mu_assert("journal removed", !journal_exists());
+    edit(fs, 1, "TWO", false);
+    mu_assert("new journal", journal_exists());
+    free_file_state(fs);
+    mu_assert("closed", !journal_exists());
+    remove(FILE_PATH);
+    return 0;
+}
+
+static char *test_recover_typing() {
+    write_text(FILE_PATH, "one two\nthree\n");
+    FileState *fs = open_file(FILE_PATH);
+    mu_assert("opened", fs != NULL);
+    load_all_remaining_lines(fs);
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    fs->cursor_y = 1;
+    fs->cursor_x = 5;
+    for (const char *p = "and "; *p; ++p)
+        handle_default_key(&ctx, fs, (wint_t)*p);
+    fs->cursor_x = 4;
+    handle_key_backspace(&ctx, fs);
+    handle_key_delete(&ctx, fs);
+    fs->cursor_y = 2;
+    fs->cursor_x = 3;
+    handle_key_enter(&ctx, fs);
+    mu_assert("typed", strcmp(lb_get(&fs->buffer, 0), "onand two") == 0 &&
+                       strcmp(lb_get(&fs->buffer, 1), "th") == 0 &&
+                       strcmp(lb_get(&fs->buffer, 2), "ree") == 0);
+    crash(fs);
+
+    /* The keystrokes are replayed and gathered into the same records */
+    fs = open_file(FILE_PATH);
+    mu_assert("reopened", fs != NULL);
+    mu_assert("keystrokes replayed", jn_recover(fs) == 8);
+    mu_assert("same lines", strcmp(lb_get(&fs->buffer, 0), "onand two") == 0 &&
+                            strcmp(lb_get(&fs->buffer, 1), "th") == 0 &&
+                            strcmp(lb_get(&fs->buffer, 2), "ree") == 0);
+    mu_assert("gathered", fs->undo_stack && fs->undo_stack->next &&
+                          fs->undo_stack->next->next &&
+                          fs->undo_stack->next->next->next &&
+                          !fs->undo_stack->next->next->next->next);
+    for (int i = 0; i < 4; ++i)
+        undo(fs);
+    mu_assert("all undone", !fs->undo_stack && fs->buffer.count >= 2 &&
+                            strcmp(lb_get(&fs->buffer, 0), "one two") == 0 &&
+                            strcmp(lb_get(&fs->buffer, 1), "three") == 0);
+    free_file_state(fs);
+    mu_assert("closed", !journal_exists());
+    remove(FILE_PATH);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_recover_after_crash);
+    mu_run_test(test_saves_update_journal);
+    mu_run_test(test_recover_typing);
+    return 0;
+}
+
+int main(void) {
+    setenv("VENTO_SWAP", SWAP_DIR, 1);
+    initscr();
+    char *result = all_tests();
+    endwin();
+    rmdir(SWAP_DIR);
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
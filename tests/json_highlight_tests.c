@@ -10,7 +10,7 @@ int tests_run = 0;
 
 static char *test_json_highlighting_runs() {
     initscr();
-    FileState *fs = initialize_file_state("tests/sample.json", 10, 80);
+    FileState *fs = initialize_file_state("tests/sample.json", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -26,12 +26,12 @@ static char *test_json_highlighting_runs() {
     };
     int line_count = 5;
     for (int i = 0; i < line_count; i++) {
-        strcpy(fs->buffer.lines[i], lines[i]);
+        lb_set(&fs->buffer, i, lines[i]);
     }
-    fs->buffer.count = line_count;
+    lb_resize(&fs->buffer, line_count);
 
     for (int i = 0; i < fs->buffer.count; i++) {
-        apply_syntax_highlighting(fs, fs->text_win, fs->buffer.lines[i], i + 1);
+        apply_syntax_highlighting(fs, fs->text_win, lb_get(&fs->buffer, i), i + 1);
     }
 
     const SyntaxDef *def = syntax_get(JSON_SYNTAX);
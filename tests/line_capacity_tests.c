@@ -1,45 +1,324 @@
 #include "minunit.h"
 #include "files.h"
+#include "input.h"
+#include "editor_state.h"
+#include "file_ops.h"
 #include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 extern int calloc_fail_on;
 extern int calloc_call_count;
-extern int realloc_fail_on;
-extern int realloc_call_count;
+extern int calloc_fail_enabled;
 
 int tests_run = 0;
 
 static char *test_allocation_failure_cleanup() {
     initscr();
-    FileState *fs = initialize_file_state("", 2, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
 
-    calloc_call_count = 0;
-    realloc_call_count = 0;
-    calloc_fail_on = 2; /* fail second new line */
-    realloc_fail_on = 2; /* fail shrink */
+    /* Fill the first leaf so the next insert has to split it */
+    char text[16];
+    for (int i = 1; i < LT_LEAF_MAX; ++i) {
+        snprintf(text, sizeof(text), "%d", i);
+        mu_assert("fill", lb_insert(&fs->buffer, i, text) == 0);
+    }
 
-    int res = ensure_line_capacity(fs, 5);
+    calloc_call_count = 0;
+    calloc_fail_on = 1; /* fail the new leaf */
+    calloc_fail_enabled = 1;
+    int res = lb_insert(&fs->buffer, 10, "new");
+    calloc_fail_enabled = 0;
     calloc_fail_on = 0;
-    realloc_fail_on = 0;
 
     mu_assert("failure returned", res == -1);
-    mu_assert("capacity unchanged", fs->buffer.capacity == 2);
-    mu_assert("lines intact", fs->buffer.lines[0] != NULL && fs->buffer.lines[1] != NULL);
+    mu_assert("count unchanged", fs->buffer.count == LT_LEAF_MAX);
+    mu_assert("lines intact", strcmp(lb_get(&fs->buffer, 10), "10") == 0 &&
+                              strcmp(lb_get(&fs->buffer, LT_LEAF_MAX - 1), "255") == 0);
 
-    res = ensure_line_capacity(fs, 4);
+    res = lb_insert(&fs->buffer, 10, "new");
     mu_assert("second success", res == 0);
-    mu_assert("capacity grown", fs->buffer.capacity >= 4);
-    for (int i = 0; i < fs->buffer.capacity; ++i)
-        mu_assert("line allocated", fs->buffer.lines[i] != NULL);
+    mu_assert("count grown", fs->buffer.count == LT_LEAF_MAX + 1);
+    mu_assert("inserted", strcmp(lb_get(&fs->buffer, 10), "new") == 0);
+    mu_assert("shifted", strcmp(lb_get(&fs->buffer, 11), "10") == 0);
+    mu_assert("last", strcmp(lb_get(&fs->buffer, LT_LEAF_MAX), "255") == 0);
+
+    free_file_state(fs);
+    endwin();
+    return 0;
+}
+
+static char *test_many_lines_in_order() {
+    LineBuffer lb;
+    char text[16];
+    lb_init(&lb);
+
+    /* Build 0..19999 by inserting odd lines between the even ones */
+    for (int i = 0; i < 10000; ++i) {
+        snprintf(text, sizeof(text), "%d", i * 2);
+        mu_assert("append", lb_insert(&lb, i, text) == 0);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        snprintf(text, sizeof(text), "%d", i * 2 + 1);
+        mu_assert("insert", lb_insert(&lb, i * 2 + 1, text) == 0);
+    }
+    mu_assert("count", lb.count == 20000);
+    for (int i = 0; i < lb.count; ++i)
+        mu_assert("sequential", atoi(lb_get(&lb, i)) == i);
+    for (int i = lb.count - 1; i >= 0; i -= 7)
+        mu_assert("backwards", atoi(lb_get(&lb, i)) == i);
+
+    /* Remove every multiple of three from the front half */
+    for (int i = 0, kept = 0; i < 10000; ++i) {
+        if (i % 3 == 0)
+            lb_delete(&lb, kept);
+        else
+            kept++;
+    }
+    mu_assert("after delete", atoi(lb_get(&lb, 0)) == 1 &&
+                              atoi(lb_get(&lb, 1)) == 2 &&
+                              atoi(lb_get(&lb, 2)) == 4);
+    mu_assert("tail kept", atoi(lb_get(&lb, lb.count - 1)) == 19999);
+
+    mu_assert("shrink", lb_resize(&lb, 3) == 0 && lb.count == 3);
+    mu_assert("grow", lb_resize(&lb, 5) == 0 && lb.count == 5);
+    mu_assert("padding empty", strcmp(lb_get(&lb, 4), "") == 0);
+    lb_free(&lb);
+    return 0;
+}
+
+static char *test_long_line_grows_alone() {
+    initscr();
+    FileState *fs = initialize_file_state("", 8);
+    mu_assert("fs allocated", fs != NULL);
+    active_file = fs;
+    text_win = fs->text_win;
+
+    char long_line[4001];
+    memset(long_line, 'a', sizeof(long_line) - 1);
+    long_line[4000] = '\0';
+    mu_assert("set long line", lb_set(&fs->buffer, 0, long_line) == 0);
+    mu_assert("second line", lb_insert(&fs->buffer, 1, "short") == 0);
+    mu_assert("long line stored", strcmp(lb_get(&fs->buffer, 0), long_line) == 0);
+    mu_assert("other line untouched", lb_capacity(&fs->buffer, 1) < sizeof(long_line));
+    mu_assert("column hint unchanged", fs->line_capacity == 8);
+
+    /* Typing past the initial width grows only the edited line */
+    fs->cursor_y = 2;
+    fs->cursor_x = 6;
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    for (int i = 0; i < 20; ++i)
+        handle_default_key(&ctx, fs, L'b');
+    mu_assert("typed text kept",
+              strcmp(lb_get(&fs->buffer, 1), "shortbbbbbbbbbbbbbbbbbbbb") == 0);
+    mu_assert("cursor advanced", fs->cursor_x == 26);
+    mu_assert("first line unchanged", strlen(lb_get(&fs->buffer, 0)) == 4000);
+
+    free_file_state(fs);
+    endwin();
+    return 0;
+}
+
+static char *test_empty_lines_unallocated() {
+    initscr();
+    FileState *fs = initialize_file_state("", 80);
+    mu_assert("fs allocated", fs != NULL);
+    active_file = fs;
+    text_win = fs->text_win;
+
+    mu_assert("blank buffer holds no text", lb_capacity(&fs->buffer, 0) == 0);
+    mu_assert("blank lines", lb_resize(&fs->buffer, 1000) == 0);
+    mu_assert("padding unallocated", lb_capacity(&fs->buffer, 999) == 0);
+    mu_assert("reads as empty", strcmp(lb_get(&fs->buffer, 500), "") == 0);
+
+    /* The first typed character allocates just that line */
+    fs->cursor_y = 501;
+    fs->cursor_x = 1;
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    handle_default_key(&ctx, fs, L'x');
+    mu_assert("typed", strcmp(lb_get(&fs->buffer, 500), "x") == 0);
+    mu_assert("allocated", lb_capacity(&fs->buffer, 500) > 0);
+    mu_assert("neighbour still empty", lb_capacity(&fs->buffer, 501) == 0);
+
+    mu_assert("cleared", lb_set(&fs->buffer, 500, "") == 0);
+    mu_assert("released", lb_capacity(&fs->buffer, 500) == 0);
+
+    free_file_state(fs);
+    endwin();
+    return 0;
+}
+
+static char *test_mapped_lines_copied_on_edit() {
+    const char *path = "mapped_load.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    fputs("alpha\n\ngamma", fp);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("special file refused", lb_load_mapped(&lb, "/dev/null") == -1);
+    mu_assert("mapped", lb_load_mapped(&lb, path) == 0);
+    mu_assert("three lines", lb.count == 3);
+    mu_assert("alpha", strcmp(lb_get(&lb, 0), "alpha") == 0);
+    mu_assert("blank", strcmp(lb_get(&lb, 1), "") == 0);
+    mu_assert("unterminated last line", strcmp(lb_get(&lb, 2), "gamma") == 0);
+    mu_assert("borrowed from mapping", lb_capacity(&lb, 0) == 0);
+
+    mu_assert("edit", lb_insert_text(&lb, 0, 5, "bet", 3) == 0);
+    mu_assert("edited", strcmp(lb_get(&lb, 0), "alphabet") == 0);
+    mu_assert("copied", lb_capacity(&lb, 0) > 0);
+    mu_assert("delete text", lb_delete_text(&lb, 2, 0, 1) == 0);
+    mu_assert("gamma edited", strcmp(lb_get(&lb, 2), "amma") == 0);
+    lb_free(&lb);
+
+    char buf[32] = {0};
+    fp = fopen(path, "r");
+    mu_assert("reopen", fp != NULL);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    mu_assert("file untouched", n == 12 && memcmp(buf, "alpha\n\ngamma", 12) == 0);
+    remove(path);
+    return 0;
+}
+
+static char *test_mapped_file_saved_over_itself() {
+    const char *path = "mapped_save.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    fputs("one\ntwo\nthree\n", fp);
+    fclose(fp);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    mu_assert("mapped", lb_map_file(&fs->buffer, path) == 0);
+    mu_assert("lines split", load_next_lines(fs, 10) == 3);
+    mu_assert("edit", lb_insert_text(&fs->buffer, 1, 3, "!", 1) == 0);
+    fs->modified = true;
+
+    /* Unedited lines still point into the mapping of the file being saved */
+    save_file(NULL, fs);
+    mu_assert("saving", fs->save != NULL);
+    mu_assert("saved", finish_save(fs, true) && !fs->modified && !fs->save);
+    mu_assert("mapped lines intact", strcmp(lb_get(&fs->buffer, 2), "three") == 0);
+    free_file_state(fs);
+    endwin();
+
+    char buf[32] = {0};
+    fp = fopen(path, "r");
+    mu_assert("reopen", fp != NULL);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    mu_assert("contents written", n == 15 && strcmp(buf, "one\ntwo!\nthree\n") == 0);
+    remove(path);
+    return 0;
+}
+
+static char *test_line_metadata_tracked() {
+    const char *path = "line_meta.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    fwrite("a\0b\nsame\nsame", 1, 13, fp);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("mapped", lb_load_mapped(&lb, path) == 0);
+    mu_assert("NUL kept", lb_length(&lb, 0) == 3 && lb_get(&lb, 0)[2] == 'b');
+    mu_assert("equal lines hash equal", lb_hash(&lb, 1) == lb_hash(&lb, 2));
+    mu_assert("hash non-zero", lb_hash(&lb, 1) != 0);
+    mu_assert("edit after NUL", lb_insert_text(&lb, 0, 3, "c", 1) == 0);
+    mu_assert("copied whole", lb_length(&lb, 0) == 4 &&
+              memcmp(lb_get(&lb, 0), "a\0bc", 5) == 0);
+
+    unsigned before = lb_hash(&lb, 2);
+    mu_assert("append", lb_insert_text(&lb, 2, 4, "!", 1) == 0);
+    mu_assert("length grows", lb_length(&lb, 2) == 5);
+    mu_assert("hash refreshed", lb_hash(&lb, 2) != before);
+    mu_assert("delete", lb_delete_text(&lb, 2, 0, 2) == 0);
+    mu_assert("length shrinks", lb_length(&lb, 2) == 3);
+    mu_assert("set", lb_set(&lb, 1, "") == 0 && lb_length(&lb, 1) == 0);
+
+    mu_assert("no state yet", lb_state(&lb, 1) == -1);
+    lb_set_state(&lb, 1, 1);
+    lb_set_state(&lb, 2, 0);
+    mu_assert("insert before", lb_insert(&lb, 0, "top") == 0);
+    mu_assert("states move with lines",
+              lb_state(&lb, 2) == 1 && lb_state(&lb, 3) == 0);
+    mu_assert("new line has none", lb_state(&lb, 0) == -1);
+    lb_free(&lb);
+
+    /* Lines read through stdio keep their NUL bytes as well */
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    fs->fp = fopen(path, "r");
+    mu_assert("fp open", fs->fp != NULL);
+    lb_resize(&fs->buffer, 0);
+    mu_assert("lines read", load_next_lines(fs, 10) == 3);
+    mu_assert("stdio NUL kept", lb_length(&fs->buffer, 0) == 3);
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    return 0;
+}
+
+static char *test_multi_megabyte_line_loaded_whole() {
+    const char *path = "line_capacity_huge.tmp";
+    size_t huge = (size_t)3 << 20;
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (size_t i = 0; i < huge; ++i)
+        fputc('a' + i % 26, fp);
+    fputs("\ntail\n", fp);
+    fclose(fp);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    active_file = fs;
+    text_win = fs->text_win;
+    fs->fp = fopen(path, "r");
+    mu_assert("fp open", fs->fp != NULL);
+    lb_resize(&fs->buffer, 0);
+    mu_assert("lines read", load_next_lines(fs, 10) == 2);
+    mu_assert("complete", fs->file_complete);
+
+    const char *line = lb_get(&fs->buffer, 0);
+    mu_assert("not truncated", strlen(line) == huge);
+    mu_assert("last byte kept", line[huge - 1] == 'a' + (huge - 1) % 26);
+    mu_assert("next line intact", strcmp(lb_get(&fs->buffer, 1), "tail") == 0);
+
+    /* The cursor can reach the end of the line and no further */
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+    fs->cursor_y = 1;
+    fs->cursor_x = (int)huge;
+    handle_key_right(&ctx, fs);
+    mu_assert("moved to end", fs->cursor_x == (int)huge + 1);
+    handle_key_right(&ctx, fs);
+    mu_assert("stopped at end", fs->cursor_x == (int)huge + 1);
 
     free_file_state(fs);
     endwin();
+    remove(path);
     return 0;
 }
 
 static char *all_tests() {
+    mu_run_test(test_long_line_grows_alone);
     mu_run_test(test_allocation_failure_cleanup);
+    mu_run_test(test_many_lines_in_order);
+    mu_run_test(test_empty_lines_unallocated);
+    mu_run_test(test_mapped_lines_copied_on_edit);
+    mu_run_test(test_mapped_file_saved_over_itself);
+    mu_run_test(test_multi_megabyte_line_loaded_whole);
+    mu_run_test(test_line_metadata_tracked);
     return 0;
 }
 
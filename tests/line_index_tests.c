@@ -0,0 +1,329 @@
+#include "minunit.h"
+#include "files.h"
+#include "line_index.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+#define INDEX_LINES (3 * LI_STRIDE + 5)
+
+/* Write INDEX_LINES numbered lines, the last one without a newline. */
+static long write_numbered(const char *path, long *third_offset) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    for (int i = 0; i < INDEX_LINES; ++i) {
+        if (i == 2 * LI_STRIDE)
+            *third_offset = ftell(fp);
+        fprintf(fp, i + 1 < INDEX_LINES ? "line %d\n" : "line %d", i);
+    }
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static void wait_for_index(LineIndex *li) {
+    bool complete = false;
+    struct timespec ts = {0, 1000000};
+    for (int i = 0; i < 5000; ++i) {
+        li_lines(li, &complete);
+        if (complete)
+            break;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static char *test_index_counts_and_offsets() {
+    const char *path = "line_index.tmp";
+    long third = 0;
+    mu_assert("file written", write_numbered(path, &third) > 0);
+
+    LineIndex *li = li_start(path);
+    mu_assert("index started", li != NULL);
+    wait_for_index(li);
+    bool complete = false;
+    mu_assert("all lines counted", li_lines(li, &complete) == INDEX_LINES);
+    mu_assert("complete", complete);
+
+    off_t off = -1;
+    mu_assert("first checkpoint", li_offset(li, 10, &off) == 0 && off == 0);
+    mu_assert("third checkpoint",
+              li_offset(li, 2 * LI_STRIDE + 7, &off) == 2 * LI_STRIDE);
+    mu_assert("third offset", off == third);
+    mu_assert("past the end",
+              li_offset(li, 10 * LI_STRIDE, &off) == 3 * LI_STRIDE);
+    li_free(li);
+
+    mu_assert("missing file", li_start("no_such_file.tmp") == NULL);
+    remove(path);
+    return 0;
+}
+
+static char *test_mapped_file_loaded_on_demand() {
+    const char *path = "line_index_lazy.tmp";
+    long third = 0;
+    mu_assert("file written", write_numbered(path, &third) > 0);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    mu_assert("mapped", lb_map_file(&fs->buffer, path) == 0);
+    mu_assert("first lines", load_next_lines(fs, 10) == 10);
+    mu_assert("not complete", !fs->file_complete);
+    fs->line_index = li_start(path);
+    mu_assert("index started", fs->line_index != NULL);
+    wait_for_index(fs->line_index);
+
+    mu_assert("only ten loaded", fs->buffer.count == 10);
+    mu_assert("total from index", total_line_count(fs) == INDEX_LINES);
+    ensure_line_loaded(fs, 2 * LI_STRIDE);
+    mu_assert("loaded through target", fs->buffer.count == 2 * LI_STRIDE + 1);
+    mu_assert("target text", strcmp(lb_get(&fs->buffer, 2 * LI_STRIDE),
+                                    "line 8192") == 0);
+    mu_assert("total unchanged", total_line_count(fs) == INDEX_LINES);
+
+    /* A file that shrinks on disk is only split up to its new end */
+    mu_assert("truncated", truncate(path, third + 4) == 0);
+    load_all_remaining_lines(fs);
+    mu_assert("complete", fs->file_complete);
+    mu_assert("index released", fs->line_index == NULL);
+    mu_assert("lines up to new end", fs->buffer.count == 2 * LI_STRIDE + 1);
+    mu_assert("total exact", total_line_count(fs) == fs->buffer.count);
+
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    return 0;
+}
+
+static char *test_paged_buffer_keeps_window() {
+    const char *path = "line_index_paged.tmp";
+    int lines = (LB_PAGE_BUDGET + 6) * LI_STRIDE;
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < lines; ++i)
+        fprintf(fp, "line %d\n", i);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("paged", lb_page_file(&lb, path) == 0);
+    LineIndex *li = li_start(path);
+    mu_assert("index started", li != NULL);
+    wait_for_index(li);
+    mu_assert("all pages", lb_page_sync(&lb, li) == 1);
+    li_free(li);
+    mu_assert("count", lb.count == lines);
+    mu_assert("nothing read yet", lb.tree.count == 0);
+
+    char expect[32];
+    snprintf(expect, sizeof(expect), "line %d", lines - 1);
+    mu_assert("last line", strcmp(lb_get(&lb, lines - 1), expect) == 0);
+    mu_assert("edit pins page", lb_set(&lb, 1, "edited") == 0);
+    mu_assert("insert", lb_insert(&lb, 2, "inserted") == 0);
+
+    for (int i = 3; i <= lines; ++i) {
+        snprintf(expect, sizeof(expect), "line %d", i - 1);
+        if (strcmp(lb_get(&lb, i), expect) != 0)
+            mu_assert("walked line", 0);
+    }
+    mu_assert("window bounded",
+              lb.tree.count <= (LB_PAGE_BUDGET + 1) * LI_STRIDE + 1);
+    mu_assert("edit kept", strcmp(lb_get(&lb, 1), "edited") == 0);
+    mu_assert("insert kept", strcmp(lb_get(&lb, 2), "inserted") == 0);
+    snprintf(expect, sizeof(expect), "line %d", LI_STRIDE);
+    mu_assert("evicted page reread",
+              strcmp(lb_get(&lb, LI_STRIDE + 1), expect) == 0);
+    mu_assert("deleted", lb_delete(&lb, 2) == 0);
+    mu_assert("count after delete", lb.count == lines);
+    mu_assert("no read errors", lb_page_errors(&lb) == 0);
+
+    /* Pages that can no longer be read stop a resize instead of hanging it */
+    mu_assert("file cut", truncate(path, 0) == 0);
+    mu_assert("resize fails", lb_resize(&lb, LI_STRIDE) == -1);
+    mu_assert("lines kept", lb.count > LI_STRIDE && lb_page_errors(&lb) > 0);
+
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *test_packed_buffer_expands_window() {
+    const char *path = "line_index_packed.tmp";
+    int lines = (LB_PACK_BUDGET + 4) * LB_PACK_LINES + 3;
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < lines; ++i)
+        fprintf(fp, i + 1 < lines ? "line %d\n" : "line %d", i);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("packed", lb_pack_file(&lb, path) == 0);
+    mu_assert("count", lb.count == lines);
+    mu_assert("nothing expanded yet", lb.tree.count == 0);
+    /* The buffer no longer reads the file */
+    remove(path);
+
+    char expect[32];
+    snprintf(expect, sizeof(expect), "line %d", lines - 1);
+    mu_assert("last line", strcmp(lb_get(&lb, lines - 1), expect) == 0);
+    mu_assert("edit", lb_set(&lb, 1, "edited") == 0);
+    mu_assert("insert", lb_insert(&lb, 2, "inserted") == 0);
+    for (int i = 3; i <= lines; ++i) {
+        snprintf(expect, sizeof(expect), "line %d", i - 1);
+        if (strcmp(lb_get(&lb, i), expect) != 0)
+            mu_assert("walked line", 0);
+    }
+    mu_assert("window bounded",
+              lb.tree.count <= LB_PACK_BUDGET * LB_PACK_LINES + 1);
+    mu_assert("edit packed and expanded again",
+              strcmp(lb_get(&lb, 1), "edited") == 0);
+    mu_assert("insert kept", strcmp(lb_get(&lb, 2), "inserted") == 0);
+    mu_assert("length kept", lb_length(&lb, 1) == strlen("edited"));
+    lb_delete(&lb, 2);
+    mu_assert("count after delete", lb.count == lines);
+    mu_assert("no errors", lb_page_errors(&lb) == 0);
+    lb_free(&lb);
+
+    mu_assert("missing file", lb_pack_file(&lb, path) < 0);
+    return 0;
+}
+
+#define SPARSE_HOLE ((off_t)5 << 30)
+
+/*
+ * A sparse file whose first line starts with a 5 GiB hole, followed by
+ * INDEX_LINES numbered lines. Only the lines are stored on disk.
+ */
+static int write_sparse(const char *path, off_t *third_offset) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    if (fseeko(fp, SPARSE_HOLE, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    for (int i = 0; i < INDEX_LINES; ++i) {
+        if (i == 2 * LI_STRIDE)
+            *third_offset = ftello(fp);
+        fprintf(fp, "line %d\n", i);
+    }
+    return fclose(fp);
+}
+
+static char *test_sparse_file_beyond_4gb() {
+    const char *path = "line_index_sparse.tmp";
+    off_t third = 0;
+    if (write_sparse(path, &third) < 0) {
+        /* The file system cannot hold a file this large */
+        remove(path);
+        return 0;
+    }
+    mu_assert("past 4 GiB", third > ((off_t)1 << 32));
+
+    LineIndex *li = li_start(path);
+    mu_assert("index started", li != NULL);
+    wait_for_index(li);
+    bool complete = false;
+    mu_assert("all lines counted", li_lines(li, &complete) == INDEX_LINES);
+    mu_assert("complete", complete);
+    off_t off = 0;
+    mu_assert("third checkpoint",
+              li_offset(li, 2 * LI_STRIDE, &off) == 2 * LI_STRIDE);
+    mu_assert("64-bit offset", off == third);
+    li_free(li);
+
+    initscr();
+    FileState *fs = initialize_file_state(path, 80);
+    mu_assert("fs allocated", fs != NULL);
+    mu_assert("paged", lb_page_file(&fs->buffer, path) == 0);
+    fs->line_index = li_start(path);
+    mu_assert("index started", fs->line_index != NULL);
+    fs->file_complete = false;
+    load_all_remaining_lines(fs);
+    mu_assert("complete", fs->file_complete);
+    mu_assert("total", total_line_count(fs) == INDEX_LINES);
+
+    /* Lines beyond the hole are read from offsets past 4 GiB */
+    long last = INDEX_LINES - 1;
+    ensure_line_loaded(fs, last);
+    char expect[32];
+    snprintf(expect, sizeof(expect), "line %ld", last);
+    mu_assert("last line", strcmp(lb_get(&fs->buffer, last), expect) == 0);
+    mu_assert("third line",
+              strcmp(lb_get(&fs->buffer, 2 * LI_STRIDE), "line 8192") == 0);
+    mu_assert("no read errors", lb_page_errors(&fs->buffer) == 0);
+
+    free_file_state(fs);
+    endwin();
+    remove(path);
+    return 0;
+}
+
+static char *test_view_reads_lines_in_place() {
+    const char *path = "line_index_view.tmp";
+    long third = 0;
+    mu_assert("file written", write_numbered(path, &third) > 0);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("viewed", lb_view_file(&lb, path) == 0);
+    mu_assert("backend", lb.backend == LB_MAP_VIEW);
+    struct timespec ts = {0, 1000000};
+    for (int i = 0; i < 5000 && lb_view_sync(&lb) == 0; ++i)
+        nanosleep(&ts, NULL);
+    mu_assert("count", lb.count == INDEX_LINES);
+
+    char expect[32];
+    for (long i = 0; i < lb.count; ++i) {
+        snprintf(expect, sizeof(expect), "line %ld", i);
+        if (strcmp(lb_get(&lb, i), expect) != 0 ||
+            lb_length(&lb, i) != strlen(expect))
+            mu_assert("walked line", 0);
+    }
+    mu_assert("jump back",
+              strcmp(lb_get(&lb, 2 * LI_STRIDE + 3), "line 8195") == 0);
+    mu_assert("last line", lb_length(&lb, INDEX_LINES - 1) ==
+                               strlen("line 12292"));
+    mu_assert("nothing stored per line", lb.tree.count == 0);
+
+    mu_assert("set refused", lb_set(&lb, 1, "edited") < 0);
+    mu_assert("insert refused", lb_insert(&lb, 1, "new") < 0);
+    mu_assert("text refused", lb_insert_text(&lb, 1, 0, "x", 1) < 0);
+    lb_delete(&lb, 1);
+    mu_assert("resize refused", lb_resize(&lb, 1) < 0);
+    mu_assert("count kept", lb.count == INDEX_LINES);
+    mu_assert("line kept", strcmp(lb_get(&lb, 1), "line 1") == 0);
+    lb_free(&lb);
+    mu_assert("tree again", lb.backend == LB_LINE_TREE && lb.count == 0);
+
+    mu_assert("missing file", lb_view_file(&lb, "no_such_file.tmp") < 0);
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_index_counts_and_offsets);
+    mu_run_test(test_mapped_file_loaded_on_demand);
+    mu_run_test(test_paged_buffer_keeps_window);
+    mu_run_test(test_packed_buffer_expands_window);
+    mu_run_test(test_sparse_file_beyond_4gb);
+    mu_run_test(test_view_reads_lines_in_place);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
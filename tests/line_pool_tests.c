@@ -0,0 +1,101 @@
+#include "minunit.h"
+#include "line_buffer.h"
+#include "line_pool.h"
+#include <stdio.h>
+#include <string.h>
+
+int tests_run = 0;
+
+static char *test_identical_text_interned_once() {
+    size_t before = pool_count();
+    char *a = pool_intern("same", 4);
+    char *b = pool_intern("same", 4);
+    char *c = pool_intern("same\0tail", 9);
+    mu_assert("interned", a && b && c);
+    mu_assert("shared", a == b);
+    mu_assert("embedded NUL kept apart", c != a && pool_length(c) == 9);
+    mu_assert("two entries", pool_count() == before + 2);
+    mu_assert("retain", pool_retain(a) == a);
+
+    pool_release(a);
+    pool_release(b);
+    mu_assert("still referenced", pool_count() == before + 2);
+    pool_release(a);
+    pool_release(c);
+    pool_release(NULL);
+    mu_assert("released", pool_count() == before);
+    return 0;
+}
+
+static char *test_buffer_copies_shared_line_on_edit() {
+    size_t before = pool_count();
+    LineBuffer lb;
+    lb_init(&lb);
+    for (int i = 0; i < 100; ++i)
+        mu_assert("insert", lb_insert_shared(&lb, i, i % 2 ? "odd" : "even",
+                                             i % 2 ? 3 : 4) == 0);
+    mu_assert("one entry per distinct line", pool_count() == before + 2);
+    mu_assert("lines share text", lb_get(&lb, 0) == lb_get(&lb, 98));
+    mu_assert("no arena capacity", lb_capacity(&lb, 0) == 0);
+
+    char *undo_text = lb_share(&lb, 2);
+    mu_assert("undo shares the line", undo_text == lb_get(&lb, 2));
+
+    mu_assert("edit", lb_insert_text(&lb, 2, 4, "!", 1) == 0);
+    mu_assert("edited line copied", strcmp(lb_get(&lb, 2), "even!") == 0);
+    mu_assert("others untouched", strcmp(lb_get(&lb, 4), "even") == 0);
+    mu_assert("undo text untouched", strcmp(undo_text, "even") == 0);
+    mu_assert("hash follows text", lb_hash(&lb, 4) == pool_hash("even", 4));
+
+    mu_assert("restore", lb_set_shared(&lb, 2, undo_text, 4) == 0);
+    mu_assert("shared again", lb_get(&lb, 2) == undo_text);
+    pool_release(undo_text);
+
+    lb_free(&lb);
+    mu_assert("all released", pool_count() == before);
+    return 0;
+}
+
+static char *test_mapped_lines_interned() {
+    const char *path = "line_pool.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < 1000; ++i)
+        fprintf(fp, i % 10 ? "repeated line\n" : "header %d\n", i);
+    fclose(fp);
+
+    size_t before = pool_count();
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("mapped", lb_map_file(&lb, path) == 0);
+    lb.share_lines = true;
+    mu_assert("split", lb_map_lines(&lb, 2000) == 1000);
+    mu_assert("mapping released", lb.map == NULL);
+    mu_assert("distinct lines pooled", pool_count() == before + 101);
+    mu_assert("repeats share text", lb_get(&lb, 1) == lb_get(&lb, 999));
+    mu_assert("header text", strcmp(lb_get(&lb, 990), "header 990") == 0);
+    lb_delete(&lb, 990);
+    mu_assert("deleted", lb.count == 999);
+    lb_free(&lb);
+    mu_assert("all released", pool_count() == before);
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_identical_text_interned_once);
+    mu_run_test(test_buffer_copies_shared_line_on_edit);
+    mu_run_test(test_mapped_lines_interned);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
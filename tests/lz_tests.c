@@ -0,0 +1,93 @@
+#include "minunit.h"
+#include "lz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int tests_run = 0;
+
+/* Compress LEN bytes of SRC and expand them again; return the packed size. */
+static size_t round_trip(const char *src, size_t len, int *ok) {
+    char *packed = malloc(lz_bound(len));
+    char *out = malloc(len + 1);
+    size_t n = lz_compress(src, len, packed);
+    *ok = n <= lz_bound(len) && lz_decompress(packed, n, out, len) == 0 &&
+          memcmp(out, src, len) == 0;
+    free(packed);
+    free(out);
+    return n;
+}
+
+static char *test_log_text_shrinks() {
+    size_t cap = 1 << 20;
+    char *text = malloc(cap);
+    size_t len = 0;
+    for (int i = 0; len + 100 < cap; ++i)
+        len += snprintf(text + len, cap - len,
+                        "2024-05-01 12:%02d:%02d INFO request %d served in %d ms\n",
+                        i / 60 % 60, i % 60, i, i % 97);
+    int ok;
+    size_t n = round_trip(text, len, &ok);
+    mu_assert("log round trip", ok);
+    mu_assert("log compressed at least 3x", n * 3 < len);
+
+    /* A run overlapping its own copy */
+    memset(text, 'a', 1000);
+    n = round_trip(text, 1000, &ok);
+    mu_assert("run round trip", ok && n < 20);
+    round_trip(text, 0, &ok);
+    mu_assert("empty round trip", ok);
+    free(text);
+    return 0;
+}
+
+static char *test_random_bytes_stored() {
+    size_t len = 100000;
+    char *data = malloc(len);
+    srand(7);
+    for (size_t i = 0; i < len; ++i)
+        data[i] = (char)(rand() & 0xff);
+    int ok;
+    size_t n = round_trip(data, len, &ok);
+    mu_assert("random round trip", ok);
+    mu_assert("random within bound", n <= lz_bound(len));
+    free(data);
+    return 0;
+}
+
+static char *test_damaged_input_rejected() {
+    const char *text = "abcabcabcabcabcabcabcabc hello hello hello";
+    size_t len = strlen(text);
+    char packed[128];
+    char out[128];
+    size_t n = lz_compress(text, len, packed);
+    mu_assert("short output rejected",
+              lz_decompress(packed, n, out, len - 1) < 0);
+    mu_assert("truncated input rejected",
+              lz_decompress(packed, n / 2, out, len) < 0);
+    mu_assert("long output rejected",
+              lz_decompress(packed, n, out, len + 1) < 0);
+    /* A match reaching before the start of the output */
+    const char bad[] = {0x10, 'x', 0x05, 0x00};
+    mu_assert("bad distance rejected",
+              lz_decompress(bad, sizeof(bad), out, 5) < 0);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_log_text_shrinks);
+    mu_run_test(test_random_bytes_stored);
+    mu_run_test(test_damaged_input_rejected);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -14,7 +14,7 @@ static char *test_simple_record_play() {
     initscr();
     fm_init(&file_manager);
 
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     fm_add(&file_manager, fs);
     active_file = fs;
@@ -0,0 +1,142 @@
+#include "minunit.h"
+#include "config.h"
+#include "file_manager.h"
+#include "files.h"
+#include "line_buffer.h"
+#include "line_index.h"
+#include "mem_budget.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int tests_run = 0;
+
+static char *test_trim_after_deletes() {
+    LineBuffer lb;
+    lb_init(&lb);
+    char line[200];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    for (int i = 0; i < 2000; ++i)
+        mu_assert("inserted", lb_insert(&lb, i, line) == 0);
+
+    LineMemory full;
+    size_t total = lb_memory(&lb, &full);
+    mu_assert("text counted", full.text >= 2000 * sizeof(line));
+    mu_assert("breakdown adds up", total == full.text + full.slack);
+    mu_assert("nothing mapped", full.mapped == 0);
+
+    /* Deleted lines leave their blocks in the arena */
+    for (int i = 1999; i >= 100; --i)
+        lb_delete(&lb, i);
+    LineMemory before;
+    lb_memory(&lb, &before);
+    mu_assert("slack left", before.slack > 1800 * sizeof(line));
+    mu_assert("total alone", lb_memory(&lb, NULL) == before.text + before.slack);
+
+    size_t freed = lb_trim(&lb);
+    LineMemory after;
+    lb_memory(&lb, &after);
+    mu_assert("released", freed > 0 && after.slack < before.slack);
+    mu_assert("released figure", freed == before.text + before.slack -
+                                              after.text - after.slack);
+    mu_assert("lines kept", lb.count == 100 &&
+                                strcmp(lb_get(&lb, 99), line) == 0);
+    mu_assert("still editable", lb_insert_text(&lb, 0, 0, "ab", 2) == 0 &&
+                                    strncmp(lb_get(&lb, 0), "abxx", 4) == 0);
+    lb_free(&lb);
+    return 0;
+}
+
+static char *test_trim_paged_buffer() {
+    const char *path = "mem_budget_paged.tmp";
+    int lines = 8 * LI_STRIDE;
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < lines; ++i)
+        fprintf(fp, "line %d\n", i);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("paged", lb_page_file(&lb, path) == 0);
+    LineIndex *li = li_start(path);
+    mu_assert("index started", li != NULL);
+    struct timespec ts = {0, 1000000};
+    int res;
+    while ((res = lb_page_sync(&lb, li)) == 0)
+        nanosleep(&ts, NULL);
+    li_free(li);
+    mu_assert("all pages", res == 1 && lb.count == lines);
+
+    for (int i = 0; i < lines; i += LI_STRIDE)
+        lb_get(&lb, i);
+    size_t before = lb_memory(&lb, NULL);
+    mu_assert("trimmed", lb_trim(&lb) > 0 && lb_memory(&lb, NULL) < before);
+    mu_assert("paged in again", strcmp(lb_get(&lb, 5), "line 5") == 0 &&
+                                    strcmp(lb_get(&lb, lines - 1),
+                                           "line 32767") == 0);
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *test_budget_refuses_edits() {
+    initscr();
+    FileState *fs = initialize_file_state("budget.tmp", 80);
+    mu_assert("file state", fs != NULL);
+    FileState *files[1] = {fs};
+    FileManager fm = {files, 1, 0, 1};
+
+    FileMemory mem;
+    size_t used = mb_file_usage(fs, &mem);
+    mu_assert("parts add up",
+              used == mem.lines + mem.slack + mem.undo + mem.window);
+    mu_assert("window counted", mem.window > 0);
+    mu_assert("usage total", mb_usage(&fm) >= used);
+
+    app_config.memory_budget_mb = 1;
+    mu_assert("within budget", mb_check(&fm, fs) == 0 && !mb_over_budget());
+    mu_assert("edit allowed", !reject_edit(fs));
+
+    char line[1024];
+    memset(line, 'y', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    for (int i = 0; i < 2048; ++i)
+        lb_insert(&fs->buffer, i, line);
+    mu_assert("went over", mb_check(&fm, fs) == 1 && mb_over_budget());
+    mu_assert("reported once", mb_check(&fm, fs) == 0 && mb_over_budget());
+    mu_assert("edit refused", reject_edit(fs));
+    mu_assert("text intact", fs->buffer.count >= 2048 &&
+                                 strcmp(lb_get(&fs->buffer, 2047), line) == 0);
+
+    for (long i = fs->buffer.count - 1; i >= 1; --i)
+        lb_delete(&fs->buffer, i);
+    mu_assert("back within", mb_check(&fm, fs) == 0 && !mb_over_budget());
+    mu_assert("edit allowed again", !reject_edit(fs));
+
+    app_config.memory_budget_mb = 0;
+    mu_assert("no budget", mb_check(&fm, fs) == 0 && !mb_over_budget());
+    free_file_state(fs);
+    endwin();
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_trim_after_deletes);
+    mu_run_test(test_trim_paged_buffer);
+    mu_run_test(test_budget_refuses_edits);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -14,12 +14,12 @@ int tests_run = 0;
 
 static char *test_drag_clamp_bottom_right() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    fs->buffer.count = 3;
+    lb_resize(&fs->buffer, 3);
     fs->cursor_x = 1;
     fs->cursor_y = 1;
     start_selection_mode(fs, fs->cursor_x, fs->cursor_y);
@@ -43,12 +43,12 @@ static char *test_drag_clamp_bottom_right() {
 
 static char *test_drag_clamp_top_left() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    fs->buffer.count = 3;
+    lb_resize(&fs->buffer, 3);
     fs->cursor_x = 3;
     fs->cursor_y = 2;
     start_selection_mode(fs, fs->cursor_x, fs->cursor_y);
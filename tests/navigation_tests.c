@@ -206,7 +206,7 @@ static char *test_go_to_line_lazy_load() {
     fclose(f);
 
     initscr();
-    FileState *fs = initialize_file_state(path, 10, 80);
+    FileState *fs = initialize_file_state(path, 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -218,7 +218,7 @@ static char *test_go_to_line_lazy_load() {
     mu_assert("fp open", fs->fp != NULL);
     fs->file_pos = 0;
     fs->file_complete = false;
-    fs->buffer.count = 0;
+    lb_resize(&fs->buffer, 0);
 
     load_next_lines(fs, 50);
 
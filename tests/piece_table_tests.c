@@ -0,0 +1,135 @@
+#include "minunit.h"
+#include "piece_table.h"
+#include "line_buffer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+int tests_run = 0;
+
+static void write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return;
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static char *test_pt_insert_delete() {
+    PieceTable *pt = pt_create();
+    mu_assert("pt created", pt != NULL);
+    mu_assert("insert", pt_insert(pt, 0, "hello world", 11) == 0);
+    mu_assert("insert middle", pt_insert(pt, 5, ",\nbig", 5) == 0);
+    mu_assert("length", pt_length(pt) == 16);
+    mu_assert("newlines", pt_newlines(pt) == 1);
+    mu_assert("line 1 start", pt_line_start(pt, 1) == 7);
+    mu_assert("line 2 missing", pt_line_start(pt, 2) == (size_t)-1);
+
+    char buf[32];
+    size_t n = pt_copy(pt, 0, pt_length(pt), buf);
+    buf[n] = '\0';
+    mu_assert("contents", strcmp(buf, "hello,\nbig world") == 0);
+
+    mu_assert("delete", pt_delete(pt, 5, 5) == 0);
+    n = pt_copy(pt, 0, pt_length(pt), buf);
+    buf[n] = '\0';
+    mu_assert("after delete", strcmp(buf, "hello world") == 0);
+    mu_assert("no newlines", pt_newlines(pt) == 0);
+    pt_free(pt);
+    return 0;
+}
+
+static char *test_pt_typing_sequence() {
+    PieceTable *pt = pt_create();
+    const char *text = "typed one byte at a time";
+    for (size_t i = 0; i < strlen(text); ++i)
+        mu_assert("insert byte", pt_insert(pt, i, &text[i], 1) == 0);
+    char buf[64];
+    size_t n = pt_copy(pt, 0, pt_length(pt), buf);
+    buf[n] = '\0';
+    mu_assert("typed text", strcmp(buf, text) == 0);
+    pt_free(pt);
+    return 0;
+}
+
+static char *test_lb_piece_table_edit() {
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("init pt", lb_init_piece_table(&lb, NULL) == 0);
+    mu_assert("one empty line", lb.count == 1 && strcmp(lb_get(&lb, 0), "") == 0);
+
+    mu_assert("set", lb_set(&lb, 0, "first") == 0);
+    mu_assert("append", lb_insert(&lb, 1, "third") == 0);
+    mu_assert("insert", lb_insert(&lb, 1, "second") == 0);
+    mu_assert("count", lb.count == 3);
+    mu_assert("line 0", strcmp(lb_get(&lb, 0), "first") == 0);
+    mu_assert("line 1", strcmp(lb_get(&lb, 1), "second") == 0);
+    mu_assert("line 2", strcmp(lb_get(&lb, 2), "third") == 0);
+
+    lb_delete(&lb, 2);
+    mu_assert("delete last", lb.count == 2);
+    mu_assert("line 1 kept", strcmp(lb_get(&lb, 1), "second") == 0);
+    lb_delete(&lb, 0);
+    mu_assert("delete first", lb.count == 1);
+    mu_assert("line 0 now", strcmp(lb_get(&lb, 0), "second") == 0);
+    mu_assert("out of range", lb_get(&lb, 1) == NULL);
+
+    /* Shared text is stored whole, NUL bytes included */
+    mu_assert("set shared", lb_set_shared(&lb, 0, "nul\0byte", 8) == 0);
+    mu_assert("length kept", lb_length(&lb, 0) == 8 &&
+                             memcmp(lb_get(&lb, 0), "nul\0byte", 8) == 0);
+
+    lb_free(&lb);
+    return 0;
+}
+
+static char *test_lb_piece_table_open() {
+    const char *path = "pt_open.tmp";
+    LineBuffer lb;
+
+    write_file(path, "alpha\nbeta\n");
+    lb_init(&lb);
+    mu_assert("open", lb_init_piece_table(&lb, path) == 0);
+    mu_assert("trailing newline ends last line", lb.count == 2);
+    mu_assert("alpha", strcmp(lb_get(&lb, 0), "alpha") == 0);
+    mu_assert("beta", strcmp(lb_get(&lb, 1), "beta") == 0);
+    lb_free(&lb);
+
+    write_file(path, "alpha\n\ngamma");
+    lb_init(&lb);
+    mu_assert("open no newline", lb_init_piece_table(&lb, path) == 0);
+    mu_assert("three lines", lb.count == 3);
+    mu_assert("blank line", strcmp(lb_get(&lb, 1), "") == 0);
+    mu_assert("gamma", strcmp(lb_get(&lb, 2), "gamma") == 0);
+    lb_free(&lb);
+
+    write_file(path, "");
+    lb_init(&lb);
+    mu_assert("open empty", lb_init_piece_table(&lb, path) == 0);
+    mu_assert("no lines", lb.count == 0);
+    mu_assert("insert into empty", lb_insert(&lb, 0, "x") == 0);
+    mu_assert("one line", lb.count == 1 && strcmp(lb_get(&lb, 0), "x") == 0);
+    lb_free(&lb);
+
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_pt_insert_delete);
+    mu_run_test(test_pt_typing_sequence);
+    mu_run_test(test_lb_piece_table_edit);
+    mu_run_test(test_lb_piece_table_open);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -0,0 +1,156 @@
+#include "minunit.h"
+#include "line_buffer.h"
+#include "line_index.h"
+#include "read_ahead.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+/* Request a range and wait until the worker has read it. */
+static char *fetch(ReadAhead *ra, off_t offset, size_t bytes) {
+    struct timespec ts = {0, 1000000};
+    char *text = NULL;
+    for (int i = 0; i < 2000 && !text; ++i) {
+        ra_request(ra, offset, bytes);
+        nanosleep(&ts, NULL);
+        text = ra_take(ra, offset, bytes);
+    }
+    return text;
+}
+
+static char *test_ranges_read_in_background() {
+    const char *path = "read_ahead.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < 1000; ++i)
+        fprintf(fp, "%04d\n", i);
+    fclose(fp);
+
+    int fd = open(path, O_RDONLY);
+    mu_assert("opened", fd >= 0);
+    ReadAhead *ra = ra_start(fd);
+    mu_assert("started", ra != NULL);
+
+    char *text = fetch(ra, 50, 15);
+    mu_assert("range read", text && strcmp(text, "0010\n0011\n0012\n") == 0);
+    free(text);
+    mu_assert("taken once", ra_take(ra, 50, 15) == NULL);
+    mu_assert("never requested", ra_take(ra, 0, 5) == NULL);
+
+    for (int i = 0; i < 3 * RA_SLOTS; ++i)
+        ra_request(ra, i * 5, 5);
+    text = fetch(ra, 995, 5);
+    mu_assert("newest request kept", text && strcmp(text, "0199\n") == 0);
+    free(text);
+    ra_request(ra, 4990, 20);
+    struct timespec ts = {0, 50000000};
+    nanosleep(&ts, NULL);
+    mu_assert("past the end", ra_take(ra, 4990, 20) == NULL);
+
+    ra_request(ra, 100, 5);
+    ra_free(ra);
+    close(fd);
+    remove(path);
+    return 0;
+}
+
+static char *test_paged_buffer_reads_ahead() {
+    const char *path = "read_ahead_paged.tmp";
+    int lines = (LB_AHEAD_PAGES + 2) * LI_STRIDE;
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < lines; ++i)
+        fprintf(fp, "line %d\n", i);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("paged", lb_page_file(&lb, path) == 0);
+    LineIndex *li = li_start(path);
+    mu_assert("index started", li != NULL);
+    struct timespec ts = {0, 1000000};
+    int res;
+    while ((res = lb_page_sync(&lb, li)) == 0)
+        nanosleep(&ts, NULL);
+    li_free(li);
+    mu_assert("all pages", res == 1 && lb.count == lines);
+
+    /* Reading the first page queues the ones after it */
+    mu_assert("first line", strcmp(lb_get(&lb, 0), "line 0") == 0);
+    ts.tv_nsec = 300000000;
+    nanosleep(&ts, NULL);
+
+    /* Read-ahead pages no longer need the file */
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    mu_assert("truncated", fd >= 0);
+    close(fd);
+    char expect[32];
+    for (int i = 1; i <= LB_AHEAD_PAGES; ++i) {
+        snprintf(expect, sizeof(expect), "line %d", i * LI_STRIDE + 7);
+        mu_assert("page read ahead",
+                  strcmp(lb_get(&lb, i * LI_STRIDE + 7), expect) == 0);
+    }
+    mu_assert("no read errors", lb_page_errors(&lb) == 0);
+    lb_get(&lb, (LB_AHEAD_PAGES + 1) * LI_STRIDE);
+    mu_assert("later page unread", lb_page_errors(&lb) == 1);
+
+    lb_read_ahead(&lb, 0, lines);
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *test_mapped_hints() {
+    const char *path = "read_ahead_mapped.tmp";
+    FILE *fp = fopen(path, "w");
+    mu_assert("file created", fp != NULL);
+    for (int i = 0; i < 2 * LI_STRIDE; ++i)
+        fprintf(fp, "line %d\n", i);
+    fclose(fp);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("mapped", lb_map_file(&lb, path) == 0);
+    mu_assert("split", lb_map_lines(&lb, 100) == 100);
+    lb_read_ahead(&lb, 50, 200);
+    mu_assert("rest split",
+              lb_map_lines(&lb, 4 * LI_STRIDE) == 2 * LI_STRIDE - 100);
+    mu_assert("line", strcmp(lb_get(&lb, 150), "line 150") == 0);
+    lb_read_ahead(&lb, 0, lb.count + 100);
+    lb_free(&lb);
+
+    mu_assert("viewed", lb_view_file(&lb, path) == 0);
+    lb_read_ahead(&lb, 0, 100);
+    struct timespec ts = {0, 1000000};
+    while (lb_view_sync(&lb) == 0)
+        nanosleep(&ts, NULL);
+    lb_read_ahead(&lb, LI_STRIDE, 3 * LI_STRIDE);
+    mu_assert("view line",
+              strcmp(lb_get(&lb, LI_STRIDE + 1), "line 4097") == 0);
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_ranges_read_in_background);
+    mu_run_test(test_paged_buffer_reads_ahead);
+    mu_run_test(test_mapped_hints);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -9,7 +9,7 @@ static char *test_narrow_resize_bounds() {
     show_line_numbers = 1;
     initscr();
     resizeterm(2, 3);
-    FileState *fs = initialize_file_state("", 5, 8);
+    FileState *fs = initialize_file_state("", 8);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
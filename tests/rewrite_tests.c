@@ -0,0 +1,190 @@
+#include "minunit.h"
+#include "files.h"
+#include "line_index.h"
+#include "rewrite.h"
+#include "undo.h"
+#include <dirent.h>
+#include <errno.h>
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int tests_run = 0;
+
+#define FILE_PATH "rewrite.tmp"
+#define BACKUP_PREFIX FILE_PATH ".orig-"
+
+static void write_text(const char *path, const char *text, size_t len) {
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        fwrite(text, 1, len, fp);
+        fclose(fp);
+    }
+}
+
+/*
+ * Build a file of a little over two chunks whose lines each name HOST,
+ * the first of them straddling the end of the first chunk, and whose last
+ * line has no newline. Its length is stored in LEN.
+ */
+static char *make_text(const char *host, size_t *len) {
+    size_t cap = 3 * RW_CHUNK;
+    char *text = malloc(cap);
+    if (!text)
+        return NULL;
+    size_t n = RW_CHUNK - 12;
+    memset(text, 'x', n - 1);
+    text[n - 1] = '\n';
+    for (long i = 0; n < 2 * RW_CHUNK + 4096; ++i)
+        n += (size_t)sprintf(text + n, "line %ld %s\n", i, host);
+    n += (size_t)sprintf(text + n, "last HOST-A.example.com");
+    *len = n;
+    return text;
+}
+
+static bool file_is(const char *path, const char *text, size_t len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+    char *buf = malloc(len + 1);
+    size_t got = buf ? fread(buf, 1, len + 1, fp) : 0;
+    fclose(fp);
+    bool same = buf && got == len && memcmp(buf, text, len) == 0;
+    free(buf);
+    return same;
+}
+
+static int backups(void) {
+    DIR *dir = opendir(".");
+    int n = 0;
+    struct dirent *de;
+    while (dir && (de = readdir(dir)))
+        if (strncmp(de->d_name, BACKUP_PREFIX, strlen(BACKUP_PREFIX)) == 0)
+            n++;
+    if (dir)
+        closedir(dir);
+    return n;
+}
+
+/* A FileState reading PATH as the editor reads a huge file. */
+static FileState *open_paged(const char *path) {
+    FileState *fs = initialize_file_state(path, 80);
+    if (fs && (lb_page_file(&fs->buffer, path) < 0 ||
+               !(fs->line_index = li_start(path)))) {
+        free_file_state(fs);
+        return NULL;
+    }
+    if (fs) {
+        fs->file_complete = false;
+        load_next_lines(fs, 16);
+    }
+    return fs;
+}
+
+static long replace_file(FileState *fs, const char *search,
+                         const char *replacement, bool ignore_case) {
+    RewriteJob *job = rw_start(FILE_PATH, search, replacement, ignore_case,
+                               false);
+    return job ? rw_finish(job, fs) : -1;
+}
+
+static char *test_replace_and_undo() {
+    size_t old_len, new_len;
+    char *old_text = make_text("host-a.example.com", &old_len);
+    char *new_text = make_text("host-b.example.org", &new_len);
+    mu_assert("texts", old_text && new_text);
+    write_text(FILE_PATH, old_text, old_len);
+    FileState *fs = open_paged(FILE_PATH);
+    mu_assert("opened", fs != NULL);
+
+    long lines = 0;
+    for (size_t i = 0; i < old_len; ++i)
+        lines += old_text[i] == '\n';
+    mu_assert("replaced", replace_file(fs, "host-a.example.com",
+                                       "host-b.example.org", false) == lines - 1);
+    mu_assert("file rewritten", file_is(FILE_PATH, new_text, new_len));
+    mu_assert("original kept", backups() == 1);
+    mu_assert("buffer read again",
+              strcmp(lb_get(&fs->buffer, 1), "line 0 host-b.example.org") == 0);
+    mu_assert("unmodified", !fs->modified);
+
+    undo(fs);
+    mu_assert("undone", file_is(FILE_PATH, old_text, old_len));
+    mu_assert("buffer undone",
+              strcmp(lb_get(&fs->buffer, 1), "line 0 host-a.example.com") == 0);
+    redo(fs);
+    mu_assert("redone", file_is(FILE_PATH, new_text, new_len));
+
+    /* A later replacement keeps only its own original */
+    mu_assert("ignoring case", replace_file(fs, "host-A.EXAMPLE.com",
+                                            "host-c", true) == 1);
+    mu_assert("one original", backups() == 1);
+    load_all_remaining_lines(fs);
+    mu_assert("last line", strcmp(lb_get(&fs->buffer, fs->buffer.count - 1),
+                                  "last host-c") == 0);
+    undo(fs);
+    undo(fs);
+    mu_assert("first replacement stays", fs->undo_stack != NULL &&
+                                         file_is(FILE_PATH, new_text, new_len));
+
+    free_file_state(fs);
+    mu_assert("closing removes it", backups() == 0);
+    free(old_text);
+    free(new_text);
+    remove(FILE_PATH);
+    return 0;
+}
+
+static char *test_file_left_alone() {
+    const char text[] = "alpha\nbeta\n";
+    write_text(FILE_PATH, text, strlen(text));
+    FileState *fs = open_paged(FILE_PATH);
+    mu_assert("opened", fs != NULL);
+
+    mu_assert("nothing found", replace_file(fs, "gamma", "x", false) == 0);
+    mu_assert("no undo record", fs->undo_stack == NULL && backups() == 0);
+    mu_assert("empty search", !rw_start(FILE_PATH, "", "x", false, false) &&
+                              errno == EINVAL);
+
+    /* Reading the buffer again would lose unsaved edits */
+    mu_assert("replaced", replace_file(fs, "beta", "BETA", false) == 1);
+    fs->modified = true;
+    long mark = fs->undo_stack->change.line;
+    mu_assert("edits kept", rw_swap(fs, mark) == -1 && errno == EBUSY &&
+                            file_is(FILE_PATH, "alpha\nBETA\n", 11));
+    fs->modified = false;
+    mu_assert("undone once saved", rw_swap(fs, mark) == 0 &&
+                                   file_is(FILE_PATH, text, strlen(text)));
+    mu_assert("redone", rw_swap(fs, mark) == 0);
+
+    /* Once the file is saved over, the original no longer follows it */
+    write_text(FILE_PATH, "saved\n", 6);
+    undo(fs);
+    mu_assert("not undone", fs->undo_stack != NULL &&
+                            fs->undo_stack->change.line < 0 &&
+                            file_is(FILE_PATH, "saved\n", 6));
+    free_file_state(fs);
+    mu_assert("closed", backups() == 0);
+    remove(FILE_PATH);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_replace_and_undo);
+    mu_run_test(test_file_left_alone);
+    return 0;
+}
+
+int main(void) {
+    initscr();
+    char *result = all_tests();
+    endwin();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
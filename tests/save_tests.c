@@ -0,0 +1,357 @@
+#include "minunit.h"
+#include "line_buffer.h"
+#include "save.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+int tests_run = 0;
+
+/* Read PATH into a NUL terminated string, storing its size in *LEN. */
+static char *slurp(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = malloc((size_t)size + 1);
+    if (buf && fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf)
+        buf[size] = '\0';
+    fclose(fp);
+    *len = (size_t)size;
+    return buf;
+}
+
+/* Number of entries in the current directory starting with PREFIX. */
+static int leftovers(const char *prefix) {
+    DIR *dir = opendir(".");
+    int n = 0;
+    struct dirent *e;
+    while (dir && (e = readdir(dir)))
+        if (strncmp(e->d_name, prefix, strlen(prefix)) == 0)
+            n++;
+    if (dir)
+        closedir(dir);
+    return n;
+}
+
+static void write_text(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    if (fp) {
+        fputs(text, fp);
+        fclose(fp);
+    }
+}
+
+static char *test_replaces_through_rename() {
+    const char *path = "save_target.tmp";
+    write_text(path, "old contents\n");
+    chmod(path, 0640);
+    struct stat before;
+    stat(path, &before);
+
+    LineBuffer lb;
+    lb_init(&lb);
+    char line[32];
+    for (int i = 0; i < 3 * SV_IOV; ++i) {
+        snprintf(line, sizeof(line), "line %d", i);
+        lb_insert(&lb, i, line);
+    }
+    lb_insert_bytes(&lb, 1, "a\0b", 3);
+    char *big = malloc(SV_STAGE + 10);
+    mu_assert("big line", big != NULL);
+    memset(big, 'q', SV_STAGE + 9);
+    big[SV_STAGE + 9] = '\0';
+    lb_insert(&lb, 2, big);
+
+    mu_assert("saved", sv_save(&lb, path, true) == 0);
+    struct stat after;
+    stat(path, &after);
+    mu_assert("mode kept", (after.st_mode & 07777) == 0640);
+    mu_assert("owner kept", after.st_uid == before.st_uid &&
+                                after.st_gid == before.st_gid);
+    mu_assert("renamed", after.st_ino != before.st_ino);
+    mu_assert("no temporary left", leftovers("save_target.tmp.") == 0);
+
+    size_t len;
+    char *text = slurp(path, &len);
+    mu_assert("read back", text != NULL);
+    mu_assert("first lines", strncmp(text, "line 0\na\0b\nqqq", 14) == 0);
+    char *tail = text + 7 + 4 + SV_STAGE + 10;
+    mu_assert("after big line", strncmp(tail, "line 1\n", 7) == 0);
+    snprintf(line, sizeof(line), "line %d\n", 3 * SV_IOV - 1);
+    mu_assert("last line", len > strlen(line) &&
+                               strcmp(text + len - strlen(line), line) == 0);
+    free(text);
+    free(big);
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *test_copied_lines_and_links() {
+    const char *path = "save_pieces.tmp";
+    const char *link_path = "save_pieces_link.tmp";
+    write_text(path, "alpha\nbeta\ngamma\n");
+
+    /* Piece-table lines are temporary copies and go through the stage */
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("piece table", lb_init_piece_table(&lb, path) == 0);
+    lb_set(&lb, 1, "BETA");
+    mu_assert("saved", sv_save(&lb, path, false) == 0);
+    lb_free(&lb);
+    size_t len;
+    char *text = slurp(path, &len);
+    mu_assert("pieces written", text && strcmp(text, "alpha\nBETA\ngamma\n") == 0);
+    free(text);
+
+    /* Pages of a packed buffer come and go while it is written */
+    const char *packed = "save_packed.tmp";
+    FILE *fp = fopen(packed, "w");
+    mu_assert("packed file", fp != NULL);
+    for (int i = 0; i < 20 * LB_PACK_LINES; ++i)
+        fprintf(fp, "packed line %d\n", i);
+    fclose(fp);
+    char *orig = slurp(packed, &len);
+    mu_assert("packed text", orig != NULL);
+    mu_assert("packed", lb_pack_file(&lb, packed) == 0);
+    mu_assert("saved packed", sv_save(&lb, packed, false) == 0);
+    lb_free(&lb);
+    size_t saved_len;
+    text = slurp(packed, &saved_len);
+    mu_assert("packed written", text && saved_len == len &&
+                                    memcmp(text, orig, len) == 0);
+    free(text);
+    free(orig);
+    remove(packed);
+
+    /* A hard linked file is rewritten in place to keep the link */
+    mu_assert("linked", link(path, link_path) == 0);
+    struct stat before;
+    stat(path, &before);
+    lb_init(&lb);
+    lb_insert(&lb, 0, "one line");
+    mu_assert("saved in place", sv_save(&lb, path, false) == 0);
+    struct stat after;
+    stat(path, &after);
+    mu_assert("same file", after.st_ino == before.st_ino);
+    text = slurp(link_path, &len);
+    mu_assert("link sees it", text && strcmp(text, "one line\n") == 0);
+    free(text);
+
+    /* New files get the default mode */
+    const char *fresh = "save_new.tmp";
+    remove(fresh);
+    mode_t mask = umask(022);
+    mu_assert("created", sv_save(&lb, fresh, false) == 0);
+    umask(mask);
+    stat(fresh, &after);
+    mu_assert("default mode", (after.st_mode & 07777) == 0644);
+    remove(fresh);
+    mask = umask(027);
+    mu_assert("created again", sv_save(&lb, fresh, false) == 0);
+    mu_assert("umask left alone", umask(mask) == 027);
+    stat(fresh, &after);
+    mu_assert("umask applied", (after.st_mode & 07777) == 0640 &&
+                               leftovers("save_new.tmp.") == 0);
+    mu_assert("missing directory",
+              sv_save(&lb, "no_such_dir.tmp/file", false) == -1);
+    lb_free(&lb);
+    remove(path);
+    remove(link_path);
+    remove(fresh);
+    return 0;
+}
+
+/* Write LINES numbered lines to PATH, the last one without a newline. */
+static char *numbered(const char *path, int lines, size_t *len) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return NULL;
+    for (int i = 0; i < lines; ++i)
+        fprintf(fp, i + 1 < lines ? "line %d\n" : "line %d", i);
+    fclose(fp);
+    return slurp(path, len);
+}
+
+/* Whether PATH holds the LEN bytes at EXPECT followed by a newline. */
+static bool saved_as(const char *path, const char *expect, size_t len) {
+    size_t saved_len;
+    char *text = slurp(path, &saved_len);
+    bool same = text && saved_len == len + 1 && memcmp(text, expect, len) == 0 &&
+                text[len] == '\n';
+    free(text);
+    return same;
+}
+
+static char *test_unloaded_parts_copied() {
+    const char *path = "save_source.tmp";
+    const char *out = "save_copy.tmp";
+    int lines = 3 * LI_STRIDE + 5;
+    size_t len;
+    char *orig = numbered(path, lines, &len);
+    mu_assert("source", orig != NULL);
+    char *expect = malloc(len);
+    mu_assert("expected text", expect != NULL);
+
+    /* A mapped file split into ten lines, one of them edited */
+    LineBuffer lb;
+    lb_init(&lb);
+    mu_assert("mapped", lb_map_file(&lb, path) == 0);
+    mu_assert("split", lb_map_lines(&lb, 10) == 10);
+    lb_set(&lb, 2, "LINE 2");
+    mu_assert("saved mapped", sv_save(&lb, out, false) == 0);
+    mu_assert("rest not split", lb.count == 10 && lb_map_pending(&lb));
+    memcpy(expect, orig, len);
+    memcpy(expect + 14, "LINE", 4);
+    mu_assert("mapped written", saved_as(out, expect, len));
+    lb_free(&lb);
+
+    /* A paged file with one edited page */
+    lb_init(&lb);
+    mu_assert("paged", lb_page_file(&lb, path) == 0);
+    LineIndex *li = li_start(path);
+    mu_assert("index", li != NULL);
+    struct timespec ts = {0, 1000000};
+    int res;
+    while ((res = lb_page_sync(&lb, li)) == 0)
+        nanosleep(&ts, NULL);
+    li_free(li);
+    mu_assert("all pages", res == 1 && lb.count == lines);
+    char line[32];
+    snprintf(line, sizeof(line), "LINE %d", LI_STRIDE + 1);
+    lb_set(&lb, LI_STRIDE + 1, line);
+    mu_assert("saved paged", sv_save(&lb, out, false) == 0);
+    mu_assert("one page read", lb.tree.count == LI_STRIDE);
+    memcpy(expect, orig, len);
+    snprintf(line, sizeof(line), "\nline %d\n", LI_STRIDE + 1);
+    char *at = strstr(expect, line);
+    mu_assert("edited line", at != NULL);
+    memcpy(at + 1, "LINE", 4);
+    mu_assert("paged written", saved_as(out, expect, len));
+    lb_free(&lb);
+
+    /* A paged file nothing is known of yet */
+    lb_init(&lb);
+    mu_assert("paged again", lb_page_file(&lb, path) == 0);
+    mu_assert("saved unindexed", sv_save(&lb, out, false) == 0);
+    mu_assert("whole file copied", saved_as(out, orig, len));
+    lb_free(&lb);
+
+    /* A view, lines and all */
+    lb_init(&lb);
+    mu_assert("viewed", lb_view_file(&lb, path) == 0);
+    for (int i = 0; i < 5000 && lb_view_sync(&lb) == 0; ++i)
+        nanosleep(&ts, NULL);
+    mu_assert("saved view", sv_save(&lb, out, false) == 0);
+    mu_assert("view written", saved_as(out, orig, len));
+    lb_free(&lb);
+
+    free(expect);
+    free(orig);
+    remove(path);
+    remove(out);
+    return 0;
+}
+
+static char *test_saved_in_background() {
+    const char *path = "save_background.tmp";
+    LineBuffer lb;
+    lb_init(&lb);
+    char line[32];
+    size_t len = 0;
+    for (int i = 0; i < 4 * SV_IOV; ++i) {
+        len += (size_t)snprintf(line, sizeof(line), "line %d", i) + 1;
+        lb_insert(&lb, i, line);
+    }
+
+    /* Edits made once the save has started do not reach the file */
+    SaveJob *job = sv_start(&lb, path, false, SIZE_MAX);
+    mu_assert("started", job != NULL);
+    lb_set(&lb, 0, "changed");
+    lb_insert(&lb, 1, "inserted");
+    lb_free(&lb);
+    off_t written, total;
+    struct timespec ts = {0, 1000000};
+    while (!sv_done(job, &written, &total))
+        nanosleep(&ts, NULL);
+    mu_assert("all written", total == (off_t)len && written == total);
+    mu_assert("finished", sv_finish(job) == 0);
+
+    size_t saved_len;
+    char *text = slurp(path, &saved_len);
+    mu_assert("snapshot written", text && saved_len == len &&
+                                      strncmp(text, "line 0\nline 1\n", 14) == 0);
+    free(text);
+
+    lb_init(&lb);
+    lb_insert(&lb, 0, "lost");
+    job = sv_start(&lb, "no_such_dir.tmp/file", false, SIZE_MAX);
+    lb_free(&lb);
+    mu_assert("failure reported", job && sv_finish(job) == -1 && errno == ENOENT);
+    remove(path);
+    return 0;
+}
+
+static char *test_written_without_room() {
+    const char *path = "save_no_room.tmp";
+    LineBuffer lb;
+    lb_init(&lb);
+    char *big = malloc(SV_STAGE + 2);
+    mu_assert("allocated", big != NULL);
+    memset(big, 'x', SV_STAGE + 1);
+    big[SV_STAGE + 1] = '\0';
+    lb_insert(&lb, 0, "first");
+    lb_insert(&lb, 1, big);
+    lb_insert(&lb, 2, "last");
+
+    /* Lines that do not fit in the copy are written before it returns */
+    SaveJob *job = sv_start(&lb, path, false, 16);
+    mu_assert("started", job != NULL);
+    off_t written, total;
+    mu_assert("written at once", sv_done(job, &written, &total));
+    mu_assert("all counted", total == SV_STAGE + 13 && written == total);
+    mu_assert("finished", sv_finish(job) == 0);
+    size_t len;
+    char *text = slurp(path, &len);
+    mu_assert("lines written", text && len == SV_STAGE + 13 &&
+                                   strncmp(text, "first\nxx", 8) == 0 &&
+                                   strcmp(text + len - 7, "x\nlast\n") == 0);
+    free(text);
+    free(big);
+    lb_free(&lb);
+    remove(path);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_replaces_through_rename);
+    mu_run_test(test_copied_lines_and_links);
+    mu_run_test(test_unloaded_parts_copied);
+    mu_run_test(test_saved_in_background);
+    mu_run_test(test_written_without_room);
+    return 0;
+}
+
+int main(void) {
+    char *result = all_tests();
+    if (result) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
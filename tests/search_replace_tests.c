@@ -10,18 +10,19 @@ int tests_run = 0;
 
 static char *test_replace_long_near_end() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 10);
+    FileState *fs = initialize_file_state("", 10);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcdefgh");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abcdefgh");
+    lb_resize(&fs->buffer, 1);
 
     replace_next_occurrence(fs, "gh", "0123456789ABCDE");
 
     int line_len = strlen(lb_get(&fs->buffer, 0));
-    mu_assert("truncated line", strcmp(lb_get(&fs->buffer, 0), "abcdef012") == 0);
+    mu_assert("line grows past capacity",
+              strcmp(lb_get(&fs->buffer, 0), "abcdef0123456789ABCDE") == 0);
     mu_assert("cursor clamped", fs->cursor_x == line_len + 1);
 
     free_file_state(fs);
@@ -42,7 +43,7 @@ static char *test_replace_next_beyond_load() {
     fclose(f);
 
     initscr();
-    FileState *fs = initialize_file_state(path, 10, 80);
+    FileState *fs = initialize_file_state(path, 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -51,7 +52,7 @@ static char *test_replace_next_beyond_load() {
     mu_assert("fp open", fs->fp != NULL);
     fs->file_pos = 0;
     fs->file_complete = false;
-    fs->buffer.count = 0;
+    lb_resize(&fs->buffer, 0);
 
     load_next_lines(fs, 50);
 
@@ -79,7 +80,7 @@ static char *test_replace_all_beyond_load() {
     fclose(f);
 
     initscr();
-    FileState *fs = initialize_file_state(path, 10, 80);
+    FileState *fs = initialize_file_state(path, 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
@@ -88,7 +89,7 @@ static char *test_replace_all_beyond_load() {
     mu_assert("fp open", fs->fp != NULL);
     fs->file_pos = 0;
     fs->file_complete = false;
-    fs->buffer.count = 0;
+    lb_resize(&fs->buffer, 0);
 
     load_next_lines(fs, 50);
 
@@ -1,6 +1,7 @@
 #include "editor.h"
 #include "file_manager.h"
 #include "editor_state.h"
+#include "hibernate.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,6 +55,8 @@ int __wrap_fm_switch(FileManager *fm, int index) {
         return -1;
     if (!fm || index < 0 || index >= fm->count)
         return -1;
+    if (hb_wake(fm->files[index]) < 0)
+        return -1;
     fm->active_index = index;
     return fm->active_index;
 }
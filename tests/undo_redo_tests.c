@@ -1,8 +1,10 @@
 #include "minunit.h"
 #include "files.h"
 #include "undo.h"
+#include "line_pool.h"
 #include "editor.h"
 #include "editor_state.h"
+#include "input.h"
 #include <ncurses.h>
 #include <string.h>
 
@@ -11,16 +13,16 @@ extern int strdup_fail_on;
 extern int strdup_call_count;
 extern int allocation_fail_count;
 
-static char *test_undo_strdup_failure() {
+static char *test_undo_moves_change_without_copy() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abc");
-    fs->buffer.count = 1;
-    char *new_text = strdup("abc");
+    lb_set(&fs->buffer, 0, "abc");
+    lb_resize(&fs->buffer, 1);
+    char *new_text = pool_intern("abc", 3);
     mu_assert("allocated", new_text != NULL);
     push(&fs->undo_stack, (Change){0, NULL, new_text});
 
@@ -30,24 +32,26 @@ static char *test_undo_strdup_failure() {
     undo(fs);
     strdup_fail_on = 0;
 
-    mu_assert("allocation_failed called", allocation_fail_count == 1);
-    mu_assert("redo stack empty", fs->redo_stack == NULL);
+    mu_assert("no copies", strdup_call_count == 0);
+    mu_assert("no allocation failure", allocation_fail_count == 0);
+    mu_assert("redo stack holds the same text",
+              fs->redo_stack && fs->redo_stack->change.new_text == new_text);
 
     free_file_state(fs);
     endwin();
     return 0;
 }
 
-static char *test_redo_strdup_failure() {
+static char *test_redo_moves_change_without_copy() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abc");
-    fs->buffer.count = 1;
-    char *old_text = strdup("abc");
+    lb_set(&fs->buffer, 0, "abc");
+    lb_resize(&fs->buffer, 1);
+    char *old_text = pool_intern("abc", 3);
     mu_assert("allocated", old_text != NULL);
     push(&fs->redo_stack, (Change){0, old_text, NULL});
 
@@ -57,8 +61,10 @@ static char *test_redo_strdup_failure() {
     redo(fs);
     strdup_fail_on = 0;
 
-    mu_assert("allocation_failed called", allocation_fail_count == 1);
-    mu_assert("undo stack empty", fs->undo_stack == NULL);
+    mu_assert("no copies", strdup_call_count == 0);
+    mu_assert("no allocation failure", allocation_fail_count == 0);
+    mu_assert("undo stack holds the same text",
+              fs->undo_stack && fs->undo_stack->change.old_text == old_text);
 
     free_file_state(fs);
     endwin();
@@ -67,13 +73,13 @@ static char *test_redo_strdup_failure() {
 
 static char *test_clear_text_buffer_frees_stacks() {
     initscr();
-    FileState *fs = initialize_file_state("", 10, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    char *undo_text = strdup("old");
-    char *redo_text = strdup("new");
+    char *undo_text = pool_intern("old", 3);
+    char *redo_text = pool_intern("new", 3);
     mu_assert("allocated", undo_text && redo_text);
 
     push(&fs->undo_stack, (Change){0, undo_text, NULL});
@@ -91,24 +97,26 @@ static char *test_clear_text_buffer_frees_stacks() {
 
 static char *test_backspace_undo_redo_character() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcde");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abcde");
+    lb_resize(&fs->buffer, 1);
     fs->cursor_y = 1;
     fs->cursor_x = 4;
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
 
-    handle_key_backspace(NULL, fs);
+    handle_key_backspace(&ctx, fs);
 
-    mu_assert("char removed", strcmp(fs->buffer.lines[0], "abde") == 0);
+    mu_assert("char removed", strcmp(lb_get(&fs->buffer, 0), "abde") == 0);
 
     undo(fs);
-    mu_assert("undo restored", strcmp(fs->buffer.lines[0], "abcde") == 0);
+    mu_assert("undo restored", strcmp(lb_get(&fs->buffer, 0), "abcde") == 0);
     redo(fs);
-    mu_assert("redo applied", strcmp(fs->buffer.lines[0], "abde") == 0);
+    mu_assert("redo applied", strcmp(lb_get(&fs->buffer, 0), "abde") == 0);
 
     free_file_state(fs);
     endwin();
@@ -117,24 +125,86 @@ static char *test_backspace_undo_redo_character() {
 
 static char *test_delete_undo_redo_character() {
     initscr();
-    FileState *fs = initialize_file_state("", 5, 80);
+    FileState *fs = initialize_file_state("", 80);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abcde");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abcde");
+    lb_resize(&fs->buffer, 1);
     fs->cursor_y = 1;
     fs->cursor_x = 3;
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
 
-    handle_key_delete(NULL, fs);
+    handle_key_delete(&ctx, fs);
 
-    mu_assert("char deleted", strcmp(fs->buffer.lines[0], "abde") == 0);
+    mu_assert("char deleted", strcmp(lb_get(&fs->buffer, 0), "abde") == 0);
 
     undo(fs);
-    mu_assert("undo restored", strcmp(fs->buffer.lines[0], "abcde") == 0);
+    mu_assert("undo restored", strcmp(lb_get(&fs->buffer, 0), "abcde") == 0);
     redo(fs);
-    mu_assert("redo applied", strcmp(fs->buffer.lines[0], "abde") == 0);
+    mu_assert("redo applied", strcmp(lb_get(&fs->buffer, 0), "abde") == 0);
+
+    free_file_state(fs);
+    endwin();
+    return 0;
+}
+
+static long stack_size(Node *stack) {
+    long n = 0;
+    for (; stack; stack = stack->next)
+        n++;
+    return n;
+}
+
+static char *test_typing_kept_by_word() {
+    initscr();
+    FileState *fs = initialize_file_state("", 80);
+    mu_assert("fs allocated", fs != NULL);
+    active_file = fs;
+    text_win = fs->text_win;
+
+    char line[2048];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    lb_set(&fs->buffer, 0, line);
+    lb_resize(&fs->buffer, 1);
+    fs->cursor_y = 1;
+    fs->cursor_x = 1;
+    EditorContext ctx = {0};
+    ctx.active_file = fs;
+
+    /* Each record holds a word and the space after it, not the line */
+    const char *typed = "foo bar ";
+    for (const char *p = typed; *p; ++p)
+        handle_default_key(&ctx, fs, (wint_t)*p);
+    mu_assert("two records", stack_size(fs->undo_stack) == 2);
+    mu_assert("last word", fs->undo_stack->change.in_line &&
+                           fs->undo_stack->change.col == 4 &&
+                           !fs->undo_stack->change.old_text &&
+                           strcmp(fs->undo_stack->change.new_text, "bar ") == 0);
+
+    /* Backspace and delete gather the bytes they remove the same way */
+    handle_key_backspace(&ctx, fs);
+    handle_key_backspace(&ctx, fs);
+    fs->cursor_x = 1;
+    handle_key_delete(&ctx, fs);
+    handle_key_delete(&ctx, fs);
+    mu_assert("edited", strncmp(lb_get(&fs->buffer, 0), "o bax", 5) == 0);
+    mu_assert("four records", stack_size(fs->undo_stack) == 4);
+    mu_assert("deleted bytes", strcmp(fs->undo_stack->change.old_text, "fo") == 0);
+    mu_assert("backspaced bytes",
+              strcmp(fs->undo_stack->next->change.old_text, "r ") == 0 &&
+              fs->undo_stack->next->change.col == 6);
+
+    for (int i = 0; i < 4; ++i)
+        undo(fs);
+    mu_assert("exact text restored", strcmp(lb_get(&fs->buffer, 0), line) == 0);
+    for (int i = 0; i < 4; ++i)
+        redo(fs);
+    mu_assert("redone", strncmp(lb_get(&fs->buffer, 0), "o bax", 5) == 0 &&
+                        lb_length(&fs->buffer, 0) == sizeof(line) + 3);
 
     free_file_state(fs);
     endwin();
@@ -142,11 +212,12 @@ static char *test_delete_undo_redo_character() {
 }
 
 static char *all_tests() {
-    mu_run_test(test_undo_strdup_failure);
-    mu_run_test(test_redo_strdup_failure);
+    mu_run_test(test_undo_moves_change_without_copy);
+    mu_run_test(test_redo_moves_change_without_copy);
     mu_run_test(test_clear_text_buffer_frees_stacks);
     mu_run_test(test_backspace_undo_redo_character);
     mu_run_test(test_delete_undo_redo_character);
+    mu_run_test(test_typing_kept_by_word);
     return 0;
 }
 
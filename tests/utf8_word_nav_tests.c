@@ -12,13 +12,13 @@ int tests_run = 0;
 static char *test_forward_utf8() {
     setlocale(LC_ALL, "");
     initscr();
-    FileState *fs = initialize_file_state("", 5, 32);
+    FileState *fs = initialize_file_state("", 32);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "héllö 世界 bar");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "héllö 世界 bar");
+    lb_resize(&fs->buffer, 1);
     fs->cursor_y = 1;
     fs->cursor_x = 1;
 
@@ -34,13 +34,13 @@ static char *test_forward_utf8() {
 static char *test_backward_utf8() {
     setlocale(LC_ALL, "");
     initscr();
-    FileState *fs = initialize_file_state("", 5, 32);
+    FileState *fs = initialize_file_state("", 32);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "héllö 世界 bar");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "héllö 世界 bar");
+    lb_resize(&fs->buffer, 1);
     fs->cursor_y = 1;
     fs->cursor_x = 16;
 
@@ -59,14 +59,14 @@ static char *test_backward_utf8() {
 static char *test_backward_no_underflow_start_of_line() {
     setlocale(LC_ALL, "");
     initscr();
-    FileState *fs = initialize_file_state("", 5, 32);
+    FileState *fs = initialize_file_state("", 32);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "foo");
-    strcpy(fs->buffer.lines[1], "bar");
-    fs->buffer.count = 2;
+    lb_set(&fs->buffer, 0, "foo");
+    lb_set(&fs->buffer, 1, "bar");
+    lb_resize(&fs->buffer, 2);
     fs->cursor_y = 2;
     fs->cursor_x = 1;
 
@@ -83,13 +83,13 @@ static char *test_backward_no_underflow_start_of_line() {
 static char *test_backward_at_file_start() {
     setlocale(LC_ALL, "");
     initscr();
-    FileState *fs = initialize_file_state("", 5, 32);
+    FileState *fs = initialize_file_state("", 32);
     mu_assert("fs allocated", fs != NULL);
     active_file = fs;
     text_win = fs->text_win;
 
-    strcpy(fs->buffer.lines[0], "abc");
-    fs->buffer.count = 1;
+    lb_set(&fs->buffer, 0, "abc");
+    lb_resize(&fs->buffer, 1);
     fs->cursor_y = 1;
     fs->cursor_x = 1;
 